@@ -1,8 +1,16 @@
 #pragma once
 
+#ifdef CRITSEC_PROFILING
+#include "LockProfiler.h"
+#endif
+
 //////////////////////////////////////////////////////////////////////////
 //  CritSec
 //  Description: Wraps a critical section.
+//
+//  With CRITSEC_PROFILING defined, every lock records its wait and hold
+//  times per call site in the LockProfiler (see LockProfiler.h). The name
+//  and the call sites are only used then; without it they compile out.
 //////////////////////////////////////////////////////////////////////////
 
 class CritSec
@@ -11,7 +19,28 @@ public:
     CRITICAL_SECTION m_criticalSection;
 public:
     CritSec()
+#ifdef CRITSEC_PROFILING
+        : m_sites("CritSec")
+        , m_cRecursion(0)
+        , m_tAcquired(0)
+        , m_pSite(nullptr)
+        , m_pszSite(nullptr)
+#endif
+    {
+        InitializeCriticalSectionEx(&m_criticalSection, 100, 0);
+    }
+
+    // pszName names the lock in the profile. It must outlive the CritSec.
+    explicit CritSec(const char *pszName)
+#ifdef CRITSEC_PROFILING
+        : m_sites(pszName)
+        , m_cRecursion(0)
+        , m_tAcquired(0)
+        , m_pSite(nullptr)
+        , m_pszSite(nullptr)
+#endif
     {
+        (void)pszName;
         InitializeCriticalSectionEx(&m_criticalSection, 100, 0);
     }
 
@@ -20,8 +49,55 @@ public:
         DeleteCriticalSection(&m_criticalSection);
     }
 
+#ifdef CRITSEC_PROFILING
+	_Acquires_lock_(m_criticalSection)
+    void Lock(const char *pszSite = nullptr)
+    {
+        // An uncontended acquisition is counted as no wait, which saves
+        // reading the clock twice.
+        const uint64_t tStart = LockProfiler::Now();
+        const bool fContended = !TryEnterCriticalSection(&m_criticalSection);
+        if (fContended)
+        {
+            EnterCriticalSection(&m_criticalSection);
+        }
+
+        // A recursive acquisition is part of the outer one.
+        if (m_cRecursion++ == 0)
+        {
+            m_tAcquired = fContended ? LockProfiler::Now() : tStart;
+            m_pszSite = pszSite;
+            m_pSite = m_sites.Find(pszSite);
+            m_pSite->RecordWait(m_tAcquired - tStart, fContended);
+        }
+    }
+
+	_Releases_lock_(m_criticalSection)
+    void Unlock()
+    {
+        if (--m_cRecursion == 0)
+        {
+            m_pSite->RecordHold(LockProfiler::Now() - m_tAcquired);
+        }
+        LeaveCriticalSection(&m_criticalSection);
+    }
+
+    // GetOwnerSite: The call site that holds the lock. Only for the owner.
+    const char* GetOwnerSite() const
+    {
+        return m_pszSite;
+    }
+
+private:
+    // Touched only by the owner.
+    LockSiteCache m_sites;
+    unsigned m_cRecursion;
+    uint64_t m_tAcquired;
+    LockSiteStats *m_pSite;
+    const char *m_pszSite;
+#else
 	_Acquires_lock_(m_criticalSection)
-    void Lock()
+    void Lock(const char * = nullptr)
     {
         EnterCriticalSection(&m_criticalSection);
     }
@@ -31,6 +107,12 @@ public:
     {
         LeaveCriticalSection(&m_criticalSection);
     }
+
+    const char* GetOwnerSite() const
+    {
+        return nullptr;
+    }
+#endif
 };
 
 
@@ -40,6 +122,8 @@ public:
 //               of a critical section.
 //
 //  Note: The AutoLock object must go out of scope before the CritSec.
+//        pszSite names the call site in the profile (usually
+//        __FUNCTION__); it is ignored unless CRITSEC_PROFILING is defined.
 //////////////////////////////////////////////////////////////////////////
 
 class AutoLock
@@ -48,10 +132,10 @@ private:
     CritSec *m_pCriticalSection;
 public:
 	_Acquires_lock_(m_pCriticalSection)
-    AutoLock(CritSec& crit)
+    AutoLock(CritSec& crit, const char *pszSite = nullptr)
     {
         m_pCriticalSection = &crit;
-        m_pCriticalSection->Lock();
+        m_pCriticalSection->Lock(pszSite);
     }
 
 	_Releases_lock_(m_pCriticalSection)
@@ -60,3 +144,34 @@ public:
 	    m_pCriticalSection->Unlock();
     }
 };
+
+
+//////////////////////////////////////////////////////////////////////////
+//  AutoUnlock
+//  Description: Leaves a critical section that the caller holds, for
+//               the lifetime of the object, and enters it again
+//               afterwards. For slow work inside a locked region.
+//
+//  Note: The caller must hold the critical section exactly once.
+//////////////////////////////////////////////////////////////////////////
+
+class AutoUnlock
+{
+private:
+    CritSec *m_pCriticalSection;
+    const char *m_pszSite;
+public:
+	_Releases_lock_(m_pCriticalSection)
+    AutoUnlock(CritSec& crit)
+    {
+        m_pCriticalSection = &crit;
+        m_pszSite = crit.GetOwnerSite();
+        m_pCriticalSection->Unlock();
+    }
+
+	_Acquires_lock_(m_pCriticalSection)
+    ~AutoUnlock()
+    {
+        m_pCriticalSection->Lock(m_pszSite);
+    }
+};
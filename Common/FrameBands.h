@@ -0,0 +1,81 @@
+//-----------------------------------------------------------------------------
+// File: FrameBands.h
+// Desc: Splits a frame into horizontal bands for parallel processing.
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Notes:
+//
+// A band is a range of rows that one worker reads and writes. Bands never
+// overlap, so processing them in any order, on any number of threads, gives
+// the same result as processing the whole frame at once. This holds for
+// point effects only: an effect that reads neighbouring pixels would also
+// need rows from the bands above and below.
+//
+// Band boundaries are multiples of rowAlign. Use 2 for 4:2:0 formats so that
+// a chroma row is never shared by two bands.
+
+struct FrameBand
+{
+    uint32_t top;           // First row of the band.
+    uint32_t bottom;        // One past the last row.
+};
+
+// SplitIntoBands: Splits rows [top, bottom) into at most cBands bands.
+// Returns the number of bands written to pBands.
+inline size_t SplitIntoBands(
+    uint32_t top,
+    uint32_t bottom,
+    size_t cBands,
+    uint32_t rowAlign,
+    std::vector<FrameBand> *pBands
+    )
+{
+    pBands->clear();
+
+    if (bottom <= top)
+    {
+        return 0;
+    }
+
+    if (rowAlign == 0)
+    {
+        rowAlign = 1;
+    }
+
+    uint32_t cRows = bottom - top;
+    uint32_t cUnits = (cRows + rowAlign - 1) / rowAlign;   // Smallest indivisible row groups.
+
+    if (cBands == 0)
+    {
+        cBands = 1;
+    }
+    if (cBands > cUnits)
+    {
+        cBands = cUnits;
+    }
+
+    // Spread the units evenly; the first (cUnits % cBands) bands get one extra.
+    uint32_t cUnitsPerBand = cUnits / (uint32_t)cBands;
+    uint32_t cExtra = cUnits % (uint32_t)cBands;
+    uint32_t row = top;
+
+    for (size_t i = 0; i < cBands; i++)
+    {
+        uint32_t cBandRows = (cUnitsPerBand + (i < cExtra ? 1 : 0)) * rowAlign;
+
+        FrameBand band;
+        band.top = row;
+        band.bottom = (bottom - row < cBandRows) ? bottom : row + cBandRows;
+
+        pBands->push_back(band);
+        row = band.bottom;
+    }
+
+    return pBands->size();
+}
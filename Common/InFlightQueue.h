@@ -0,0 +1,260 @@
+//-----------------------------------------------------------------------------
+// File: InFlightQueue.h
+// Desc: Bounded queue of frames that are being processed concurrently.
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Notes:
+//
+// InFlightQueue keeps up to N frames that have been submitted for processing
+// but not yet delivered. Frames can complete in any order, but they leave the
+// queue in the order they were reserved, which for a capture source is
+// presentation (timestamp) order.
+//
+// The queue does not lock. The owner serializes access, typically with the
+// same lock that protects the rest of its streaming state. Workers only touch
+// the queue to call Complete().
+//
+// Usage:
+//
+//     uint64_t ticket;
+//     if (queue.Reserve(hnsTime, &ticket))
+//     {
+//         ... start work; when it finishes:
+//         queue.Complete(ticket, result);
+//     }
+//
+//     T item;
+//     while (queue.PopReady(&item)) { deliver item }
+//
+// Tickets are never reused, so a completion that arrives after Clear() (for
+// example a render that was running during a flush) is recognized and dropped.
+//
+// A frame that will not produce output (a late frame the scheduler skips) is
+// ended with Drop() instead of Complete(). Dropped frames are not counted as
+// ready and are removed as soon as they reach the head of the queue, by
+// PopReady() or DiscardDropped().
+
+template <class T>
+class InFlightQueue
+{
+public:
+    explicit InFlightQueue(size_t cMaxInFlight = 1)
+        : m_slots(cMaxInFlight > 0 ? cMaxInFlight : 1)
+        , m_headTicket(0)
+        , m_count(0)
+        , m_cSignaled(0)
+    {
+    }
+
+    // SetCapacity: Changes the maximum number of frames in flight.
+    // The queue must be empty.
+    void SetCapacity(size_t cMaxInFlight)
+    {
+        assert(IsEmpty());
+        m_slots.assign(cMaxInFlight > 0 ? cMaxInFlight : 1, Slot());
+    }
+
+    size_t GetCapacity() const { return m_slots.size(); }
+    size_t GetCount() const { return m_count; }
+    bool IsEmpty() const { return m_count == 0; }
+    bool IsFull() const { return m_count == m_slots.size(); }
+
+    // Reserve: Reserves the next slot for a frame with time stamp hnsTime.
+    // Returns false if N frames are already in flight.
+    bool Reserve(int64_t hnsTime, uint64_t *pTicket)
+    {
+        if (IsFull())
+        {
+            return false;
+        }
+
+        uint64_t ticket = m_headTicket + m_count;
+        Slot &slot = SlotFor(ticket);
+
+        slot.ticket = ticket;
+        slot.hnsTime = hnsTime;
+        slot.fComplete = false;
+        slot.fDropped = false;
+        slot.item = T();
+
+        m_count++;
+        *pTicket = ticket;
+        return true;
+    }
+
+    // Complete: Stores the result for a reserved frame.
+    // Returns false if the ticket is no longer in the queue (flushed).
+    bool Complete(uint64_t ticket, const T &item)
+    {
+        if (!IsLive(ticket))
+        {
+            return false;
+        }
+
+        Slot &slot = SlotFor(ticket);
+        assert(!slot.fComplete);
+
+        slot.item = item;
+        slot.fComplete = true;
+        return true;
+    }
+
+    // Drop: Ends a reserved frame without output.
+    // Returns false if the ticket is no longer in the queue (flushed).
+    bool Drop(uint64_t ticket)
+    {
+        if (!IsLive(ticket))
+        {
+            return false;
+        }
+
+        Slot &slot = SlotFor(ticket);
+        assert(!slot.fComplete);
+
+        slot.item = T();
+        slot.fComplete = true;
+        slot.fDropped = true;
+        return true;
+    }
+
+    // GetReadyCount: Number of completed frames at the head of the queue,
+    // i.e. the frames that PopReady can return without waiting. Dropped
+    // frames among them are not counted.
+    size_t GetReadyCount() const
+    {
+        size_t cReady = 0;
+        for (size_t i = 0; i < m_count && SlotFor(m_headTicket + i).fComplete; i++)
+        {
+            if (!SlotFor(m_headTicket + i).fDropped)
+            {
+                cReady++;
+            }
+        }
+        return cReady;
+    }
+
+    // DiscardDropped: Removes the dropped frames at the head of the queue.
+    // Returns how many were removed, i.e. how many slots were freed.
+    size_t DiscardDropped()
+    {
+        size_t cDiscarded = 0;
+        while (!IsEmpty())
+        {
+            Slot &slot = SlotFor(m_headTicket);
+            if (!slot.fComplete || !slot.fDropped)
+            {
+                break;
+            }
+
+            slot.fComplete = false;
+            slot.fDropped = false;
+            m_headTicket++;
+            m_count--;
+            cDiscarded++;
+        }
+        return cDiscarded;
+    }
+
+    // TakeNewlyReady: Returns how many frames became ready since the last
+    // call. Used to send exactly one "output available" signal per frame.
+    size_t TakeNewlyReady()
+    {
+        size_t cReady = GetReadyCount();
+        size_t cNew = cReady - m_cSignaled;
+        m_cSignaled = cReady;
+        return cNew;
+    }
+
+    // PopReady: Removes the oldest frame if it has completed, skipping
+    // dropped frames.
+    bool PopReady(T *pItem, int64_t *phnsTime = nullptr)
+    {
+        DiscardDropped();
+
+        if (IsEmpty())
+        {
+            return false;
+        }
+
+        Slot &slot = SlotFor(m_headTicket);
+        if (!slot.fComplete)
+        {
+            return false;
+        }
+
+        if (pItem)
+        {
+            *pItem = slot.item;
+        }
+        if (phnsTime)
+        {
+            *phnsTime = slot.hnsTime;
+        }
+
+        slot.item = T();
+        slot.fComplete = false;
+
+        m_headTicket++;
+        m_count--;
+        if (m_cSignaled > 0)
+        {
+            m_cSignaled--;
+        }
+
+        DiscardDropped();
+        return true;
+    }
+
+    // Clear: Drops every frame, complete or not.
+    void Clear()
+    {
+        for (size_t i = 0; i < m_slots.size(); i++)
+        {
+            m_slots[i] = Slot();
+        }
+        m_headTicket += m_count;
+        m_count = 0;
+        m_cSignaled = 0;
+    }
+
+private:
+    struct Slot
+    {
+        uint64_t ticket;
+        int64_t  hnsTime;
+        bool     fComplete;
+        bool     fDropped;  // Completed without output.
+        T        item;
+
+        Slot() : ticket(0), hnsTime(0), fComplete(false), fDropped(false), item()
+        {
+        }
+    };
+
+    bool IsLive(uint64_t ticket) const
+    {
+        return ticket >= m_headTicket && ticket < m_headTicket + m_count;
+    }
+
+    Slot& SlotFor(uint64_t ticket)
+    {
+        return m_slots[(size_t)(ticket % m_slots.size())];
+    }
+
+    const Slot& SlotFor(uint64_t ticket) const
+    {
+        return m_slots[(size_t)(ticket % m_slots.size())];
+    }
+
+    std::vector<Slot> m_slots;
+    uint64_t m_headTicket;  // Ticket of the oldest frame in the queue.
+    size_t   m_count;       // Number of frames in flight.
+    size_t   m_cSignaled;   // Ready frames already reported by TakeNewlyReady.
+};
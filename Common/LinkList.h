@@ -33,6 +33,14 @@
 
 // The ComPtrList class template derives from List<> and implements a list of COM pointers.
 
+// Node allocation:
+// Removed nodes are not deleted; they go to a free list owned by the list and
+// are reused by the next insertion. Once a list has held its largest number
+// of items, inserting and removing no longer touch the heap. Reserve(n) (or
+// the constructor that takes a count) fills the free list up front, so a
+// queue can be warmed up before streaming starts. Trim() returns the free
+// nodes to the heap.
+
 template <class T>
 struct NoOp
 {
@@ -98,6 +106,8 @@ public:
 protected:
     Node    m_anchor;  // Anchor node for the linked list.
     DWORD   m_count;   // Number of items in the list.
+    Node    *m_pFree;  // Free nodes, linked through next.
+    DWORD   m_cFree;   // Number of free nodes.
 
     Node* Front() const
     {
@@ -109,6 +119,34 @@ protected:
         return m_anchor.prev;
     }
 
+    // AllocNode: Takes a node from the free list, or from the heap if it is empty.
+    Node* AllocNode(T item)
+    {
+        Node *pNode = m_pFree;
+        if (pNode == nullptr)
+        {
+            return new Node(item);
+        }
+
+        m_pFree = pNode->next;
+        m_cFree--;
+
+        pNode->next = nullptr;
+        pNode->item = item;
+        return pNode;
+    }
+
+    // FreeNode: Puts a node on the free list. The item is reset so that the
+    // list does not keep anything alive.
+    void FreeNode(Node *pNode)
+    {
+        pNode->item = T();
+        pNode->prev = nullptr;
+        pNode->next = m_pFree;
+        m_pFree = pNode;
+        m_cFree++;
+    }
+
     virtual HRESULT InsertAfter(T item, Node *pBefore)
     {
         if (pBefore == nullptr)
@@ -116,7 +154,7 @@ protected:
             return E_POINTER;
         }
 
-        Node *pNode = new Node(item);
+        Node *pNode = AllocNode(item);
         if (pNode == nullptr)
         {
             return E_OUTOFMEMORY;
@@ -172,7 +210,7 @@ protected:
         pNode->prev->next = pNode->next;
 
         item = pNode->item;
-        delete pNode;
+        FreeNode(pNode);
 
         m_count--;
 
@@ -192,13 +230,60 @@ public:
         m_anchor.prev = &m_anchor;
 
         m_count = 0;
+        m_pFree = nullptr;
+        m_cFree = 0;
+    }
+
+    // cPreallocate: Number of nodes to put on the free list right away.
+    explicit List(DWORD cPreallocate)
+    {
+        m_anchor.next = &m_anchor;
+        m_anchor.prev = &m_anchor;
+
+        m_count = 0;
+        m_pFree = nullptr;
+        m_cFree = 0;
+
+        (void)Reserve(cPreallocate);
     }
 
     virtual ~List()
     {
         Clear();
+        Trim();
     }
 
+    // Reserve: Makes sure that cNodes items in total can be held without
+    // allocating.
+    HRESULT Reserve(DWORD cNodes)
+    {
+        while (m_count + m_cFree < cNodes)
+        {
+            Node *pNode = new Node();
+            if (pNode == nullptr)
+            {
+                return E_OUTOFMEMORY;
+            }
+            FreeNode(pNode);
+        }
+        return S_OK;
+    }
+
+    // Trim: Deletes the free nodes.
+    void Trim()
+    {
+        while (m_pFree != nullptr)
+        {
+            Node *tmp = m_pFree->next;
+            delete m_pFree;
+            m_pFree = tmp;
+        }
+        m_cFree = 0;
+    }
+
+    // GetFreeCount: Returns the number of nodes that can be reused.
+    DWORD GetFreeCount() const { return m_cFree; }
+
     // Insertion functions
     HRESULT InsertBack(T item)
     {
@@ -291,13 +376,13 @@ public:
     {
         Node *n = m_anchor.next;
 
-        // Delete the nodes
+        // Recycle the nodes
         while (n != &m_anchor)
         {
             clear_fn(n->item);
 
             Node *tmp = n->next;
-            delete n;
+            FreeNode(n);
             n = tmp;
         }
 
@@ -403,7 +488,9 @@ public:
 class MemDelete
 {
 public: 
-    void operator()(void *p)
+    // Deleted through its own type, so that its destructor runs.
+    template <class T>
+    void operator()(T *p)
     {
         if (p)
         {
@@ -432,6 +519,14 @@ public:
 
     typedef T* Ptr;
 
+    ComPtrList()
+    {
+    }
+
+    explicit ComPtrList(DWORD cPreallocate) : List<Ptr>(cPreallocate)
+    {
+    }
+
     void Clear()
     {
         ComAutoRelease car;
@@ -444,6 +539,9 @@ public:
     }
 
 protected:
+    // Named through the base so that compilers with two-phase lookup find it.
+    typedef typename List<Ptr>::Node Node;
+
     HRESULT InsertAfter(Ptr item, Node *pBefore)
     {
         // Do not allow nullptr item pointers unless NULLABLE is true.
@@ -0,0 +1,336 @@
+//-----------------------------------------------------------------------------
+// File: LockProfiler.h
+// Desc: Wait and hold times of locks, per lock and call site.
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Notes:
+//
+// Used by CritSec when CRITSEC_PROFILING is defined; without it CritSec does
+// not include this file and AutoLock costs what it always did.
+//
+// For every pair of lock name and call site the profiler counts the
+// acquisitions, how many of them found the lock taken (contended), and the
+// time spent waiting for the lock and holding it. Times are kept as a total,
+// a maximum and a histogram with power-of-two buckets: bucket 0 counts times
+// under 1 ns, bucket i times in [2^(i-1), 2^i) ns, and the last bucket
+// everything longer.
+//
+// Locks with the same name share their sites' counters (every instance of a
+// class, say), so the counters are atomic. SnapshotJson() returns every site
+// as JSON:
+//
+//     { "locks": [ { "lock": "CImagingEffect", "site": "ProcessOutput",
+//                    "acquisitions": 1200, "contended": 14,
+//                    "wait_ns": { "total": ..., "max": ..., "histogram": [ ... ] },
+//                    "hold_ns": { ... } }, ... ] }
+//
+// Histograms are printed up to their last non-zero bucket.
+//
+// Usage (what CritSec does):
+//
+//     LockSiteStats *pSite = LockProfiler::Get().GetSite("MyLock", "MyFunction");  // once
+//     uint64_t t0 = LockProfiler::Now();
+//     bool fContended = !TryLock();
+//     if (fContended) Lock();
+//     uint64_t t1 = LockProfiler::Now();
+//     pSite->RecordWait(t1 - t0, fContended);
+//     ...
+//     pSite->RecordHold(LockProfiler::Now() - t1);
+//     Unlock();
+
+const size_t LOCK_PROFILER_BUCKETS = 40;
+
+// LockDuration: Total, maximum and histogram of one kind of time.
+class LockDuration
+{
+public:
+    LockDuration()
+    {
+        Reset();
+    }
+
+    void Record(uint64_t ns)
+    {
+        m_total.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t max = m_max.load(std::memory_order_relaxed);
+        while (ns > max && !m_max.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+        {
+        }
+        m_buckets[GetBucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Reset()
+    {
+        m_total.store(0, std::memory_order_relaxed);
+        m_max.store(0, std::memory_order_relaxed);
+        for (size_t i = 0; i < LOCK_PROFILER_BUCKETS; i++)
+        {
+            m_buckets[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t GetTotal() const { return m_total.load(std::memory_order_relaxed); }
+    uint64_t GetMax() const { return m_max.load(std::memory_order_relaxed); }
+    uint64_t GetBucket(size_t i) const { return m_buckets[i].load(std::memory_order_relaxed); }
+
+    // GetBucketIndex: Returns the bucket of a time in nanoseconds.
+    static size_t GetBucketIndex(uint64_t ns)
+    {
+        size_t i = 0;
+        while (ns != 0 && i < LOCK_PROFILER_BUCKETS - 1)
+        {
+            ns >>= 1;
+            i++;
+        }
+        return i;
+    }
+
+    void AppendJson(std::string *pJson) const
+    {
+        pJson->append("{ \"total\": " + std::to_string(GetTotal()));
+        pJson->append(", \"max\": " + std::to_string(GetMax()));
+        pJson->append(", \"histogram\": [");
+
+        size_t cBuckets = LOCK_PROFILER_BUCKETS;
+        while (cBuckets > 0 && GetBucket(cBuckets - 1) == 0)
+        {
+            cBuckets--;
+        }
+        for (size_t i = 0; i < cBuckets; i++)
+        {
+            pJson->append(i > 0 ? ", " : " ");
+            pJson->append(std::to_string(GetBucket(i)));
+        }
+        pJson->append(" ] }");
+    }
+
+private:
+    std::atomic<uint64_t> m_total;
+    std::atomic<uint64_t> m_max;
+    std::atomic<uint64_t> m_buckets[LOCK_PROFILER_BUCKETS];
+};
+
+// LockSiteStats: Counters of one call site of one lock.
+class LockSiteStats
+{
+public:
+    LockSiteStats(const char *pszLock, const char *pszSite)
+        : m_lock(pszLock)
+        , m_site(pszSite)
+        , m_cAcquisitions(0)
+        , m_cContended(0)
+    {
+    }
+
+    // RecordWait: Called once the lock is held.
+    void RecordWait(uint64_t ns, bool fContended)
+    {
+        m_cAcquisitions.fetch_add(1, std::memory_order_relaxed);
+        if (fContended)
+        {
+            m_cContended.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_wait.Record(ns);
+    }
+
+    // RecordHold: Called just before the lock is released.
+    void RecordHold(uint64_t ns)
+    {
+        m_hold.Record(ns);
+    }
+
+    // Reset: Clears the counters. Racy against the lock owner; for use
+    // between measurements.
+    void Reset()
+    {
+        m_cAcquisitions.store(0, std::memory_order_relaxed);
+        m_cContended.store(0, std::memory_order_relaxed);
+        m_wait.Reset();
+        m_hold.Reset();
+    }
+
+    const std::string& GetLock() const { return m_lock; }
+    const std::string& GetSite() const { return m_site; }
+    uint64_t GetAcquisitions() const { return m_cAcquisitions.load(std::memory_order_relaxed); }
+    uint64_t GetContended() const { return m_cContended.load(std::memory_order_relaxed); }
+    const LockDuration& GetWait() const { return m_wait; }
+    const LockDuration& GetHold() const { return m_hold; }
+
+private:
+    LockSiteStats(const LockSiteStats&);
+    LockSiteStats& operator=(const LockSiteStats&);
+
+    std::string m_lock;
+    std::string m_site;
+    std::atomic<uint64_t> m_cAcquisitions;
+    std::atomic<uint64_t> m_cContended;
+    LockDuration m_wait;
+    LockDuration m_hold;
+};
+
+// LockProfiler: The registry of all sites. One per process.
+class LockProfiler
+{
+public:
+    // Get: Returns the profiler. Created on first use and never destroyed,
+    // so locks may be profiled until the process ends. (Local statics are
+    // not initialized thread-safely by VS2013.)
+    static LockProfiler& Get()
+    {
+        static std::atomic<LockProfiler*> s_pProfiler;
+        LockProfiler *pProfiler = s_pProfiler.load(std::memory_order_acquire);
+        if (pProfiler == nullptr)
+        {
+            LockProfiler *pNew = new LockProfiler();
+            if (s_pProfiler.compare_exchange_strong(pProfiler, pNew, std::memory_order_acq_rel))
+            {
+                pProfiler = pNew;
+            }
+            else
+            {
+                delete pNew;
+            }
+        }
+        return *pProfiler;
+    }
+
+    // Now: Monotonic time in nanoseconds.
+    static uint64_t Now()
+    {
+#ifdef _WIN32
+        // The standard clocks of VS2013 are not precise enough.
+        LARGE_INTEGER frequency;
+        LARGE_INTEGER count;
+        QueryPerformanceFrequency(&frequency);
+        QueryPerformanceCounter(&count);
+        return (uint64_t)((double)count.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    // GetSite: Returns the counters of a site, creating them on first use.
+    // The strings are copied. Callers cache the result: this locks.
+    LockSiteStats* GetSite(const char *pszLock, const char *pszSite)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        for (size_t i = 0; i < m_sites.size(); i++)
+        {
+            if (m_sites[i]->GetLock() == pszLock && m_sites[i]->GetSite() == pszSite)
+            {
+                return m_sites[i].get();
+            }
+        }
+        m_sites.push_back(std::unique_ptr<LockSiteStats>(new LockSiteStats(pszLock, pszSite)));
+        return m_sites.back().get();
+    }
+
+    // SnapshotJson: Returns the counters of every site.
+    std::string SnapshotJson() const
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        std::string json("{ \"locks\": [");
+        for (size_t i = 0; i < m_sites.size(); i++)
+        {
+            const LockSiteStats &site = *m_sites[i];
+
+            json.append(i > 0 ? ",\n    { \"lock\": " : "\n    { \"lock\": ");
+            AppendString(&json, site.GetLock());
+            json.append(", \"site\": ");
+            AppendString(&json, site.GetSite());
+            json.append(", \"acquisitions\": " + std::to_string(site.GetAcquisitions()));
+            json.append(", \"contended\": " + std::to_string(site.GetContended()));
+            json.append(", \"wait_ns\": ");
+            site.GetWait().AppendJson(&json);
+            json.append(", \"hold_ns\": ");
+            site.GetHold().AppendJson(&json);
+            json.append(" }");
+        }
+        json.append(m_sites.empty() ? "] }" : "\n] }");
+        return json;
+    }
+
+    // Reset: Clears the counters of every site. The sites stay registered.
+    void Reset()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        for (size_t i = 0; i < m_sites.size(); i++)
+        {
+            m_sites[i]->Reset();
+        }
+    }
+
+private:
+    LockProfiler()
+    {
+    }
+
+    LockProfiler(const LockProfiler&);
+    LockProfiler& operator=(const LockProfiler&);
+
+    static void AppendString(std::string *pJson, const std::string &s)
+    {
+        pJson->push_back('"');
+        for (size_t i = 0; i < s.size(); i++)
+        {
+            if (s[i] == '"' || s[i] == '\\')
+            {
+                pJson->push_back('\\');
+            }
+            pJson->push_back(s[i]);
+        }
+        pJson->push_back('"');
+    }
+
+    mutable std::mutex m_lock;
+    std::vector<std::unique_ptr<LockSiteStats>> m_sites;   // Never removed: CritSecs keep pointers.
+};
+
+// LockSiteCache: The sites a lock has been taken from, looked up by the
+// address of the site string. Touched only by the lock owner.
+class LockSiteCache
+{
+public:
+    explicit LockSiteCache(const char *pszLock)
+        : m_pszLock(pszLock)
+    {
+    }
+
+    LockSiteStats* Find(const char *pszSite)
+    {
+        for (size_t i = 0; i < m_entries.size(); i++)
+        {
+            if (m_entries[i].pszSite == pszSite)
+            {
+                return m_entries[i].pStats;
+            }
+        }
+
+        Entry entry;
+        entry.pszSite = pszSite;
+        entry.pStats = LockProfiler::Get().GetSite(m_pszLock, pszSite ? pszSite : "(unnamed)");
+        m_entries.push_back(entry);
+        return entry.pStats;
+    }
+
+private:
+    struct Entry
+    {
+        const char *pszSite;
+        LockSiteStats *pStats;
+    };
+
+    const char *m_pszLock;
+    std::vector<Entry> m_entries;
+};
@@ -58,6 +58,110 @@
 
 
 
+#include "LinkList.h"
+#include "RingQueue.h"
+#include "AsyncCB.h"
+
+
+//-------------------------------------------------------------------
+// RingOpList class template
+//
+// Holds COM pointers in a ring queue, with the subset of the
+// ComPtrList interface that OpQueue uses. Like ComPtrList, it holds a
+// reference on each item, and GetFront returns an AddRef'd pointer.
+//
+// TRing: MpscRingQueue<TOperation*> if operations are queued from
+//        several threads, SpscRingQueue<TOperation*> if only one
+//        thread ever queues them.
+//-------------------------------------------------------------------
+
+const size_t DEFAULT_OP_RING_CAPACITY = 64;
+
+template <class TOperation, class TRing = MpscRingQueue<TOperation*> >
+class RingOpList
+{
+public:
+    explicit RingOpList(size_t cCapacity = DEFAULT_OP_RING_CAPACITY)
+        : m_ring(cCapacity)
+    {
+    }
+
+    ~RingOpList()
+    {
+        Clear();
+    }
+
+    HRESULT InsertBack(TOperation *pOp)
+    {
+        if (pOp == nullptr)
+        {
+            return E_POINTER;
+        }
+
+        pOp->AddRef();
+        if (!m_ring.TryPush(pOp))
+        {
+            pOp->Release();
+            return MF_E_NOTACCEPTING;
+        }
+        return S_OK;
+    }
+
+    HRESULT GetFront(TOperation **ppOp)
+    {
+        if (!m_ring.Peek(ppOp))
+        {
+            return E_FAIL;
+        }
+        (*ppOp)->AddRef();
+        return S_OK;
+    }
+
+    HRESULT RemoveFront(TOperation **ppOp)
+    {
+        TOperation *pOp = nullptr;
+        if (!m_ring.TryPop(&pOp))
+        {
+            return E_FAIL;
+        }
+        if (ppOp)
+        {
+            *ppOp = pOp;
+            (*ppOp)->AddRef();
+        }
+        pOp->Release();
+        return S_OK;
+    }
+
+    DWORD GetCount() const { return (DWORD)m_ring.GetCount(); }
+
+    void Clear()
+    {
+        TOperation *pOp = nullptr;
+        while (m_ring.TryPop(&pOp))
+        {
+            pOp->Release();
+        }
+    }
+
+private:
+    TRing m_ring;
+};
+
+// Tells OpQueue whether an operation list can be filled without the lock.
+template <class TOpList>
+struct IsLockFreeOpList
+{
+    enum { value = 0 };
+};
+
+template <class TOperation, class TRing>
+struct IsLockFreeOpList<RingOpList<TOperation, TRing> >
+{
+    enum { value = 1 };
+};
+
+
 //-------------------------------------------------------------------
 // OpQueue class template
 //
@@ -91,16 +195,22 @@
 //      another operation is still in progress) the method should
 //      return MF_E_NOTACCEPTING.
 //
+// TOpList: Where queued operations are kept. By default a ComPtrList,
+//          which allocates a node per operation and is only touched
+//          under the critical section. RingOpList (above) keeps them in
+//          a bounded lock-free ring instead: QueueOperation then does not
+//          take the critical section or allocate, and fails with
+//          MF_E_NOTACCEPTING when the ring is full. Validation and
+//          dispatch are unchanged and still run under the critical
+//          section, one operation at a time.
+//
 //-------------------------------------------------------------------
-#include "linklist.h"
-#include "AsyncCB.h"
-
-template <class T, class TOperation>
+template <class T, class TOperation, class TOpList = ComPtrList<TOperation> >
 class OpQueue //: public IUnknown
 {
 public:
 
-    typedef ComPtrList<TOperation>   OpList;
+    typedef TOpList   OpList;
 
     HRESULT QueueOperation(TOperation *pOp);
 
@@ -135,11 +245,23 @@ protected:
 // Public method.
 //-------------------------------------------------------------------
 
-template <class T, class TOperation>
-HRESULT OpQueue<T, TOperation>::QueueOperation(TOperation *pOp)
+template <class T, class TOperation, class TOpList>
+HRESULT OpQueue<T, TOperation, TOpList>::QueueOperation(TOperation *pOp)
 {
     HRESULT hr = S_OK;
 
+    if (IsLockFreeOpList<OpList>::value)
+    {
+        // The work item is put after the operation is in the list, so the
+        // callback will find it.
+        hr = m_OpQueue.InsertBack(pOp);
+        if (SUCCEEDED(hr))
+        {
+            hr = ProcessQueue();
+        }
+        return hr;
+    }
+
     EnterCriticalSection(&m_critsec);
 
     hr = m_OpQueue.InsertBack(pOp);
@@ -160,8 +282,8 @@ HRESULT OpQueue<T, TOperation>::QueueOperation(TOperation *pOp)
 // Note: This method dispatches the operation to a work queue.
 //-------------------------------------------------------------------
 
-template <class T, class TOperation>
-HRESULT OpQueue<T, TOperation>::ProcessQueue()
+template <class T, class TOperation, class TOpList>
+HRESULT OpQueue<T, TOperation, TOpList>::ProcessQueue()
 {
     HRESULT hr = S_OK;
     if (m_OpQueue.GetCount() > 0)
@@ -184,8 +306,8 @@ HRESULT OpQueue<T, TOperation>::ProcessQueue()
 // Note: This method is called from a work-queue thread.
 //-------------------------------------------------------------------
 
-template <class T, class TOperation>
-HRESULT OpQueue<T, TOperation>::ProcessQueueAsync(IMFAsyncResult *pResult)
+template <class T, class TOperation, class TOpList>
+HRESULT OpQueue<T, TOperation, TOpList>::ProcessQueueAsync(IMFAsyncResult *pResult)
 {
     HRESULT hr = S_OK;
     TOperation *pOp = nullptr;
@@ -200,11 +322,17 @@ HRESULT OpQueue<T, TOperation>::ProcessQueueAsync(IMFAsyncResult *pResult)
         {
             hr = ValidateOperation(pOp);
         }
-        if (SUCCEEDED(hr))
+        else if (IsLockFreeOpList<OpList>::value)
+        {
+            // A producer has claimed a slot but not filled it yet. It puts
+            // its own work item once it has.
+            hr = S_OK;
+        }
+        if (SUCCEEDED(hr) && pOp != nullptr)
         {
             hr = m_OpQueue.RemoveFront(nullptr);
         }
-        if (SUCCEEDED(hr))
+        if (SUCCEEDED(hr) && pOp != nullptr)
         {
             (void)DispatchOperation(pOp);
         }
@@ -0,0 +1,66 @@
+//-----------------------------------------------------------------------------
+// File: RcuPtr.h
+// Desc: Shared pointer that readers copy without locking while a writer
+//       replaces it (read-copy-update).
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+// Notes:
+//
+// RcuPtr holds the current version of an object that many threads read and
+// one occasionally replaces. A reader takes a snapshot with Acquire() and uses
+// it for as long as it likes; a writer builds the next version aside and
+// installs it with Publish(). Readers that took the old version keep it alive
+// through their snapshot, and it is destroyed when the last one lets go, on
+// whichever thread that is.
+//
+// Neither side waits for the other: a new version does not wait for readers
+// of the old one to finish, and readers never see a version half-built.
+//
+// Usage:
+//
+//     std::shared_ptr<Config> spNext = std::make_shared<Config>(...);
+//     ... validate spNext; it is not visible yet ...
+//     current.Publish(spNext);
+//
+//     std::shared_ptr<Config> spConfig = current.Acquire();
+//     if (spConfig) { use *spConfig, unchanged for as long as it is held }
+//
+// Writers must be serialized by the owner if the order of versions matters.
+
+template <class T>
+class RcuPtr
+{
+public:
+    RcuPtr()
+    {
+    }
+
+    // Acquire: Returns the current version, or nullptr if none is published.
+    std::shared_ptr<T> Acquire() const
+    {
+        return std::atomic_load(&m_sp);
+    }
+
+    // Publish: Makes sp the current version and returns the previous one.
+    std::shared_ptr<T> Publish(std::shared_ptr<T> sp)
+    {
+        return std::atomic_exchange(&m_sp, std::move(sp));
+    }
+
+    // Reset: Withdraws the current version. Snapshots already taken remain valid.
+    void Reset()
+    {
+        Publish(std::shared_ptr<T>());
+    }
+
+private:
+    RcuPtr(const RcuPtr&);
+    RcuPtr& operator=(const RcuPtr&);
+
+    std::shared_ptr<T> m_sp;
+};
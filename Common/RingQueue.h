@@ -0,0 +1,291 @@
+//-----------------------------------------------------------------------------
+// File: RingQueue.h
+// Desc: Bounded lock-free ring queues.
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+// Notes:
+//
+// Two fixed-capacity FIFO queues that never lock and never allocate after
+// construction:
+//
+//     SpscRingQueue<T>    One producer thread and one consumer thread.
+//     MpscRingQueue<T>    Any number of producer threads, one consumer.
+//
+// "One consumer" means one at a time: several threads may consume if the
+// owner serializes them (OpQueue does, with its critical section). The same
+// goes for the producer of SpscRingQueue.
+//
+// The capacity is rounded up to a power of two. TryPush fails when the queue
+// is full and TryPop / Peek fail when it is empty; neither waits.
+//
+// Usage:
+//
+//     MpscRingQueue<IMFSample*> queue(64);
+//
+//     producer:   if (!queue.TryPush(pSample)) { ... queue full ... }
+//     consumer:   IMFSample *pSample;
+//                 while (queue.TryPop(&pSample)) { ... }
+//
+// MpscRingQueue follows D. Vyukov's bounded queue: each slot carries a
+// sequence number that tells whether it is free for the producer that
+// claimed its position or holds an item for the consumer. A producer that
+// has claimed a slot but not yet written it makes the queue look empty up
+// to that slot until it finishes; TryPop then fails even though GetCount
+// is not zero.
+//
+// The indices are kept on separate cache lines so that the producer and
+// the consumer do not invalidate each other's line on every operation.
+
+namespace RingQueueDetail
+{
+    const size_t CACHE_LINE_SIZE = 64;
+
+    inline size_t RoundUpToPowerOfTwo(size_t n)
+    {
+        size_t p = 1;
+        while (p < n)
+        {
+            p <<= 1;
+        }
+        return p;
+    }
+
+    // An atomic index alone on its cache line.
+    struct PaddedIndex
+    {
+        std::atomic<size_t> value;
+        char pad[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+
+        PaddedIndex() : value(0)
+        {
+        }
+    };
+}
+
+
+//-------------------------------------------------------------------
+// SpscRingQueue class template
+//-------------------------------------------------------------------
+
+template <class T>
+class SpscRingQueue
+{
+public:
+    explicit SpscRingQueue(size_t cCapacity)
+        : m_items(RingQueueDetail::RoundUpToPowerOfTwo(cCapacity > 0 ? cCapacity : 1))
+        , m_mask(m_items.size() - 1)
+    {
+    }
+
+    size_t GetCapacity() const { return m_items.size(); }
+
+    // GetCount: Number of items in the queue. Exact on the producer and
+    // consumer threads while the other side is idle; a snapshot otherwise.
+    size_t GetCount() const
+    {
+        return m_tail.value.load(std::memory_order_acquire) - m_head.value.load(std::memory_order_acquire);
+    }
+
+    bool IsEmpty() const { return GetCount() == 0; }
+
+    // Producer side.
+    bool TryPush(const T &item)
+    {
+        const size_t tail = m_tail.value.load(std::memory_order_relaxed);
+        if (tail - m_head.value.load(std::memory_order_acquire) == m_items.size())
+        {
+            return false;
+        }
+
+        m_items[tail & m_mask] = item;
+        m_tail.value.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: Peek returns the oldest item without removing it.
+    bool Peek(T *pItem) const
+    {
+        const size_t head = m_head.value.load(std::memory_order_relaxed);
+        if (head == m_tail.value.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        *pItem = m_items[head & m_mask];
+        return true;
+    }
+
+    // Consumer side. pItem can be nullptr to drop the item.
+    bool TryPop(T *pItem)
+    {
+        const size_t head = m_head.value.load(std::memory_order_relaxed);
+        if (head == m_tail.value.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        T &slot = m_items[head & m_mask];
+        if (pItem)
+        {
+            *pItem = slot;
+        }
+        slot = T();
+        m_head.value.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    SpscRingQueue(const SpscRingQueue&);
+    SpscRingQueue& operator=(const SpscRingQueue&);
+
+    RingQueueDetail::PaddedIndex m_head;    // Next item to pop. Written by the consumer.
+    RingQueueDetail::PaddedIndex m_tail;    // Next slot to fill. Written by the producer.
+    std::vector<T> m_items;
+    const size_t m_mask;
+};
+
+
+//-------------------------------------------------------------------
+// MpscRingQueue class template
+//-------------------------------------------------------------------
+
+template <class T>
+class MpscRingQueue
+{
+public:
+    explicit MpscRingQueue(size_t cCapacity)
+        : m_slots(RingQueueDetail::RoundUpToPowerOfTwo(cCapacity > 0 ? cCapacity : 1))
+        , m_mask(m_slots.size() - 1)
+    {
+        // Slot i is free for the producer that claims position i.
+        for (size_t i = 0; i < m_slots.size(); i++)
+        {
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    size_t GetCapacity() const { return m_slots.size(); }
+
+    // GetCount: Number of positions claimed by producers and not yet
+    // popped. A snapshot; it includes pushes still in progress.
+    size_t GetCount() const
+    {
+        const size_t head = m_head.value.load(std::memory_order_acquire);
+        const size_t tail = m_tail.value.load(std::memory_order_acquire);
+        return tail - head;
+    }
+
+    bool IsEmpty() const { return GetCount() == 0; }
+
+    // Producer side. Safe to call from any number of threads.
+    bool TryPush(const T &item)
+    {
+        size_t pos = m_tail.value.load(std::memory_order_relaxed);
+        Slot *pSlot = nullptr;
+
+        for (;;)
+        {
+            pSlot = &m_slots[pos & m_mask];
+            const size_t sequence = pSlot->sequence.load(std::memory_order_acquire);
+            const ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)pos;
+
+            if (diff == 0)
+            {
+                // The slot is free; claim the position.
+                if (m_tail.value.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                // The slot still holds the item from one lap ago: full.
+                return false;
+            }
+            else
+            {
+                // Another producer took this position; try the next one.
+                pos = m_tail.value.load(std::memory_order_relaxed);
+            }
+        }
+
+        pSlot->item = item;
+        pSlot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: Peek returns the oldest item without removing it.
+    bool Peek(T *pItem) const
+    {
+        const size_t head = m_head.value.load(std::memory_order_relaxed);
+        const Slot &slot = m_slots[head & m_mask];
+        if (slot.sequence.load(std::memory_order_acquire) != head + 1)
+        {
+            return false;
+        }
+
+        *pItem = slot.item;
+        return true;
+    }
+
+    // Consumer side. pItem can be nullptr to drop the item.
+    bool TryPop(T *pItem)
+    {
+        const size_t head = m_head.value.load(std::memory_order_relaxed);
+        Slot &slot = m_slots[head & m_mask];
+        if (slot.sequence.load(std::memory_order_acquire) != head + 1)
+        {
+            return false;
+        }
+
+        if (pItem)
+        {
+            *pItem = slot.item;
+        }
+        slot.item = T();
+
+        // Hand the slot to the producer that will claim it on the next lap.
+        slot.sequence.store(head + m_slots.size(), std::memory_order_release);
+        m_head.value.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    MpscRingQueue(const MpscRingQueue&);
+    MpscRingQueue& operator=(const MpscRingQueue&);
+
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        T item;
+
+        Slot() : sequence(0), item()
+        {
+        }
+
+        // std::vector needs these to size itself; only used before the
+        // queue is shared.
+        Slot(const Slot &other) : sequence(other.sequence.load(std::memory_order_relaxed)), item(other.item)
+        {
+        }
+
+        Slot& operator=(const Slot &other)
+        {
+            sequence.store(other.sequence.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            item = other.item;
+            return *this;
+        }
+    };
+
+    RingQueueDetail::PaddedIndex m_head;    // Next position to pop. Written by the consumer.
+    RingQueueDetail::PaddedIndex m_tail;    // Next position to claim. Shared by the producers.
+    std::vector<Slot> m_slots;
+    const size_t m_mask;
+};
@@ -7,21 +7,30 @@
 
 using namespace Microsoft::WRL;
 
+// lRowCount is the number of rows of lDefaultStride bytes the frame
+// occupies, e.g. one and a half times the height for NV12. It is used to
+// validate the buffer size and to find the top row of bottom-up buffers.
+//
+// lRowSize is the number of bytes the pixels of one row use. The pitch of a
+// 2D buffer may be larger than that (padded rows) but never smaller.
+
 class VideoBufferLock 
 {
 public:
-    VideoBufferLock(_In_ IMFMediaBuffer *pBuffer, _In_ MF2DBuffer_LockFlags flags, _In_ LONG lHeightInPixels, _In_ LONG lDefaultStride) 
+    VideoBufferLock(_In_ IMFMediaBuffer *pBuffer, _In_ MF2DBuffer_LockFlags flags, _In_ LONG lRowCount, _In_ LONG lDefaultStride, _In_ LONG lRowSize) 
         : _fLockedBuffer(false)
         , _fLocked2D(false)
         , _fLocked2D2(false)
         , _pData(nullptr)
         , _lPitch(0) 
+        , _pBufferStart(nullptr)
+        , _cbBuffer(0)
         , _spInputBuffer(pBuffer)
-        , _lHeightInPixels(lHeightInPixels)
+        , _lRowCount(lRowCount)
     {
         try
         {
-            Lock(flags, lDefaultStride);
+            Lock(flags, lDefaultStride, lRowSize);
         }
         catch(Exception^)
         {
@@ -66,7 +75,7 @@ public:
         if (_fLockedBuffer && _lPitch < 0)
         {
             // We only do that when we locked IMFMediaBuffer.
-            return _pData + abs(_lPitch) * (_lHeightInPixels - 1);
+            return _pData + abs(_lPitch) * (_lRowCount - 1);
         }
         else
         {
@@ -75,8 +84,13 @@ public:
     }
     LONG GetStride(){ return _lPitch; }
 
+    // Start and length of the memory behind the buffer, when the buffer
+    // reports them. GetBufferStart returns nullptr if it does not.
+    BYTE *GetBufferStart() const { return _pBufferStart; }
+    DWORD GetBufferLength() const { return _cbBuffer; }
+
 private:
-    void Lock(_In_ MF2DBuffer_LockFlags flags, _In_ LONG lDefaultStride)
+    void Lock(_In_ MF2DBuffer_LockFlags flags, _In_ LONG lDefaultStride, _In_ LONG lRowSize)
     {
         DWORD dwBufferCount = 0;
         DWORD maxSize = 0;
@@ -92,11 +106,15 @@ private:
         {
             if (SUCCEEDED(_spInputBuffer2D2->Lock2DSize( flags, &_pData, &_lPitch, &pbBufferStart, &dwBufferLength )))
             {
-                if (dwBufferLength < _lHeightInPixels * abs(lDefaultStride) || abs(_lPitch) < abs(lDefaultStride))
+                // The pitch may differ from the default stride; check the
+                // rows against the pitch the buffer actually has.
+                if (abs(_lPitch) < lRowSize || dwBufferLength < (_lRowCount - 1) * (DWORD)abs(_lPitch) + lRowSize)
                 {
                     _spInputBuffer2D2->Unlock2D();
                     ThrowException(MF_E_BUFFERTOOSMALL);
                 }
+                _pBufferStart = pbBufferStart;
+                _cbBuffer = dwBufferLength;
                 _fLocked2D2 = true;
             }
         }
@@ -107,7 +125,7 @@ private:
             {
                 if (SUCCEEDED(_spInputBuffer2D->Lock2D(&_pData, &_lPitch)))
                 {
-                    if (abs(_lPitch) < abs(lDefaultStride))
+                    if (abs(_lPitch) < lRowSize)
                     {
                         _spInputBuffer2D->Unlock2D();
                         ThrowException(MF_E_BUFFERTOOSMALL);
@@ -121,12 +139,14 @@ private:
         {
             ThrowIfError(_spInputBuffer->Lock(&_pData, &maxSize, nullptr));
       
-            if (maxSize < _lHeightInPixels * abs(lDefaultStride))
+            if (maxSize < _lRowCount * (DWORD)abs(lDefaultStride))
             {
                 _spInputBuffer->Unlock();
                 ThrowException(MF_E_BUFFERTOOSMALL);
             }
 
+            _pBufferStart = _pData;
+            _cbBuffer = maxSize;
             _fLockedBuffer = true;
             _lPitch = lDefaultStride;
         }
@@ -145,5 +165,8 @@ private:
     BYTE *_pData;
     LONG _lPitch;
 
-    DWORD _lHeightInPixels;
+    BYTE *_pBufferStart;
+    DWORD _cbBuffer;
+
+    DWORD _lRowCount;
 };
@@ -0,0 +1,533 @@
+// 3D colour lookup tables: resampling to YUV and tetrahedral interpolation.
+//
+// Interpolation in fixed point:
+//
+// A code x (0-255) maps to the lattice position x * (size - 1) / 255, kept
+// in 1/256 steps and computed as (x * m_scale + 32768) >> 16 so that no
+// division is needed in the SIMD code. The integer part selects the cell and is clamped
+// to size - 2, so code 255 lands on the far corner of the last cell with a
+// fraction of 256.
+//
+// The cell is split into six tetrahedra along its main diagonal. With the
+// three fractions sorted as fMax >= fMid >= fMin, the result is
+//
+//   (256 - fMax) * c000 + (fMax - fMid) * c1 + (fMid - fMin) * c2 + fMin * c111
+//
+// where c1 is one step along the axis with the largest fraction and c2 one
+// more step along the axis with the middle fraction. When fractions are
+// equal, the weight of the vertex that depends on the ordering is zero, so
+// ties can be broken any consistent way.
+//
+// Entries hold Y, U and V with 2 fractional bits in 10-bit fields, so one
+// 32-bit gather fetches a whole vertex.
+//
+// This file does not use the precompiled header so that it can be built
+// without Windows headers.
+
+#include "ColorCube.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define CUBE_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+namespace ImagingEffects
+{
+	namespace
+	{
+		// Chroma samples per chunk in ApplyToRows.
+		const uint32_t CHUNK = 64;
+
+		inline uint32_t EntryY(uint32_t e) { return e >> 20; }
+		inline uint32_t EntryU(uint32_t e) { return (e >> 10) & 1023; }
+		inline uint32_t EntryV(uint32_t e) { return e & 1023; }
+
+		void InterpolateScalar(
+			const uint32_t *entries, uint32_t size, uint32_t scale,
+			const uint8_t *pY, const uint8_t *pU, const uint8_t *pV, uint32_t n,
+			uint8_t *pOutY, uint8_t *pOutU, uint8_t *pOutV)
+		{
+			const uint32_t maxIndex = size - 2;
+			const uint32_t sY = size * size;
+			const uint32_t sU = size;
+			const uint32_t sV = 1;
+			const uint32_t sAll = sY + sU + sV;
+
+			for (uint32_t i = 0; i < n; i++)
+			{
+				uint32_t fy = (pY[i] * scale + 32768) >> 16;
+				uint32_t fu = (pU[i] * scale + 32768) >> 16;
+				uint32_t fv = (pV[i] * scale + 32768) >> 16;
+				uint32_t iy = (fy >> 8) < maxIndex ? (fy >> 8) : maxIndex;
+				uint32_t iu = (fu >> 8) < maxIndex ? (fu >> 8) : maxIndex;
+				uint32_t iv = (fv >> 8) < maxIndex ? (fv >> 8) : maxIndex;
+				fy -= iy << 8;
+				fu -= iu << 8;
+				fv -= iv << 8;
+
+				uint32_t sMax, fMax, sMin, fMin;
+				if (fy >= fu && fy >= fv) { sMax = sY; fMax = fy; }
+				else if (fu >= fv) { sMax = sU; fMax = fu; }
+				else { sMax = sV; fMax = fv; }
+
+				if (fy < fu && fy < fv) { sMin = sY; fMin = fy; }
+				else if (fu < fv) { sMin = sU; fMin = fu; }
+				else { sMin = sV; fMin = fv; }
+
+				const uint32_t fMid = fy + fu + fv - fMax - fMin;
+				const uint32_t sMid = sAll - sMax - sMin;
+
+				const uint32_t *c = entries + iy * sY + iu * sU + iv * sV;
+				const uint32_t c0 = c[0];
+				const uint32_t c1 = c[sMax];
+				const uint32_t c2 = c[sMax + sMid];
+				const uint32_t c3 = c[sAll];
+
+				const uint32_t w0 = 256 - fMax;
+				const uint32_t w1 = fMax - fMid;
+				const uint32_t w2 = fMid - fMin;
+				const uint32_t w3 = fMin;
+
+				if (pOutY)
+				{
+					pOutY[i] = (uint8_t)((w0 * EntryY(c0) + w1 * EntryY(c1) + w2 * EntryY(c2) + w3 * EntryY(c3) + 512) >> 10);
+				}
+				if (pOutU)
+				{
+					pOutU[i] = (uint8_t)((w0 * EntryU(c0) + w1 * EntryU(c1) + w2 * EntryU(c2) + w3 * EntryU(c3) + 512) >> 10);
+				}
+				if (pOutV)
+				{
+					pOutV[i] = (uint8_t)((w0 * EntryV(c0) + w1 * EntryV(c1) + w2 * EntryV(c2) + w3 * EntryV(c3) + 512) >> 10);
+				}
+			}
+		}
+
+#if defined(CUBE_X86)
+		TARGET_AVX2 inline __m256i LoadCodes_AVX2(const uint8_t *p)
+		{
+			return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)p));
+		}
+
+		TARGET_AVX2 inline void StoreCodes_AVX2(uint8_t *p, __m256i v)
+		{
+			__m128i w = _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+			_mm_storel_epi64((__m128i *)p, _mm_packus_epi16(w, w));
+		}
+
+		TARGET_AVX2 inline __m256i Blend_AVX2(__m256i a, __m256i b, __m256i mask)
+		{
+			return _mm256_blendv_epi8(a, b, mask);
+		}
+
+		TARGET_AVX2 inline __m256i Weighted_AVX2(__m256i c0, __m256i c1, __m256i c2, __m256i c3, __m256i w0, __m256i w1, __m256i w2, __m256i w3)
+		{
+			__m256i sum = _mm256_mullo_epi32(c0, w0);
+			sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(c1, w1));
+			sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(c2, w2));
+			sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(c3, w3));
+			return _mm256_srli_epi32(_mm256_add_epi32(sum, _mm256_set1_epi32(512)), 10);
+		}
+
+		TARGET_AVX2 void InterpolateAvx2(
+			const uint32_t *entries, uint32_t size, uint32_t scale,
+			const uint8_t *pY, const uint8_t *pU, const uint8_t *pV, uint32_t n,
+			uint8_t *pOutY, uint8_t *pOutU, uint8_t *pOutV)
+		{
+			const __m256i vScale = _mm256_set1_epi32((int)scale);
+			const __m256i vHalf = _mm256_set1_epi32(32768);
+			const __m256i vMaxIndex = _mm256_set1_epi32((int)(size - 2));
+			const __m256i sY = _mm256_set1_epi32((int)(size * size));
+			const __m256i sU = _mm256_set1_epi32((int)size);
+			const __m256i sV = _mm256_set1_epi32(1);
+			const __m256i sAll = _mm256_add_epi32(sY, _mm256_add_epi32(sU, sV));
+			const __m256i v256 = _mm256_set1_epi32(256);
+			const __m256i mask10 = _mm256_set1_epi32(1023);
+			const int *base = (const int *)entries;
+			uint32_t x = 0;
+
+			for (; x + 8 <= n; x += 8)
+			{
+				__m256i fy = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(LoadCodes_AVX2(pY + x), vScale), vHalf), 16);
+				__m256i fu = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(LoadCodes_AVX2(pU + x), vScale), vHalf), 16);
+				__m256i fv = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(LoadCodes_AVX2(pV + x), vScale), vHalf), 16);
+				__m256i iy = _mm256_min_epi32(_mm256_srli_epi32(fy, 8), vMaxIndex);
+				__m256i iu = _mm256_min_epi32(_mm256_srli_epi32(fu, 8), vMaxIndex);
+				__m256i iv = _mm256_min_epi32(_mm256_srli_epi32(fv, 8), vMaxIndex);
+				fy = _mm256_sub_epi32(fy, _mm256_slli_epi32(iy, 8));
+				fu = _mm256_sub_epi32(fu, _mm256_slli_epi32(iu, 8));
+				fv = _mm256_sub_epi32(fv, _mm256_slli_epi32(iv, 8));
+
+				// Same tie-breaking as the scalar code.
+				__m256i uGtY = _mm256_cmpgt_epi32(fu, fy);
+				__m256i vGtY = _mm256_cmpgt_epi32(fv, fy);
+				__m256i vGtU = _mm256_cmpgt_epi32(fv, fu);
+				__m256i yIsMax = _mm256_andnot_si256(_mm256_or_si256(uGtY, vGtY), _mm256_set1_epi32(-1));
+				__m256i yIsMin = _mm256_and_si256(uGtY, vGtY);
+
+				__m256i sMax = Blend_AVX2(Blend_AVX2(sU, sV, vGtU), sY, yIsMax);
+				__m256i sMin = Blend_AVX2(Blend_AVX2(sV, sU, vGtU), sY, yIsMin);
+				__m256i fMax = _mm256_max_epi32(fy, _mm256_max_epi32(fu, fv));
+				__m256i fMin = _mm256_min_epi32(fy, _mm256_min_epi32(fu, fv));
+				__m256i fMid = _mm256_sub_epi32(_mm256_add_epi32(fy, _mm256_add_epi32(fu, fv)), _mm256_add_epi32(fMax, fMin));
+				__m256i sMid = _mm256_sub_epi32(sAll, _mm256_add_epi32(sMax, sMin));
+
+				__m256i cell = _mm256_add_epi32(_mm256_mullo_epi32(iy, sY), _mm256_add_epi32(_mm256_mullo_epi32(iu, sU), iv));
+				__m256i c0 = _mm256_i32gather_epi32(base, cell, 4);
+				__m256i c1 = _mm256_i32gather_epi32(base, _mm256_add_epi32(cell, sMax), 4);
+				__m256i c2 = _mm256_i32gather_epi32(base, _mm256_add_epi32(cell, _mm256_add_epi32(sMax, sMid)), 4);
+				__m256i c3 = _mm256_i32gather_epi32(base, _mm256_add_epi32(cell, sAll), 4);
+
+				__m256i w0 = _mm256_sub_epi32(v256, fMax);
+				__m256i w1 = _mm256_sub_epi32(fMax, fMid);
+				__m256i w2 = _mm256_sub_epi32(fMid, fMin);
+				__m256i w3 = fMin;
+
+				if (pOutY)
+				{
+					StoreCodes_AVX2(pOutY + x, Weighted_AVX2(
+						_mm256_srli_epi32(c0, 20), _mm256_srli_epi32(c1, 20), _mm256_srli_epi32(c2, 20), _mm256_srli_epi32(c3, 20),
+						w0, w1, w2, w3));
+				}
+				if (pOutU)
+				{
+					StoreCodes_AVX2(pOutU + x, Weighted_AVX2(
+						_mm256_and_si256(_mm256_srli_epi32(c0, 10), mask10), _mm256_and_si256(_mm256_srli_epi32(c1, 10), mask10),
+						_mm256_and_si256(_mm256_srli_epi32(c2, 10), mask10), _mm256_and_si256(_mm256_srli_epi32(c3, 10), mask10),
+						w0, w1, w2, w3));
+				}
+				if (pOutV)
+				{
+					StoreCodes_AVX2(pOutV + x, Weighted_AVX2(
+						_mm256_and_si256(c0, mask10), _mm256_and_si256(c1, mask10),
+						_mm256_and_si256(c2, mask10), _mm256_and_si256(c3, mask10),
+						w0, w1, w2, w3));
+				}
+			}
+
+			InterpolateScalar(entries, size, scale, pY + x, pU + x, pV + x, n - x,
+				pOutY ? pOutY + x : nullptr, pOutU ? pOutU + x : nullptr, pOutV ? pOutV + x : nullptr);
+		}
+#endif
+
+		// YUV <-> RGB for a matrix and range. RGB is in 0-1.
+		struct YuvConverter
+		{
+			float kr, kb;
+			float yOffset, yScale, cScale;
+
+			YuvConverter(YuvMatrix matrix, YuvRange range)
+			{
+				kr = (matrix == YuvMatrix_BT709) ? 0.2126f : 0.299f;
+				kb = (matrix == YuvMatrix_BT709) ? 0.0722f : 0.114f;
+				yOffset = (range == YuvRange_Video) ? 16.0f : 0.0f;
+				yScale = (range == YuvRange_Video) ? 219.0f : 255.0f;
+				cScale = (range == YuvRange_Video) ? 224.0f : 255.0f;
+			}
+
+			void ToRgb(float y, float u, float v, float *pRgb) const
+			{
+				float l = (y - yOffset) / yScale;
+				float cb = (u - 128.0f) / cScale;
+				float cr = (v - 128.0f) / cScale;
+				float r = l + 2.0f * (1.0f - kr) * cr;
+				float b = l + 2.0f * (1.0f - kb) * cb;
+				float g = (l - kr * r - kb * b) / (1.0f - kr - kb);
+				pRgb[0] = r;
+				pRgb[1] = g;
+				pRgb[2] = b;
+			}
+
+			void ToYuv(const float *pRgb, float *pYuv) const
+			{
+				float l = kr * pRgb[0] + (1.0f - kr - kb) * pRgb[1] + kb * pRgb[2];
+				pYuv[0] = yOffset + yScale * l;
+				pYuv[1] = 128.0f + cScale * (pRgb[2] - l) / (2.0f * (1.0f - kb));
+				pYuv[2] = 128.0f + cScale * (pRgb[0] - l) / (2.0f * (1.0f - kr));
+			}
+		};
+
+		inline float Clamp01(float v)
+		{
+			return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+		}
+
+		// A code with 2 fractional bits, as stored in the entries.
+		inline uint32_t ToEntryField(float code)
+		{
+			float q = floorf(code * 4.0f + 0.5f);
+			return (uint32_t)(q < 0.0f ? 0.0f : (q > 1020.0f ? 1020.0f : q));
+		}
+
+		bool IsSupportedSize(uint32_t size)
+		{
+			return size == 17 || size == 33 || size == 65;
+		}
+	}
+
+	//-------------------------------------------------------------------
+	// YuvCube
+	//-------------------------------------------------------------------
+
+	YuvCube::YuvCube(uint32_t size, std::vector<uint32_t> &entries)
+		: m_size(size)
+		, m_scale((uint32_t)((((uint64_t)(size - 1) << 24) + 254) / 255))
+	{
+		m_entries.swap(entries);
+	}
+
+	void YuvCube::Interpolate(const uint8_t *pY, const uint8_t *pU, const uint8_t *pV, uint32_t n, uint8_t *pOutY, uint8_t *pOutU, uint8_t *pOutV) const
+	{
+#if defined(CUBE_X86)
+		if (GetConversionIsa() == ConversionIsa_AVX2)
+		{
+			InterpolateAvx2(m_entries.data(), m_size, m_scale, pY, pU, pV, n, pOutY, pOutU, pOutV);
+			return;
+		}
+#endif
+		InterpolateScalar(m_entries.data(), m_size, m_scale, pY, pU, pV, n, pOutY, pOutU, pOutV);
+	}
+
+	void YuvCube::ApplyToRows(
+		const uint8_t *pSrcY0, const uint8_t *pSrcY1, const uint8_t *pSrcUV,
+		uint8_t *pDestY0, uint8_t *pDestY1, uint8_t *pDestUV,
+		uint32_t width) const
+	{
+		const uint32_t cChroma = (width + 1) / 2;
+
+		uint8_t yAverage[CHUNK];
+		uint8_t u[CHUNK];
+		uint8_t v[CHUNK];
+		uint8_t u2[2 * CHUNK];
+		uint8_t v2[2 * CHUNK];
+
+		for (uint32_t c = 0; c < cChroma; c += CHUNK)
+		{
+			const uint32_t n = (cChroma - c < CHUNK) ? cChroma - c : CHUNK;
+			const uint32_t x0 = 2 * c;
+			const uint32_t cLuma = (width - x0 < 2 * n) ? width - x0 : 2 * n;
+
+			// Read everything the chunk needs before writing any of it, so the
+			// rows can be processed in place.
+			for (uint32_t i = 0; i < n; i++)
+			{
+				uint32_t x = x0 + 2 * i;
+				uint32_t x1 = (x + 1 < width) ? x + 1 : x;
+				uint32_t sum0 = pSrcY0[x] + pSrcY0[x1];
+				uint32_t sum1 = pSrcY1 ? pSrcY1[x] + pSrcY1[x1] : sum0;
+				yAverage[i] = (uint8_t)((sum0 + sum1 + 2) >> 2);
+				u[i] = u2[2 * i] = u2[2 * i + 1] = pSrcUV[2 * (c + i)];
+				v[i] = v2[2 * i] = v2[2 * i + 1] = pSrcUV[2 * (c + i) + 1];
+			}
+
+			Interpolate(yAverage, u, v, n, nullptr, u, v);
+			Interpolate(pSrcY0 + x0, u2, v2, cLuma, pDestY0 + x0, nullptr, nullptr);
+			if (pSrcY1)
+			{
+				Interpolate(pSrcY1 + x0, u2, v2, cLuma, pDestY1 + x0, nullptr, nullptr);
+			}
+
+			for (uint32_t i = 0; i < n; i++)
+			{
+				pDestUV[2 * (c + i)] = u[i];
+				pDestUV[2 * (c + i) + 1] = v[i];
+			}
+		}
+	}
+
+	//-------------------------------------------------------------------
+	// ColorCube
+	//-------------------------------------------------------------------
+
+	ColorCube::ColorCube(uint32_t size, std::vector<float> &rgb)
+		: m_size(size)
+	{
+		m_rgb.swap(rgb);
+	}
+
+	std::shared_ptr<ColorCube> ColorCube::Create(uint32_t size, const float *pRgb, size_t cValues)
+	{
+		if (!IsSupportedSize(size) || pRgb == nullptr || cValues < (size_t)size * size * size * 3)
+		{
+			return nullptr;
+		}
+
+		std::vector<float> rgb(pRgb, pRgb + (size_t)size * size * size * 3);
+		return std::shared_ptr<ColorCube>(new ColorCube(size, rgb));
+	}
+
+	std::shared_ptr<ColorCube> ColorCube::Parse(const std::string &text)
+	{
+		uint32_t size = 0;
+		float domainMin[3] = { 0.0f, 0.0f, 0.0f };
+		float domainMax[3] = { 1.0f, 1.0f, 1.0f };
+		std::vector<float> rgb;
+
+		size_t pos = 0;
+		while (pos < text.size())
+		{
+			size_t end = text.find('\n', pos);
+			if (end == std::string::npos)
+			{
+				end = text.size();
+			}
+			std::string line = text.substr(pos, end - pos);
+			pos = end + 1;
+
+			size_t first = line.find_first_not_of(" \t\r");
+			if (first == std::string::npos || line[first] == '#')
+			{
+				continue;
+			}
+			const char *p = line.c_str() + first;
+
+			if (strncmp(p, "TITLE", 5) == 0)
+			{
+				continue;
+			}
+			else if (strncmp(p, "LUT_3D_SIZE", 11) == 0)
+			{
+				size = (uint32_t)strtoul(p + 11, nullptr, 10);
+			}
+			else if (strncmp(p, "DOMAIN_MIN", 10) == 0 || strncmp(p, "DOMAIN_MAX", 10) == 0)
+			{
+				float *pDomain = (p[8] == 'I') ? domainMin : domainMax;
+				char *next = const_cast<char *>(p + 10);
+				for (int i = 0; i < 3; i++)
+				{
+					pDomain[i] = (float)strtod(next, &next);
+				}
+			}
+			else if ((*p >= '0' && *p <= '9') || *p == '-' || *p == '+' || *p == '.')
+			{
+				char *next = const_cast<char *>(p);
+				for (int i = 0; i < 3; i++)
+				{
+					float value = (float)strtod(next, &next);
+					rgb.push_back((value - domainMin[i]) / (domainMax[i] - domainMin[i]));
+				}
+			}
+			else
+			{
+				// LUT_1D_SIZE or another keyword this parser does not handle.
+				return nullptr;
+			}
+		}
+
+		return Create(size, rgb.data(), rgb.size());
+	}
+
+	std::shared_ptr<const YuvCube> ColorCube::GetYuvCube(YuvMatrix matrix, YuvRange range) const
+	{
+		std::lock_guard<std::mutex> lock(m_cacheLock);
+
+		std::shared_ptr<const YuvCube> &cached = m_cache[matrix == YuvMatrix_BT709 ? 1 : 0][range == YuvRange_Full ? 1 : 0];
+		if (!cached)
+		{
+			cached = BuildYuvCube(matrix, range);
+		}
+		return cached;
+	}
+
+	// Tetrahedral interpolation of the RGB table, in floating point.
+
+	void ColorCube::LookupRgb(const float *pRgbIn, float *pRgbOut) const
+	{
+		const uint32_t n = m_size;
+		const size_t strides[3] = { 3, 3 * (size_t)n, 3 * (size_t)n * n };   // Red changes fastest.
+
+		uint32_t index[3];
+		float frac[3];
+		for (int i = 0; i < 3; i++)
+		{
+			float position = Clamp01(pRgbIn[i]) * (n - 1);
+			index[i] = (uint32_t)position;
+			if (index[i] > n - 2)
+			{
+				index[i] = n - 2;
+			}
+			frac[i] = position - index[i];
+		}
+
+		// Order the axes by fraction, largest first.
+		int order[3] = { 0, 1, 2 };
+		for (int i = 0; i < 2; i++)
+		{
+			for (int j = i + 1; j < 3; j++)
+			{
+				if (frac[order[j]] > frac[order[i]])
+				{
+					int t = order[i];
+					order[i] = order[j];
+					order[j] = t;
+				}
+			}
+		}
+
+		const float *c0 = &m_rgb[index[0] * strides[0] + index[1] * strides[1] + index[2] * strides[2]];
+		const float *c1 = c0 + strides[order[0]];
+		const float *c2 = c1 + strides[order[1]];
+		const float *c3 = c2 + strides[order[2]];
+
+		const float w0 = 1.0f - frac[order[0]];
+		const float w1 = frac[order[0]] - frac[order[1]];
+		const float w2 = frac[order[1]] - frac[order[2]];
+		const float w3 = frac[order[2]];
+
+		for (int i = 0; i < 3; i++)
+		{
+			pRgbOut[i] = w0 * c0[i] + w1 * c1[i] + w2 * c2[i] + w3 * c3[i];
+		}
+	}
+
+	// Samples the RGB table at every point of a YUV lattice of the same size.
+	// Many of the points are outside the RGB gamut; they are looked up at the
+	// nearest colour inside it and keep their distance from it, so that
+	// cells straddling the edge of the gamut still interpolate correctly for
+	// the colours that are inside.
+
+	std::shared_ptr<const YuvCube> ColorCube::BuildYuvCube(YuvMatrix matrix, YuvRange range) const
+	{
+		const uint32_t n = m_size;
+		const float step = 255.0f / (n - 1);
+		const YuvConverter converter(matrix, range);
+
+		std::vector<uint32_t> entries((size_t)n * n * n);
+
+		for (uint32_t iy = 0; iy < n; iy++)
+		{
+			for (uint32_t iu = 0; iu < n; iu++)
+			{
+				for (uint32_t iv = 0; iv < n; iv++)
+				{
+					float rgb[3];
+					float graded[3];
+					float yuv[3];
+
+					converter.ToRgb(iy * step, iu * step, iv * step, rgb);
+					LookupRgb(rgb, graded);
+					for (int i = 0; i < 3; i++)
+					{
+						graded[i] += rgb[i] - Clamp01(rgb[i]);
+					}
+					converter.ToYuv(graded, yuv);
+
+					entries[((size_t)iy * n + iu) * n + iv] =
+						(ToEntryField(yuv[0]) << 20) | (ToEntryField(yuv[1]) << 10) | ToEntryField(yuv[2]);
+				}
+			}
+		}
+
+		return std::make_shared<YuvCube>(n, entries);
+	}
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+// 3D colour lookup tables.
+//
+// A ColorCube holds an RGB-to-RGB lookup table as it is authored (e.g. a
+// .cube file exported from a grading tool), with 17, 33 or 65 points per
+// axis. Video frames are YUV, so before a cube can be applied it is
+// resampled into a YuvCube: a table indexed by Y, U and V codes that gives
+// the graded Y, U and V codes directly. The YUV-to-RGB conversion, the RGB
+// lookup and the conversion back are all folded into that table.
+//
+// The resampled table depends on the YUV matrix and range of the stream.
+// ColorCube caches one YuvCube per combination, so a stream that restarts
+// with the same format does not pay for the resampling again.
+//
+// YuvCubes are applied with tetrahedral interpolation in fixed point. The
+// AVX2 implementation gathers the cube entries eight pixels at a time and
+// produces exactly the same output as the scalar one. SSE2 and NEON have no
+// gather instruction, so they use the scalar implementation.
+//
+// This file does not depend on Windows headers.
+
+#include "VideoFrame.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ImagingEffects
+{
+	enum YuvMatrix
+	{
+		YuvMatrix_BT601,
+		YuvMatrix_BT709
+	};
+
+	enum YuvRange
+	{
+		YuvRange_Video,     // Y in 16-235, chroma in 16-240.
+		YuvRange_Full       // All components in 0-255.
+	};
+
+	// YuvCube class:
+	// A 3D table indexed by Y, U and V codes. Immutable once built.
+
+	class YuvCube
+	{
+	public:
+		YuvCube(uint32_t size, std::vector<uint32_t> &entries);
+
+		uint32_t GetSize() const { return m_size; }
+
+		// Looks up n points given as separate Y, U and V arrays. Any output
+		// array may be null if that component is not needed. The outputs
+		// may be the inputs.
+		void Interpolate(const uint8_t *pY, const uint8_t *pU, const uint8_t *pV, uint32_t n, uint8_t *pOutY, uint8_t *pOutU, uint8_t *pOutV) const;
+
+		// Applies the cube to one chroma row of an NV12 frame and the one or
+		// two luma rows that share it. Chroma is graded with the average luma
+		// of each 2x2 block, luma with the chroma of its block. Source and
+		// destination rows may be the same.
+		void ApplyToRows(
+			const uint8_t *pSrcY0, const uint8_t *pSrcY1, const uint8_t *pSrcUV,
+			uint8_t *pDestY0, uint8_t *pDestY1, uint8_t *pDestUV,
+			uint32_t width) const;
+
+	private:
+		uint32_t m_size;
+		uint32_t m_scale;                   // Maps a code to a lattice position in 1/256 steps.
+		std::vector<uint32_t> m_entries;    // Y, U and V in 10 bits each (2 fractional bits).
+	};
+
+	// ColorCube class:
+	// An RGB-to-RGB table as authored, and the YUV tables derived from it.
+
+	class ColorCube
+	{
+	public:
+		// Creates a cube from size^3 RGB triplets in the 0-1 range, red
+		// changing fastest (the .cube file order). Returns null if the size is
+		// not 17, 33 or 65 or there is not enough data.
+		static std::shared_ptr<ColorCube> Create(uint32_t size, const float *pRgb, size_t cValues);
+
+		// Parses the text of a .cube file (LUT_3D_SIZE, optional DOMAIN_MIN
+		// and DOMAIN_MAX, then the RGB triplets). Returns null if the text is
+		// not a 3D cube of a supported size.
+		static std::shared_ptr<ColorCube> Parse(const std::string &text);
+
+		uint32_t GetSize() const { return m_size; }
+
+		// The size^3 RGB triplets, as Create takes them (a parsed cube's
+		// values are mapped from its domain to 0-1).
+		const std::vector<float>& GetRgb() const { return m_rgb; }
+
+		// Returns the YUV table for a stream format, building it on first use.
+		// Safe to call from several threads.
+		std::shared_ptr<const YuvCube> GetYuvCube(YuvMatrix matrix, YuvRange range) const;
+
+	private:
+		ColorCube(uint32_t size, std::vector<float> &rgb);
+
+		void LookupRgb(const float *pRgbIn, float *pRgbOut) const;
+		std::shared_ptr<const YuvCube> BuildYuvCube(YuvMatrix matrix, YuvRange range) const;
+
+		uint32_t m_size;
+		std::vector<float> m_rgb;
+
+		mutable std::mutex m_cacheLock;
+		mutable std::shared_ptr<const YuvCube> m_cache[2][2];     // [matrix][range]
+	};
+}
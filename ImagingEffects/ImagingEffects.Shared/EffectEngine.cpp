@@ -0,0 +1,161 @@
+// Native effects of one stream, without Media Foundation.
+//
+// This file does not use the precompiled header so that it can be built
+// without Windows headers.
+
+#include "EffectEngine.h"
+#include "TraceRecorder.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace ImagingEffects
+{
+	namespace
+	{
+		// Bands per processor. More bands than cores lets a busy thread be helped.
+		const size_t BANDS_PER_PROCESSOR = 2;
+
+		// Frames per window of the latency statistics.
+		const uint64_t LATENCY_WINDOW_FRAMES = 1000;
+
+		bool MatchesFormat(const VideoFrame &frame, const StreamFormat &format)
+		{
+			return frame.format == format.pixelFormat && frame.width == format.width && frame.height == format.height;
+		}
+	}
+
+	EffectEngine::EffectEngine(const ParallelFor &parallelFor, size_t cBands)
+		: m_parallelFor(parallelFor)
+		, m_cBands(cBands > 0 ? cBands : (std::max)(1u, std::thread::hardware_concurrency()) * BANDS_PER_PROCESSOR)
+		, m_fHaveFormat(false)
+		, m_latency(LATENCY_WINDOW_FRAMES)
+	{
+	}
+
+	void EffectEngine::SetFilters(const std::vector<NativeFilter> &filters, const std::vector<NativeFilter> &fallbackFilters)
+	{
+		std::lock_guard<std::mutex> lock(m_configLock);
+		m_filters = filters;
+		m_fallbackFilters = fallbackFilters;
+		Rebuild();
+	}
+
+	bool EffectEngine::SetFormat(const StreamFormat &format)
+	{
+		// The filters work on NV12 and YUY2.
+		if (format.width == 0 || format.height == 0 || format.pixelFormat == PixelFormat_I420)
+		{
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(m_configLock);
+		m_format = format;
+		m_fHaveFormat = true;
+		Rebuild();
+		return true;
+	}
+
+	void EffectEngine::SetSchedulerPolicy(const SchedulerPolicy &policy)
+	{
+		std::lock_guard<std::mutex> lock(m_schedulerLock);
+		m_scheduler.SetPolicy(policy);
+	}
+
+	// Builds the renderer for the current configuration and makes it the one
+	// new frames use. Called with m_configLock held.
+	void EffectEngine::Rebuild()
+	{
+		if (!m_fHaveFormat)
+		{
+			return;
+		}
+
+		m_renderer.Publish(BuildRenderer(m_format, m_filters, m_fallbackFilters));
+
+		// Costs measured with the previous renderer do not apply.
+		ResetCosts();
+	}
+
+	std::shared_ptr<const FrameRenderer> EffectEngine::BuildRenderer(const StreamFormat &format, const std::vector<NativeFilter> &filters, const std::vector<NativeFilter> &fallbackFilters) const
+	{
+		return std::make_shared<const FrameRenderer>(format, filters, fallbackFilters, m_cBands);
+	}
+
+	bool EffectEngine::ProcessFrame(const FrameTiming &timing, const VideoFrame &dest, const VideoFrame &src, FrameAction *pAction)
+	{
+		TraceScope scope("ProcessFrame");
+		const uint64_t tStart = TraceRecorder::Now();
+
+		std::shared_ptr<const FrameRenderer> spRenderer = m_renderer.Acquire();
+		if (!spRenderer || !MatchesFormat(dest, spRenderer->GetFormat()) || !MatchesFormat(src, spRenderer->GetFormat()))
+		{
+			return false;
+		}
+
+		uint64_t stageNs[FrameStage_Count] = {};
+
+		const FrameAction action = ScheduleFrame(timing, spRenderer->HasFallback());
+		const uint64_t tRender = TraceRecorder::Now();
+		stageNs[FrameStage_LockWait] = tRender - tStart;
+
+		if (action != FrameAction_Drop)
+		{
+			RenderFrame(*spRenderer, action, dest, src);
+			const uint64_t tRendered = TraceRecorder::Now();
+			stageNs[FrameStage_Render] = tRendered - tRender;
+			stageNs[FrameStage_Total] = tRendered - tStart;
+			CompleteFrame(action, stageNs[FrameStage_Render], stageNs);
+		}
+
+		*pAction = action;
+		return true;
+	}
+
+	FrameAction EffectEngine::ScheduleFrame(const FrameTiming &timing, bool fCanDegrade)
+	{
+		std::lock_guard<std::mutex> lock(m_schedulerLock);
+
+		const FrameAction action = m_scheduler.Decide((int64_t)(TraceRecorder::Now() / 100), timing.fHasTime, timing.hnsTime, timing.hnsDuration, fCanDegrade);
+		if (action != FrameAction_Process)
+		{
+			// Late frames show in the trace, with how many there have been.
+			static const char *const s_actionNames[] = { "Process", "Degrade", "PassThrough", "Drop" };
+			TraceRecorder::Get().Instant(s_actionNames[action], (int64_t)m_scheduler.GetStats().cFrames[action]);
+		}
+		return action;
+	}
+
+	void EffectEngine::RenderFrame(const FrameRenderer &renderer, FrameAction action, const VideoFrame &dest, const VideoFrame &src) const
+	{
+		TraceScope scope("Render");
+		renderer.Render(action, dest, src, m_parallelFor);
+	}
+
+	void EffectEngine::CompleteFrame(FrameAction action, uint64_t nsCost, const uint64_t *pStageNs)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_schedulerLock);
+			m_scheduler.RecordCost(action, (int64_t)(nsCost / 100));
+		}
+		m_latency.RecordFrame(pStageNs);
+	}
+
+	void EffectEngine::ResetCosts()
+	{
+		std::lock_guard<std::mutex> lock(m_schedulerLock);
+		m_scheduler.ResetCosts();
+	}
+
+	void EffectEngine::ResetClock()
+	{
+		std::lock_guard<std::mutex> lock(m_schedulerLock);
+		m_scheduler.ResetClock();
+	}
+
+	SchedulerStats EffectEngine::GetSchedulerStats() const
+	{
+		std::lock_guard<std::mutex> lock(m_schedulerLock);
+		return m_scheduler.GetStats();
+	}
+}
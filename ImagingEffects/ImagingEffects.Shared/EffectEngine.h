@@ -0,0 +1,140 @@
+#pragma once
+
+// Renders the frames of one stream with the native effects, without Media
+// Foundation.
+//
+// The engine is what the media foundation transform does with a frame once
+// its buffers are locked, for hosts that have the frames in memory already:
+// tools, benchmarks and servers. It owns the effect configuration, the
+// renderer built from it for the stream's format, the late-frame scheduler
+// and the latency statistics:
+//
+//     EffectEngine engine(pool.GetParallelFor());
+//     engine.SetFilters(filters, fallbackFilters);
+//     engine.SetFormat(MakeStreamFormat(PixelFormat_NV12, 1920, 1080));
+//     ...
+//     FrameAction action;
+//     engine.ProcessFrame(timing, dest, src, &action);
+//
+// Frames may be processed on several threads at once. Configuration may
+// change meanwhile: frames being rendered finish with the renderer they
+// started with (see RcuPtr.h), and later frames use the new one.
+//
+// The transform renders through an engine too, one step at a time: it must
+// know what will be done with a frame before it locks the buffers (a frame
+// rendered in place needs no output sample), and it keeps a renderer of its
+// own next to the SDK effects of each chain. The SDK effects and everything
+// tied to samples, buffers and media types stay in the transform.
+//
+// This file does not depend on Windows headers.
+
+#include "FrameLatency.h"
+#include "FrameRenderer.h"
+#include "FrameScheduler.h"
+#include "RcuPtr.h"
+
+#include <mutex>
+
+namespace ImagingEffects
+{
+	// Time stamp and duration of a frame, in 100-nanosecond units.
+	struct FrameTiming
+	{
+		bool fHasTime;              // False if the frame has no time stamp.
+		int64_t hnsTime;
+		int64_t hnsDuration;        // 0 if unknown.
+	};
+
+	// EffectEngine class:
+	// The native effects of one stream.
+
+	class EffectEngine
+	{
+	public:
+		// Bands are rendered through parallelFor. cBands is the number of
+		// bands a frame is split into; 0 uses twice the number of processors.
+		explicit EffectEngine(const ParallelFor &parallelFor, size_t cBands = 0);
+
+		// Sets the effects. Either list may be empty; with neither, frames
+		// are copied.
+		void SetFilters(const std::vector<NativeFilter> &filters, const std::vector<NativeFilter> &fallbackFilters);
+
+		// Sets the frame format. Returns false, and keeps the previous
+		// format, if the effects cannot handle it.
+		bool SetFormat(const StreamFormat &format);
+
+		void SetSchedulerPolicy(const SchedulerPolicy &policy);
+
+		// Renders src into dest. Both must have the engine's format; dest may
+		// be src if GetRenderer()->CanProcessInPlace is true for every action.
+		// *pAction tells what was done; a dropped frame leaves dest as it was.
+		// Returns false if no format is set or the frames do not match it.
+		bool ProcessFrame(const FrameTiming &timing, const VideoFrame &dest, const VideoFrame &src, FrameAction *pAction);
+
+		// The steps of ProcessFrame, for hosts that keep their renderers
+		// themselves or need the action before they have the frames:
+		//
+		//     FrameAction action = engine.ScheduleFrame(timing, spRenderer->HasFallback());
+		//     if (action != FrameAction_Drop)
+		//     {
+		//         engine.RenderFrame(*spRenderer, action, dest, src);
+		//         engine.CompleteFrame(action, nsCost, stageNs);
+		//     }
+
+		// Decides what to do with a frame. fCanDegrade tells whether the
+		// renderer the frame will be rendered with has a fallback chain.
+		FrameAction ScheduleFrame(const FrameTiming &timing, bool fCanDegrade);
+
+		// Renders src into dest with the renderer, through the engine's
+		// ParallelFor. See FrameRenderer::Render.
+		void RenderFrame(const FrameRenderer &renderer, FrameAction action, const VideoFrame &dest, const VideoFrame &src) const;
+
+		// Records a frame that was not dropped: nsCost, the time its action
+		// took, for the scheduler, and the FrameStage_Count stage times in
+		// pStageNs for the latency statistics.
+		void CompleteFrame(FrameAction action, uint64_t nsCost, const uint64_t *pStageNs);
+
+		// Builds a renderer with the engine's bands, for a host that keeps
+		// its renderers itself.
+		std::shared_ptr<const FrameRenderer> BuildRenderer(const StreamFormat &format, const std::vector<NativeFilter> &filters, const std::vector<NativeFilter> &fallbackFilters) const;
+
+		// Forgets the measured costs; for a host that switches to a renderer
+		// of its own. SetFilters and SetFormat do it themselves.
+		void ResetCosts();
+
+		// Forgets how time stamps map to the clock, after a seek or a gap.
+		void ResetClock();
+
+		// The renderer new frames use; nullptr before a format is set.
+		std::shared_ptr<const FrameRenderer> GetRenderer() const { return m_renderer.Acquire(); }
+
+		SchedulerStats GetSchedulerStats() const;
+
+		// Fills FrameStage_Count summaries of the latency of recent frames.
+		// ProcessFrame leaves the buffer stages 0, since it is given frames,
+		// not buffers, and counts the time spent scheduling as lock wait.
+		void GetLatency(LatencySummary *pSummaries) { m_latency.GetSummaries(pSummaries); }
+
+	private:
+		EffectEngine(const EffectEngine&);
+		EffectEngine& operator=(const EffectEngine&);
+
+		void Rebuild();
+
+		const ParallelFor m_parallelFor;
+		const size_t m_cBands;
+
+		std::mutex m_configLock;                // Guards the configuration; held while a renderer is built.
+		bool m_fHaveFormat;
+		StreamFormat m_format;
+		std::vector<NativeFilter> m_filters;
+		std::vector<NativeFilter> m_fallbackFilters;
+
+		RcuPtr<const FrameRenderer> m_renderer;
+
+		mutable std::mutex m_schedulerLock;     // FrameScheduler is not thread-safe.
+		FrameScheduler m_scheduler;
+
+		FrameLatencyStats m_latency;
+	};
+}
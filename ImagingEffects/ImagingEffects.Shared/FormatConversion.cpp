@@ -0,0 +1,830 @@
+// YUY2 / NV12 / I420 conversion kernels.
+//
+// Each instruction set implements the same six row kernels. The frame-level
+// functions at the bottom of the file walk the rows and call the kernels of
+// the selected instruction set. Every SIMD kernel hands the pixels left over
+// at the end of a row to the scalar kernel, which is also the reference
+// implementation.
+//
+// This file does not use the precompiled header so that it can be built
+// without Windows headers.
+
+#include "FormatConversion.h"
+
+#include <string.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define CONVERSION_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(_M_ARM) || defined(_M_ARM64) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CONVERSION_NEON 1
+#include <arm_neon.h>
+#endif
+
+// GCC and Clang only emit AVX2 instructions in functions marked for it.
+#if defined(__GNUC__)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+namespace ImagingEffects
+{
+	namespace
+	{
+		// Row kernels. Widths are in pixels; cChroma is the number of chroma
+		// samples per plane row, i.e. (width + 1) / 2.
+		struct RowKernels
+		{
+			// Two YUY2 rows to two Y rows and one averaged UV row.
+			void(*yuy2ToNv12)(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1, uint8_t *uv, uint32_t width);
+
+			// Two YUY2 rows to two Y rows and one averaged U and V row.
+			void(*yuy2ToI420)(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uint32_t width);
+
+			// One Y row and its UV row to one YUY2 row.
+			void(*nv12ToYuy2)(const uint8_t *y, const uint8_t *uv, uint8_t *d, uint32_t width);
+
+			// One Y row and its U and V rows to one YUY2 row.
+			void(*i420ToYuy2)(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *d, uint32_t width);
+
+			void(*splitUV)(const uint8_t *uv, uint8_t *u, uint8_t *v, uint32_t cChroma);
+			void(*mergeUV)(const uint8_t *u, const uint8_t *v, uint8_t *uv, uint32_t cChroma);
+		};
+
+		inline uint8_t Average(uint8_t a, uint8_t b)
+		{
+			return (uint8_t)((a + b + 1) >> 1);
+		}
+
+		//-------------------------------------------------------------------
+		// Scalar reference kernels
+		//-------------------------------------------------------------------
+
+		void Yuy2ToNv12Rows_Scalar(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1, uint8_t *uv, uint32_t width)
+		{
+			uint32_t cPairs = width / 2;
+
+			for (uint32_t i = 0; i < cPairs; i++)
+			{
+				y0[2 * i] = s0[4 * i];
+				y0[2 * i + 1] = s0[4 * i + 2];
+				y1[2 * i] = s1[4 * i];
+				y1[2 * i + 1] = s1[4 * i + 2];
+				uv[2 * i] = Average(s0[4 * i + 1], s1[4 * i + 1]);
+				uv[2 * i + 1] = Average(s0[4 * i + 3], s1[4 * i + 3]);
+			}
+
+			// An odd width ends in half a macropixel.
+			if (width & 1)
+			{
+				uint32_t i = cPairs;
+				y0[2 * i] = s0[4 * i];
+				y1[2 * i] = s1[4 * i];
+				uv[2 * i] = Average(s0[4 * i + 1], s1[4 * i + 1]);
+				uv[2 * i + 1] = Average(s0[4 * i + 3], s1[4 * i + 3]);
+			}
+		}
+
+		void Yuy2ToI420Rows_Scalar(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uint32_t width)
+		{
+			uint32_t cChroma = (width + 1) / 2;
+
+			for (uint32_t i = 0; i < cChroma; i++)
+			{
+				y0[2 * i] = s0[4 * i];
+				y1[2 * i] = s1[4 * i];
+				if (2 * i + 1 < width)
+				{
+					y0[2 * i + 1] = s0[4 * i + 2];
+					y1[2 * i + 1] = s1[4 * i + 2];
+				}
+				u[i] = Average(s0[4 * i + 1], s1[4 * i + 1]);
+				v[i] = Average(s0[4 * i + 3], s1[4 * i + 3]);
+			}
+		}
+
+		void Nv12ToYuy2Row_Scalar(const uint8_t *y, const uint8_t *uv, uint8_t *d, uint32_t width)
+		{
+			uint32_t cChroma = (width + 1) / 2;
+
+			for (uint32_t i = 0; i < cChroma; i++)
+			{
+				uint8_t y1 = (2 * i + 1 < width) ? y[2 * i + 1] : y[2 * i];
+
+				d[4 * i] = y[2 * i];
+				d[4 * i + 1] = uv[2 * i];
+				d[4 * i + 2] = y1;
+				d[4 * i + 3] = uv[2 * i + 1];
+			}
+		}
+
+		void I420ToYuy2Row_Scalar(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *d, uint32_t width)
+		{
+			uint32_t cChroma = (width + 1) / 2;
+
+			for (uint32_t i = 0; i < cChroma; i++)
+			{
+				uint8_t y1 = (2 * i + 1 < width) ? y[2 * i + 1] : y[2 * i];
+
+				d[4 * i] = y[2 * i];
+				d[4 * i + 1] = u[i];
+				d[4 * i + 2] = y1;
+				d[4 * i + 3] = v[i];
+			}
+		}
+
+		void SplitUVRow_Scalar(const uint8_t *uv, uint8_t *u, uint8_t *v, uint32_t cChroma)
+		{
+			for (uint32_t i = 0; i < cChroma; i++)
+			{
+				u[i] = uv[2 * i];
+				v[i] = uv[2 * i + 1];
+			}
+		}
+
+		void MergeUVRow_Scalar(const uint8_t *u, const uint8_t *v, uint8_t *uv, uint32_t cChroma)
+		{
+			for (uint32_t i = 0; i < cChroma; i++)
+			{
+				uv[2 * i] = u[i];
+				uv[2 * i + 1] = v[i];
+			}
+		}
+
+		const RowKernels g_ScalarKernels =
+		{
+			Yuy2ToNv12Rows_Scalar,
+			Yuy2ToI420Rows_Scalar,
+			Nv12ToYuy2Row_Scalar,
+			I420ToYuy2Row_Scalar,
+			SplitUVRow_Scalar,
+			MergeUVRow_Scalar
+		};
+
+#if defined(CONVERSION_X86)
+
+		//-------------------------------------------------------------------
+		// SSE2 kernels: 16 pixels per iteration.
+		//-------------------------------------------------------------------
+
+		TARGET_SSE2 void Yuy2ToNv12Rows_SSE2(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1, uint8_t *uv, uint32_t width)
+		{
+			const __m128i mask = _mm_set1_epi16(0x00FF);
+			uint32_t x = 0;
+
+			for (; x + 16 <= width; x += 16)
+			{
+				__m128i a0 = _mm_loadu_si128((const __m128i *)(s0 + 2 * x));
+				__m128i b0 = _mm_loadu_si128((const __m128i *)(s0 + 2 * x + 16));
+				__m128i a1 = _mm_loadu_si128((const __m128i *)(s1 + 2 * x));
+				__m128i b1 = _mm_loadu_si128((const __m128i *)(s1 + 2 * x + 16));
+
+				// Luma is in the even bytes, chroma in the odd bytes.
+				_mm_storeu_si128((__m128i *)(y0 + x), _mm_packus_epi16(_mm_and_si128(a0, mask), _mm_and_si128(b0, mask)));
+				_mm_storeu_si128((__m128i *)(y1 + x), _mm_packus_epi16(_mm_and_si128(a1, mask), _mm_and_si128(b1, mask)));
+
+				__m128i c0 = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(b0, 8));
+				__m128i c1 = _mm_packus_epi16(_mm_srli_epi16(a1, 8), _mm_srli_epi16(b1, 8));
+				_mm_storeu_si128((__m128i *)(uv + x), _mm_avg_epu8(c0, c1));
+			}
+
+			if (x < width)
+			{
+				Yuy2ToNv12Rows_Scalar(s0 + 2 * x, s1 + 2 * x, y0 + x, y1 + x, uv + x, width - x);
+			}
+		}
+
+		TARGET_SSE2 void Yuy2ToI420Rows_SSE2(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uint32_t width)
+		{
+			const __m128i mask = _mm_set1_epi16(0x00FF);
+			const __m128i zero = _mm_setzero_si128();
+			uint32_t x = 0;
+
+			for (; x + 16 <= width; x += 16)
+			{
+				__m128i a0 = _mm_loadu_si128((const __m128i *)(s0 + 2 * x));
+				__m128i b0 = _mm_loadu_si128((const __m128i *)(s0 + 2 * x + 16));
+				__m128i a1 = _mm_loadu_si128((const __m128i *)(s1 + 2 * x));
+				__m128i b1 = _mm_loadu_si128((const __m128i *)(s1 + 2 * x + 16));
+
+				_mm_storeu_si128((__m128i *)(y0 + x), _mm_packus_epi16(_mm_and_si128(a0, mask), _mm_and_si128(b0, mask)));
+				_mm_storeu_si128((__m128i *)(y1 + x), _mm_packus_epi16(_mm_and_si128(a1, mask), _mm_and_si128(b1, mask)));
+
+				__m128i c0 = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(b0, 8));
+				__m128i c1 = _mm_packus_epi16(_mm_srli_epi16(a1, 8), _mm_srli_epi16(b1, 8));
+				__m128i c = _mm_avg_epu8(c0, c1);
+
+				_mm_storel_epi64((__m128i *)(u + x / 2), _mm_packus_epi16(_mm_and_si128(c, mask), zero));
+				_mm_storel_epi64((__m128i *)(v + x / 2), _mm_packus_epi16(_mm_srli_epi16(c, 8), zero));
+			}
+
+			if (x < width)
+			{
+				Yuy2ToI420Rows_Scalar(s0 + 2 * x, s1 + 2 * x, y0 + x, y1 + x, u + x / 2, v + x / 2, width - x);
+			}
+		}
+
+		TARGET_SSE2 void Nv12ToYuy2Row_SSE2(const uint8_t *y, const uint8_t *uv, uint8_t *d, uint32_t width)
+		{
+			uint32_t x = 0;
+
+			for (; x + 16 <= width; x += 16)
+			{
+				__m128i luma = _mm_loadu_si128((const __m128i *)(y + x));
+				__m128i chroma = _mm_loadu_si128((const __m128i *)(uv + x));
+
+				_mm_storeu_si128((__m128i *)(d + 2 * x), _mm_unpacklo_epi8(luma, chroma));
+				_mm_storeu_si128((__m128i *)(d + 2 * x + 16), _mm_unpackhi_epi8(luma, chroma));
+			}
+
+			if (x < width)
+			{
+				Nv12ToYuy2Row_Scalar(y + x, uv + x, d + 2 * x, width - x);
+			}
+		}
+
+		TARGET_SSE2 void I420ToYuy2Row_SSE2(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *d, uint32_t width)
+		{
+			uint32_t x = 0;
+
+			for (; x + 16 <= width; x += 16)
+			{
+				__m128i luma = _mm_loadu_si128((const __m128i *)(y + x));
+				__m128i chroma = _mm_unpacklo_epi8(
+					_mm_loadl_epi64((const __m128i *)(u + x / 2)),
+					_mm_loadl_epi64((const __m128i *)(v + x / 2)));
+
+				_mm_storeu_si128((__m128i *)(d + 2 * x), _mm_unpacklo_epi8(luma, chroma));
+				_mm_storeu_si128((__m128i *)(d + 2 * x + 16), _mm_unpackhi_epi8(luma, chroma));
+			}
+
+			if (x < width)
+			{
+				I420ToYuy2Row_Scalar(y + x, u + x / 2, v + x / 2, d + 2 * x, width - x);
+			}
+		}
+
+		TARGET_SSE2 void SplitUVRow_SSE2(const uint8_t *uv, uint8_t *u, uint8_t *v, uint32_t cChroma)
+		{
+			const __m128i mask = _mm_set1_epi16(0x00FF);
+			uint32_t i = 0;
+
+			for (; i + 16 <= cChroma; i += 16)
+			{
+				__m128i a = _mm_loadu_si128((const __m128i *)(uv + 2 * i));
+				__m128i b = _mm_loadu_si128((const __m128i *)(uv + 2 * i + 16));
+
+				_mm_storeu_si128((__m128i *)(u + i), _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+				_mm_storeu_si128((__m128i *)(v + i), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+			}
+
+			if (i < cChroma)
+			{
+				SplitUVRow_Scalar(uv + 2 * i, u + i, v + i, cChroma - i);
+			}
+		}
+
+		TARGET_SSE2 void MergeUVRow_SSE2(const uint8_t *u, const uint8_t *v, uint8_t *uv, uint32_t cChroma)
+		{
+			uint32_t i = 0;
+
+			for (; i + 16 <= cChroma; i += 16)
+			{
+				__m128i a = _mm_loadu_si128((const __m128i *)(u + i));
+				__m128i b = _mm_loadu_si128((const __m128i *)(v + i));
+
+				_mm_storeu_si128((__m128i *)(uv + 2 * i), _mm_unpacklo_epi8(a, b));
+				_mm_storeu_si128((__m128i *)(uv + 2 * i + 16), _mm_unpackhi_epi8(a, b));
+			}
+
+			if (i < cChroma)
+			{
+				MergeUVRow_Scalar(u + i, v + i, uv + 2 * i, cChroma - i);
+			}
+		}
+
+		const RowKernels g_Sse2Kernels =
+		{
+			Yuy2ToNv12Rows_SSE2,
+			Yuy2ToI420Rows_SSE2,
+			Nv12ToYuy2Row_SSE2,
+			I420ToYuy2Row_SSE2,
+			SplitUVRow_SSE2,
+			MergeUVRow_SSE2
+		};
+
+		//-------------------------------------------------------------------
+		// AVX2 kernels: 32 pixels per iteration.
+		//
+		// The 256-bit pack and unpack instructions work within 128-bit lanes,
+		// so their results are put back in order with a permute.
+		//-------------------------------------------------------------------
+
+		// Pack the low bytes of the 16-bit elements of a and b, in order.
+		TARGET_AVX2 inline __m256i PackLow_AVX2(__m256i a, __m256i b, __m256i mask)
+		{
+			return _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask)), 0xD8);
+		}
+
+		// Pack the high bytes of the 16-bit elements of a and b, in order.
+		TARGET_AVX2 inline __m256i PackHigh_AVX2(__m256i a, __m256i b)
+		{
+			return _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8)), 0xD8);
+		}
+
+		// Interleave the bytes of a and b and store the 64 bytes at d.
+		TARGET_AVX2 inline void StoreInterleaved_AVX2(uint8_t *d, __m256i a, __m256i b)
+		{
+			__m256i lo = _mm256_unpacklo_epi8(a, b);
+			__m256i hi = _mm256_unpackhi_epi8(a, b);
+
+			_mm256_storeu_si256((__m256i *)d, _mm256_permute2x128_si256(lo, hi, 0x20));
+			_mm256_storeu_si256((__m256i *)(d + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+		}
+
+		TARGET_AVX2 void Yuy2ToNv12Rows_AVX2(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1, uint8_t *uv, uint32_t width)
+		{
+			const __m256i mask = _mm256_set1_epi16(0x00FF);
+			uint32_t x = 0;
+
+			for (; x + 32 <= width; x += 32)
+			{
+				__m256i a0 = _mm256_loadu_si256((const __m256i *)(s0 + 2 * x));
+				__m256i b0 = _mm256_loadu_si256((const __m256i *)(s0 + 2 * x + 32));
+				__m256i a1 = _mm256_loadu_si256((const __m256i *)(s1 + 2 * x));
+				__m256i b1 = _mm256_loadu_si256((const __m256i *)(s1 + 2 * x + 32));
+
+				_mm256_storeu_si256((__m256i *)(y0 + x), PackLow_AVX2(a0, b0, mask));
+				_mm256_storeu_si256((__m256i *)(y1 + x), PackLow_AVX2(a1, b1, mask));
+				_mm256_storeu_si256((__m256i *)(uv + x), _mm256_avg_epu8(PackHigh_AVX2(a0, b0), PackHigh_AVX2(a1, b1)));
+			}
+
+			if (x < width)
+			{
+				Yuy2ToNv12Rows_SSE2(s0 + 2 * x, s1 + 2 * x, y0 + x, y1 + x, uv + x, width - x);
+			}
+		}
+
+		TARGET_AVX2 void Yuy2ToI420Rows_AVX2(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uint32_t width)
+		{
+			const __m256i mask = _mm256_set1_epi16(0x00FF);
+			const __m256i zero = _mm256_setzero_si256();
+			uint32_t x = 0;
+
+			for (; x + 32 <= width; x += 32)
+			{
+				__m256i a0 = _mm256_loadu_si256((const __m256i *)(s0 + 2 * x));
+				__m256i b0 = _mm256_loadu_si256((const __m256i *)(s0 + 2 * x + 32));
+				__m256i a1 = _mm256_loadu_si256((const __m256i *)(s1 + 2 * x));
+				__m256i b1 = _mm256_loadu_si256((const __m256i *)(s1 + 2 * x + 32));
+
+				_mm256_storeu_si256((__m256i *)(y0 + x), PackLow_AVX2(a0, b0, mask));
+				_mm256_storeu_si256((__m256i *)(y1 + x), PackLow_AVX2(a1, b1, mask));
+
+				__m256i c = _mm256_avg_epu8(PackHigh_AVX2(a0, b0), PackHigh_AVX2(a1, b1));
+
+				_mm_storeu_si128((__m128i *)(u + x / 2), _mm256_castsi256_si128(PackLow_AVX2(c, zero, mask)));
+				_mm_storeu_si128((__m128i *)(v + x / 2), _mm256_castsi256_si128(PackHigh_AVX2(c, zero)));
+			}
+
+			if (x < width)
+			{
+				Yuy2ToI420Rows_SSE2(s0 + 2 * x, s1 + 2 * x, y0 + x, y1 + x, u + x / 2, v + x / 2, width - x);
+			}
+		}
+
+		TARGET_AVX2 void Nv12ToYuy2Row_AVX2(const uint8_t *y, const uint8_t *uv, uint8_t *d, uint32_t width)
+		{
+			uint32_t x = 0;
+
+			for (; x + 32 <= width; x += 32)
+			{
+				StoreInterleaved_AVX2(d + 2 * x,
+					_mm256_loadu_si256((const __m256i *)(y + x)),
+					_mm256_loadu_si256((const __m256i *)(uv + x)));
+			}
+
+			if (x < width)
+			{
+				Nv12ToYuy2Row_SSE2(y + x, uv + x, d + 2 * x, width - x);
+			}
+		}
+
+		TARGET_AVX2 void I420ToYuy2Row_AVX2(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *d, uint32_t width)
+		{
+			uint32_t x = 0;
+
+			for (; x + 32 <= width; x += 32)
+			{
+				__m128i cu = _mm_loadu_si128((const __m128i *)(u + x / 2));
+				__m128i cv = _mm_loadu_si128((const __m128i *)(v + x / 2));
+				__m256i chroma = _mm256_inserti128_si256(
+					_mm256_castsi128_si256(_mm_unpacklo_epi8(cu, cv)),
+					_mm_unpackhi_epi8(cu, cv), 1);
+
+				StoreInterleaved_AVX2(d + 2 * x, _mm256_loadu_si256((const __m256i *)(y + x)), chroma);
+			}
+
+			if (x < width)
+			{
+				I420ToYuy2Row_SSE2(y + x, u + x / 2, v + x / 2, d + 2 * x, width - x);
+			}
+		}
+
+		TARGET_AVX2 void SplitUVRow_AVX2(const uint8_t *uv, uint8_t *u, uint8_t *v, uint32_t cChroma)
+		{
+			const __m256i mask = _mm256_set1_epi16(0x00FF);
+			uint32_t i = 0;
+
+			for (; i + 32 <= cChroma; i += 32)
+			{
+				__m256i a = _mm256_loadu_si256((const __m256i *)(uv + 2 * i));
+				__m256i b = _mm256_loadu_si256((const __m256i *)(uv + 2 * i + 32));
+
+				_mm256_storeu_si256((__m256i *)(u + i), PackLow_AVX2(a, b, mask));
+				_mm256_storeu_si256((__m256i *)(v + i), PackHigh_AVX2(a, b));
+			}
+
+			if (i < cChroma)
+			{
+				SplitUVRow_SSE2(uv + 2 * i, u + i, v + i, cChroma - i);
+			}
+		}
+
+		TARGET_AVX2 void MergeUVRow_AVX2(const uint8_t *u, const uint8_t *v, uint8_t *uv, uint32_t cChroma)
+		{
+			uint32_t i = 0;
+
+			for (; i + 32 <= cChroma; i += 32)
+			{
+				StoreInterleaved_AVX2(uv + 2 * i,
+					_mm256_loadu_si256((const __m256i *)(u + i)),
+					_mm256_loadu_si256((const __m256i *)(v + i)));
+			}
+
+			if (i < cChroma)
+			{
+				MergeUVRow_SSE2(u + i, v + i, uv + 2 * i, cChroma - i);
+			}
+		}
+
+		const RowKernels g_Avx2Kernels =
+		{
+			Yuy2ToNv12Rows_AVX2,
+			Yuy2ToI420Rows_AVX2,
+			Nv12ToYuy2Row_AVX2,
+			I420ToYuy2Row_AVX2,
+			SplitUVRow_AVX2,
+			MergeUVRow_AVX2
+		};
+
+		bool IsAvx2Supported()
+		{
+#if defined(_MSC_VER)
+			int info[4];
+
+			__cpuid(info, 0);
+			if (info[0] < 7)
+			{
+				return false;
+			}
+
+			// The processor must support AVX and the OS must save the YMM registers.
+			__cpuid(info, 1);
+			const int OSXSAVE = 1 << 27;
+			const int AVX = 1 << 28;
+			if ((info[2] & (OSXSAVE | AVX)) != (OSXSAVE | AVX) || (_xgetbv(0) & 6) != 6)
+			{
+				return false;
+			}
+
+			__cpuidex(info, 7, 0);
+			return (info[1] & (1 << 5)) != 0;
+#else
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2") != 0;
+#endif
+		}
+
+#endif // CONVERSION_X86
+
+#if defined(CONVERSION_NEON)
+
+		//-------------------------------------------------------------------
+		// NEON kernels: 16 pixels per iteration. The structured loads and
+		// stores (vld2/vst2) do the interleaving.
+		//-------------------------------------------------------------------
+
+		void Yuy2ToNv12Rows_NEON(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1, uint8_t *uv, uint32_t width)
+		{
+			uint32_t x = 0;
+
+			for (; x + 16 <= width; x += 16)
+			{
+				uint8x16x2_t a = vld2q_u8(s0 + 2 * x);
+				uint8x16x2_t b = vld2q_u8(s1 + 2 * x);
+
+				vst1q_u8(y0 + x, a.val[0]);
+				vst1q_u8(y1 + x, b.val[0]);
+				vst1q_u8(uv + x, vrhaddq_u8(a.val[1], b.val[1]));
+			}
+
+			if (x < width)
+			{
+				Yuy2ToNv12Rows_Scalar(s0 + 2 * x, s1 + 2 * x, y0 + x, y1 + x, uv + x, width - x);
+			}
+		}
+
+		void Yuy2ToI420Rows_NEON(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uint32_t width)
+		{
+			uint32_t x = 0;
+
+			for (; x + 16 <= width; x += 16)
+			{
+				uint8x16x2_t a = vld2q_u8(s0 + 2 * x);
+				uint8x16x2_t b = vld2q_u8(s1 + 2 * x);
+
+				vst1q_u8(y0 + x, a.val[0]);
+				vst1q_u8(y1 + x, b.val[0]);
+
+				uint8x16_t c = vrhaddq_u8(a.val[1], b.val[1]);
+				uint8x8x2_t split = vuzp_u8(vget_low_u8(c), vget_high_u8(c));
+
+				vst1_u8(u + x / 2, split.val[0]);
+				vst1_u8(v + x / 2, split.val[1]);
+			}
+
+			if (x < width)
+			{
+				Yuy2ToI420Rows_Scalar(s0 + 2 * x, s1 + 2 * x, y0 + x, y1 + x, u + x / 2, v + x / 2, width - x);
+			}
+		}
+
+		void Nv12ToYuy2Row_NEON(const uint8_t *y, const uint8_t *uv, uint8_t *d, uint32_t width)
+		{
+			uint32_t x = 0;
+
+			for (; x + 16 <= width; x += 16)
+			{
+				uint8x16x2_t out;
+				out.val[0] = vld1q_u8(y + x);
+				out.val[1] = vld1q_u8(uv + x);
+				vst2q_u8(d + 2 * x, out);
+			}
+
+			if (x < width)
+			{
+				Nv12ToYuy2Row_Scalar(y + x, uv + x, d + 2 * x, width - x);
+			}
+		}
+
+		void I420ToYuy2Row_NEON(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *d, uint32_t width)
+		{
+			uint32_t x = 0;
+
+			for (; x + 16 <= width; x += 16)
+			{
+				uint8x8x2_t chroma = vzip_u8(vld1_u8(u + x / 2), vld1_u8(v + x / 2));
+
+				uint8x16x2_t out;
+				out.val[0] = vld1q_u8(y + x);
+				out.val[1] = vcombine_u8(chroma.val[0], chroma.val[1]);
+				vst2q_u8(d + 2 * x, out);
+			}
+
+			if (x < width)
+			{
+				I420ToYuy2Row_Scalar(y + x, u + x / 2, v + x / 2, d + 2 * x, width - x);
+			}
+		}
+
+		void SplitUVRow_NEON(const uint8_t *uv, uint8_t *u, uint8_t *v, uint32_t cChroma)
+		{
+			uint32_t i = 0;
+
+			for (; i + 16 <= cChroma; i += 16)
+			{
+				uint8x16x2_t a = vld2q_u8(uv + 2 * i);
+				vst1q_u8(u + i, a.val[0]);
+				vst1q_u8(v + i, a.val[1]);
+			}
+
+			if (i < cChroma)
+			{
+				SplitUVRow_Scalar(uv + 2 * i, u + i, v + i, cChroma - i);
+			}
+		}
+
+		void MergeUVRow_NEON(const uint8_t *u, const uint8_t *v, uint8_t *uv, uint32_t cChroma)
+		{
+			uint32_t i = 0;
+
+			for (; i + 16 <= cChroma; i += 16)
+			{
+				uint8x16x2_t out;
+				out.val[0] = vld1q_u8(u + i);
+				out.val[1] = vld1q_u8(v + i);
+				vst2q_u8(uv + 2 * i, out);
+			}
+
+			if (i < cChroma)
+			{
+				MergeUVRow_Scalar(u + i, v + i, uv + 2 * i, cChroma - i);
+			}
+		}
+
+		const RowKernels g_NeonKernels =
+		{
+			Yuy2ToNv12Rows_NEON,
+			Yuy2ToI420Rows_NEON,
+			Nv12ToYuy2Row_NEON,
+			I420ToYuy2Row_NEON,
+			SplitUVRow_NEON,
+			MergeUVRow_NEON
+		};
+
+#endif // CONVERSION_NEON
+
+		ConversionIsa BestSupportedIsa()
+		{
+#if defined(CONVERSION_X86)
+			return IsAvx2Supported() ? ConversionIsa_AVX2 : ConversionIsa_SSE2;
+#elif defined(CONVERSION_NEON)
+			return ConversionIsa_NEON;
+#else
+			return ConversionIsa_Scalar;
+#endif
+		}
+
+		const RowKernels *KernelsFor(ConversionIsa isa)
+		{
+			switch (isa)
+			{
+			case ConversionIsa_Scalar:
+				return &g_ScalarKernels;
+#if defined(CONVERSION_X86)
+			case ConversionIsa_SSE2:
+				return &g_Sse2Kernels;
+			case ConversionIsa_AVX2:
+				return IsAvx2Supported() ? &g_Avx2Kernels : nullptr;
+#endif
+#if defined(CONVERSION_NEON)
+			case ConversionIsa_NEON:
+				return &g_NeonKernels;
+#endif
+			default:
+				return nullptr;
+			}
+		}
+
+		ConversionIsa g_isa = BestSupportedIsa();
+		const RowKernels *g_pKernels = KernelsFor(g_isa);
+	}
+
+	ConversionIsa GetConversionIsa()
+	{
+		return g_isa;
+	}
+
+	bool SetConversionIsa(ConversionIsa isa)
+	{
+		const RowKernels *pKernels = KernelsFor(isa);
+		if (pKernels == nullptr)
+		{
+			return false;
+		}
+
+		g_isa = isa;
+		g_pKernels = pKernels;
+		return true;
+	}
+
+	//-------------------------------------------------------------------
+	// Frame-level conversions
+	//-------------------------------------------------------------------
+
+	void ConvertYuy2ToNv12(
+		const uint8_t *pSrc, ptrdiff_t srcStride,
+		uint8_t *pDstY, ptrdiff_t dstYStride,
+		uint8_t *pDstUV, ptrdiff_t dstUVStride,
+		uint32_t width, uint32_t height)
+	{
+		const RowKernels *k = g_pKernels;
+
+		for (uint32_t row = 0; row < height; row += 2)
+		{
+			// An odd last row is averaged with itself.
+			bool fPair = (row + 1 < height);
+			const uint8_t *s0 = pSrc + (ptrdiff_t)row * srcStride;
+			uint8_t *y0 = pDstY + (ptrdiff_t)row * dstYStride;
+
+			k->yuy2ToNv12(s0, fPair ? s0 + srcStride : s0, y0, fPair ? y0 + dstYStride : y0,
+				pDstUV + (ptrdiff_t)(row / 2) * dstUVStride, width);
+		}
+	}
+
+	void ConvertNv12ToYuy2(
+		const uint8_t *pSrcY, ptrdiff_t srcYStride,
+		const uint8_t *pSrcUV, ptrdiff_t srcUVStride,
+		uint8_t *pDst, ptrdiff_t dstStride,
+		uint32_t width, uint32_t height)
+	{
+		const RowKernels *k = g_pKernels;
+
+		for (uint32_t row = 0; row < height; row++)
+		{
+			k->nv12ToYuy2(pSrcY + (ptrdiff_t)row * srcYStride, pSrcUV + (ptrdiff_t)(row / 2) * srcUVStride,
+				pDst + (ptrdiff_t)row * dstStride, width);
+		}
+	}
+
+	void ConvertYuy2ToI420(
+		const uint8_t *pSrc, ptrdiff_t srcStride,
+		uint8_t *pDstY, ptrdiff_t dstYStride,
+		uint8_t *pDstU, ptrdiff_t dstUStride,
+		uint8_t *pDstV, ptrdiff_t dstVStride,
+		uint32_t width, uint32_t height)
+	{
+		const RowKernels *k = g_pKernels;
+
+		for (uint32_t row = 0; row < height; row += 2)
+		{
+			bool fPair = (row + 1 < height);
+			const uint8_t *s0 = pSrc + (ptrdiff_t)row * srcStride;
+			uint8_t *y0 = pDstY + (ptrdiff_t)row * dstYStride;
+
+			k->yuy2ToI420(s0, fPair ? s0 + srcStride : s0, y0, fPair ? y0 + dstYStride : y0,
+				pDstU + (ptrdiff_t)(row / 2) * dstUStride, pDstV + (ptrdiff_t)(row / 2) * dstVStride, width);
+		}
+	}
+
+	void ConvertI420ToYuy2(
+		const uint8_t *pSrcY, ptrdiff_t srcYStride,
+		const uint8_t *pSrcU, ptrdiff_t srcUStride,
+		const uint8_t *pSrcV, ptrdiff_t srcVStride,
+		uint8_t *pDst, ptrdiff_t dstStride,
+		uint32_t width, uint32_t height)
+	{
+		const RowKernels *k = g_pKernels;
+
+		for (uint32_t row = 0; row < height; row++)
+		{
+			k->i420ToYuy2(pSrcY + (ptrdiff_t)row * srcYStride,
+				pSrcU + (ptrdiff_t)(row / 2) * srcUStride, pSrcV + (ptrdiff_t)(row / 2) * srcVStride,
+				pDst + (ptrdiff_t)row * dstStride, width);
+		}
+	}
+
+	void ConvertNv12ToI420(
+		const uint8_t *pSrcY, ptrdiff_t srcYStride,
+		const uint8_t *pSrcUV, ptrdiff_t srcUVStride,
+		uint8_t *pDstY, ptrdiff_t dstYStride,
+		uint8_t *pDstU, ptrdiff_t dstUStride,
+		uint8_t *pDstV, ptrdiff_t dstVStride,
+		uint32_t width, uint32_t height)
+	{
+		const RowKernels *k = g_pKernels;
+
+		for (uint32_t row = 0; row < height; row++)
+		{
+			memcpy(pDstY + (ptrdiff_t)row * dstYStride, pSrcY + (ptrdiff_t)row * srcYStride, width);
+		}
+
+		for (uint32_t row = 0; row < (height + 1) / 2; row++)
+		{
+			k->splitUV(pSrcUV + (ptrdiff_t)row * srcUVStride,
+				pDstU + (ptrdiff_t)row * dstUStride, pDstV + (ptrdiff_t)row * dstVStride, (width + 1) / 2);
+		}
+	}
+
+	void ConvertI420ToNv12(
+		const uint8_t *pSrcY, ptrdiff_t srcYStride,
+		const uint8_t *pSrcU, ptrdiff_t srcUStride,
+		const uint8_t *pSrcV, ptrdiff_t srcVStride,
+		uint8_t *pDstY, ptrdiff_t dstYStride,
+		uint8_t *pDstUV, ptrdiff_t dstUVStride,
+		uint32_t width, uint32_t height)
+	{
+		const RowKernels *k = g_pKernels;
+
+		for (uint32_t row = 0; row < height; row++)
+		{
+			memcpy(pDstY + (ptrdiff_t)row * dstYStride, pSrcY + (ptrdiff_t)row * srcYStride, width);
+		}
+
+		for (uint32_t row = 0; row < (height + 1) / 2; row++)
+		{
+			k->mergeUV(pSrcU + (ptrdiff_t)row * srcUStride, pSrcV + (ptrdiff_t)row * srcVStride,
+				pDstUV + (ptrdiff_t)row * dstUVStride, (width + 1) / 2);
+		}
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+// Conversions between the YUV layouts the effect handles.
+//
+// The effect works on a single internal layout (NV12) and converts at the
+// edges of the pipeline. All functions honour independent source and
+// destination strides, which may be negative for bottom-up images, and
+// may be called on a band of rows (pointers offset to the first row of the
+// band) as long as bands of 4:2:0 images start on even rows.
+//
+// Chroma is averaged between row pairs when going from 4:2:2 to 4:2:0 and
+// duplicated when going back. The averages round up, (a + b + 1) / 2, in
+// every implementation, so all instruction sets produce identical output.
+//
+// This file does not depend on Windows headers.
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ImagingEffects
+{
+	// Pixel layouts.
+	enum PixelFormat
+	{
+		PixelFormat_NV12,   // Y plane, interleaved UV plane at half height.
+		PixelFormat_YUY2,   // Packed Y0 U0 Y1 V0.
+		PixelFormat_I420    // Y plane, U plane, V plane; chroma at half width and height.
+	};
+
+	// Instruction sets the kernels are implemented for.
+	enum ConversionIsa
+	{
+		ConversionIsa_Scalar,
+		ConversionIsa_SSE2,
+		ConversionIsa_AVX2,
+		ConversionIsa_NEON
+	};
+
+	// Returns the instruction set the conversions currently use. By default
+	// this is the best one the processor supports.
+	ConversionIsa GetConversionIsa();
+
+	// Forces an instruction set, e.g. to compare against the scalar reference.
+	// Returns false (and changes nothing) if the processor does not support it.
+	// Not thread-safe; call it before streaming starts.
+	bool SetConversionIsa(ConversionIsa isa);
+
+	void ConvertYuy2ToNv12(
+		const uint8_t *pSrc, ptrdiff_t srcStride,
+		uint8_t *pDstY, ptrdiff_t dstYStride,
+		uint8_t *pDstUV, ptrdiff_t dstUVStride,
+		uint32_t width, uint32_t height);
+
+	void ConvertNv12ToYuy2(
+		const uint8_t *pSrcY, ptrdiff_t srcYStride,
+		const uint8_t *pSrcUV, ptrdiff_t srcUVStride,
+		uint8_t *pDst, ptrdiff_t dstStride,
+		uint32_t width, uint32_t height);
+
+	void ConvertYuy2ToI420(
+		const uint8_t *pSrc, ptrdiff_t srcStride,
+		uint8_t *pDstY, ptrdiff_t dstYStride,
+		uint8_t *pDstU, ptrdiff_t dstUStride,
+		uint8_t *pDstV, ptrdiff_t dstVStride,
+		uint32_t width, uint32_t height);
+
+	void ConvertI420ToYuy2(
+		const uint8_t *pSrcY, ptrdiff_t srcYStride,
+		const uint8_t *pSrcU, ptrdiff_t srcUStride,
+		const uint8_t *pSrcV, ptrdiff_t srcVStride,
+		uint8_t *pDst, ptrdiff_t dstStride,
+		uint32_t width, uint32_t height);
+
+	void ConvertNv12ToI420(
+		const uint8_t *pSrcY, ptrdiff_t srcYStride,
+		const uint8_t *pSrcUV, ptrdiff_t srcUVStride,
+		uint8_t *pDstY, ptrdiff_t dstYStride,
+		uint8_t *pDstU, ptrdiff_t dstUStride,
+		uint8_t *pDstV, ptrdiff_t dstVStride,
+		uint32_t width, uint32_t height);
+
+	void ConvertI420ToNv12(
+		const uint8_t *pSrcY, ptrdiff_t srcYStride,
+		const uint8_t *pSrcU, ptrdiff_t srcUStride,
+		const uint8_t *pSrcV, ptrdiff_t srcVStride,
+		uint8_t *pDstY, ptrdiff_t dstYStride,
+		uint8_t *pDstUV, ptrdiff_t dstUVStride,
+		uint32_t width, uint32_t height);
+}
@@ -0,0 +1,166 @@
+// Per-frame latency histograms.
+//
+// This file does not use the precompiled header so that it can be built
+// without Windows headers.
+
+#include "FrameLatency.h"
+
+#include <math.h>
+
+namespace ImagingEffects
+{
+	namespace
+	{
+		// Every power of two from 32 up is split into 2^SUB_BUCKET_BITS buckets.
+		const uint32_t SUB_BUCKET_BITS = 5;
+		const uint32_t SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+
+		// Index of the highest set bit of a non-zero value.
+		uint32_t GetHighestBit(uint64_t v)
+		{
+			uint32_t n = 0;
+			if (v >> 32) { v >>= 32; n += 32; }
+			if (v >> 16) { v >>= 16; n += 16; }
+			if (v >> 8) { v >>= 8; n += 8; }
+			if (v >> 4) { v >>= 4; n += 4; }
+			if (v >> 2) { v >>= 2; n += 2; }
+			if (v >> 1) { n += 1; }
+			return n;
+		}
+	}
+
+	LatencyHistogram::LatencyHistogram()
+	{
+		for (uint32_t i = 0; i < LATENCY_BUCKET_COUNT; i++)
+		{
+			m_counts[i].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	void LatencyHistogram::Record(uint64_t ns)
+	{
+		m_counts[GetBucket(ns)].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void LatencyHistogram::CopyCounts(uint64_t *pCounts) const
+	{
+		for (uint32_t i = 0; i < LATENCY_BUCKET_COUNT; i++)
+		{
+			pCounts[i] = m_counts[i].load(std::memory_order_relaxed);
+		}
+	}
+
+	uint32_t LatencyHistogram::GetBucket(uint64_t ns)
+	{
+		if (ns < SUB_BUCKETS)
+		{
+			return (uint32_t)ns;
+		}
+
+		// Values from 2^e to 2^(e+1) share 32 buckets, 2^(e-5) wide.
+		const uint32_t e = GetHighestBit(ns);
+		const uint32_t iBucket = (e - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + (uint32_t)((ns >> (e - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+		return (iBucket < LATENCY_BUCKET_COUNT) ? iBucket : LATENCY_BUCKET_COUNT - 1;
+	}
+
+	uint64_t LatencyHistogram::GetBucketUpperBound(uint32_t iBucket)
+	{
+		if (iBucket < SUB_BUCKETS)
+		{
+			return iBucket;
+		}
+
+		const uint32_t shift = iBucket / SUB_BUCKETS - 1;
+		const uint64_t low = (uint64_t)(SUB_BUCKETS + iBucket % SUB_BUCKETS) << shift;
+		return low + (((uint64_t)1 << shift) - 1);
+	}
+
+	uint64_t LatencyHistogram::GetPercentile(const uint64_t *pCounts, uint64_t cTotal, double q)
+	{
+		if (cTotal == 0)
+		{
+			return 0;
+		}
+
+		// The rank of the value, counting from 1.
+		uint64_t rank = (uint64_t)ceil(q * (double)cTotal);
+		if (rank < 1)
+		{
+			rank = 1;
+		}
+		if (rank > cTotal)
+		{
+			rank = cTotal;
+		}
+
+		uint64_t cBelow = 0;
+		for (uint32_t i = 0; i < LATENCY_BUCKET_COUNT; i++)
+		{
+			cBelow += pCounts[i];
+			if (cBelow >= rank)
+			{
+				return GetBucketUpperBound(i);
+			}
+		}
+		return GetBucketUpperBound(LATENCY_BUCKET_COUNT - 1);
+	}
+
+	FrameLatencyStats::FrameLatencyStats(uint64_t cWindowFrames)
+		: m_cFrames(0)
+		, m_cWindowFrames(cWindowFrames > 0 ? cWindowFrames : 1)
+		, m_closedStart(FrameStage_Count * LATENCY_BUCKET_COUNT, 0)
+		, m_openStart(FrameStage_Count * LATENCY_BUCKET_COUNT, 0)
+		, m_cFramesAtOpen(0)
+		, m_current(FrameStage_Count * LATENCY_BUCKET_COUNT, 0)
+	{
+	}
+
+	void FrameLatencyStats::RecordFrame(const uint64_t *pStageNs)
+	{
+		for (int stage = 0; stage < FrameStage_Count; stage++)
+		{
+			m_stages[stage].Record(pStageNs[stage]);
+		}
+		m_cFrames.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void FrameLatencyStats::GetSummaries(LatencySummary *pSummaries)
+	{
+		std::lock_guard<std::mutex> lock(m_readLock);
+
+		const uint64_t cFrames = m_cFrames.load(std::memory_order_relaxed);
+		for (int stage = 0; stage < FrameStage_Count; stage++)
+		{
+			m_stages[stage].CopyCounts(&m_current[stage * LATENCY_BUCKET_COUNT]);
+		}
+
+		// Close the open window once it is full: it becomes the closed one,
+		// and the one closed before is forgotten.
+		if (cFrames - m_cFramesAtOpen >= m_cWindowFrames)
+		{
+			m_closedStart.swap(m_openStart);
+			m_openStart = m_current;
+			m_cFramesAtOpen = cFrames;
+		}
+
+		// Counts since the closed window began.
+		std::vector<uint64_t> window(LATENCY_BUCKET_COUNT);
+		for (int stage = 0; stage < FrameStage_Count; stage++)
+		{
+			const uint64_t *pNow = &m_current[stage * LATENCY_BUCKET_COUNT];
+			const uint64_t *pStart = &m_closedStart[stage * LATENCY_BUCKET_COUNT];
+
+			uint64_t cTotal = 0;
+			for (uint32_t i = 0; i < LATENCY_BUCKET_COUNT; i++)
+			{
+				window[i] = pNow[i] - pStart[i];
+				cTotal += window[i];
+			}
+
+			pSummaries[stage].cFrames = cTotal;
+			pSummaries[stage].p50 = LatencyHistogram::GetPercentile(window.data(), cTotal, 0.50);
+			pSummaries[stage].p99 = LatencyHistogram::GetPercentile(window.data(), cTotal, 0.99);
+			pSummaries[stage].p999 = LatencyHistogram::GetPercentile(window.data(), cTotal, 0.999);
+		}
+	}
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+// Per-frame latency, stage by stage, with tail percentiles.
+//
+// Every processed frame reports how long each of its stages took. The times
+// go into one histogram per stage, from which the 50th, 99th and 99.9th
+// percentiles are read. The histograms are log-linear, like HdrHistogram:
+// values below 32 ns have a bucket each, and every power of two above is
+// split into 32 buckets, so a percentile is reported at most about 3% above
+// the true value. Values from 1 ns to about a minute are told apart; longer
+// ones land in the last bucket.
+//
+// Recording is lock-free (one atomic increment per stage) and may happen on
+// any number of threads at once. The histograms only grow; reading takes a
+// copy and subtracts the copy taken at the start of the window, so the
+// summaries cover recent frames only. A window is closed, when it is read,
+// once it holds cWindowFrames frames; the summaries cover the closed window
+// and the open one, so between one and two windows of frames (fewer right
+// after the start).
+//
+// This file does not depend on Windows headers.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace ImagingEffects
+{
+	enum FrameStage
+	{
+		FrameStage_LockWait,    // Waiting for the MFT lock.
+		FrameStage_BufferLock,  // Locking the sample buffers.
+		FrameStage_Wrap,        // Describing the buffers as frames, copying those that cannot be used in place.
+		FrameStage_Render,      // Running the effect chain.
+		FrameStage_Stamp,       // Time stamps and hand-off of the output sample.
+		FrameStage_Total,       // The whole frame, including what is not a stage above.
+		FrameStage_Count
+	};
+
+	const uint32_t LATENCY_BUCKET_COUNT = 1024;
+
+	// Latency of one stage over the window, in nanoseconds.
+	struct LatencySummary
+	{
+		uint64_t cFrames;       // Frames in the window.
+		uint64_t p50;
+		uint64_t p99;
+		uint64_t p999;
+	};
+
+	// LatencyHistogram class:
+	// Counts of nanosecond values in log-linear buckets.
+
+	class LatencyHistogram
+	{
+	public:
+		LatencyHistogram();
+
+		// Thread-safe and lock-free.
+		void Record(uint64_t ns);
+
+		// Copies the LATENCY_BUCKET_COUNT counts.
+		void CopyCounts(uint64_t *pCounts) const;
+
+		// The bucket of a value, and the largest value of a bucket.
+		static uint32_t GetBucket(uint64_t ns);
+		static uint64_t GetBucketUpperBound(uint32_t iBucket);
+
+		// The value below which a fraction q of cTotal counted values lie:
+		// the upper bound of the bucket that holds the value of that rank.
+		// 0 if there are no values.
+		static uint64_t GetPercentile(const uint64_t *pCounts, uint64_t cTotal, double q);
+
+	private:
+		LatencyHistogram(const LatencyHistogram&);
+		LatencyHistogram& operator=(const LatencyHistogram&);
+
+		std::atomic<uint64_t> m_counts[LATENCY_BUCKET_COUNT];
+	};
+
+	// FrameLatencyStats class:
+	// One histogram per stage, summarized over a rolling window.
+
+	class FrameLatencyStats
+	{
+	public:
+		explicit FrameLatencyStats(uint64_t cWindowFrames);
+
+		// Records the FrameStage_Count stage times of one frame. Thread-safe
+		// and lock-free.
+		void RecordFrame(const uint64_t *pStageNs);
+
+		// Fills FrameStage_Count summaries. May close the window. Thread-safe;
+		// readers are serialized, recording goes on meanwhile.
+		void GetSummaries(LatencySummary *pSummaries);
+
+	private:
+		FrameLatencyStats(const FrameLatencyStats&);
+		FrameLatencyStats& operator=(const FrameLatencyStats&);
+
+		LatencyHistogram m_stages[FrameStage_Count];
+		std::atomic<uint64_t> m_cFrames;
+
+		std::mutex m_readLock;                  // Guards the rest.
+		uint64_t m_cWindowFrames;
+		std::vector<uint64_t> m_closedStart;    // Counts of every stage when the closed window began.
+		std::vector<uint64_t> m_openStart;      // Counts of every stage when the open window began.
+		uint64_t m_cFramesAtOpen;
+		std::vector<uint64_t> m_current;        // Scratch for the copy of the counts.
+	};
+}
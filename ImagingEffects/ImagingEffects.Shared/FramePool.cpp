@@ -0,0 +1,187 @@
+// Pool of aligned frame buffers.
+//
+// This file does not use the precompiled header so that it can be built
+// without Windows headers.
+
+#include "FramePool.h"
+
+#include <stdlib.h>
+
+namespace ImagingEffects
+{
+	namespace
+	{
+		// Stored just below each buffer: where the allocation starts, and
+		// the frame size it was made for.
+		struct BlockHeader
+		{
+			void *pAllocation;
+			size_t cbFrame;
+		};
+
+		BlockHeader* GetHeader(const uint8_t *pData)
+		{
+			return (BlockHeader*)(pData - sizeof(BlockHeader));
+		}
+	}
+
+	uint32_t GetPaddedStride(uint32_t cbRow)
+	{
+		return (uint32_t)((cbRow + FRAME_POOL_ALIGNMENT - 1) & ~(FRAME_POOL_ALIGNMENT - 1));
+	}
+
+	FramePool::FramePool()
+		: m_cbFrame(0)
+		, m_cAllocated(0)
+		, m_cInUse(0)
+		, m_cHighWater(0)
+	{
+	}
+
+	// Buffers handed out keep the pool alive (see PooledBuffer.h), so none is
+	// in use when it goes away.
+
+	FramePool::~FramePool()
+	{
+		Trim();
+	}
+
+	void FramePool::SetFrameSize(size_t cbFrame)
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (cbFrame == m_cbFrame)
+		{
+			return;
+		}
+
+		m_cbFrame = cbFrame;
+		for (size_t i = 0; i < m_idle.size(); i++)
+		{
+			Free(m_idle[i]);
+			m_cAllocated--;
+		}
+		m_idle.clear();
+	}
+
+	size_t FramePool::GetFrameSize() const
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		return m_cbFrame;
+	}
+
+	uint8_t* FramePool::Acquire()
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+
+		uint8_t *pData = nullptr;
+		if (!m_idle.empty())
+		{
+			pData = m_idle.back();
+			m_idle.pop_back();
+		}
+		else
+		{
+			pData = Allocate(m_cbFrame);
+			if (pData == nullptr)
+			{
+				return nullptr;
+			}
+			m_cAllocated++;
+		}
+
+		m_cInUse++;
+		if (m_cInUse > m_cHighWater)
+		{
+			m_cHighWater = m_cInUse;
+		}
+		return pData;
+	}
+
+	void FramePool::Release(uint8_t *pData)
+	{
+		if (pData == nullptr)
+		{
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_cInUse--;
+		if (GetBlockSize(pData) == m_cbFrame)
+		{
+			m_idle.push_back(pData);
+		}
+		else
+		{
+			Free(pData);
+			m_cAllocated--;
+		}
+	}
+
+	bool FramePool::Reserve(size_t cBuffers)
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+
+		// Room for every buffer to come back, so Release does not allocate.
+		m_idle.reserve(cBuffers);
+
+		while (m_cAllocated < cBuffers)
+		{
+			uint8_t *pData = Allocate(m_cbFrame);
+			if (pData == nullptr)
+			{
+				return false;
+			}
+			m_idle.push_back(pData);
+			m_cAllocated++;
+		}
+		return true;
+	}
+
+	void FramePool::Trim()
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		for (size_t i = 0; i < m_idle.size(); i++)
+		{
+			Free(m_idle[i]);
+			m_cAllocated--;
+		}
+		m_idle.clear();
+		m_idle.shrink_to_fit();
+	}
+
+	FramePoolStats FramePool::GetStats() const
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		FramePoolStats stats;
+		stats.cbFrame = m_cbFrame;
+		stats.cAllocated = m_cAllocated;
+		stats.cIdle = m_idle.size();
+		stats.cHighWater = m_cHighWater;
+		return stats;
+	}
+
+	uint8_t* FramePool::Allocate(size_t cbFrame)
+	{
+		void *pAllocation = malloc(cbFrame + sizeof(BlockHeader) + FRAME_POOL_ALIGNMENT - 1);
+		if (pAllocation == nullptr)
+		{
+			return nullptr;
+		}
+
+		uintptr_t data = ((uintptr_t)pAllocation + sizeof(BlockHeader) + FRAME_POOL_ALIGNMENT - 1) & ~(uintptr_t)(FRAME_POOL_ALIGNMENT - 1);
+		uint8_t *pData = (uint8_t*)data;
+		GetHeader(pData)->pAllocation = pAllocation;
+		GetHeader(pData)->cbFrame = cbFrame;
+		return pData;
+	}
+
+	void FramePool::Free(uint8_t *pData)
+	{
+		free(GetHeader(pData)->pAllocation);
+	}
+
+	size_t FramePool::GetBlockSize(const uint8_t *pData)
+	{
+		return GetHeader(pData)->cbFrame;
+	}
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+// Recycles the memory of output frames.
+//
+// Allocating a frame-sized buffer for every output sample costs a trip
+// through the heap (and, for large frames, fresh pages from the system)
+// about thirty times a second. The pool keeps released buffers and hands
+// them out again. It grows lazily, only when every buffer is in use, and
+// remembers the most buffers that were ever in use at once (the high-water
+// mark), which tells how deep the pipeline downstream really is.
+//
+// Every buffer starts on a FRAME_POOL_ALIGNMENT boundary. Together with
+// GetPaddedStride, which rounds rows up to the same boundary, every row of a
+// pooled frame is aligned for SIMD loads and stores.
+//
+// Buffers may be released from any thread, and after the frame size has
+// changed: a buffer of the old size is freed instead of being kept.
+//
+// This file does not depend on Windows headers.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+
+namespace ImagingEffects
+{
+	const size_t FRAME_POOL_ALIGNMENT = 64;
+
+	// Rounds a row size up to a multiple of FRAME_POOL_ALIGNMENT.
+	uint32_t GetPaddedStride(uint32_t cbRow);
+
+	struct FramePoolStats
+	{
+		size_t cbFrame;         // Size of the buffers handed out now.
+		size_t cAllocated;      // Buffers that exist, in use or idle.
+		size_t cIdle;           // Buffers waiting to be reused.
+		size_t cHighWater;      // Most buffers in use at once.
+	};
+
+	// FramePool class:
+	// A thread-safe pool of aligned, equally sized buffers.
+
+	class FramePool
+	{
+	public:
+		FramePool();
+		~FramePool();
+
+		// Sets the size of the buffers handed out from now on. Idle buffers
+		// of another size are freed.
+		void SetFrameSize(size_t cbFrame);
+		size_t GetFrameSize() const;
+
+		// Returns a buffer of the current size, or nullptr if there is no
+		// memory for a new one.
+		uint8_t* Acquire();
+
+		// Gives a buffer back for reuse.
+		void Release(uint8_t *pData);
+
+		// Allocates idle buffers until cBuffers exist, so that that many can
+		// be in use at once without allocating. Returns false if there is no
+		// memory for them.
+		bool Reserve(size_t cBuffers);
+
+		// Frees the idle buffers. Buffers in use are not affected.
+		void Trim();
+
+		FramePoolStats GetStats() const;
+
+	private:
+		FramePool(const FramePool&);
+		FramePool& operator=(const FramePool&);
+
+		static uint8_t* Allocate(size_t cbFrame);
+		static void Free(uint8_t *pData);
+		static size_t GetBlockSize(const uint8_t *pData);
+
+		mutable std::mutex m_lock;
+		size_t m_cbFrame;
+		std::vector<uint8_t*> m_idle;
+		size_t m_cAllocated;
+		size_t m_cInUse;
+		size_t m_cHighWater;
+	};
+}
@@ -0,0 +1,589 @@
+// Recordings of effect input.
+//
+// This file does not use the precompiled header so that it can be built
+// without Windows headers.
+
+#include "FrameRecording.h"
+
+#include <string.h>
+
+namespace ImagingEffects
+{
+	namespace
+	{
+		const uint8_t RECORDING_MAGIC[4] = { 'I', 'E', 'R', 'C' };
+		const uint32_t RECORDING_VERSION = 1;
+
+		// Bytes of a frame record before the pixels: the time flag, the time
+		// stamp and the duration.
+		const uint32_t FRAME_HEADER_BYTES = 1 + 8 + 8;
+
+		// Larger records are taken for damage: a 65-point cube is 3.3 MB, an
+		// 8K frame 100 MB.
+		const uint32_t MAX_PAYLOAD_BYTES = 256 * 1024 * 1024;
+
+		void Put8(std::vector<uint8_t> *pPayload, uint8_t value)
+		{
+			pPayload->push_back(value);
+		}
+
+		void Put32(std::vector<uint8_t> *pPayload, uint32_t value)
+		{
+			for (int i = 0; i < 4; i++)
+			{
+				pPayload->push_back((uint8_t)(value >> (8 * i)));
+			}
+		}
+
+		void Put64(std::vector<uint8_t> *pPayload, uint64_t value)
+		{
+			Put32(pPayload, (uint32_t)value);
+			Put32(pPayload, (uint32_t)(value >> 32));
+		}
+
+		void PutFloat(std::vector<uint8_t> *pPayload, float value)
+		{
+			uint32_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			Put32(pPayload, bits);
+		}
+
+		// Reads the fields of a payload in order. Reading past the end
+		// returns zeros and makes IsOk false.
+		class PayloadReader
+		{
+		public:
+			PayloadReader(const std::vector<uint8_t> &payload)
+				: m_p(payload.empty() ? nullptr : &payload[0])
+				, m_cb(payload.size())
+				, m_fOk(true)
+			{
+			}
+
+			bool IsOk() const { return m_fOk; }
+
+			const uint8_t* GetBytes(size_t cb)
+			{
+				if (!m_fOk || cb > m_cb)
+				{
+					m_fOk = false;
+					return nullptr;
+				}
+				const uint8_t *p = m_p;
+				m_p += cb;
+				m_cb -= cb;
+				return p;
+			}
+
+			uint8_t Get8()
+			{
+				const uint8_t *p = GetBytes(1);
+				return p != nullptr ? p[0] : 0;
+			}
+
+			uint32_t Get32()
+			{
+				const uint8_t *p = GetBytes(4);
+				return p != nullptr ? (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24) : 0;
+			}
+
+			uint64_t Get64()
+			{
+				const uint64_t low = Get32();
+				return low | ((uint64_t)Get32() << 32);
+			}
+
+			float GetFloat()
+			{
+				const uint32_t bits = Get32();
+				float value;
+				memcpy(&value, &bits, sizeof(value));
+				return value;
+			}
+
+		private:
+			const uint8_t *m_p;
+			size_t m_cb;
+			bool m_fOk;
+		};
+
+		void PutFilter(std::vector<uint8_t> *pPayload, const NativeFilter &filter)
+		{
+			Put8(pPayload, (uint8_t)filter.type);
+			switch (filter.type)
+			{
+			case NativeFilter_Grayscale:
+				break;
+
+			case NativeFilter_Sepia:
+				PutFloat(pPayload, filter.intensity);
+				break;
+
+			case NativeFilter_BrightnessContrastSaturation:
+				PutFloat(pPayload, filter.brightness);
+				PutFloat(pPayload, filter.contrast);
+				PutFloat(pPayload, filter.saturation);
+				break;
+
+			case NativeFilter_Curves:
+				pPayload->insert(pPayload->end(), &filter.curves[0][0], &filter.curves[0][0] + sizeof(filter.curves));
+				break;
+
+			case NativeFilter_Vignette:
+				PutFloat(pPayload, filter.radius);
+				PutFloat(pPayload, filter.strength);
+				break;
+
+			case NativeFilter_Lut3D:
+			{
+				// A filter without a cube is written with size 0, which the
+				// reader refuses.
+				const uint32_t size = filter.cube ? filter.cube->GetSize() : 0;
+				Put32(pPayload, size);
+				if (size > 0)
+				{
+					const std::vector<float> &rgb = filter.cube->GetRgb();
+					for (size_t i = 0; i < rgb.size(); i++)
+					{
+						PutFloat(pPayload, rgb[i]);
+					}
+				}
+				break;
+			}
+			}
+		}
+
+		bool GetFilter(PayloadReader *pReader, NativeFilter *pFilter)
+		{
+			switch (pReader->Get8())
+			{
+			case NativeFilter_Grayscale:
+				*pFilter = MakeGrayscaleFilter();
+				break;
+
+			case NativeFilter_Sepia:
+				*pFilter = MakeSepiaFilter(pReader->GetFloat());
+				break;
+
+			case NativeFilter_BrightnessContrastSaturation:
+			{
+				const float brightness = pReader->GetFloat();
+				const float contrast = pReader->GetFloat();
+				const float saturation = pReader->GetFloat();
+				*pFilter = MakeBrightnessContrastSaturationFilter(brightness, contrast, saturation);
+				break;
+			}
+
+			case NativeFilter_Curves:
+			{
+				const uint8_t *pTables = pReader->GetBytes(3 * 256);
+				if (pTables == nullptr)
+				{
+					return false;
+				}
+				*pFilter = MakeCurvesFilter(pTables, pTables + 256, pTables + 512);
+				break;
+			}
+
+			case NativeFilter_Vignette:
+			{
+				const float radius = pReader->GetFloat();
+				const float strength = pReader->GetFloat();
+				*pFilter = MakeVignetteFilter(radius, strength);
+				break;
+			}
+
+			case NativeFilter_Lut3D:
+			{
+				const uint32_t size = pReader->Get32();
+				if (size > 65)
+				{
+					return false;
+				}
+				std::vector<float> rgb((size_t)size * size * size * 3);
+				for (size_t i = 0; i < rgb.size(); i++)
+				{
+					rgb[i] = pReader->GetFloat();
+				}
+				std::shared_ptr<ColorCube> cube = ColorCube::Create(size, rgb.empty() ? nullptr : &rgb[0], rgb.size());
+				if (!cube)
+				{
+					return false;
+				}
+				*pFilter = MakeLut3DFilter(cube);
+				break;
+			}
+
+			default:
+				return false;
+			}
+
+			return pReader->IsOk();
+		}
+
+		void PutFilterList(std::vector<uint8_t> *pPayload, const std::vector<NativeFilter> &filters)
+		{
+			Put32(pPayload, (uint32_t)filters.size());
+			for (size_t i = 0; i < filters.size(); i++)
+			{
+				PutFilter(pPayload, filters[i]);
+			}
+		}
+
+		bool GetFilterList(PayloadReader *pReader, std::vector<NativeFilter> *pFilters)
+		{
+			pFilters->clear();
+			const uint32_t cFilters = pReader->Get32();
+			for (uint32_t i = 0; i < cFilters && pReader->IsOk(); i++)
+			{
+				NativeFilter filter;
+				if (!GetFilter(pReader, &filter))
+				{
+					return false;
+				}
+				pFilters->push_back(filter);
+			}
+			return pReader->IsOk();
+		}
+
+		// Bytes of a packed frame: every row of every plane at the minimum
+		// stride. Returns false if the format is unknown or a frame would not
+		// fit in a record.
+		bool GetPackedSize(const StreamFormat &format, ptrdiff_t *pStride, uint32_t *pcbImage)
+		{
+			if (format.pixelFormat != PixelFormat_NV12 && format.pixelFormat != PixelFormat_YUY2 && format.pixelFormat != PixelFormat_I420)
+			{
+				return false;
+			}
+
+			const uint64_t stride = GetMinimumStride(format.pixelFormat, format.width);
+			const uint64_t cbImage = stride * GetBufferRowCount(format.pixelFormat, format.height);
+			if (format.width == 0 || format.height == 0 || cbImage + FRAME_HEADER_BYTES > MAX_PAYLOAD_BYTES)
+			{
+				return false;
+			}
+
+			*pStride = (ptrdiff_t)stride;
+			*pcbImage = (uint32_t)cbImage;
+			return true;
+		}
+	}
+
+	FrameRecordWriter::FrameRecordWriter()
+		: m_pFile(nullptr)
+		, m_fFailed(false)
+		, m_fHaveFormat(false)
+		, m_cFrames(0)
+	{
+	}
+
+	FrameRecordWriter::~FrameRecordWriter()
+	{
+		(void)Close();
+	}
+
+	bool FrameRecordWriter::Open(FILE *pFile)
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+
+		m_pFile = pFile;
+		m_fFailed = (pFile == nullptr);
+		m_fHaveFormat = false;
+		m_cFrames = 0;
+
+		uint8_t header[8];
+		memcpy(header, RECORDING_MAGIC, 4);
+		for (int i = 0; i < 4; i++)
+		{
+			header[4 + i] = (uint8_t)(RECORDING_VERSION >> (8 * i));
+		}
+		return WriteBytes(header, sizeof(header));
+	}
+
+	bool FrameRecordWriter::WriteConfig(const EffectConfig &config)
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+
+		m_payload.clear();
+		Put8(&m_payload, config.fHasSdkEffects ? 1 : 0);
+		Put8(&m_payload, config.policy.fEnabled ? 1 : 0);
+		Put64(&m_payload, (uint64_t)config.policy.hnsMaxLatency);
+		Put8(&m_payload, config.policy.fAllowPassThrough ? 1 : 0);
+		Put8(&m_payload, config.policy.fAllowDrop ? 1 : 0);
+		Put32(&m_payload, config.policy.cMaxConsecutiveDrops);
+		PutFilterList(&m_payload, config.filters);
+		PutFilterList(&m_payload, config.fallbackFilters);
+		return WriteRecord(RecordKind_Config, m_payload, 0);
+	}
+
+	bool FrameRecordWriter::WriteFrame(const StreamFormat &format, const FrameTiming &timing, const VideoFrame &frame)
+	{
+		ptrdiff_t stride = 0;
+		uint32_t cbImage = 0;
+		if (frame.format != format.pixelFormat || frame.width != format.width || frame.height != format.height ||
+			!GetPackedSize(format, &stride, &cbImage))
+		{
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(m_lock);
+
+		if (!m_fHaveFormat || format.pixelFormat != m_format.pixelFormat || format.width != m_format.width || format.height != m_format.height ||
+			format.yuvMatrix != m_format.yuvMatrix || format.yuvRange != m_format.yuvRange)
+		{
+			m_payload.clear();
+			Put32(&m_payload, (uint32_t)format.pixelFormat);
+			Put32(&m_payload, format.width);
+			Put32(&m_payload, format.height);
+			Put32(&m_payload, (uint32_t)format.yuvMatrix);
+			Put32(&m_payload, (uint32_t)format.yuvRange);
+			if (!WriteRecord(RecordKind_Format, m_payload, 0))
+			{
+				return false;
+			}
+			m_format = format;
+			m_fHaveFormat = true;
+		}
+
+		m_payload.clear();
+		Put8(&m_payload, timing.fHasTime ? 1 : 0);
+		Put64(&m_payload, (uint64_t)timing.hnsTime);
+		Put64(&m_payload, (uint64_t)timing.hnsDuration);
+		if (!WriteRecord(RecordKind_Frame, m_payload, cbImage))
+		{
+			return false;
+		}
+
+		// The rows, whatever their layout in memory, packed top-down.
+		PlaneShape shapes[3];
+		const uint32_t cPlanes = GetPlaneShapes(format.pixelFormat, format.width, format.height, stride, shapes);
+		for (uint32_t i = 0; i < cPlanes; i++)
+		{
+			m_row.assign((size_t)shapes[i].stride, 0);
+			for (uint32_t y = 0; y < shapes[i].cRows; y++)
+			{
+				memcpy(&m_row[0], frame.planes[i].pData + y * frame.planes[i].stride, shapes[i].cbRow);
+				if (!WriteBytes(&m_row[0], m_row.size()))
+				{
+					return false;
+				}
+			}
+		}
+
+		m_cFrames++;
+		return true;
+	}
+
+	bool FrameRecordWriter::Close()
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+
+		if (m_pFile != nullptr)
+		{
+			if (fclose(m_pFile) != 0)
+			{
+				m_fFailed = true;
+			}
+			m_pFile = nullptr;
+		}
+		return !m_fFailed;
+	}
+
+	uint64_t FrameRecordWriter::GetFrameCount() const
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		return m_cFrames;
+	}
+
+	// Writes the kind and size of a record, and the payload. cbMore bytes
+	// of payload are written by the caller afterwards.
+
+	bool FrameRecordWriter::WriteRecord(RecordKind kind, const std::vector<uint8_t> &payload, uint32_t cbMore)
+	{
+		std::vector<uint8_t> header;
+		Put8(&header, (uint8_t)kind);
+		Put32(&header, (uint32_t)payload.size() + cbMore);
+		return WriteBytes(&header[0], header.size()) && (payload.empty() || WriteBytes(&payload[0], payload.size()));
+	}
+
+	bool FrameRecordWriter::WriteBytes(const void *pData, size_t cb)
+	{
+		if (m_fFailed || m_pFile == nullptr)
+		{
+			return false;
+		}
+		if (fwrite(pData, 1, cb, m_pFile) != cb)
+		{
+			m_fFailed = true;
+			return false;
+		}
+		return true;
+	}
+
+	FrameRecordReader::FrameRecordReader()
+		: m_pFile(nullptr)
+		, m_fAtEnd(false)
+		, m_fHaveFormat(false)
+	{
+		memset(&m_format, 0, sizeof(m_format));
+		m_config.policy = MakeDefaultSchedulerPolicy();
+		m_config.fHasSdkEffects = false;
+		memset(&m_timing, 0, sizeof(m_timing));
+		memset(&m_frame, 0, sizeof(m_frame));
+	}
+
+	FrameRecordReader::~FrameRecordReader()
+	{
+		if (m_pFile != nullptr)
+		{
+			fclose(m_pFile);
+		}
+	}
+
+	bool FrameRecordReader::Open(FILE *pFile)
+	{
+		m_pFile = pFile;
+		m_fAtEnd = false;
+		m_fHaveFormat = false;
+
+		uint8_t header[8];
+		if (pFile == nullptr || fread(header, 1, sizeof(header), pFile) != sizeof(header) || memcmp(header, RECORDING_MAGIC, 4) != 0)
+		{
+			return false;
+		}
+		const uint32_t version = (uint32_t)header[4] | ((uint32_t)header[5] << 8) | ((uint32_t)header[6] << 16) | ((uint32_t)header[7] << 24);
+		return version == RECORDING_VERSION;
+	}
+
+	bool FrameRecordReader::ReadNext(RecordKind *pKind)
+	{
+		for (;;)
+		{
+			if (m_pFile == nullptr)
+			{
+				return false;
+			}
+
+			uint8_t header[5];
+			const size_t cbHeader = fread(header, 1, sizeof(header), m_pFile);
+			if (cbHeader == 0 && feof(m_pFile))
+			{
+				m_fAtEnd = true;
+				return false;
+			}
+
+			const uint32_t cbPayload = (uint32_t)header[1] | ((uint32_t)header[2] << 8) | ((uint32_t)header[3] << 16) | ((uint32_t)header[4] << 24);
+			if (cbHeader != sizeof(header) || cbPayload > MAX_PAYLOAD_BYTES)
+			{
+				return false;
+			}
+
+			m_payload.resize(cbPayload);
+			if (cbPayload > 0 && fread(&m_payload[0], 1, cbPayload, m_pFile) != cbPayload)
+			{
+				return false;
+			}
+
+			switch (header[0])
+			{
+			case RecordKind_Format:
+				*pKind = RecordKind_Format;
+				return ReadFormat();
+
+			case RecordKind_Config:
+				*pKind = RecordKind_Config;
+				return ReadConfig();
+
+			case RecordKind_Frame:
+				*pKind = RecordKind_Frame;
+				return ReadFrame();
+
+			default:
+				break;      // A kind added after this reader; skipped.
+			}
+		}
+	}
+
+	bool FrameRecordReader::ReadFormat()
+	{
+		PayloadReader reader(m_payload);
+		StreamFormat format;
+		const uint32_t pixelFormat = reader.Get32();
+		format.pixelFormat = pixelFormat <= PixelFormat_I420 ? (PixelFormat)pixelFormat : PixelFormat_NV12;
+		format.width = reader.Get32();
+		format.height = reader.Get32();
+		const uint32_t matrix = reader.Get32();
+		const uint32_t range = reader.Get32();
+		format.yuvMatrix = matrix == YuvMatrix_BT709 ? YuvMatrix_BT709 : YuvMatrix_BT601;
+		format.yuvRange = range == YuvRange_Full ? YuvRange_Full : YuvRange_Video;
+
+		ptrdiff_t stride = 0;
+		uint32_t cbImage = 0;
+		if (!reader.IsOk() || pixelFormat > PixelFormat_I420 || matrix > YuvMatrix_BT709 || range > YuvRange_Full ||
+			!GetPackedSize(format, &stride, &cbImage))
+		{
+			return false;
+		}
+
+		m_format = format;
+		m_fHaveFormat = true;
+		return true;
+	}
+
+	bool FrameRecordReader::ReadConfig()
+	{
+		PayloadReader reader(m_payload);
+		EffectConfig config;
+		config.fHasSdkEffects = (reader.Get8() != 0);
+		config.policy.fEnabled = (reader.Get8() != 0);
+		config.policy.hnsMaxLatency = (int64_t)reader.Get64();
+		config.policy.fAllowPassThrough = (reader.Get8() != 0);
+		config.policy.fAllowDrop = (reader.Get8() != 0);
+		config.policy.cMaxConsecutiveDrops = reader.Get32();
+		if (!reader.IsOk() || !GetFilterList(&reader, &config.filters) || !GetFilterList(&reader, &config.fallbackFilters))
+		{
+			return false;
+		}
+
+		m_config = config;
+		return true;
+	}
+
+	bool FrameRecordReader::ReadFrame()
+	{
+		ptrdiff_t stride = 0;
+		uint32_t cbImage = 0;
+		if (!m_fHaveFormat || !GetPackedSize(m_format, &stride, &cbImage) || m_payload.size() != FRAME_HEADER_BYTES + cbImage)
+		{
+			return false;
+		}
+
+		PayloadReader reader(m_payload);
+		m_timing.fHasTime = (reader.Get8() != 0);
+		m_timing.hnsTime = (int64_t)reader.Get64();
+		m_timing.hnsDuration = (int64_t)reader.Get64();
+
+		uint8_t *pPixels = &m_payload[FRAME_HEADER_BYTES];
+		return WrapVideoFrame(m_format.pixelFormat, m_format.width, m_format.height, pPixels, stride, pPixels, cbImage, &m_frame);
+	}
+
+	uint64_t HashVideoFrame(const VideoFrame &frame)
+	{
+		PlaneShape shapes[3];
+		const uint32_t cPlanes = GetPlaneShapes(frame.format, frame.width, frame.height, GetMinimumStride(frame.format, frame.width), shapes);
+
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for (uint32_t i = 0; i < cPlanes && i < frame.cPlanes; i++)
+		{
+			for (uint32_t y = 0; y < shapes[i].cRows; y++)
+			{
+				const uint8_t *pRow = frame.planes[i].pData + y * frame.planes[i].stride;
+				for (uint32_t x = 0; x < shapes[i].cbRow; x++)
+				{
+					hash = (hash ^ pRow[x]) * 0x100000001b3ull;
+				}
+			}
+		}
+		return hash;
+	}
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+// Recordings of the frames an effect was given, for replaying them later.
+//
+// A recording holds the input of a stream as the effect saw it: the frames,
+// with their time stamps, and the native effect configuration set with
+// SetProperties, in the order they happened. It is replayed through an
+// EffectEngine on any platform, so a stream that was slow or wrong in the
+// field can be rendered again, frame for frame, as a benchmark or a test.
+//
+// The file is a header followed by records, each a kind, a payload size
+// and the payload, all little-endian:
+//
+//   Format   The pixel format, size and colour space of the frames that
+//            follow. Written before the first frame and when it changes.
+//   Config   The native filters, fallback filters and late-frame policy.
+//            SDK effects (IImageProviders) cannot be recorded; the config
+//            only notes that there were some.
+//   Frame    The time stamp and duration, then the pixels, top-down, each
+//            plane's rows packed to the minimum stride of the format.
+//
+// Readers skip records of kinds they do not know, so kinds can be added
+// without changing the version.
+//
+// This file does not depend on Windows headers.
+
+#include "EffectEngine.h"
+
+#include <stdio.h>
+#include <mutex>
+#include <vector>
+
+namespace ImagingEffects
+{
+	enum RecordKind
+	{
+		RecordKind_Format = 1,
+		RecordKind_Config = 2,
+		RecordKind_Frame = 3
+	};
+
+	// The native part of an effect configuration.
+	struct EffectConfig
+	{
+		std::vector<NativeFilter> filters;
+		std::vector<NativeFilter> fallbackFilters;
+		SchedulerPolicy policy;
+		bool fHasSdkEffects;            // The configuration also had an SDK chain, which is not recorded.
+	};
+
+	// FrameRecordWriter class:
+	// Writes a recording. Thread-safe: records are written whole, in the
+	// order the calls are made.
+
+	class FrameRecordWriter
+	{
+	public:
+		FrameRecordWriter();
+		~FrameRecordWriter();
+
+		// Takes a file opened for binary writing, which the writer closes,
+		// and writes the file header. Returns false if that fails.
+		bool Open(FILE *pFile);
+
+		bool WriteConfig(const EffectConfig &config);
+
+		// Writes a frame of the given format, and the format first if it is
+		// not the format of the previous frame.
+		bool WriteFrame(const StreamFormat &format, const FrameTiming &timing, const VideoFrame &frame);
+
+		// Closes the file. Returns false if any write failed; after a failed
+		// write the writer writes nothing more.
+		bool Close();
+
+		uint64_t GetFrameCount() const;
+
+	private:
+		FrameRecordWriter(const FrameRecordWriter&);
+		FrameRecordWriter& operator=(const FrameRecordWriter&);
+
+		// Called with m_lock held.
+		bool WriteRecord(RecordKind kind, const std::vector<uint8_t> &payload, uint32_t cbMore);
+		bool WriteBytes(const void *pData, size_t cb);
+
+		mutable std::mutex m_lock;
+		FILE *m_pFile;
+		bool m_fFailed;
+		bool m_fHaveFormat;
+		StreamFormat m_format;
+		std::vector<uint8_t> m_payload;
+		std::vector<uint8_t> m_row;             // One packed row, padding zeroed.
+		uint64_t m_cFrames;
+	};
+
+	// FrameRecordReader class:
+	// Reads a recording record by record.
+
+	class FrameRecordReader
+	{
+	public:
+		FrameRecordReader();
+		~FrameRecordReader();
+
+		// Takes a file opened for binary reading, which the reader closes,
+		// and checks the file header. Returns false if it is not a recording
+		// of a version the reader knows.
+		bool Open(FILE *pFile);
+
+		// Reads the next record and returns its kind in *pKind. Returns false
+		// at the end of the file, or if the record is damaged or truncated;
+		// IsAtEnd tells which.
+		bool ReadNext(RecordKind *pKind);
+		bool IsAtEnd() const { return m_fAtEnd; }
+
+		// What the records read so far say. The frame points into the
+		// reader's buffer and is valid until the next call to ReadNext.
+		const StreamFormat& GetFormat() const { return m_format; }
+		const EffectConfig& GetConfig() const { return m_config; }
+		const FrameTiming& GetTiming() const { return m_timing; }
+		const VideoFrame& GetFrame() const { return m_frame; }
+
+	private:
+		FrameRecordReader(const FrameRecordReader&);
+		FrameRecordReader& operator=(const FrameRecordReader&);
+
+		bool ReadFormat();
+		bool ReadConfig();
+		bool ReadFrame();
+
+		FILE *m_pFile;
+		bool m_fAtEnd;
+		std::vector<uint8_t> m_payload;
+		bool m_fHaveFormat;
+		StreamFormat m_format;
+		EffectConfig m_config;
+		FrameTiming m_timing;
+		VideoFrame m_frame;
+	};
+
+	// 64-bit FNV-1a hash of the pixels of a frame, row by row, ignoring
+	// the padding: frames with the same pixels hash the same whatever
+	// their layout in memory.
+	uint64_t HashVideoFrame(const VideoFrame &frame);
+}
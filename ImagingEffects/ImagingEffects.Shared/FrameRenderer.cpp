@@ -0,0 +1,100 @@
+// Native effect chains of a stream.
+//
+// This file does not use the precompiled header so that it can be built
+// without Windows headers.
+
+#include "FrameRenderer.h"
+
+namespace ImagingEffects
+{
+	void RunSerially(size_t cItems, const std::function<void(size_t)> &fn)
+	{
+		for (size_t i = 0; i < cItems; i++)
+		{
+			fn(i);
+		}
+	}
+
+	StreamFormat MakeStreamFormat(PixelFormat pixelFormat, uint32_t width, uint32_t height)
+	{
+		StreamFormat format;
+		format.pixelFormat = pixelFormat;
+		format.width = width;
+		format.height = height;
+		format.yuvMatrix = (height >= 720) ? YuvMatrix_BT709 : YuvMatrix_BT601;
+		format.yuvRange = YuvRange_Video;
+		return format;
+	}
+
+	FrameRenderer::FrameRenderer(
+		const StreamFormat &format,
+		const std::vector<NativeFilter> &filters,
+		const std::vector<NativeFilter> &fallbackFilters,
+		size_t cBands)
+		: m_format(format)
+	{
+		SplitIntoBands(0, format.height, cBands, 2, &m_bands);
+
+		// The chains precompute their tables for the frame size, and the
+		// working memory for every band of a frame filtered at once.
+		if (!filters.empty())
+		{
+			m_spChain.reset(new NativeFilterChain(filters, format.pixelFormat, format.width, format.height, format.yuvMatrix, format.yuvRange));
+			m_spChain->ReserveBands(m_bands.size());
+		}
+		if (!fallbackFilters.empty())
+		{
+			m_spFallbackChain.reset(new NativeFilterChain(fallbackFilters, format.pixelFormat, format.width, format.height, format.yuvMatrix, format.yuvRange));
+			m_spFallbackChain->ReserveBands(m_bands.size());
+		}
+	}
+
+	const NativeFilterChain* FrameRenderer::GetChain(FrameAction action) const
+	{
+		if (action == FrameAction_Process)
+		{
+			return m_spChain.get();
+		}
+		if (action == FrameAction_Degrade)
+		{
+			return m_spFallbackChain.get();
+		}
+		return nullptr;
+	}
+
+	bool FrameRenderer::CanProcessInPlace(FrameAction action) const
+	{
+		const NativeFilterChain *pChain = GetChain(action);
+		return (pChain == nullptr) || pChain->CanProcessInPlace();
+	}
+
+	void FrameRenderer::Render(FrameAction action, const VideoFrame &dest, const VideoFrame &src, const ParallelFor &parallelFor) const
+	{
+		// The band functions capture a single reference, so that the
+		// std::function they are passed as holds them without allocating.
+		struct BandJob
+		{
+			const NativeFilterChain *pChain;
+			const VideoFrame *pDest;
+			const VideoFrame *pSrc;
+			const FrameBand *pBands;
+		};
+		const BandJob job = { GetChain(action), &dest, &src, m_bands.data() };
+
+		if (job.pChain != nullptr)
+		{
+			parallelFor(m_bands.size(), [&job](size_t i)
+			{
+				job.pChain->Process(*job.pDest, *job.pSrc, job.pBands[i].top, job.pBands[i].bottom);
+			});
+		}
+		else if (dest.planes[0].pData != src.planes[0].pData)
+		{
+			// No effect, or a late frame shown unmodified.
+			parallelFor(m_bands.size(), [&job](size_t i)
+			{
+				ConvertVideoFrame(*job.pSrc, *job.pDest, job.pBands[i].top, job.pBands[i].bottom);
+			});
+		}
+	}
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+// The native effect chains of a stream, ready to render frames.
+//
+// A FrameRenderer is built for one frame format and one effect configuration:
+// the chain of filters, an optional cheaper fallback chain for late frames,
+// and the split of the frame into bands. It is immutable once built, so any
+// number of frames may be rendered with it at once, and a new configuration
+// gets a new renderer while frames in flight finish with the old one.
+//
+// The bands of a frame are rendered through a ParallelFor supplied by the
+// host: the PPL in the media foundation transform, a ThreadPool (see
+// ThreadPool.h) or RunSerially elsewhere. Bands start on even rows so that no
+// chroma row of a 4:2:0 frame is shared, and render the same result in any
+// order.
+//
+// This file does not depend on Windows headers.
+
+#include "FrameBands.h"
+#include "FrameScheduler.h"
+#include "NativeFilters.h"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace ImagingEffects
+{
+	// Calls fn(0) to fn(cItems - 1), in any order and on any threads, and
+	// returns once every call has returned. fn does not throw.
+	typedef std::function<void(size_t cItems, const std::function<void(size_t)> &fn)> ParallelFor;
+
+	// A ParallelFor that makes the calls one after another on the calling thread.
+	void RunSerially(size_t cItems, const std::function<void(size_t)> &fn);
+
+	// Frame format of a stream.
+	struct StreamFormat
+	{
+		PixelFormat pixelFormat;
+		uint32_t width;
+		uint32_t height;
+		YuvMatrix yuvMatrix;
+		YuvRange yuvRange;
+	};
+
+	// A format with the colour space streams are assumed to have when they do
+	// not say: BT.709 from 720 lines up, BT.601 below, and video range.
+	StreamFormat MakeStreamFormat(PixelFormat pixelFormat, uint32_t width, uint32_t height);
+
+	// FrameRenderer class:
+	// Renders frames of one format with one effect configuration.
+
+	class FrameRenderer
+	{
+	public:
+		// Either list may be empty. cBands is how many bands a frame is split
+		// into, at most; more bands than threads lets busy threads be helped.
+		FrameRenderer(
+			const StreamFormat &format,
+			const std::vector<NativeFilter> &filters,
+			const std::vector<NativeFilter> &fallbackFilters,
+			size_t cBands);
+
+		const StreamFormat& GetFormat() const { return m_format; }
+		const std::vector<FrameBand>& GetBands() const { return m_bands; }
+
+		// The chain an action renders with: the filters for FrameAction_Process,
+		// the fallback filters for FrameAction_Degrade. nullptr if that list
+		// is empty, and for the other actions.
+		const NativeFilterChain* GetChain(FrameAction action) const;
+
+		bool HasFallback() const { return m_spFallbackChain != nullptr; }
+
+		// True if Render may be given the same frame as source and destination
+		// for the action.
+		bool CanProcessInPlace(FrameAction action) const;
+
+		// Renders src into dest as the action says: through its chain, or a
+		// copy (with conversion, if the formats differ) for actions that have
+		// no chain. Both frames have the renderer's size. dest may be src if
+		// CanProcessInPlace(action) is true; a copy onto itself does nothing.
+		void Render(FrameAction action, const VideoFrame &dest, const VideoFrame &src, const ParallelFor &parallelFor) const;
+
+	private:
+		FrameRenderer(const FrameRenderer&);
+		FrameRenderer& operator=(const FrameRenderer&);
+
+		StreamFormat m_format;
+		std::vector<FrameBand> m_bands;
+		std::unique_ptr<NativeFilterChain> m_spChain;
+		std::unique_ptr<NativeFilterChain> m_spFallbackChain;   // Cheaper chain for late frames.
+	};
+}
@@ -0,0 +1,179 @@
+// Deadline-aware frame scheduling.
+//
+// This file does not use the precompiled header so that it can be built
+// without Windows headers.
+
+#include "FrameScheduler.h"
+
+#include <string.h>
+
+namespace ImagingEffects
+{
+	namespace
+	{
+		// Frame interval assumed until one can be measured (30 fps).
+		const int64_t DEFAULT_FRAME_INTERVAL = 333333;
+
+		// Moving averages give each new measurement a weight of 1/8.
+		const int AVERAGE_SHIFT = 3;
+
+		// While the full chain is not used, its cost is not measured either,
+		// and the estimate would never recover once the machine is less busy.
+		// After this many frames without it, one frame is processed anyway.
+		const uint32_t PROCESS_PROBE_INTERVAL = 30;
+
+		int64_t UpdateAverage(int64_t average, int64_t sample)
+		{
+			return average + ((sample - average) >> AVERAGE_SHIFT);
+		}
+	}
+
+	SchedulerPolicy MakeDefaultSchedulerPolicy()
+	{
+		SchedulerPolicy policy;
+		policy.fEnabled = false;
+		policy.hnsMaxLatency = 0;
+		policy.fAllowPassThrough = true;
+		policy.fAllowDrop = true;
+		policy.cMaxConsecutiveDrops = 2;
+		return policy;
+	}
+
+	FrameScheduler::FrameScheduler()
+		: m_policy(MakeDefaultSchedulerPolicy())
+		, m_cConsecutiveDrops(0)
+		, m_cSinceProcess(0)
+	{
+		memset(m_cFrames, 0, sizeof(m_cFrames));
+		ResetClock();
+		ResetCosts();
+	}
+
+	void FrameScheduler::SetPolicy(const SchedulerPolicy &policy)
+	{
+		m_policy = policy;
+	}
+
+	void FrameScheduler::ResetClock()
+	{
+		m_fHaveOffset = false;
+		m_hnsOffset = 0;
+		m_fHaveLastTime = false;
+		m_hnsLastTime = 0;
+		m_hnsInterval = 0;
+		m_cConsecutiveDrops = 0;
+	}
+
+	void FrameScheduler::ResetCosts()
+	{
+		for (int i = 0; i < FrameAction_Count; i++)
+		{
+			m_fHaveCost[i] = false;
+			m_hnsCost[i] = 0;
+		}
+		m_cSinceProcess = 0;
+	}
+
+	FrameAction FrameScheduler::Decide(int64_t hnsNow, bool fHasTime, int64_t hnsTime, int64_t hnsDuration, bool fCanDegrade)
+	{
+		if (!m_policy.fEnabled || !fHasTime)
+		{
+			return Count(FrameAction_Process);
+		}
+
+		// Map the time stamp to the clock with the frame that waited least.
+		const int64_t hnsOffset = hnsNow - hnsTime;
+		if (!m_fHaveOffset || hnsOffset < m_hnsOffset)
+		{
+			m_hnsOffset = hnsOffset;
+			m_fHaveOffset = true;
+		}
+
+		if (m_fHaveLastTime && hnsTime > m_hnsLastTime)
+		{
+			const int64_t hnsInterval = hnsTime - m_hnsLastTime;
+			m_hnsInterval = (m_hnsInterval > 0) ? UpdateAverage(m_hnsInterval, hnsInterval) : hnsInterval;
+		}
+		m_hnsLastTime = hnsTime;
+		m_fHaveLastTime = true;
+
+		int64_t hnsBudget = m_policy.hnsMaxLatency;
+		if (hnsBudget <= 0)
+		{
+			hnsBudget = (hnsDuration > 0) ? hnsDuration : (m_hnsInterval > 0 ? m_hnsInterval : DEFAULT_FRAME_INTERVAL);
+		}
+		const int64_t hnsDeadline = hnsTime + m_hnsOffset + hnsBudget;
+
+		if (m_cSinceProcess >= PROCESS_PROBE_INTERVAL || Fits(FrameAction_Process, hnsNow, hnsDeadline))
+		{
+			return Count(FrameAction_Process);
+		}
+		if (fCanDegrade && Fits(FrameAction_Degrade, hnsNow, hnsDeadline))
+		{
+			return Count(FrameAction_Degrade);
+		}
+		if (m_policy.fAllowPassThrough && Fits(FrameAction_PassThrough, hnsNow, hnsDeadline))
+		{
+			return Count(FrameAction_PassThrough);
+		}
+		if (m_policy.fAllowDrop && m_cConsecutiveDrops < m_policy.cMaxConsecutiveDrops)
+		{
+			return Count(FrameAction_Drop);
+		}
+
+		// Late whatever we do: produce output as cheaply as possible.
+		FrameAction cheapest = FrameAction_Process;
+		if (fCanDegrade && m_hnsCost[FrameAction_Degrade] < m_hnsCost[cheapest])
+		{
+			cheapest = FrameAction_Degrade;
+		}
+		if (m_policy.fAllowPassThrough && m_hnsCost[FrameAction_PassThrough] < m_hnsCost[cheapest])
+		{
+			cheapest = FrameAction_PassThrough;
+		}
+		return Count(cheapest);
+	}
+
+	void FrameScheduler::RecordCost(FrameAction action, int64_t hnsElapsed)
+	{
+		if (action < 0 || action >= FrameAction_Count)
+		{
+			return;
+		}
+
+		if (hnsElapsed < 0)
+		{
+			hnsElapsed = 0;
+		}
+
+		m_hnsCost[action] = m_fHaveCost[action] ? UpdateAverage(m_hnsCost[action], hnsElapsed) : hnsElapsed;
+		m_fHaveCost[action] = true;
+	}
+
+	// An action whose cost has not been measured yet is assumed to be free, so
+	// that it gets measured.
+
+	bool FrameScheduler::Fits(FrameAction action, int64_t hnsNow, int64_t hnsDeadline) const
+	{
+		return hnsNow + m_hnsCost[action] <= hnsDeadline;
+	}
+
+	SchedulerStats FrameScheduler::GetStats() const
+	{
+		SchedulerStats stats;
+		for (int i = 0; i < FrameAction_Count; i++)
+		{
+			stats.cFrames[i] = m_cFrames[i];
+			stats.hnsCost[i] = m_hnsCost[i];
+		}
+		return stats;
+	}
+
+	FrameAction FrameScheduler::Count(FrameAction action)
+	{
+		m_cFrames[action]++;
+		m_cConsecutiveDrops = (action == FrameAction_Drop) ? m_cConsecutiveDrops + 1 : 0;
+		m_cSinceProcess = (action == FrameAction_Process) ? 0 : m_cSinceProcess + 1;
+		return action;
+	}
+}
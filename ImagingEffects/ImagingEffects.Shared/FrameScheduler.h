@@ -0,0 +1,116 @@
+#pragma once
+
+// Decides what to do with each frame so that output latency stays bounded.
+//
+// Media Foundation hands the transform every sample, however late it already
+// is. When the effect chain takes longer than a frame interval, frames queue
+// up in front of the transform and preview latency grows without bound. The
+// scheduler estimates, before a frame is processed, when it would be done,
+// and compares that with the frame's deadline:
+//
+//   deadline = time stamp + arrival offset + latency budget
+//
+// The arrival offset maps time stamps to the clock: it is the smallest
+// difference between arrival time and time stamp seen since the last reset,
+// i.e. the offset of the frame that waited least. The latency budget is a
+// fixed value from the policy, or one frame duration.
+//
+// Processing costs are measured: the caller reports how long each action
+// took, and the scheduler keeps a moving average per action. For each frame
+// it then picks the first of these that finishes in time:
+//
+//   Process       The full effect chain.
+//   Degrade       A cheaper chain, if the caller has one.
+//   PassThrough   Copy the input unmodified (if the policy allows it).
+//   Drop          Produce no output (if the policy allows it, and not more
+//                 than a given number of frames in a row).
+//
+// If none fits, the cheapest action that produces output is used.
+//
+// The scheduler does not read a clock itself; times are passed in, in
+// 100-nanosecond units, so it can be driven by a simulated clock. It is not
+// thread-safe.
+//
+// This file does not depend on Windows headers.
+
+#include <stdint.h>
+
+namespace ImagingEffects
+{
+	enum FrameAction
+	{
+		FrameAction_Process,
+		FrameAction_Degrade,
+		FrameAction_PassThrough,
+		FrameAction_Drop,
+		FrameAction_Count
+	};
+
+	struct SchedulerPolicy
+	{
+		bool fEnabled;                  // If false, every frame is processed.
+		int64_t hnsMaxLatency;          // Latency budget. 0 uses the frame duration.
+		bool fAllowPassThrough;
+		bool fAllowDrop;
+		uint32_t cMaxConsecutiveDrops;  // Drops in a row before a late frame is shown anyway.
+	};
+
+	// Policy with scheduling disabled.
+	SchedulerPolicy MakeDefaultSchedulerPolicy();
+
+	struct SchedulerStats
+	{
+		uint64_t cFrames[FrameAction_Count];    // Frames given each action.
+		int64_t hnsCost[FrameAction_Count];     // Average measured cost of each action.
+	};
+
+	// FrameScheduler class:
+	// Picks an action for each frame of a stream.
+
+	class FrameScheduler
+	{
+	public:
+		FrameScheduler();
+
+		void SetPolicy(const SchedulerPolicy &policy);
+		const SchedulerPolicy& GetPolicy() const { return m_policy; }
+
+		// Chooses the action for a frame that is about to be processed.
+		// hnsNow is the current time; hnsTime and hnsDuration come from the
+		// sample (fHasTime false if the sample has no time stamp, hnsDuration
+		// 0 if it has no duration). fCanDegrade tells whether a cheaper chain
+		// exists. The frame is counted under the returned action.
+		FrameAction Decide(int64_t hnsNow, bool fHasTime, int64_t hnsTime, int64_t hnsDuration, bool fCanDegrade);
+
+		// Reports how long an action took.
+		void RecordCost(FrameAction action, int64_t hnsElapsed);
+
+		// Forgets the arrival offset, e.g. after a flush or a discontinuity.
+		void ResetClock();
+
+		// Forgets the measured costs, e.g. when the effect chain changes.
+		void ResetCosts();
+
+		// Returns the counters and the cost estimates.
+		SchedulerStats GetStats() const;
+
+	private:
+		bool Fits(FrameAction action, int64_t hnsNow, int64_t hnsDeadline) const;
+		FrameAction Count(FrameAction action);
+
+		SchedulerPolicy m_policy;
+
+		bool m_fHaveOffset;
+		int64_t m_hnsOffset;            // Smallest arrival time minus time stamp.
+		bool m_fHaveLastTime;
+		int64_t m_hnsLastTime;          // Time stamp of the previous frame, to estimate the interval.
+		int64_t m_hnsInterval;          // Average frame interval, for samples without a duration.
+
+		bool m_fHaveCost[FrameAction_Count];
+		int64_t m_hnsCost[FrameAction_Count];
+
+		uint32_t m_cConsecutiveDrops;
+		uint32_t m_cSinceProcess;       // Frames since the full chain was last used.
+		uint64_t m_cFrames[FrameAction_Count];
+	};
+}
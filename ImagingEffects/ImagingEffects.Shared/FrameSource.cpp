@@ -0,0 +1,326 @@
+// Synthetic camera frames.
+//
+// This file does not use the precompiled header so that it can be built
+// without Windows headers.
+
+#include "FrameSource.h"
+
+#include <string.h>
+#include <vector>
+
+namespace ImagingEffects
+{
+	namespace
+	{
+		// 75% colour bars in BT.601 video range: white, yellow, cyan, green,
+		// magenta, red, blue and black, as Y, U and V.
+		const uint8_t COLOR_BARS[8][3] =
+		{
+			{ 180, 128, 128 },
+			{ 162, 44, 142 },
+			{ 131, 156, 44 },
+			{ 112, 72, 58 },
+			{ 84, 184, 198 },
+			{ 65, 100, 212 },
+			{ 35, 212, 114 },
+			{ 16, 128, 128 }
+		};
+
+		const uint32_t BOX_COUNT = 4;
+
+		// SplitMix64: spreads the seed, frame and row numbers into a state
+		// for the row's noise.
+		uint64_t MixBits(uint64_t value)
+		{
+			value += 0x9e3779b97f4a7c15ull;
+			value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+			value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+			return value ^ (value >> 31);
+		}
+
+		// xorshift64*: eight random bytes per step.
+		uint64_t NextRandom(uint64_t *pState)
+		{
+			uint64_t x = *pState;
+			x ^= x >> 12;
+			x ^= x << 25;
+			x ^= x >> 27;
+			*pState = x;
+			return x * 0x2545f4914f6cdd1dull;
+		}
+
+		void FillRandom(uint64_t *pState, uint8_t *pData, size_t cb)
+		{
+			while (cb >= 8)
+			{
+				uint64_t bits = NextRandom(pState);
+				memcpy(pData, &bits, 8);
+				pData += 8;
+				cb -= 8;
+			}
+			if (cb > 0)
+			{
+				uint64_t bits = NextRandom(pState);
+				memcpy(pData, &bits, cb);
+			}
+		}
+
+		// Position on [0, range] of something moving back and forth at
+		// velocity pixels per frame. Even, so that boxes cover whole chroma
+		// samples.
+		uint32_t Bounce(uint64_t start, uint64_t velocity, uint64_t iFrame, uint32_t range)
+		{
+			if (range == 0)
+			{
+				return 0;
+			}
+			const uint64_t p = (start + velocity * iFrame) % (2 * (uint64_t)range);
+			return (uint32_t)(p <= range ? p : 2 * range - p) & ~1u;
+		}
+	}
+
+	SourceConfig MakeSourceConfig(SourceFormat format, uint32_t width, uint32_t height, uint32_t frameRate)
+	{
+		SourceConfig config;
+		config.format = format;
+		config.width = width;
+		config.height = height;
+		config.frameRate = frameRate;
+		config.cbPadding = 0;
+		config.content = SourceContent_Gradient;
+		config.seed = 1;
+		return config;
+	}
+
+	struct FrameSource::Box
+	{
+		uint32_t left;
+		uint32_t top;
+		uint32_t width;
+		uint32_t height;
+		const uint8_t *pColor;
+	};
+
+	FrameSource::FrameSource()
+		: m_config(MakeSourceConfig(SourceFormat_NV12, 0, 0, 0))
+		, m_stride(0)
+		, m_cbBuffer(0)
+	{
+	}
+
+	bool FrameSource::SetConfig(const SourceConfig &config)
+	{
+		if (config.width == 0 || config.height == 0 || (config.width & 1) || (config.height & 1) || config.frameRate == 0)
+		{
+			return false;
+		}
+
+		const bool fPlanar = (config.format == SourceFormat_NV12);
+		const uint64_t stride = (fPlanar ? (uint64_t)config.width : (uint64_t)config.width * 2) + config.cbPadding;
+		const uint64_t cRows = fPlanar ? (uint64_t)config.height * 3 / 2 : config.height;
+		if (stride * cRows > UINT32_MAX)
+		{
+			return false;
+		}
+
+		m_config = config;
+		m_stride = (ptrdiff_t)stride;
+		m_cbBuffer = (size_t)(stride * cRows);
+		return true;
+	}
+
+	int64_t FrameSource::GetFrameTime(uint64_t iFrame) const
+	{
+		return (int64_t)(iFrame * 10000000 / m_config.frameRate);
+	}
+
+	int64_t FrameSource::GetFrameDuration() const
+	{
+		return 10000000 / m_config.frameRate;
+	}
+
+	void FrameSource::RenderFrame(uint64_t iFrame, uint8_t *pBuffer) const
+	{
+		const uint32_t width = m_config.width;
+		const uint32_t height = m_config.height;
+
+		// The boxes of the frame, from the seed and the frame number.
+		Box boxes[BOX_COUNT];
+		if (m_config.content == SourceContent_MovingObjects)
+		{
+			for (uint32_t i = 0; i < BOX_COUNT; i++)
+			{
+				const uint64_t bits = MixBits(((uint64_t)m_config.seed << 8) + i);
+				boxes[i].width = ((width / 8 + (width / 32) * i) & ~1u) + 2;
+				boxes[i].height = ((height / 6) & ~1u) + 2;
+				boxes[i].width = boxes[i].width < width ? boxes[i].width : width;
+				boxes[i].height = boxes[i].height < height ? boxes[i].height : height;
+				boxes[i].left = Bounce(bits & 0xFFFF, 2 + ((bits >> 16) & 7), iFrame, width - boxes[i].width);
+				boxes[i].top = Bounce((bits >> 24) & 0xFFFF, 1 + ((bits >> 40) & 3), iFrame, height - boxes[i].height);
+				boxes[i].pColor = COLOR_BARS[1 + i];
+			}
+		}
+
+		std::vector<uint8_t> rows(width * 2);
+		uint8_t *pY = &rows[0];
+		uint8_t *pU = pY + width;
+		uint8_t *pV = pU + width / 2;
+
+		for (uint32_t y = 0; y < height; y++)
+		{
+			RenderRow(iFrame, y, boxes, pY, pU, pV);
+
+			uint8_t *pRow = pBuffer + y * m_stride;
+			switch (m_config.format)
+			{
+			case SourceFormat_NV12:
+				memcpy(pRow, pY, width);
+				if ((y & 1) == 0)
+				{
+					// The chroma of a row pair is the chroma of its first row.
+					uint8_t *pUV = pBuffer + height * m_stride + (y / 2) * m_stride;
+					for (uint32_t x = 0; x < width / 2; x++)
+					{
+						pUV[2 * x] = pU[x];
+						pUV[2 * x + 1] = pV[x];
+					}
+				}
+				break;
+
+			case SourceFormat_YUY2:
+				for (uint32_t x = 0; x < width / 2; x++)
+				{
+					pRow[4 * x] = pY[2 * x];
+					pRow[4 * x + 1] = pU[x];
+					pRow[4 * x + 2] = pY[2 * x + 1];
+					pRow[4 * x + 3] = pV[x];
+				}
+				break;
+
+			case SourceFormat_UYVY:
+				for (uint32_t x = 0; x < width / 2; x++)
+				{
+					pRow[4 * x] = pU[x];
+					pRow[4 * x + 1] = pY[2 * x];
+					pRow[4 * x + 2] = pV[x];
+					pRow[4 * x + 3] = pY[2 * x + 1];
+				}
+				break;
+			}
+		}
+	}
+
+	// Renders row y of the content: width luma samples and width / 2 samples
+	// of each chroma component.
+
+	void FrameSource::RenderRow(uint64_t iFrame, uint32_t y, const Box *pBoxes, uint8_t *pY, uint8_t *pU, uint8_t *pV) const
+	{
+		const uint32_t width = m_config.width;
+		const uint32_t height = m_config.height;
+		const uint32_t cChroma = width / 2;
+
+		switch (m_config.content)
+		{
+		case SourceContent_Gradient:
+		{
+			// A diagonal ramp over the video range that scrolls left, with
+			// chroma rising across and down the frame.
+			const uint64_t period = (uint64_t)width + height;
+			for (uint32_t x = 0; x < width; x++)
+			{
+				pY[x] = (uint8_t)(16 + ((x + y + iFrame) % period) * 219 / period);
+			}
+			for (uint32_t x = 0; x < cChroma; x++)
+			{
+				pU[x] = (uint8_t)(16 + (uint64_t)x * 224 / cChroma);
+				pV[x] = (uint8_t)(16 + (uint64_t)y * 224 / height);
+			}
+			break;
+		}
+
+		case SourceContent_Noise:
+		{
+			uint64_t state = MixBits(MixBits(((uint64_t)m_config.seed << 32) ^ iFrame) ^ y) | 1;
+			FillRandom(&state, pY, width);
+			FillRandom(&state, pU, cChroma);
+			FillRandom(&state, pV, cChroma);
+			break;
+		}
+
+		case SourceContent_MovingObjects:
+		{
+			// A dim vertical gradient with the boxes over it.
+			memset(pY, (int)(40 + (uint64_t)y * 120 / height), width);
+			memset(pU, 128, cChroma);
+			memset(pV, 128, cChroma);
+
+			for (uint32_t i = 0; i < BOX_COUNT; i++)
+			{
+				const Box &box = pBoxes[i];
+				if (y < box.top || y >= box.top + box.height)
+				{
+					continue;
+				}
+				memset(pY + box.left, box.pColor[0], box.width);
+				memset(pU + box.left / 2, box.pColor[1], box.width / 2);
+				memset(pV + box.left / 2, box.pColor[2], box.width / 2);
+			}
+			break;
+		}
+
+		case SourceContent_Static:
+		{
+			for (uint32_t x = 0; x < width; x++)
+			{
+				pY[x] = COLOR_BARS[(uint64_t)x * 8 / width][0];
+			}
+			for (uint32_t x = 0; x < cChroma; x++)
+			{
+				const uint8_t *pColor = COLOR_BARS[(uint64_t)x * 8 / cChroma];
+				pU[x] = pColor[1];
+				pV[x] = pColor[2];
+			}
+			break;
+		}
+		}
+	}
+
+	bool FrameSource::WrapFrame(uint8_t *pBuffer, VideoFrame *pFrame) const
+	{
+		PixelFormat format;
+		switch (m_config.format)
+		{
+		case SourceFormat_NV12:
+			format = PixelFormat_NV12;
+			break;
+
+		case SourceFormat_YUY2:
+			format = PixelFormat_YUY2;
+			break;
+
+		default:
+			return false;
+		}
+
+		return WrapVideoFrame(format, m_config.width, m_config.height, pBuffer, m_stride, pBuffer, m_cbBuffer, pFrame);
+	}
+
+	void ConvertUyvyToYuy2(
+		const uint8_t *pSrc, ptrdiff_t srcStride,
+		uint8_t *pDst, ptrdiff_t dstStride,
+		uint32_t width, uint32_t height)
+	{
+		for (uint32_t y = 0; y < height; y++)
+		{
+			const uint8_t *pSrcRow = pSrc + y * srcStride;
+			uint8_t *pDstRow = pDst + y * dstStride;
+			for (uint32_t x = 0; x < width / 2; x++)
+			{
+				pDstRow[4 * x] = pSrcRow[4 * x + 1];
+				pDstRow[4 * x + 1] = pSrcRow[4 * x];
+				pDstRow[4 * x + 2] = pSrcRow[4 * x + 3];
+				pDstRow[4 * x + 3] = pSrcRow[4 * x + 2];
+			}
+		}
+	}
+}
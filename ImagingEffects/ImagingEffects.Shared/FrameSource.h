@@ -0,0 +1,106 @@
+#pragma once
+
+// Generated camera frames, for exercising the effects without a camera.
+//
+// A FrameSource stands in for a capture device: it renders frame n of a
+// stream of the configured format, size, frame rate and content into a
+// buffer laid out as a camera driver would, with optional padding at the
+// end of each row. The contents are chosen to stress the filters in
+// different ways:
+//
+//   Gradient        Smooth ramps scrolling one pixel per frame.
+//   Noise           Random bytes, different in every frame; nothing is
+//                   predictable and every table entry is hit.
+//   MovingObjects   Coloured boxes bouncing over a still background.
+//   Static          Colour bars, the same in every frame.
+//
+// Frames are a function of their number and the seed only, so a frame can
+// be rendered again, on any thread, and comes out the same. RenderFrame does
+// not change the source, so several threads may render at once.
+//
+// UYVY (packed U0 Y0 V0 Y1) is generated for consumers that read it; the
+// effects, like the transform, take NV12 and YUY2, and ConvertUyvyToYuy2
+// reorders UYVY frames for them.
+//
+// This file does not depend on Windows headers.
+
+#include "VideoFrame.h"
+
+namespace ImagingEffects
+{
+	enum SourceFormat
+	{
+		SourceFormat_NV12,
+		SourceFormat_YUY2,
+		SourceFormat_UYVY
+	};
+
+	enum SourceContent
+	{
+		SourceContent_Gradient,
+		SourceContent_Noise,
+		SourceContent_MovingObjects,
+		SourceContent_Static
+	};
+
+	struct SourceConfig
+	{
+		SourceFormat format;
+		uint32_t width;                 // In pixels; even.
+		uint32_t height;                // Even.
+		uint32_t frameRate;             // Frames per second; sets the time stamps.
+		uint32_t cbPadding;             // Bytes added to the end of each row.
+		SourceContent content;
+		uint32_t seed;                  // Varies the noise and the objects.
+	};
+
+	// A gradient of the format and size at the frame rate, without padding.
+	SourceConfig MakeSourceConfig(SourceFormat format, uint32_t width, uint32_t height, uint32_t frameRate);
+
+	// FrameSource class:
+	// Renders the frames of a synthetic stream.
+
+	class FrameSource
+	{
+	public:
+		FrameSource();
+
+		// Returns false, and keeps the previous configuration, if the size is
+		// odd or zero, the frame rate zero, or a frame would not fit in 32 bits.
+		bool SetConfig(const SourceConfig &config);
+		const SourceConfig& GetConfig() const { return m_config; }
+
+		// Bytes from one row to the next, padding included.
+		ptrdiff_t GetStride() const { return m_stride; }
+
+		// Bytes of a frame: the rows of every plane, planes one after another.
+		size_t GetBufferSize() const { return m_cbBuffer; }
+
+		// Time stamp of a frame, in 100-nanosecond units, and frame duration.
+		int64_t GetFrameTime(uint64_t iFrame) const;
+		int64_t GetFrameDuration() const;
+
+		// Renders a frame into a buffer of GetBufferSize() bytes. Padding
+		// bytes are left as they are.
+		void RenderFrame(uint64_t iFrame, uint8_t *pBuffer) const;
+
+		// Describes a buffer holding a rendered frame. Returns false for UYVY,
+		// which has no PixelFormat.
+		bool WrapFrame(uint8_t *pBuffer, VideoFrame *pFrame) const;
+
+	private:
+		struct Box;
+
+		void RenderRow(uint64_t iFrame, uint32_t y, const Box *pBoxes, uint8_t *pY, uint8_t *pU, uint8_t *pV) const;
+
+		SourceConfig m_config;
+		ptrdiff_t m_stride;
+		size_t m_cbBuffer;
+	};
+
+	// Reorders packed 4:2:2 rows from U0 Y0 V0 Y1 to Y0 U0 Y1 V0.
+	void ConvertUyvyToYuy2(
+		const uint8_t *pSrc, ptrdiff_t srcStride,
+		uint8_t *pDst, ptrdiff_t dstStride,
+		uint32_t width, uint32_t height);
+}
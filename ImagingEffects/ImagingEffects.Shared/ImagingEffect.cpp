@@ -10,6 +10,9 @@
 #include "ImagingEffect.h"
 #include "VideoBufferLock.h"
 #include "NativeBuffer.h"
+#include "PooledBuffer.h"
+#include "SampleFrameLock.h"
+#include "TraceRecorder.h"
 
 //include use to acces IBuffer memory
 #include <wrl.h>
@@ -19,6 +22,8 @@
 #include <map>
 #include <sstream>		
 #include <algorithm>  //for str.remove
+#include <thread>
+#include <ppl.h>
 
 
 #pragma comment(lib, "d2d1")
@@ -47,6 +52,10 @@ const GUID g_MediaSubtypes[] =
 
 DWORD GetImageSize(DWORD fcc, UINT32 width, UINT32 height);
 LONG GetDefaultStride(IMFMediaType *pType);
+void CopySampleTimes(IMFSample *pSrc, IMFSample *pDest);
+
+// Default number of frames in flight in asynchronous mode.
+const DWORD DEFAULT_FRAMES_IN_FLIGHT = 3;
 
 template <typename T>
 inline T clamp(const T &val, const T &minVal, const T &maxVal)
@@ -54,43 +63,6 @@ inline T clamp(const T &val, const T &minVal, const T &maxVal)
 	return (val < minVal ? minVal : (val > maxVal ? maxVal : val));
 }
 
-//-------------------------------------------------------------------
-// Functions to convert a YUV images to grayscale.
-//
-// In all cases, the same transformation is applied to the 8-bit
-// chroma values, but the pixel layout in memory differs.
-//
-// The image conversion functions take the following parameters:
-//
-// mat               Transfomation matrix for chroma values.
-// rcDest            Destination rectangle.
-// pDest             Pointer to the destination buffer.
-// lDestStride       Stride of the destination buffer, in bytes.
-// pSrc              Pointer to the source buffer.
-// lSrcStride        Stride of the source buffer, in bytes.
-// dwWidthInPixels   Frame width in pixels.
-// dwHeightInPixels  Frame height, in pixels.
-//-------------------------------------------------------------------
-
-
-Nokia::Graphics::Imaging::Bitmap^ AsBitmapYUY2(const unsigned char* source, unsigned int width, unsigned int height)
-{
-	int totalDimensionLength = width * height;
-
-	int size = totalDimensionLength * 4; //YUY2 buffer will be returned from the camera.
-
-	ComPtr<ImagingEffects::NativeBuffer> nativeBuffer;
-	MakeAndInitialize<ImagingEffects::NativeBuffer>(&nativeBuffer, (byte *)source, size);
-	auto iinspectable = (IInspectable *)reinterpret_cast<IInspectable *>(nativeBuffer.Get());
-	IBuffer ^buffer = reinterpret_cast<IBuffer ^>(iinspectable);
-
-	nativeBuffer = nullptr;
-
-	return ref new Bitmap(Windows::Foundation::Size((float)width, (float)height), ColorMode::Yuv422_Y1UY2V, 2 * width, buffer);
-}
-
-
-
 Array<BYTE>^ MakeManagedArray(const BYTE* input, int len)
 {
 	Array<BYTE>^ result = ref new Array<BYTE>(len);
@@ -136,42 +108,6 @@ static BYTE clip(int i)
 	return i;
 }
 
-Nokia::Graphics::Imaging::Bitmap^ AsBitmapNV12(const unsigned char* source, unsigned int width, unsigned int height)
-{
-	int totalDimensionLength = width * height;
-
-	//Y buffer will be having a length of Width x Height
-	int yBufferLength = totalDimensionLength;
-
-	//UV Buffer will be Width/2 and Height/2 and each will take 2 bytes
-	int UVLength = (int)((double)totalDimensionLength / 2);
-
-	int size = yBufferLength + UVLength; //NV12 buffer will be returned from the camera.
-
-	ComPtr<ImagingEffects::NativeBuffer> nativeBuffer;
-	MakeAndInitialize<ImagingEffects::NativeBuffer>(&nativeBuffer, (byte *)source, yBufferLength);
-	auto iinspectable = (IInspectable *)reinterpret_cast<IInspectable *>(nativeBuffer.Get());
-	IBuffer ^bufferY = reinterpret_cast<IBuffer ^>(iinspectable);
-
-	MakeAndInitialize<ImagingEffects::NativeBuffer>(&nativeBuffer, (byte *)source + yBufferLength, UVLength);
-	iinspectable = (IInspectable *)reinterpret_cast<IInspectable *>(nativeBuffer.Get());
-	IBuffer ^bufferUV = reinterpret_cast<IBuffer ^>(iinspectable);
-
-	nativeBuffer = nullptr;
-
-	Platform::Array<unsigned int, 1U>^ inputScanlines = ref new Platform::Array<unsigned int>(2);      // for NV12 2 planes Y and UV.
-	Platform::Array<IBuffer^, 1U>^ inputBuffers = ref new Platform::Array<IBuffer^>(2);
-
-	//setting the input Buffers according to NV12 format
-	inputBuffers[0] = bufferY;
-	inputBuffers[1] = bufferUV;
-
-	inputScanlines[0] = (unsigned int)width; // YBuffer,  w items of 1 byte long
-	inputScanlines[1] = (unsigned int)width; // UVBuffer, Each UV is 2 bytes long, and there are w/2 of them.
-
-	return ref new Bitmap(Windows::Foundation::Size((float)width, (float)height), ColorMode::Yuv420Sp, inputScanlines, inputBuffers);
-}
-
 inline void ThrowIfFailed(HRESULT hr)
 {
 	if (FAILED(hr))
@@ -196,77 +132,261 @@ unsigned char* FromIBuffer(Windows::Storage::Streams::IBuffer^ outputBuffer)
 }
 
 
-// Convert YUY2 image.
+// Run the bands of a frame on the PPL scheduler. parallel_for returns once
+// every band is done.
 
-void TransformImage_YUY2(
-	const D2D_RECT_U &rcDest,
-	_Inout_updates_(_Inexpressible_(lDestStride * dwHeightInPixels)) BYTE *pDest,
-	_In_ LONG lDestStride,
-	_In_reads_(_Inexpressible_(lSrcStride * dwHeightInPixels)) const BYTE *pSrc,
-	_In_ LONG lSrcStride,
-	_In_ DWORD dwWidthInPixels,
-	_In_ DWORD dwHeightInPixels,
-	IVector<IImageProvider^>^ providers)
+void RunBandsInParallel(size_t cItems, const std::function<void(size_t)> &fn)
 {
-	auto size = Windows::Foundation::Size(dwWidthInPixels, dwHeightInPixels);
-	auto totalbytes = (int)dwHeightInPixels * (int)dwWidthInPixels * 2;  //each macropixel of 4 bytes creates 2 pixels (YUYV)
+	parallel_for(size_t(0), cItems, fn);
+}
+
+// Read a number from a filter description, whatever numeric type it was
+// boxed as (C# passes double, C++ often float or int).
+
+static float GetNumberProperty(IMap<String^, Object^>^ desc, String^ key, float defaultValue)
+{
+	if (!desc->HasKey(key))
+	{
+		return defaultValue;
+	}
+
+	auto value = safe_cast<Windows::Foundation::IPropertyValue^>(desc->Lookup(key));
+	switch (value->Type)
+	{
+	case Windows::Foundation::PropertyType::Double:
+		return (float)value->GetDouble();
+	case Windows::Foundation::PropertyType::Single:
+		return value->GetSingle();
+	case Windows::Foundation::PropertyType::Int32:
+		return (float)value->GetInt32();
+	case Windows::Foundation::PropertyType::UInt32:
+		return (float)value->GetUInt32();
+	case Windows::Foundation::PropertyType::Int64:
+		return (float)value->GetInt64();
+	default:
+		throw ref new InvalidArgumentException();
+	}
+}
+
+// Read a 256-entry curve (byte array) from a filter description. Returns
+// false if the key is not present.
+
+static bool GetCurveProperty(IMap<String^, Object^>^ desc, String^ key, BYTE *pTable)
+{
+	if (!desc->HasKey(key))
+	{
+		return false;
+	}
+
+	Platform::Array<BYTE>^ table = nullptr;
+	safe_cast<Windows::Foundation::IPropertyValue^>(desc->Lookup(key))->GetUInt8Array(&table);
+	if (table == nullptr || table->Length != 256)
+	{
+		throw ref new InvalidArgumentException();
+	}
+
+	memcpy(pTable, table->Data, 256);
+	return true;
+}
+
+// Read a 3D lookup table from a filter description: either the text of a
+// .cube file ("Cube"), or the number of points per axis ("Size") and the
+// RGB values, red changing fastest ("Data").
+
+static std::shared_ptr<ImagingEffects::ColorCube> GetColorCubeProperty(IMap<String^, Object^>^ desc)
+{
+	std::shared_ptr<ImagingEffects::ColorCube> cube;
+
+	if (desc->HasKey(L"Cube"))
+	{
+		// .cube files are ASCII.
+		String^ text = safe_cast<String^>(desc->Lookup(L"Cube"));
+		std::string ascii(text->Length(), ' ');
+		for (unsigned int i = 0; i < text->Length(); i++)
+		{
+			wchar_t c = text->Data()[i];
+			ascii[i] = (c < 128) ? (char)c : '?';
+		}
+		cube = ImagingEffects::ColorCube::Parse(ascii);
+	}
+	else
+	{
+		auto size = (UINT32)GetNumberProperty(desc, L"Size", 0.0f);
+		auto data = safe_cast<Windows::Foundation::IPropertyValue^>(desc->Lookup(L"Data"));
+		std::vector<float> rgb;
 
-	Nokia::Graphics::Imaging::Bitmap^ m_BitmapToProcess = AsBitmapYUY2(pSrc, (unsigned int)size.Width, (unsigned int)size.Height);
+		if (data->Type == Windows::Foundation::PropertyType::SingleArray)
+		{
+			Platform::Array<float>^ values = nullptr;
+			data->GetSingleArray(&values);
+			rgb.assign(values->begin(), values->end());
+		}
+		else
+		{
+			Platform::Array<double>^ values = nullptr;
+			data->GetDoubleArray(&values);
+			rgb.assign(values->begin(), values->end());
+		}
+		cube = ImagingEffects::ColorCube::Create(size, rgb.data(), rgb.size());
+	}
 
-	BitmapImageSource^ source = ref new BitmapImageSource(m_BitmapToProcess);
-	auto first = providers->GetAt(0);
-	((IImageConsumer^)first)->Source = source;
+	if (!cube)
+	{
+		throw ref new InvalidArgumentException();
+	}
+	return cube;
+}
 
-	auto last = providers->GetAt(providers->Size - 1);
+// Turn one entry of "NativeFilters" into a filter. The "Type" key selects
+// the filter; the other keys are its parameters.
 
-	BitmapRenderer^ renderer = ref new BitmapRenderer(last, AsBitmapYUY2(pDest, (unsigned int)size.Width, (unsigned int)size.Height));
+static ImagingEffects::NativeFilter ParseNativeFilter(IMap<String^, Object^>^ desc)
+{
+	String^ type = safe_cast<String^>(desc->Lookup(L"Type"));
 
-	auto renderOp = renderer->RenderAsync();
-	auto renderTask = create_task(renderOp);
+	if (type == L"Grayscale")
+	{
+		return ImagingEffects::MakeGrayscaleFilter();
+	}
+	else if (type == L"Sepia")
+	{
+		return ImagingEffects::MakeSepiaFilter(GetNumberProperty(desc, L"Intensity", 1.0f));
+	}
+	else if (type == L"BrightnessContrastSaturation")
+	{
+		return ImagingEffects::MakeBrightnessContrastSaturationFilter(
+			GetNumberProperty(desc, L"Brightness", 0.0f),
+			GetNumberProperty(desc, L"Contrast", 1.0f),
+			GetNumberProperty(desc, L"Saturation", 1.0f));
+	}
+	else if (type == L"Curves")
+	{
+		BYTE tables[3][256];
+		bool fY = GetCurveProperty(desc, L"Y", tables[0]);
+		bool fU = GetCurveProperty(desc, L"U", tables[1]);
+		bool fV = GetCurveProperty(desc, L"V", tables[2]);
+		return ImagingEffects::MakeCurvesFilter(fY ? tables[0] : nullptr, fU ? tables[1] : nullptr, fV ? tables[2] : nullptr);
+	}
+	else if (type == L"Vignette")
+	{
+		return ImagingEffects::MakeVignetteFilter(
+			GetNumberProperty(desc, L"Radius", 0.5f),
+			GetNumberProperty(desc, L"Strength", 0.5f));
+	}
+	else if (type == L"Lut3D")
+	{
+		return ImagingEffects::MakeLut3DFilter(GetColorCubeProperty(desc));
+	}
 
-	renderTask.wait();
+	throw ref new InvalidArgumentException();
 }
 
-// Convert NV12 image
+// Turn a list of filter descriptions ("NativeFilters" or
+// "FallbackNativeFilters") into filters.
 
-void TransformImage_NV12(
-	const D2D_RECT_U &rcDest,
-	_Inout_updates_(_Inexpressible_(2 * lDestStride * dwHeightInPixels)) BYTE *pDest,
-	_In_ LONG lDestStride,
-	_In_reads_(_Inexpressible_(2 * lSrcStride * dwHeightInPixels)) const BYTE *pSrc,
-	_In_ LONG lSrcStride,
-	_In_ DWORD dwWidthInPixels,
-	_In_ DWORD dwHeightInPixels,
-	IVector<IImageProvider^>^ providers)
+static void ParseNativeFilterList(Object^ value, std::vector<ImagingEffects::NativeFilter> *pFilters)
 {
-	auto size = Windows::Foundation::Size(dwWidthInPixels, dwHeightInPixels);
-	auto totalbytes = (int)dwHeightInPixels * (int)dwWidthInPixels * 3 / 2;
+	auto filters = safe_cast<IIterable<Object^>^>(value);
+	for (auto it = filters->First(); it->HasCurrent; it->MoveNext())
+	{
+		pFilters->push_back(ParseNativeFilter(safe_cast<IMap<String^, Object^>^>(it->Current)));
+	}
+}
 
-	Nokia::Graphics::Imaging::Bitmap^ m_BitmapToProcess = AsBitmapNV12(pSrc, (unsigned int)size.Width, (unsigned int)size.Height);
+// Read the late-frame policy. "LateFrames" says what to do with a frame that
+// would be shown too late:
+//
+//   "Process"       Nothing; every frame gets the full chain (default).
+//   "Degrade"       Use the "FallbackNativeFilters" chain.
+//   "PassThrough"   Use the fallback chain if there is one, else show the
+//                   frame unmodified.
+//   "Drop"          Use the fallback chain if there is one, else drop the
+//                   frame, but never more than "MaxConsecutiveDrops" in a row.
+//
+// "MaxLatencyMs" is how late a frame may be; by default one frame duration.
 
-	BitmapImageSource^ source = ref new BitmapImageSource(m_BitmapToProcess);
-	auto first = providers->GetAt(0);
-	((IImageConsumer^)first)->Source = source;
+static ImagingEffects::SchedulerPolicy ParseSchedulerPolicy(IPropertySet^ properties)
+{
+	ImagingEffects::SchedulerPolicy policy = ImagingEffects::MakeDefaultSchedulerPolicy();
 
-	auto last = providers->GetAt(providers->Size - 1);
+	String^ lateFrames = properties->HasKey(L"LateFrames") ? safe_cast<String^>(properties->Lookup(L"LateFrames")) : L"Process";
+	if (lateFrames == L"Process")
+	{
+		policy.fEnabled = false;
+	}
+	else if (lateFrames == L"Degrade")
+	{
+		policy.fEnabled = true;
+		policy.fAllowPassThrough = false;
+		policy.fAllowDrop = false;
+	}
+	else if (lateFrames == L"PassThrough")
+	{
+		policy.fEnabled = true;
+		policy.fAllowPassThrough = true;
+		policy.fAllowDrop = false;
+	}
+	else if (lateFrames == L"Drop")
+	{
+		policy.fEnabled = true;
+		policy.fAllowPassThrough = false;
+		policy.fAllowDrop = true;
+	}
+	else
+	{
+		throw ref new InvalidArgumentException();
+	}
 
-	//BitmapRenderer^ renderer = ref new BitmapRenderer(last, ColorMode::Yuv420Sp);
-	BitmapRenderer^ renderer = ref new BitmapRenderer(last, AsBitmapNV12(pDest, (unsigned int)size.Width, (unsigned int)size.Height));
+	if (properties->HasKey(L"MaxLatencyMs"))
+	{
+		int maxLatencyMs = safe_cast<int>(properties->Lookup(L"MaxLatencyMs"));
+		if (maxLatencyMs < 0)
+		{
+			throw ref new InvalidArgumentException();
+		}
+		policy.hnsMaxLatency = (int64_t)maxLatencyMs * 10000;
+	}
 
-	auto renderOp = renderer->RenderAsync();
-	auto renderTask = create_task(renderOp);
+	if (properties->HasKey(L"MaxConsecutiveDrops"))
+	{
+		int cMaxDrops = safe_cast<int>(properties->Lookup(L"MaxConsecutiveDrops"));
+		if (cMaxDrops < 0)
+		{
+			throw ref new InvalidArgumentException();
+		}
+		policy.cMaxConsecutiveDrops = (uint32_t)cMaxDrops;
+	}
 
-	renderTask.wait();
+	return policy;
 }
 
 CImagingEffect::CImagingEffect()
-	: m_pTransformFn(nullptr)
+	: m_critSec("CImagingEffect")
+	, m_pixelFormat(ImagingEffects::PixelFormat_NV12)
+	, m_yuvMatrix(ImagingEffects::YuvMatrix_BT601)
+	, m_yuvRange(ImagingEffects::YuvRange_Video)
 	, m_imageWidthInPixels(0)
 	, m_imageHeightInPixels(0)
 	, m_cbImageSize(0)
-	, m_rcDest(D2D1::RectU())
 	, m_fStreamingInitialized(false)
+	, m_fRendering(false)
+	, m_cFlushes(0)
+	, m_fAsync(false)
+	, m_fDraining(false)
+	, m_fShutdown(false)
+	, m_cNeedInputPending(0)
+	, m_cAsyncRenders(0)
+	, m_inFlight(DEFAULT_FRAMES_IN_FLIGHT)
+	, m_fProvideSamples(false)
+	, m_spFramePool(std::make_shared<ImagingEffects::FramePool>())
+	, m_cbCopied(0)
+	, m_fInPlace(false)
+	, m_fBypass(true)
+	, m_cChainsPublished(0)
+	, m_spSdkLock(std::make_shared<CritSec>("CImagingEffect::SdkLock"))
+	, m_engine(RunBandsInParallel)
 {
+	PublishStreamTypes();
 }
 
 CImagingEffect::~CImagingEffect()
@@ -277,7 +397,15 @@ CImagingEffect::~CImagingEffect()
 STDMETHODIMP CImagingEffect::RuntimeClassInitialize()
 {
 	// Create the attribute store.
-	return MFCreateAttributes(&m_spAttributes, 3);
+	HRESULT hr = MFCreateAttributes(&m_spAttributes, 3);
+
+	// Create the event queue used in asynchronous mode.
+	if (SUCCEEDED(hr))
+	{
+		hr = MFCreateEventQueue(&m_spEventQueue);
+	}
+
+	return hr;
 }
 
 // IMediaExtension methods
@@ -293,7 +421,182 @@ HRESULT CImagingEffect::SetProperties(ABI::Windows::Foundation::Collections::IPr
 	try
 	{
 		IPropertySet^ properties = reinterpret_cast<IPropertySet^>(pConfiguration);
-		m_imageProviders = safe_cast<IVector<IImageProvider^>^>(properties->Lookup(L"IImageProviders"));
+
+		// "IImageProviders" is an SDK effect chain; "NativeFilters" is a list of
+		// property sets describing built-in filters. With neither, the MFT is
+		// bypassed: samples go through untouched, without a copy.
+		IVector<IImageProvider^>^ imageProviders = nullptr;
+		std::vector<ImagingEffects::NativeFilter> nativeFilters;
+
+		if (properties->HasKey(L"IImageProviders"))
+		{
+			imageProviders = safe_cast<IVector<IImageProvider^>^>(properties->Lookup(L"IImageProviders"));
+		}
+
+		if (properties->HasKey(L"NativeFilters"))
+		{
+			ParseNativeFilterList(properties->Lookup(L"NativeFilters"), &nativeFilters);
+		}
+
+		const bool fBypass = (imageProviders == nullptr || imageProviders->Size == 0) && nativeFilters.empty();
+		if (fBypass)
+		{
+			imageProviders = nullptr;
+		}
+
+		// "FallbackNativeFilters" is a cheaper chain for frames that are late.
+		std::vector<ImagingEffects::NativeFilter> fallbackFilters;
+		if (properties->HasKey(L"FallbackNativeFilters"))
+		{
+			ParseNativeFilterList(properties->Lookup(L"FallbackNativeFilters"), &fallbackFilters);
+		}
+
+		ImagingEffects::SchedulerPolicy policy = ParseSchedulerPolicy(properties);
+		if (policy.fEnabled && !policy.fAllowPassThrough && !policy.fAllowDrop && fallbackFilters.empty())
+		{
+			throw ref new InvalidArgumentException();   // "Degrade" needs a fallback chain.
+		}
+
+		// "Record" is the path of a file to record the stream to: the input
+		// of every rendered frame, with its time stamps, and the native part
+		// of each configuration, for replaying with effectreplay. An empty
+		// path stops recording. The file is closed when the last frame
+		// recorded into it is done.
+		bool fSetRecorder = false;
+		std::shared_ptr<ImagingEffects::FrameRecordWriter> spNewRecorder;
+		if (properties->HasKey(L"Record"))
+		{
+			String^ path = safe_cast<String^>(properties->Lookup(L"Record"));
+			fSetRecorder = true;
+			if (!path->IsEmpty())
+			{
+				FILE *pFile = nullptr;
+				if (_wfopen_s(&pFile, path->Data(), L"wb") != 0)
+				{
+					ThrowException(E_ACCESSDENIED);
+				}
+				spNewRecorder = std::make_shared<ImagingEffects::FrameRecordWriter>();
+				if (!spNewRecorder->Open(pFile))
+				{
+					ThrowException(E_FAIL);
+				}
+			}
+		}
+
+		ImagingEffects::StreamFormat format;
+		std::shared_ptr<EffectChain> spCurrent;
+		bool fStreaming = false;
+		bool fInPlace = false;
+		{
+			AutoLock lock(m_critSec, __FUNCTION__);
+
+			// "FramesInFlight" switches the MFT to asynchronous mode with up to N
+			// frames being rendered while the capture thread keeps delivering input.
+			if (properties->HasKey(L"FramesInFlight"))
+			{
+				int cFramesInFlight = safe_cast<int>(properties->Lookup(L"FramesInFlight"));
+				if (cFramesInFlight < 0)
+				{
+					throw ref new InvalidArgumentException();
+				}
+
+				if (HasPendingOutput())
+				{
+					ThrowException(MF_E_INVALIDREQUEST);
+				}
+
+				m_fAsync = (cFramesInFlight > 0);
+				m_inFlight.SetCapacity(m_fAsync ? cFramesInFlight : DEFAULT_FRAMES_IN_FLIGHT);
+				ThrowIfError(m_spAttributes->SetUINT32(MF_TRANSFORM_ASYNC, m_fAsync ? TRUE : FALSE));
+				PublishStreamTypes();
+			}
+
+			// "ProvideSamples" makes the MFT allocate its output samples in
+			// synchronous mode too, from its pool of aligned frames. The client
+			// reads the flag from GetOutputStreamInfo, so set it before streaming.
+			if (properties->HasKey(L"ProvideSamples"))
+			{
+				if (HasPendingOutput())
+				{
+					ThrowException(MF_E_INVALIDREQUEST);
+				}
+				m_fProvideSamples = safe_cast<bool>(properties->Lookup(L"ProvideSamples"));
+				PublishStreamTypes();
+			}
+
+			// "InPlace" lets a chain that can overwrite its source filter the input
+			// sample and send it on as the output, when the MFT provides the
+			// output samples. Only for sources that do not use a sample after
+			// delivering it.
+			if (properties->HasKey(L"InPlace"))
+			{
+				m_fInPlace = safe_cast<bool>(properties->Lookup(L"InPlace"));
+			}
+			fInPlace = m_fInPlace;
+
+			// While streaming, the new chain replaces the current one without
+			// interrupting the stream. It is built for the current format.
+			fStreaming = m_fStreamingInitialized;
+			if (fStreaming)
+			{
+				format = GetChainFormat();
+				spCurrent = m_chain.Acquire();
+			}
+		}
+
+		// Build the new chain outside the lock: frames keep being accepted and
+		// rendered with the current chain meanwhile, and a configuration that
+		// fails to build leaves the stream as it was.
+		std::shared_ptr<EffectChain> spChain;
+		if (fStreaming)
+		{
+			spChain = BuildChain(format, imageProviders, nativeFilters, fallbackFilters, fInPlace);
+		}
+
+		// The configuration goes into the recording ahead of the frames
+		// rendered with it. Frames in flight meanwhile may follow it.
+		std::shared_ptr<ImagingEffects::FrameRecordWriter> spRecorder = fSetRecorder ? spNewRecorder : m_recorder.Acquire();
+		if (spRecorder)
+		{
+			ImagingEffects::EffectConfig config;
+			config.filters = nativeFilters;
+			config.fallbackFilters = fallbackFilters;
+			config.policy = policy;
+			config.fHasSdkEffects = (imageProviders != nullptr);
+			(void)spRecorder->WriteConfig(config);
+		}
+
+		AutoLock lock(m_critSec, __FUNCTION__);
+
+		m_imageProviders = imageProviders;
+		m_nativeFilters.swap(nativeFilters);
+		m_fallbackFilters.swap(fallbackFilters);
+		m_engine.SetSchedulerPolicy(policy);
+		m_fBypass = fBypass;
+		if (fSetRecorder)
+		{
+			m_recorder.Publish(spNewRecorder);
+		}
+
+		// "Trace" turns the event recorder on or off. It serves the whole
+		// process; GetAttributes returns what it holds.
+		if (properties->HasKey(L"Trace"))
+		{
+			ImagingEffects::TraceRecorder::Get().SetEnabled(safe_cast<bool>(properties->Lookup(L"Trace")));
+		}
+
+		// Frames accepted from now on are rendered with the new chain; frames
+		// in flight finish with the chain they were accepted with. If the
+		// stream was restarted or another configuration was published while
+		// the chain was built, it may be out of date: rebuild on the next frame.
+		if (spChain && m_chain.Acquire() == spCurrent)
+		{
+			PublishChain(spChain);
+		}
+		else if (m_chain.Acquire() != spCurrent)
+		{
+			EndStreaming();
+		}
 	}
 	catch (Exception ^exc)
 	{
@@ -393,13 +696,14 @@ HRESULT CImagingEffect::GetInputStreamInfo(
 		return E_POINTER;
 	}
 
-	AutoLock lock(m_critSec);
-
 	if (!IsValidInputStream(dwInputStreamID))
 	{
 		return MF_E_INVALIDSTREAMNUMBER;
 	}
 
+	// Answered from the published snapshot, without waiting for the lock.
+	std::shared_ptr<const StreamTypes> spTypes = m_streamTypes.Acquire();
+
 	// NOTE: This method should succeed even when there is no media type on the
 	//       stream. If there is no media type, we only need to fill in the dwFlags
 	//       member of MFT_INPUT_STREAM_INFO. The other members depend on having a
@@ -408,13 +712,13 @@ HRESULT CImagingEffect::GetInputStreamInfo(
 	pStreamInfo->hnsMaxLatency = 0;
 	pStreamInfo->dwFlags = MFT_INPUT_STREAM_WHOLE_SAMPLES | MFT_INPUT_STREAM_SINGLE_SAMPLE_PER_BUFFER;
 
-	if (m_spInputType == nullptr)
+	if (spTypes->spInputType == nullptr)
 	{
 		pStreamInfo->cbSize = 0;
 	}
 	else
 	{
-		pStreamInfo->cbSize = m_cbImageSize;
+		pStreamInfo->cbSize = spTypes->cbImageSize;
 	}
 
 	pStreamInfo->cbMaxLookahead = 0;
@@ -438,13 +742,14 @@ HRESULT CImagingEffect::GetOutputStreamInfo(
 		return E_POINTER;
 	}
 
-	AutoLock lock(m_critSec);
-
 	if (!IsValidOutputStream(dwOutputStreamID))
 	{
 		return MF_E_INVALIDSTREAMNUMBER;
 	}
 
+	// Answered from the published snapshot, without waiting for the lock.
+	std::shared_ptr<const StreamTypes> spTypes = m_streamTypes.Acquire();
+
 	// NOTE: This method should succeed even when there is no media type on the
 	//       stream. If there is no media type, we only need to fill in the dwFlags
 	//       member of MFT_OUTPUT_STREAM_INFO. The other members depend on having a
@@ -455,16 +760,22 @@ HRESULT CImagingEffect::GetOutputStreamInfo(
 		MFT_OUTPUT_STREAM_SINGLE_SAMPLE_PER_BUFFER |
 		MFT_OUTPUT_STREAM_FIXED_SAMPLE_SIZE;
 
-	if (m_spOutputType == nullptr)
+	if (spTypes->fProvidesSamples)
+	{
+		pStreamInfo->dwFlags |= MFT_OUTPUT_STREAM_PROVIDES_SAMPLES;
+	}
+
+	if (spTypes->spOutputType == nullptr)
 	{
 		pStreamInfo->cbSize = 0;
 	}
 	else
 	{
-		pStreamInfo->cbSize = m_cbImageSize;
+		pStreamInfo->cbSize = spTypes->cbImageSize;
 	}
 
-	pStreamInfo->cbAlignment = 0;
+	// Frames the MFT provides start, and have their rows, on 64-byte boundaries.
+	pStreamInfo->cbAlignment = (pStreamInfo->dwFlags & MFT_OUTPUT_STREAM_PROVIDES_SAMPLES) ? (DWORD)(ImagingEffects::FRAME_POOL_ALIGNMENT - 1) : 0;
 
 	return S_OK;
 }
@@ -482,8 +793,28 @@ HRESULT CImagingEffect::GetAttributes(IMFAttributes **ppAttributes)
 		return E_POINTER;
 	}
 
-	AutoLock lock(m_critSec);
+#ifdef CRITSEC_PROFILING
+	// Let the client read the lock profile with the other counters.
+	std::string profile = LockProfiler::Get().SnapshotJson();
+	(void)m_spAttributes->SetString(IMAGINGEFFECT_LOCK_PROFILE, std::wstring(profile.begin(), profile.end()).c_str());
+#endif
+
+	// Refresh the frame latency. Frames go on being recorded meanwhile.
+	ImagingEffects::LatencySummary latency[ImagingEffects::FrameStage_Count];
+	m_engine.GetLatency(latency);
+	(void)m_spAttributes->SetBlob(IMAGINGEFFECT_FRAME_LATENCY, (const UINT8*)latency, sizeof(latency));
+	(void)m_spAttributes->SetUINT64(IMAGINGEFFECT_FRAME_LATENCY_P50, latency[ImagingEffects::FrameStage_Total].p50);
+	(void)m_spAttributes->SetUINT64(IMAGINGEFFECT_FRAME_LATENCY_P99, latency[ImagingEffects::FrameStage_Total].p99);
+	(void)m_spAttributes->SetUINT64(IMAGINGEFFECT_FRAME_LATENCY_P999, latency[ImagingEffects::FrameStage_Total].p999);
+
+	// The event trace, while it is recorded.
+	if (ImagingEffects::TraceRecorder::Get().IsEnabled())
+	{
+		std::string trace = ImagingEffects::TraceRecorder::Get().DumpJson();
+		(void)m_spAttributes->SetString(IMAGINGEFFECT_TRACE, std::wstring(trace.begin(), trace.end()).c_str());
+	}
 
+	// The attribute store is created with the MFT and locks itself.
 	*ppAttributes = m_spAttributes.Get();
 	(*ppAttributes)->AddRef();
 
@@ -565,15 +896,15 @@ HRESULT CImagingEffect::GetInputAvailableType(
 			throw ref new InvalidArgumentException();
 		}
 
-		AutoLock lock(m_critSec);
-
 		if (!IsValidInputStream(dwInputStreamID))
 		{
 			ThrowException(MF_E_INVALIDSTREAMNUMBER);
 		}
 
+		std::shared_ptr<const StreamTypes> spTypes = m_streamTypes.Acquire();
+
 		// If the output type is set, return that type as our preferred input type.
-		if (m_spOutputType == nullptr)
+		if (spTypes->spOutputType == nullptr)
 		{
 			// The output type is not set. Create a partial media type.
 			*ppType = OnGetPartialType(dwTypeIndex).Detach();
@@ -584,7 +915,7 @@ HRESULT CImagingEffect::GetInputAvailableType(
 		}
 		else
 		{
-			*ppType = m_spOutputType.Get();
+			*ppType = spTypes->spOutputType.Get();
 			(*ppType)->AddRef();
 		}
 	}
@@ -618,14 +949,14 @@ HRESULT CImagingEffect::GetOutputAvailableType(
 			throw ref new InvalidArgumentException();
 		}
 
-		AutoLock lock(m_critSec);
-
 		if (!IsValidOutputStream(dwOutputStreamID))
 		{
 			return MF_E_INVALIDSTREAMNUMBER;
 		}
 
-		if (m_spInputType == nullptr)
+		std::shared_ptr<const StreamTypes> spTypes = m_streamTypes.Acquire();
+
+		if (spTypes->spInputType == nullptr)
 		{
 			// The input type is not set. Create a partial media type.
 			*ppType = OnGetPartialType(dwTypeIndex).Detach();
@@ -636,7 +967,7 @@ HRESULT CImagingEffect::GetOutputAvailableType(
 		}
 		else
 		{
-			*ppType = m_spInputType.Get();
+			*ppType = spTypes->spInputType.Get();
 			(*ppType)->AddRef();
 		}
 	}
@@ -669,7 +1000,7 @@ HRESULT CImagingEffect::SetInputType(
 			throw ref new InvalidArgumentException();
 		}
 
-		AutoLock lock(m_critSec);
+		AutoLock lock(m_critSec, __FUNCTION__);
 
 		if (!IsValidInputStream(dwInputStreamID))
 		{
@@ -734,7 +1065,7 @@ HRESULT CImagingEffect::SetOutputType(
 			return E_INVALIDARG;
 		}
 
-		AutoLock lock(m_critSec);
+		AutoLock lock(m_critSec, __FUNCTION__);
 
 		// Does the caller want us to set the type, or just test it?
 		bool fReallySet = ((dwFlags & MFT_SET_TYPE_TEST_ONLY) == 0);
@@ -786,19 +1117,19 @@ HRESULT CImagingEffect::GetInputCurrentType(
 
 	HRESULT hr = S_OK;
 
-	AutoLock lock(m_critSec);
+	std::shared_ptr<const StreamTypes> spTypes = m_streamTypes.Acquire();
 
 	if (!IsValidInputStream(dwInputStreamID))
 	{
 		hr = MF_E_INVALIDSTREAMNUMBER;
 	}
-	else if (!m_spInputType)
+	else if (!spTypes->spInputType)
 	{
 		hr = MF_E_TRANSFORM_TYPE_NOT_SET;
 	}
 	else
 	{
-		*ppType = m_spInputType.Get();
+		*ppType = spTypes->spInputType.Get();
 		(*ppType)->AddRef();
 	}
 
@@ -823,19 +1154,19 @@ HRESULT CImagingEffect::GetOutputCurrentType(
 
 	HRESULT hr = S_OK;
 
-	AutoLock lock(m_critSec);
+	std::shared_ptr<const StreamTypes> spTypes = m_streamTypes.Acquire();
 
 	if (!IsValidOutputStream(dwOutputStreamID))
 	{
 		hr = MF_E_INVALIDSTREAMNUMBER;
 	}
-	else if (!m_spOutputType)
+	else if (!spTypes->spOutputType)
 	{
 		hr = MF_E_TRANSFORM_TYPE_NOT_SET;
 	}
 	else
 	{
-		*ppType = m_spOutputType.Get();
+		*ppType = spTypes->spOutputType.Get();
 		(*ppType)->AddRef();
 	}
 
@@ -858,7 +1189,7 @@ HRESULT CImagingEffect::GetInputStatus(
 		return E_POINTER;
 	}
 
-	AutoLock lock(m_critSec);
+	AutoLock lock(m_critSec, __FUNCTION__);
 
 	if (!IsValidInputStream(dwInputStreamID))
 	{
@@ -874,7 +1205,8 @@ HRESULT CImagingEffect::GetInputStatus(
 	// samples. For the video effect, each sample is transformed independently, so
 	// there is no reason to queue multiple input samples.
 
-	if (m_spSample == nullptr)
+	// In asynchronous mode up to N samples can be in flight.
+	if (m_fAsync ? !m_inFlight.IsFull() : m_spSample == nullptr)
 	{
 		*pdwFlags = MFT_INPUT_STATUS_ACCEPT_DATA;
 	}
@@ -900,10 +1232,11 @@ HRESULT CImagingEffect::GetOutputStatus(DWORD *pdwFlags)
 		return E_POINTER;
 	}
 
-	AutoLock lock(m_critSec);
+	AutoLock lock(m_critSec, __FUNCTION__);
 
 	// The MFT can produce an output sample if (and only if) there an input sample.
-	if (m_spSample != nullptr)
+	// In asynchronous mode, the oldest frame in flight must have been rendered.
+	if (m_fAsync ? m_inFlight.GetReadyCount() > 0 : m_spSample != nullptr)
 	{
 		*pdwFlags = MFT_OUTPUT_STATUS_SAMPLE_READY;
 	}
@@ -957,7 +1290,7 @@ HRESULT CImagingEffect::ProcessMessage(
 	ULONG_PTR           ulParam
 	)
 {
-	AutoLock lock(m_critSec);
+	AutoLock lock(m_critSec, __FUNCTION__);
 
 	HRESULT hr = S_OK;
 
@@ -972,10 +1305,21 @@ HRESULT CImagingEffect::ProcessMessage(
 
 		case MFT_MESSAGE_COMMAND_DRAIN:
 			// Drain: Tells the MFT to reject further input until all pending samples are
-			// processed. That is our default behavior already, so there is nothing to do.
+			// processed. In synchronous mode that is our default behavior already.
 			//
-			// For a decoder that accepts a queue of samples, the MFT might need to drain
-			// the queue in response to this command.
+			// In asynchronous mode, stop requesting input and signal completion once
+			// the frames in flight have been collected.
+			if (m_fAsync)
+			{
+				if (m_inFlight.IsEmpty())
+				{
+					QueueTransformEvent(METransformDrainComplete);
+				}
+				else
+				{
+					m_fDraining = true;
+				}
+			}
 			break;
 
 		case MFT_MESSAGE_SET_D3D_MANAGER:
@@ -1000,12 +1344,16 @@ HRESULT CImagingEffect::ProcessMessage(
 			EndStreaming();
 			break;
 
-			// The next two messages do not require any action from this MFT.
-
 		case MFT_MESSAGE_NOTIFY_END_OF_STREAM:
 			break;
 
 		case MFT_MESSAGE_NOTIFY_START_OF_STREAM:
+			// An asynchronous MFT asks for its first samples here.
+			if (m_fAsync)
+			{
+				m_fDraining = false;
+				RequestInput();
+			}
 			break;
 		}
 	}
@@ -1030,6 +1378,7 @@ HRESULT CImagingEffect::ProcessInput(
 	)
 {
 	HRESULT hr = S_OK;
+	ImagingEffects::TraceScope scope("ProcessInput");
 
 	try
 	{
@@ -1044,7 +1393,7 @@ HRESULT CImagingEffect::ProcessInput(
 			throw ref new InvalidArgumentException(); // dwFlags is reserved and must be zero.
 		}
 
-		AutoLock lock(m_critSec);
+		AutoLock lock(m_critSec, __FUNCTION__);
 
 		// Validate the input stream number.
 		if (!IsValidInputStream(dwInputStreamID))
@@ -1059,6 +1408,59 @@ HRESULT CImagingEffect::ProcessInput(
 			ThrowException(MF_E_NOTACCEPTING);
 		}
 
+		if (m_fAsync)
+		{
+			CheckAsyncUnlocked();
+
+			// Reserve a slot for the frame; this fails if N frames are in flight.
+			LONGLONG hnsTime = 0;
+			(void)pSample->GetSampleTime(&hnsTime);
+
+			uint64_t ticket = 0;
+			if (m_fDraining || !m_inFlight.Reserve(hnsTime, &ticket))
+			{
+				ThrowException(MF_E_NOTACCEPTING);
+			}
+			ImagingEffects::TraceRecorder::Get().Counter("FramesInFlight", (int64_t)m_inFlight.GetCount());
+
+			if (m_cNeedInputPending > 0)
+			{
+				m_cNeedInputPending--;
+			}
+
+			// Bypassed: the input sample is the output, ready at once.
+			if (m_fBypass)
+			{
+				m_inFlight.Complete(ticket, ComPtr<IMFSample>(pSample));
+				for (size_t cReady = m_inFlight.TakeNewlyReady(); cReady > 0; cReady--)
+				{
+					QueueTransformEvent(METransformHaveOutput);
+				}
+				return S_OK;
+			}
+
+			// Initialize streaming.
+			BeginStreaming();
+
+			// Render on a worker. The capture thread does not wait for it. The
+			// frame is rendered with the chain that is current now, even if
+			// SetProperties replaces it before the worker gets to the frame.
+			ComPtr<CImagingEffect> spThis(this);
+			ComPtr<IMFSample> spInput(pSample);
+			std::shared_ptr<EffectChain> spChain = m_chain.Acquire();
+			create_task([spThis, spInput, ticket, spChain]()
+			{
+				spThis->OnProcessSampleAsync(ticket, spInput.Get(), spChain);
+			});
+
+			// The worker reads the stream format until it takes the lock, so
+			// the format must not change before then, even after a flush.
+			// The count is taken back under the lock as well.
+			m_cAsyncRenders++;
+
+			return S_OK;
+		}
+
 		// Check if an input sample is already queued.
 		if (m_spSample != nullptr)
 		{
@@ -1093,7 +1495,11 @@ HRESULT CImagingEffect::ProcessOutput(
 	)
 {
 	HRESULT hr = S_OK;
-	AutoLock lock(m_critSec);
+	ImagingEffects::TraceScope scope("ProcessOutput");
+	FrameTimes times;
+	const LONGLONG hnsCalled = MFGetSystemTime();
+	AutoLock lock(m_critSec, __FUNCTION__);
+	times.hnsStage[ImagingEffects::FrameStage_LockWait] = MFGetSystemTime() - hnsCalled;
 
 	try
 	{
@@ -1121,14 +1527,40 @@ HRESULT CImagingEffect::ProcessOutput(
 			throw ref new InvalidArgumentException();
 		}
 
-		// It must contain a sample.
-		if (pOutputSamples[0].pSample == nullptr)
+		if (m_fAsync)
 		{
-			throw ref new InvalidArgumentException();
+			CheckAsyncUnlocked();
+
+			// Hand out the oldest rendered frame. Frames leave in input order.
+			ComPtr<IMFSample> spOutput;
+			if (!m_inFlight.PopReady(&spOutput))
+			{
+				return MF_E_TRANSFORM_NEED_MORE_INPUT;
+			}
+
+			pOutputSamples[0].pSample = spOutput.Detach();
+			pOutputSamples[0].dwStatus = 0;
+			*pdwStatus = 0;
+
+			// A slot is free again.
+			if (m_fDraining && m_inFlight.IsEmpty())
+			{
+				m_fDraining = false;
+				QueueTransformEvent(METransformDrainComplete);
+			}
+			else
+			{
+				RequestInput();
+			}
+
+			return S_OK;
 		}
 
-		ComPtr<IMFMediaBuffer> spInput;
-		ComPtr<IMFMediaBuffer> spOutput;
+		// It must contain a sample, unless the MFT provides them.
+		if ((pOutputSamples[0].pSample == nullptr) != m_fProvideSamples)
+		{
+			throw ref new InvalidArgumentException();
+		}
 
 		// There must be an input sample available for processing.
 		if (m_spSample == nullptr)
@@ -1136,45 +1568,191 @@ HRESULT CImagingEffect::ProcessOutput(
 			return MF_E_TRANSFORM_NEED_MORE_INPUT;
 		}
 
+		// Another call is rendering the sample.
+		if (m_fRendering)
+		{
+			return MF_E_INVALIDREQUEST;
+		}
+
+		// Bypassed: hand the input on without touching its pixels.
+		if (m_fBypass)
+		{
+			ComPtr<IMFSample> spOutputSample = BypassFrame(m_spSample.Get(), m_fProvideSamples ? nullptr : pOutputSamples[0].pSample);
+			if (m_fProvideSamples)
+			{
+				pOutputSamples[0].pSample = spOutputSample.Detach();
+			}
+			pOutputSamples[0].dwStatus = 0;
+			*pdwStatus = 0;
+
+			m_spSample.Reset();
+			return S_OK;
+		}
+
 		// Initialize streaming.
 		BeginStreaming();
+		std::shared_ptr<EffectChain> spChain = m_chain.Acquire();
 
-		// Get the input buffer.
-		ThrowIfError(m_spSample->ConvertToContiguousBuffer(&spInput));
-
-		// Get the output buffer.
-		ThrowIfError(pOutputSamples[0].pSample->ConvertToContiguousBuffer(&spOutput));
+		// A frame that is too late may be dropped: the input is consumed
+		// without producing output.
+		ImagingEffects::FrameAction action = ScheduleFrame(m_spSample.Get(), spChain->renderer->HasFallback());
+		if (action == ImagingEffects::FrameAction_Drop)
+		{
+			hr = MF_E_TRANSFORM_NEED_MORE_INPUT;
+		}
+		else
+		{
+			ComPtr<IMFSample> spOutputSample;
+			ComPtr<IMFSample> spInput = m_spSample;
+			const UINT64 cFlushes = m_cFlushes;
+			HRESULT hrRender = S_OK;
+
+			// Render without the lock, so that status queries, messages and
+			// SetProperties do not wait for the frame. m_fRendering keeps the
+			// media types and the sample allocation from changing meanwhile.
+			LONGLONG hnsStart = MFGetSystemTime();
+			LONGLONG hnsRendered = 0;
+			m_fRendering = true;
+			{
+				AutoUnlock unlock(m_critSec);
+				try
+				{
+					spOutputSample = RenderFrame(*spChain, spInput.Get(), m_fProvideSamples ? nullptr : pOutputSamples[0].pSample, action, &times);
+				}
+				catch (Exception ^exc)
+				{
+					hrRender = exc->HResult;
+				}
+				hnsRendered = MFGetSystemTime();
+			}
+			times.hnsStage[ImagingEffects::FrameStage_LockWait] += MFGetSystemTime() - hnsRendered;
+			m_fRendering = false;
+
+			// Flushed while rendering: the frame is discarded, and m_spSample
+			// may already be the next input.
+			if (m_cFlushes != cFlushes)
+			{
+				return MF_E_TRANSFORM_NEED_MORE_INPUT;
+			}
+
+			ThrowIfError(hrRender);
+
+			// Copy the duration and time stamp from the input sample, if present.
+			ImagingEffects::TraceScope stampScope("Stamp");
+			LONGLONG hnsStamp = MFGetSystemTime();
+			CopySampleTimes(m_spSample.Get(), spOutputSample.Get());
+
+			// Set status flags.
+			if (m_fProvideSamples)
+			{
+				pOutputSamples[0].pSample = spOutputSample.Detach();
+			}
+			pOutputSamples[0].dwStatus = 0;
+			*pdwStatus = 0;
+
+			LONGLONG hnsDone = MFGetSystemTime();
+			times.hnsStage[ImagingEffects::FrameStage_Stamp] = hnsDone - hnsStamp;
+			times.hnsStage[ImagingEffects::FrameStage_Total] = hnsDone - hnsCalled;
+			CompleteFrame(action, hnsRendered - hnsStart, times);
+		}
+	}
+	catch (Exception ^exc)
+	{
+		hr = exc->HResult;
+	}
 
-		OnProcessOutput(spInput.Get(), spOutput.Get());
+	m_spSample.Reset(); // Release our input sample.
 
-		// Set status flags.
-		pOutputSamples[0].dwStatus = 0;
-		*pdwStatus = 0;
+	return hr;
+}
 
 
-		// Copy the duration and time stamp from the input sample, if present.
+// IMFMediaEventGenerator methods. The MFT only sends events in asynchronous mode.
 
-		LONGLONG hnsDuration = 0;
-		LONGLONG hnsTime = 0;
+HRESULT CImagingEffect::GetEvent(DWORD dwFlags, IMFMediaEvent **ppEvent)
+{
+	ComPtr<IMFMediaEventQueue> spQueue;
 
-		if (SUCCEEDED(m_spSample->GetSampleDuration(&hnsDuration)))
+	{
+		AutoLock lock(m_critSec, __FUNCTION__);
+		if (m_fShutdown)
 		{
-			ThrowIfError(pOutputSamples[0].pSample->SetSampleDuration(hnsDuration));
+			return MF_E_SHUTDOWN;
 		}
+		spQueue = m_spEventQueue;
+	}
 
-		if (SUCCEEDED(m_spSample->GetSampleTime(&hnsTime)))
-		{
-			ThrowIfError(pOutputSamples[0].pSample->SetSampleTime(hnsTime));
-		}
+	// GetEvent can block, so call it without holding the lock.
+	return spQueue->GetEvent(dwFlags, ppEvent);
+}
+
+HRESULT CImagingEffect::BeginGetEvent(IMFAsyncCallback *pCallback, IUnknown *punkState)
+{
+	AutoLock lock(m_critSec, __FUNCTION__);
+	if (m_fShutdown)
+	{
+		return MF_E_SHUTDOWN;
 	}
-	catch (Exception ^exc)
+	return m_spEventQueue->BeginGetEvent(pCallback, punkState);
+}
+
+HRESULT CImagingEffect::EndGetEvent(IMFAsyncResult *pResult, IMFMediaEvent **ppEvent)
+{
+	AutoLock lock(m_critSec, __FUNCTION__);
+	if (m_fShutdown)
 	{
-		hr = exc->HResult;
+		return MF_E_SHUTDOWN;
 	}
+	return m_spEventQueue->EndGetEvent(pResult, ppEvent);
+}
 
-	m_spSample.Reset(); // Release our input sample.
+HRESULT CImagingEffect::QueueEvent(
+	MediaEventType      met,
+	REFGUID             guidExtendedType,
+	HRESULT             hrStatus,
+	const PROPVARIANT   *pvValue
+	)
+{
+	AutoLock lock(m_critSec, __FUNCTION__);
+	if (m_fShutdown)
+	{
+		return MF_E_SHUTDOWN;
+	}
+	return m_spEventQueue->QueueEventParamVar(met, guidExtendedType, hrStatus, pvValue);
+}
 
-	return hr;
+
+// IMFShutdown methods
+
+HRESULT CImagingEffect::Shutdown()
+{
+	AutoLock lock(m_critSec, __FUNCTION__);
+
+	if (!m_fShutdown)
+	{
+		m_fShutdown = true;
+		m_inFlight.Clear();
+		(void)m_spEventQueue->Shutdown();
+	}
+	return S_OK;
+}
+
+HRESULT CImagingEffect::GetShutdownStatus(MFSHUTDOWN_STATUS *pStatus)
+{
+	if (pStatus == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	AutoLock lock(m_critSec, __FUNCTION__);
+
+	if (!m_fShutdown)
+	{
+		return MF_E_INVALIDREQUEST;
+	}
+
+	*pStatus = MFSHUTDOWN_COMPLETED;
+	return S_OK;
 }
 
 // PRIVATE METHODS
@@ -1310,6 +1888,7 @@ void CImagingEffect::OnSetInputType(IMFMediaType *pmt)
 
 	// Update the format information.
 	UpdateFormatInfo();
+	PublishStreamTypes();
 }
 
 
@@ -1321,6 +1900,7 @@ void CImagingEffect::OnSetOutputType(IMFMediaType *pmt)
 {
 	// If pmt is nullptr, clear the type. Otherwise, set the type.
 	m_spOutputType = pmt;
+	PublishStreamTypes();
 }
 
 
@@ -1333,7 +1913,15 @@ void CImagingEffect::BeginStreaming()
 {
 	if (!m_fStreamingInitialized)
 	{
-		m_rcDest = D2D1::RectU(0, 0, m_imageWidthInPixels, m_imageHeightInPixels);
+		// Build the SDK objects and native tables once for the stream.
+		// Samples only rebind buffers.
+		PublishChain(BuildChain(GetChainFormat(), m_imageProviders, m_nativeFilters, m_fallbackFilters, m_fInPlace));
+
+		// Output samples from the pool have rows padded to the pool alignment.
+		m_spFramePool->SetFrameSize((size_t)GetPoolStride() * ImagingEffects::GetBufferRowCount(m_pixelFormat, m_imageHeightInPixels));
+
+		m_engine.ResetClock();
+
 		m_fStreamingInitialized = true;
 	}
 }
@@ -1347,35 +1935,261 @@ void CImagingEffect::BeginStreaming()
 
 void CImagingEffect::EndStreaming()
 {
+	// Frames still being rendered hold the chain; the last one releases it.
+	m_chain.Reset();
 	m_fStreamingInitialized = false;
+
+	// Give back the memory of the idle output frames. Frames still held
+	// downstream are freed when they are released.
+	m_spFramePool->Trim();
+}
+
+
+// The frame format the effect chains are built for.
+
+ImagingEffects::StreamFormat CImagingEffect::GetChainFormat() const
+{
+	ImagingEffects::StreamFormat format;
+	format.pixelFormat = m_pixelFormat;
+	format.width = m_imageWidthInPixels;
+	format.height = m_imageHeightInPixels;
+	format.yuvMatrix = m_yuvMatrix;
+	format.yuvRange = m_yuvRange;
+	return format;
+}
+
+
+// Build the chains for an effect configuration. Reads nothing of the MFT
+// that changes after construction, so it can run without the lock while
+// frames are being rendered.
+
+std::shared_ptr<EffectChain> CImagingEffect::BuildChain(
+	const ImagingEffects::StreamFormat &format,
+	IVector<IImageProvider^>^ imageProviders,
+	const std::vector<ImagingEffects::NativeFilter> &nativeFilters,
+	const std::vector<ImagingEffects::NativeFilter> &fallbackFilters,
+	bool fInPlace
+	) const
+{
+	std::shared_ptr<EffectChain> spChain = std::make_shared<EffectChain>();
+
+	spChain->fInPlace = fInPlace;
+
+	// The renderer splits the frame into the engine's bands for band-parallel
+	// work and builds the native chains, which precompute tables for the
+	// frame size.
+	spChain->renderer = m_engine.BuildRenderer(format, nativeFilters, fallbackFilters);
+
+	if (imageProviders != nullptr && imageProviders->Size > 0)
+	{
+		spChain->renderGraph.reset(new RenderGraph(format.pixelFormat, format.width, format.height, spChain->renderer->GetBands(), imageProviders));
+		spChain->spSdkLock = m_spSdkLock;
+	}
+
+	return spChain;
+}
+
+
+// Make a chain the one new frames are rendered with. Called with m_critSec held.
+
+void CImagingEffect::PublishChain(const std::shared_ptr<EffectChain> &spChain)
+{
+	spChain->version = ++m_cChainsPublished;
+	m_chain.Publish(spChain);
+	(void)m_spAttributes->SetUINT64(IMAGINGEFFECT_CHAIN_VERSION, spChain->version);
+
+	// Costs measured with the previous chain do not apply.
+	m_engine.ResetCosts();
+}
+
+
+
+// Forward a sample while bypassed. If the MFT provides the output samples
+// (pOutput is nullptr) the input sample is the output; otherwise the client's
+// sample is given references to the input buffers in place of its own.
+
+ComPtr<IMFSample> CImagingEffect::BypassFrame(IMFSample *pInput, IMFSample *pOutput)
+{
+	if (pOutput == nullptr)
+	{
+		return pInput;
+	}
+
+	DWORD cBuffers = 0;
+	ThrowIfError(pInput->GetBufferCount(&cBuffers));
+	ThrowIfError(pOutput->RemoveAllBuffers());
+	for (DWORD i = 0; i < cBuffers; i++)
+	{
+		ComPtr<IMFMediaBuffer> spBuffer;
+		ThrowIfError(pInput->GetBufferByIndex(i, &spBuffer));
+		ThrowIfError(pOutput->AddBuffer(spBuffer.Get()));
+	}
+	CopySampleTimes(pInput, pOutput);
+
+	return pOutput;
+}
+
+
+// Render a frame with a chain. pOutput is the client's output sample, or
+// nullptr if the MFT provides it; then the input sample itself is the output
+// when the frame can be processed in place. Returns the output sample. The
+// times of the buffer and render stages are added to *pTimes.
+
+ComPtr<IMFSample> CImagingEffect::RenderFrame(EffectChain &chain, IMFSample *pInput, IMFSample *pOutput, ImagingEffects::FrameAction action, FrameTimes *pTimes)
+{
+	std::shared_ptr<ImagingEffects::FrameRecordWriter> spRecorder = m_recorder.Acquire();
+
+	if (pOutput == nullptr && CanProcessInPlace(chain, action))
+	{
+		OnProcessInPlace(chain, pInput, action, spRecorder.get(), pTimes);
+		return pInput;
+	}
+
+	ComPtr<IMFSample> spOutput = pOutput;
+	if (spOutput == nullptr)
+	{
+		spOutput = CreateOutputSample();
+	}
+
+	OnProcessOutput(chain, pInput, spOutput.Get(), action, spRecorder.get(), pTimes);
+	return spOutput;
+}
+
+
+// Write the input of a frame to the recording, if there is one. frame is the
+// input as the render path has it locked, and is written before it is
+// rendered: a frame rendered in place is overwritten. Recording is for
+// diagnosis; a write that fails ends the recording, not the stream.
+
+void CImagingEffect::RecordInput(ImagingEffects::FrameRecordWriter *pRecorder, const EffectChain &chain, IMFSample *pInput, const ImagingEffects::VideoFrame &frame)
+{
+	if (pRecorder == nullptr)
+	{
+		return;
+	}
+
+	LONGLONG hnsTime = 0;
+	LONGLONG hnsDuration = 0;
+	ImagingEffects::FrameTiming timing;
+	timing.fHasTime = SUCCEEDED(pInput->GetSampleTime(&hnsTime));
+	timing.hnsTime = timing.fHasTime ? hnsTime : 0;
+	timing.hnsDuration = SUCCEEDED(pInput->GetSampleDuration(&hnsDuration)) ? hnsDuration : 0;
+
+	ImagingEffects::TraceScope scope("Record");
+	(void)pRecorder->WriteFrame(chain.renderer->GetFormat(), timing, frame);
 }
 
 
+// Whether the chain that will render a frame can overwrite the frame.
+// The SDK chain cannot; a late frame passed through needs no work at all.
+// Reads only the chain, so it needs no lock.
+
+bool CImagingEffect::CanProcessInPlace(const EffectChain &chain, ImagingEffects::FrameAction action) const
+{
+	if (!chain.fInPlace)
+	{
+		return false;
+	}
+
+	if (action == ImagingEffects::FrameAction_Process && chain.renderGraph)
+	{
+		return false;
+	}
+	return chain.renderer->CanProcessInPlace(action);
+}
+
+
+// Filter the input sample in place.
+
+void CImagingEffect::OnProcessInPlace(const EffectChain &chain, IMFSample *pSample, ImagingEffects::FrameAction action, ImagingEffects::FrameRecordWriter *pRecorder, FrameTimes *pTimes)
+{
+	const LONG lDefaultStride = GetDefaultStride(m_spInputType.Get());
+
+	// Passed through: the sample already holds the output, and is locked
+	// only to be recorded.
+	const bool fPassedThrough = (chain.renderer->GetChain(action) == nullptr);
+	if (fPassedThrough && pRecorder == nullptr)
+	{
+		return;
+	}
+
+	ImagingEffects::TraceScope lockScope("LockBuffers");
+	ImagingEffects::SampleFrameLock lock(pSample, fPassedThrough ? MF2DBuffer_LockFlags_Read : MF2DBuffer_LockFlags_ReadWrite, m_pixelFormat, m_imageWidthInPixels, m_imageHeightInPixels, lDefaultStride);
+	lockScope.End();
+	const ImagingEffects::VideoFrame &frame = lock.GetFrame();
+
+	AddBytesCopied(lock.GetBytesCopied());
+	pTimes->hnsStage[ImagingEffects::FrameStage_BufferLock] += lock.GetLockTime();
+	pTimes->hnsStage[ImagingEffects::FrameStage_Wrap] += lock.GetWrapTime();
+
+	RecordInput(pRecorder, chain, pSample, frame);
+	if (fPassedThrough)
+	{
+		return;
+	}
+
+	LONGLONG hnsStart = MFGetSystemTime();
+	m_engine.RenderFrame(*chain.renderer, action, frame, frame);
+	pTimes->hnsStage[ImagingEffects::FrameStage_Render] += MFGetSystemTime() - hnsStart;
+}
+
 
 // Generate output data.
 
-void CImagingEffect::OnProcessOutput(IMFMediaBuffer *pIn, IMFMediaBuffer *pOut)
+void CImagingEffect::OnProcessOutput(EffectChain &chain, IMFSample *pIn, IMFSample *pOut, ImagingEffects::FrameAction action, ImagingEffects::FrameRecordWriter *pRecorder, FrameTimes *pTimes)
 {
 	// Stride if the buffer does not support IMF2DBuffer
 	const LONG lDefaultStride = GetDefaultStride(m_spInputType.Get());
 
-	// Helper objects to lock the buffers.
-	VideoBufferLock inputLock(pIn, MF2DBuffer_LockFlags_Read, m_imageHeightInPixels, lDefaultStride);
-	VideoBufferLock outputLock(pOut, MF2DBuffer_LockFlags_Write, m_imageHeightInPixels, lDefaultStride);
+	// Lock the buffers and describe the frames as they are in memory: padded
+	// rows, bottom-up images and planes in separate buffers are handled
+	// downstream, without repacking here.
+	ImagingEffects::TraceScope lockScope("LockBuffers");
+	ImagingEffects::SampleFrameLock inputLock(pIn, MF2DBuffer_LockFlags_Read, m_pixelFormat, m_imageWidthInPixels, m_imageHeightInPixels, lDefaultStride);
+	ImagingEffects::SampleFrameLock outputLock(pOut, MF2DBuffer_LockFlags_Write, m_pixelFormat, m_imageWidthInPixels, m_imageHeightInPixels, lDefaultStride);
+	lockScope.End();
+
+	const ImagingEffects::VideoFrame &src = inputLock.GetFrame();
+	const ImagingEffects::VideoFrame &dest = outputLock.GetFrame();
+
+	// Count what had to be copied because a layout could not be used in place.
+	AddBytesCopied(inputLock.GetBytesCopied() + outputLock.GetBytesCopied());
+	pTimes->hnsStage[ImagingEffects::FrameStage_BufferLock] += inputLock.GetLockTime() + outputLock.GetLockTime();
+	pTimes->hnsStage[ImagingEffects::FrameStage_Wrap] += inputLock.GetWrapTime() + outputLock.GetWrapTime();
+
+	RecordInput(pRecorder, chain, pIn, src);
 
-	// Invoke the image transform function.
-	assert(m_pTransformFn != nullptr);
-	if (m_pTransformFn)
+	LONGLONG hnsStart = MFGetSystemTime();
+	if (action == ImagingEffects::FrameAction_Process && chain.renderGraph)
 	{
-		(*m_pTransformFn)(m_rcDest, outputLock.GetTopRow(), outputLock.GetStride(), inputLock.GetTopRow(), inputLock.GetStride(), m_imageWidthInPixels, m_imageHeightInPixels, m_imageProviders);
+		// The SDK chain is a single object graph and renders the whole frame,
+		// one frame at a time. The app's providers may be in the graphs of
+		// several chains while one replaces another, so every SDK render of
+		// the MFT waits for the previous one, whatever its chain.
+		{
+			ImagingEffects::TraceScope scope("SdkRender");
+			AutoLock sdkLock(*chain.spSdkLock, __FUNCTION__);
+			chain.renderGraph->Render(dest, src);
+		}
+
+		// Native filters run after the SDK chain, in place on the output.
+		if (chain.renderer->GetChain(action) != nullptr)
+		{
+			m_engine.RenderFrame(*chain.renderer, action, dest, dest);
+		}
 	}
 	else
 	{
-		ThrowException(E_UNEXPECTED);
+		// Native filters only, the cheaper chain for a late frame, or a copy
+		// when there is no effect or the frame is shown unmodified. The SDK
+		// is not involved and the chains are immutable, so frames in flight
+		// are rendered concurrently.
+		m_engine.RenderFrame(*chain.renderer, action, dest, src);
 	}
+	pTimes->hnsStage[ImagingEffects::FrameStage_Render] += MFGetSystemTime() - hnsStart;
 
-	// Set the data size on the output buffer.
-	ThrowIfError(pOut->SetCurrentLength(m_cbImageSize));
+	// Set the data size on the output buffers.
+	outputLock.SetCurrentLength(m_cbImageSize);
 
 }
 
@@ -1384,8 +2198,265 @@ void CImagingEffect::OnProcessOutput(IMFMediaBuffer *pIn, IMFMediaBuffer *pOut)
 
 void CImagingEffect::OnFlush()
 {
-	// For this MFT, flushing just means releasing the input sample.
+	// For this MFT, flushing just means releasing the input sample. A
+	// synchronous render in progress finds out by the count.
 	m_spSample.Reset();
+	m_cFlushes++;
+
+	// Drop the frames in flight. Renders that are still running complete
+	// against stale tickets and their output is discarded; until they do,
+	// m_cAsyncRenders keeps the media types from changing.
+	m_inFlight.Clear();
+	m_cNeedInputPending = 0;
+	m_fDraining = false;
+
+	// Samples after a flush are timed from scratch.
+	m_engine.ResetClock();
+}
+
+
+// Fail if the client has not unlocked the asynchronous MFT.
+
+void CImagingEffect::CheckAsyncUnlocked()
+{
+	if (!MFGetAttributeUINT32(m_spAttributes.Get(), MF_TRANSFORM_ASYNC_UNLOCK, FALSE))
+	{
+		ThrowException(MF_E_TRANSFORM_ASYNC_LOCKED);
+	}
+}
+
+
+// Ask the client for enough input to fill the free slots.
+
+void CImagingEffect::RequestInput()
+{
+	while (!m_fDraining && m_cNeedInputPending + m_inFlight.GetCount() < m_inFlight.GetCapacity())
+	{
+		QueueTransformEvent(METransformNeedInput);
+		m_cNeedInputPending++;
+	}
+}
+
+
+// Queue an METransformNeedInput/HaveOutput/DrainComplete event for stream 0.
+
+void CImagingEffect::QueueTransformEvent(MediaEventType met)
+{
+	ComPtr<IMFMediaEvent> spEvent;
+
+	ThrowIfError(MFCreateMediaEvent(met, GUID_NULL, S_OK, nullptr, &spEvent));
+	ThrowIfError(spEvent->SetUINT32(MF_EVENT_MFT_INPUT_STREAM_ID, 0));
+	ThrowIfError(m_spEventQueue->QueueEvent(spEvent.Get()));
+}
+
+
+// Render one sample in asynchronous mode. Runs on a worker thread.
+
+void CImagingEffect::OnProcessSampleAsync(uint64_t ticket, IMFSample *pInput, const std::shared_ptr<EffectChain> &spChain)
+{
+	HRESULT hr = S_OK;
+	ComPtr<IMFSample> spOutput;
+	ImagingEffects::FrameAction action = ImagingEffects::FrameAction_Process;
+	ImagingEffects::TraceScope scope("ProcessSample");
+	FrameTimes times;
+	const LONGLONG hnsCalled = MFGetSystemTime();
+
+	// Decide when the work starts: the frame may have waited for a worker.
+	action = ScheduleFrame(pInput, spChain->renderer->HasFallback());
+	LONGLONG hnsCost = 0;
+
+	if (action != ImagingEffects::FrameAction_Drop)
+	{
+		try
+		{
+			// The format cannot change while this render is counted in
+			// m_cAsyncRenders, and the chain is this frame's own reference,
+			// so no lock is needed.
+			LONGLONG hnsStart = MFGetSystemTime();
+			spOutput = RenderFrame(*spChain, pInput, nullptr, action, &times);
+			hnsCost = MFGetSystemTime() - hnsStart;
+
+			ImagingEffects::TraceScope stampScope("Stamp");
+			LONGLONG hnsStamp = MFGetSystemTime();
+			CopySampleTimes(pInput, spOutput.Get());
+			times.hnsStage[ImagingEffects::FrameStage_Stamp] = MFGetSystemTime() - hnsStamp;
+		}
+		catch (Exception ^exc)
+		{
+			hr = exc->HResult;
+			spOutput.Reset();
+		}
+	}
+
+	LONGLONG hnsWait = MFGetSystemTime();
+	AutoLock lock(m_critSec, __FUNCTION__);
+	hnsWait = MFGetSystemTime() - hnsWait;
+
+	// The format is no longer read.
+	m_cAsyncRenders--;
+
+	if (m_fShutdown)
+	{
+		return;
+	}
+
+	bool fLive = (action == ImagingEffects::FrameAction_Drop) ? m_inFlight.Drop(ticket) : m_inFlight.Complete(ticket, spOutput);
+	if (!fLive)
+	{
+		return; // Flushed while rendering.
+	}
+
+	ImagingEffects::TraceRecorder::Get().Counter("FramesInFlight", (int64_t)m_inFlight.GetCount());
+
+	// The frame is done once it is queued for output.
+	if (SUCCEEDED(hr) && action != ImagingEffects::FrameAction_Drop)
+	{
+		times.hnsStage[ImagingEffects::FrameStage_LockWait] += hnsWait;
+		times.hnsStage[ImagingEffects::FrameStage_Total] = MFGetSystemTime() - hnsCalled;
+		CompleteFrame(action, hnsCost, times);
+	}
+
+	try
+	{
+		if (FAILED(hr))
+		{
+			ThrowIfError(m_spEventQueue->QueueEventParamVar(MEError, GUID_NULL, hr, nullptr));
+		}
+
+		// Frames leave in order, so an early finisher may have to wait for its
+		// predecessors before it is announced.
+		for (size_t cReady = m_inFlight.TakeNewlyReady(); cReady > 0; cReady--)
+		{
+			QueueTransformEvent(METransformHaveOutput);
+		}
+
+		// Dropped frames at the head free their slots without a ProcessOutput
+		// call, so ask for input (or finish draining) here.
+		if (m_inFlight.DiscardDropped() > 0)
+		{
+			if (m_fDraining && m_inFlight.IsEmpty())
+			{
+				m_fDraining = false;
+				QueueTransformEvent(METransformDrainComplete);
+			}
+			else
+			{
+				RequestInput();
+			}
+		}
+	}
+	catch (Exception ^)
+	{
+		// The event queue has been shut down.
+	}
+}
+
+
+// Pick what to do with a sample: process it, use the fallback chain, pass it
+// through or drop it. fCanDegrade tells whether the chain the frame will be
+// rendered with has a fallback chain. The engine has a lock of its own, so
+// m_critSec need not be held.
+
+ImagingEffects::FrameAction CImagingEffect::ScheduleFrame(IMFSample *pSample, bool fCanDegrade)
+{
+	ImagingEffects::FrameTiming timing;
+	timing.fHasTime = SUCCEEDED(pSample->GetSampleTime(&timing.hnsTime));
+	if (FAILED(pSample->GetSampleDuration(&timing.hnsDuration)))
+	{
+		timing.hnsDuration = 0;
+	}
+
+	// Time stamps jump at a discontinuity.
+	if (MFGetAttributeUINT32(pSample, MFSampleExtension_Discontinuity, FALSE))
+	{
+		m_engine.ResetClock();
+	}
+
+	ImagingEffects::FrameAction action = m_engine.ScheduleFrame(timing, fCanDegrade);
+
+	// Publish the counters for GetAttributes.
+	ImagingEffects::SchedulerStats stats = m_engine.GetSchedulerStats();
+	(void)m_spAttributes->SetUINT64(IMAGINGEFFECT_FRAMES_PROCESSED, stats.cFrames[ImagingEffects::FrameAction_Process]);
+	(void)m_spAttributes->SetUINT64(IMAGINGEFFECT_FRAMES_DEGRADED, stats.cFrames[ImagingEffects::FrameAction_Degrade]);
+	(void)m_spAttributes->SetUINT64(IMAGINGEFFECT_FRAMES_PASSED_THROUGH, stats.cFrames[ImagingEffects::FrameAction_PassThrough]);
+	(void)m_spAttributes->SetUINT64(IMAGINGEFFECT_FRAMES_DROPPED, stats.cFrames[ImagingEffects::FrameAction_Drop]);
+
+	return action;
+}
+
+
+// Record a rendered frame: hnsCost, the time its action took, for the
+// scheduler, and its stage times for the latency statistics. m_critSec need
+// not be held.
+
+void CImagingEffect::CompleteFrame(ImagingEffects::FrameAction action, LONGLONG hnsCost, const FrameTimes &times)
+{
+	uint64_t stageNs[ImagingEffects::FrameStage_Count];
+	for (int i = 0; i < ImagingEffects::FrameStage_Count; i++)
+	{
+		stageNs[i] = (times.hnsStage[i] > 0) ? (uint64_t)times.hnsStage[i] * 100 : 0;
+	}
+	m_engine.CompleteFrame(action, (hnsCost > 0) ? (uint64_t)hnsCost * 100 : 0, stageNs);
+}
+
+
+// Count bytes copied because a layout could not be used in place. Frames are
+// rendered concurrently, so the count is atomic.
+
+void CImagingEffect::AddBytesCopied(uint64_t cbCopied)
+{
+	if (cbCopied > 0)
+	{
+		const uint64_t cbTotal = (m_cbCopied += cbCopied);
+		(void)m_spAttributes->SetUINT64(IMAGINGEFFECT_BYTES_COPIED, cbTotal);
+	}
+}
+
+
+// Allocate an output sample, when the MFT provides them. The buffer comes
+// from the frame pool and goes back to it when downstream releases it.
+
+ComPtr<IMFSample> CImagingEffect::CreateOutputSample()
+{
+	ComPtr<IMFSample> spSample;
+	ComPtr<ImagingEffects::PooledBuffer> spBuffer;
+
+	const DWORD cbRow = ImagingEffects::GetMinimumStride(m_pixelFormat, m_imageWidthInPixels);
+	const DWORD cRows = ImagingEffects::GetBufferRowCount(m_pixelFormat, m_imageHeightInPixels);
+
+	ThrowIfError(MFCreateSample(&spSample));
+	ThrowIfError(MakeAndInitialize<ImagingEffects::PooledBuffer>(&spBuffer, m_spFramePool, (LONG)GetPoolStride(), cbRow, cRows));
+	ThrowIfError(spSample->AddBuffer(spBuffer.Get()));
+
+	(void)m_spAttributes->SetUINT32(IMAGINGEFFECT_OUTPUT_POOL_HIGH_WATER, (UINT32)m_spFramePool->GetStats().cHighWater);
+
+	return spSample;
+}
+
+
+// Pitch of the frames in the output pool.
+
+UINT32 CImagingEffect::GetPoolStride() const
+{
+	return ImagingEffects::GetPaddedStride(ImagingEffects::GetMinimumStride(m_pixelFormat, m_imageWidthInPixels));
+}
+
+
+// Replace the snapshot that the negotiation queries read. Called with
+// m_critSec held whenever a media type or the sample allocation changes.
+
+void CImagingEffect::PublishStreamTypes()
+{
+	std::shared_ptr<StreamTypes> spTypes = std::make_shared<StreamTypes>();
+	spTypes->spInputType = m_spInputType;
+	spTypes->spOutputType = m_spOutputType;
+	spTypes->cbImageSize = m_cbImageSize;
+
+	// In asynchronous mode the frame is rendered before the client asks for
+	// it, so the MFT allocates the output samples itself.
+	spTypes->fProvidesSamples = m_fAsync || m_fProvideSamples;
+
+	m_streamTypes.Publish(spTypes);
 }
 
 
@@ -1400,22 +2471,19 @@ void CImagingEffect::UpdateFormatInfo()
 	m_imageHeightInPixels = 0;
 	m_cbImageSize = 0;
 
-	m_pTransformFn = nullptr;
+	// The effect chains depend on the frame size and color mode.
+	m_chain.Reset();
 
 	if (m_spInputType != nullptr)
 	{
 		ThrowIfError(m_spInputType->GetGUID(MF_MT_SUBTYPE, &subtype));
 		if (subtype == MFVideoFormat_YUY2)
 		{
-			m_pTransformFn = TransformImage_YUY2;
+			m_pixelFormat = ImagingEffects::PixelFormat_YUY2;
 		}
-		/*else if (subtype == MFVideoFormat_UYVY)
-		{
-		m_pTransformFn = TransformImage_UYVY;
-		}*/
 		else if (subtype == MFVideoFormat_NV12)
 		{
-			m_pTransformFn = TransformImage_NV12;
+			m_pixelFormat = ImagingEffects::PixelFormat_NV12;
 		}
 		else
 		{
@@ -1426,6 +2494,30 @@ void CImagingEffect::UpdateFormatInfo()
 
 		// Calculate the image size (not including padding)
 		m_cbImageSize = GetImageSize(subtype.Data1, m_imageWidthInPixels, m_imageHeightInPixels);
+
+		// Colour space, for the 3D lookup tables. Streams that do not say get
+		// the colour space of MakeStreamFormat.
+		const ImagingEffects::StreamFormat defaults = ImagingEffects::MakeStreamFormat(m_pixelFormat, m_imageWidthInPixels, m_imageHeightInPixels);
+
+		UINT32 matrix = MFGetAttributeUINT32(m_spInputType.Get(), MF_MT_YUV_MATRIX, MFVideoTransferMatrix_Unknown);
+		if (matrix == MFVideoTransferMatrix_Unknown)
+		{
+			m_yuvMatrix = defaults.yuvMatrix;
+		}
+		else
+		{
+			m_yuvMatrix = (matrix == MFVideoTransferMatrix_BT709) ? ImagingEffects::YuvMatrix_BT709 : ImagingEffects::YuvMatrix_BT601;
+		}
+
+		UINT32 range = MFGetAttributeUINT32(m_spInputType.Get(), MF_MT_VIDEO_NOMINAL_RANGE, MFNominalRange_Unknown);
+		if (range == MFNominalRange_Unknown)
+		{
+			m_yuvRange = defaults.yuvRange;
+		}
+		else
+		{
+			m_yuvRange = (range == MFNominalRange_0_255) ? ImagingEffects::YuvRange_Full : ImagingEffects::YuvRange_Video;
+		}
 	}
 }
 
@@ -1436,39 +2528,30 @@ void CImagingEffect::UpdateFormatInfo()
 
 DWORD GetImageSize(DWORD fcc, UINT32 width, UINT32 height)
 {
+	ImagingEffects::PixelFormat format = ImagingEffects::PixelFormat_NV12;
 	switch (fcc)
 	{
 	case FOURCC_YUY2:
 	case FOURCC_UYVY:
-		// check overflow
-		if ((width > MAXDWORD / 2) || (width * 2 > MAXDWORD / height))
-		{
-			throw ref new InvalidArgumentException();
-		}
-		else
-		{
-			// 16 bpp
-			return width * height * 2;
-		}
+		format = ImagingEffects::PixelFormat_YUY2;  // 16 bpp
+		break;
 
 	case FOURCC_NV12:
-		// check overflow
-		if ((height / 2 > MAXDWORD - height) || ((height + height / 2) > MAXDWORD / width))
-		{
-			throw ref new InvalidArgumentException();
-		}
-		else
-		{
-			// 12 bpp
-			return width * (height + (height / 2));
-		}
+		format = ImagingEffects::PixelFormat_NV12;  // 12 bpp
+		break;
 
 	default:
 		// Unsupported type.
 		ThrowException(MF_E_INVALIDTYPE);
 	}
 
-	return 0;
+	uint32_t cbImage = 0;
+	if (!ImagingEffects::GetImageSize(format, width, height, &cbImage))
+	{
+		// Overflow.
+		throw ref new InvalidArgumentException();
+	}
+	return cbImage;
 }
 
 // Get the default stride for a video format. 
@@ -1490,11 +2573,11 @@ LONG GetDefaultStride(IMFMediaType *pType)
 		ThrowIfError(MFGetAttributeSize(pType, MF_MT_FRAME_SIZE, &width, &height));
 		if (subtype == MFVideoFormat_NV12)
 		{
-			lStride = width;
+			lStride = ImagingEffects::GetDefaultStride(ImagingEffects::PixelFormat_NV12, width);
 		}
 		else if (subtype == MFVideoFormat_YUY2 || subtype == MFVideoFormat_UYVY)
 		{
-			lStride = ((width * 2) + 3) & ~3;
+			lStride = ImagingEffects::GetDefaultStride(ImagingEffects::PixelFormat_YUY2, width);
 		}
 		else
 		{
@@ -1507,3 +2590,21 @@ LONG GetDefaultStride(IMFMediaType *pType)
 
 	return lStride;
 }
+
+
+// Copy the duration and time stamp from one sample to another, if present.
+void CopySampleTimes(IMFSample *pSrc, IMFSample *pDest)
+{
+	LONGLONG hnsDuration = 0;
+	LONGLONG hnsTime = 0;
+
+	if (SUCCEEDED(pSrc->GetSampleDuration(&hnsDuration)))
+	{
+		ThrowIfError(pDest->SetSampleDuration(hnsDuration));
+	}
+
+	if (SUCCEEDED(pSrc->GetSampleTime(&hnsTime)))
+	{
+		ThrowIfError(pDest->SetSampleTime(hnsTime));
+	}
+}
@@ -1,18 +1,64 @@
 #pragma once
 #include "CritSec.h"
+#include "EffectEngine.h"
+#include "FrameBands.h"
+#include "FramePool.h"
+#include "FrameRecording.h"
+#include "InFlightQueue.h"
+#include "NativeFilters.h"
+#include "RcuPtr.h"
+#include "RenderGraph.h"
+#include <atomic>
 #include <vector>
+#include <memory>
 
-// Function pointer for the function that transforms the image.
-typedef void(*IMAGE_TRANSFORM_FN)(
-	const D2D_RECT_U&       rcDest,          // Destination rectangle for the transformation.
-	BYTE*                   pDest,           // Destination buffer.
-	LONG                    lDestStride,     // Destination stride.
-	const BYTE*             pSrc,            // Source buffer.
-	LONG                    lSrcStride,      // Source stride.
-	DWORD                   dwWidthInPixels, // Image width in pixels.
-	DWORD                   dwHeightInPixels, // Image height in pixels.
-	Windows::Foundation::Collections::IVector<Nokia::Graphics::Imaging::IImageProvider^>^ providers
-	);
+// Scheduler counters, published as UINT64 values in the attribute store
+// returned by GetAttributes. Each counts frames since the MFT was created.
+
+// {3891382e-b229-49da-921d-489d7ce8e205}  Processed with the full effect chain.
+static const GUID IMAGINGEFFECT_FRAMES_PROCESSED = { 0x3891382e, 0xb229, 0x49da, { 0x92, 0x1d, 0x48, 0x9d, 0x7c, 0xe8, 0xe2, 0x05 } };
+
+// {2a6c9f2d-ff96-4e14-abbd-a02fb127820a}  Processed with the fallback chain because they were late.
+static const GUID IMAGINGEFFECT_FRAMES_DEGRADED = { 0x2a6c9f2d, 0xff96, 0x4e14, { 0xab, 0xbd, 0xa0, 0x2f, 0xb1, 0x27, 0x82, 0x0a } };
+
+// {875a0f7e-029a-4afd-b9ae-9d7e0aea355b}  Passed through unmodified because they were late.
+static const GUID IMAGINGEFFECT_FRAMES_PASSED_THROUGH = { 0x875a0f7e, 0x029a, 0x4afd, { 0xb9, 0xae, 0x9d, 0x7e, 0x0a, 0xea, 0x35, 0x5b } };
+
+// {07771076-ab86-499a-a195-7511a870e131}  Dropped because they were late.
+static const GUID IMAGINGEFFECT_FRAMES_DROPPED = { 0x07771076, 0xab86, 0x499a, { 0xa1, 0x95, 0x75, 0x11, 0xa8, 0x70, 0xe1, 0x31 } };
+
+// {5f0b8e64-3c1d-4a57-9e2b-7d4c21a6f093}  Most output frames from the pool in use at once (UINT32).
+static const GUID IMAGINGEFFECT_OUTPUT_POOL_HIGH_WATER = { 0x5f0b8e64, 0x3c1d, 0x4a57, { 0x9e, 0x2b, 0x7d, 0x4c, 0x21, 0xa6, 0xf0, 0x93 } };
+
+// {c7a3e1d2-6b94-4f0e-8a15-2e9d3b7c4f61}  Bytes copied because a sample's buffers could not be used in place (UINT64).
+static const GUID IMAGINGEFFECT_BYTES_COPIED = { 0xc7a3e1d2, 0x6b94, 0x4f0e, { 0x8a, 0x15, 0x2e, 0x9d, 0x3b, 0x7c, 0x4f, 0x61 } };
+
+// {9d4e2b17-8c3a-4f61-b5d0-1e7a6c93f248}  Version of the effect chain new frames are rendered with (UINT64).
+static const GUID IMAGINGEFFECT_CHAIN_VERSION = { 0x9d4e2b17, 0x8c3a, 0x4f61, { 0xb5, 0xd0, 0x1e, 0x7a, 0x6c, 0x93, 0xf2, 0x48 } };
+
+// {4b81c6e3-27d5-4a9f-8e60-f3a15c9d0b72}  Lock profile as JSON, refreshed by GetAttributes (string).
+// Only when built with CRITSEC_PROFILING; see Common/LockProfiler.h.
+static const GUID IMAGINGEFFECT_LOCK_PROFILE = { 0x4b81c6e3, 0x27d5, 0x4a9f, { 0x8e, 0x60, 0xf3, 0xa1, 0x5c, 0x9d, 0x0b, 0x72 } };
+
+// Frame latency over the last one to two thousand rendered frames, refreshed
+// by GetAttributes. Times are in nanoseconds, measured at 100 ns resolution.
+
+// {e2c05a39-71b8-4d2e-9f43-6a8d15b7c0e4}  Latency of every stage (blob): one ImagingEffects::LatencySummary
+// per ImagingEffects::FrameStage, in the order of the enumeration.
+static const GUID IMAGINGEFFECT_FRAME_LATENCY = { 0xe2c05a39, 0x71b8, 0x4d2e, { 0x9f, 0x43, 0x6a, 0x8d, 0x15, 0xb7, 0xc0, 0xe4 } };
+
+// {3a7f92c4-5e16-48b0-a2d9-c84e01f6b357}  Median latency of a whole frame (UINT64).
+static const GUID IMAGINGEFFECT_FRAME_LATENCY_P50 = { 0x3a7f92c4, 0x5e16, 0x48b0, { 0xa2, 0xd9, 0xc8, 0x4e, 0x01, 0xf6, 0xb3, 0x57 } };
+
+// {8b14d6e0-a2c7-4f59-b38e-0d9571ca42f6}  99th percentile latency of a whole frame (UINT64).
+static const GUID IMAGINGEFFECT_FRAME_LATENCY_P99 = { 0x8b14d6e0, 0xa2c7, 0x4f59, { 0xb3, 0x8e, 0x0d, 0x95, 0x71, 0xca, 0x42, 0xf6 } };
+
+// {c65e1f08-3bd4-4a72-8c19-f72a3e60d98b}  99.9th percentile latency of a whole frame (UINT64).
+static const GUID IMAGINGEFFECT_FRAME_LATENCY_P999 = { 0xc65e1f08, 0x3bd4, 0x4a72, { 0x8c, 0x19, 0xf7, 0x2a, 0x3e, 0x60, 0xd9, 0x8b } };
+
+// {6d2a8f51-0e47-4b9c-a3f6-58c1e2b7d904}  Event trace as Chrome trace JSON, refreshed by GetAttributes while the
+// "Trace" property is on (string). See TraceRecorder.h.
+static const GUID IMAGINGEFFECT_TRACE = { 0x6d2a8f51, 0x0e47, 0x4b9c, { 0xa3, 0xf6, 0x58, 0xc1, 0xe2, 0xb7, 0xd9, 0x04 } };
 
 namespace ImagingEffects // Change the namespace to a project name.
 {
@@ -24,6 +70,67 @@ namespace ImagingEffects // Change the namespace to a project name.
 }
 
 
+// EffectChain:
+// What frames are rendered with: the chains built from one effect
+// configuration for one frame format. A chain is never changed once it is
+// published; a new configuration gets a new chain. Each frame holds a
+// reference to the chain it was accepted with and is rendered with it to
+// the end, however often the chain is replaced meanwhile.
+
+struct EffectChain
+{
+	EffectChain() : version(0), fInPlace(false) {}
+
+	UINT64 version;                         // 1 for the first chain the MFT publishes, then counting up.
+	bool fInPlace;                          // "InPlace" as it was when the chain was built.
+
+	std::unique_ptr<RenderGraph> renderGraph;
+	std::shared_ptr<CritSec> spSdkLock;     // Held while renderGraph renders; the MFT's m_spSdkLock.
+
+	// The native chains and the bands of the frame; also copies the frames
+	// that no chain renders. Built and run by the MFT's m_engine.
+	std::shared_ptr<const ImagingEffects::FrameRenderer> renderer;
+
+private:
+	EffectChain(const EffectChain&);
+	EffectChain& operator=(const EffectChain&);
+};
+
+
+// StreamTypes:
+// What the negotiation queries (GetInputStreamInfo, Get*CurrentType, ...)
+// report. Replaced as a whole whenever one of them changes, so the queries
+// read it without taking the MFT lock and never wait for a frame.
+
+struct StreamTypes
+{
+	StreamTypes() : cbImageSize(0), fProvidesSamples(false) {}
+
+	ComPtr<IMFMediaType> spInputType;
+	ComPtr<IMFMediaType> spOutputType;
+	DWORD cbImageSize;
+	bool fProvidesSamples;                  // MFT_OUTPUT_STREAM_PROVIDES_SAMPLES
+};
+
+
+// FrameTimes:
+// Time one frame spent in each ImagingEffects::FrameStage, in 100 ns units.
+// Filled in as the frame goes through the MFT.
+
+struct FrameTimes
+{
+	FrameTimes()
+	{
+		for (int i = 0; i < ImagingEffects::FrameStage_Count; i++)
+		{
+			hnsStage[i] = 0;
+		}
+	}
+
+	LONGLONG hnsStage[ImagingEffects::FrameStage_Count];
+};
+
+
 // CImagingEffect class:
 // Implements a video effect that allows Nokia Imaging SDK filters/effects.
 
@@ -31,7 +138,9 @@ class CImagingEffect WrlSealed
 	: public Microsoft::WRL::RuntimeClass<
 	Microsoft::WRL::RuntimeClassFlags< Microsoft::WRL::RuntimeClassType::WinRtClassicComMix >,
 	ABI::Windows::Media::IMediaExtension,
-	IMFTransform >
+	IMFTransform,
+	IMFMediaEventGenerator,
+	IMFShutdown >
 {
 	InspectableClass(L"ImagingEffects.ImagingEffect", BaseTrust)
 
@@ -165,10 +274,30 @@ public:
 		DWORD                   *pdwStatus
 		);
 
+	// IMFMediaEventGenerator (used in asynchronous mode)
+	STDMETHODIMP GetEvent(DWORD dwFlags, IMFMediaEvent **ppEvent);
+
+	STDMETHODIMP BeginGetEvent(IMFAsyncCallback *pCallback, IUnknown *punkState);
+
+	STDMETHODIMP EndGetEvent(IMFAsyncResult *pResult, IMFMediaEvent **ppEvent);
+
+	STDMETHODIMP QueueEvent(
+		MediaEventType      met,
+		REFGUID             guidExtendedType,
+		HRESULT             hrStatus,
+		const PROPVARIANT   *pvValue
+		);
+
+	// IMFShutdown
+	STDMETHODIMP Shutdown();
+
+	STDMETHODIMP GetShutdownStatus(MFSHUTDOWN_STATUS *pStatus);
 
 private:
-	// HasPendingOutput: Returns TRUE if the MFT is holding an input sample.
-	bool HasPendingOutput() const { return m_spSample != nullptr; }
+	// HasPendingOutput: Returns TRUE if the MFT is holding an input sample,
+	// or a render still reads the stream format. A flush empties the queue
+	// but does not stop the renders already started.
+	bool HasPendingOutput() const { return m_spSample != nullptr || m_fRendering || !m_inFlight.IsEmpty() || m_cAsyncRenders > 0; }
 
 
 
@@ -192,30 +321,103 @@ private:
 	void OnSetOutputType(IMFMediaType *pmt);
 	void BeginStreaming();
 	void EndStreaming();
-	void OnProcessOutput(IMFMediaBuffer *pIn, IMFMediaBuffer *pOut);
+	ComPtr<IMFSample> BypassFrame(IMFSample *pInput, IMFSample *pOutput);
+	ComPtr<IMFSample> RenderFrame(EffectChain &chain, IMFSample *pInput, IMFSample *pOutput, ImagingEffects::FrameAction action, FrameTimes *pTimes);
+	void RecordInput(ImagingEffects::FrameRecordWriter *pRecorder, const EffectChain &chain, IMFSample *pInput, const ImagingEffects::VideoFrame &frame);
+	bool CanProcessInPlace(const EffectChain &chain, ImagingEffects::FrameAction action) const;
+	void OnProcessInPlace(const EffectChain &chain, IMFSample *pSample, ImagingEffects::FrameAction action, ImagingEffects::FrameRecordWriter *pRecorder, FrameTimes *pTimes);
+	void OnProcessOutput(EffectChain &chain, IMFSample *pIn, IMFSample *pOut, ImagingEffects::FrameAction action, ImagingEffects::FrameRecordWriter *pRecorder, FrameTimes *pTimes);
+	ImagingEffects::FrameAction ScheduleFrame(IMFSample *pSample, bool fCanDegrade);
+	void CompleteFrame(ImagingEffects::FrameAction action, LONGLONG hnsCost, const FrameTimes &times);
 	void OnFlush();
 	void UpdateFormatInfo();
-
+	void PublishStreamTypes();
+	void AddBytesCopied(uint64_t cbCopied);
+
+	// Effect chains
+	ImagingEffects::StreamFormat GetChainFormat() const;
+	std::shared_ptr<EffectChain> BuildChain(
+		const ImagingEffects::StreamFormat &format,
+		Windows::Foundation::Collections::IVector<Nokia::Graphics::Imaging::IImageProvider^>^ imageProviders,
+		const std::vector<ImagingEffects::NativeFilter> &nativeFilters,
+		const std::vector<ImagingEffects::NativeFilter> &fallbackFilters,
+		bool fInPlace
+		) const;
+	void PublishChain(const std::shared_ptr<EffectChain> &spChain);
+
+	// Asynchronous mode
+	void CheckAsyncUnlocked();
+	void RequestInput();
+	void QueueTransformEvent(MediaEventType met);
+	void OnProcessSampleAsync(uint64_t ticket, IMFSample *pInput, const std::shared_ptr<EffectChain> &spChain);
+	ComPtr<IMFSample> CreateOutputSample();
+	UINT32 GetPoolStride() const;
+
+	// Guards the state below, except what is noted. Never held while a frame
+	// is rendered, so queries wait at most for bookkeeping.
 	CritSec m_critSec;
 
-	// Transformation parameters
-	D2D_RECT_U m_rcDest;                    // Destination rectangle for the effect.
-
 	// Streaming
 	bool m_fStreamingInitialized;
 	ComPtr<IMFSample> m_spSample;           // Input sample.
+	bool m_fRendering;                      // Synchronous ProcessOutput is rendering m_spSample without the lock.
+	UINT64 m_cFlushes;                      // Tells a render that the MFT was flushed meanwhile.
 	ComPtr<IMFMediaType> m_spInputType;     // Input media type.
 	ComPtr<IMFMediaType> m_spOutputType;    // Output media type.
+	RcuPtr<const StreamTypes> m_streamTypes;   // Read without the lock.
 
 	// Fomat information
 	UINT32 m_imageWidthInPixels;
 	UINT32 m_imageHeightInPixels;
 	DWORD m_cbImageSize;                    // Image size, in bytes.
 
-	ComPtr<IMFAttributes> m_spAttributes;
+	ComPtr<IMFAttributes> m_spAttributes;   // Set once; thread-safe itself, so read without the lock.
+
+	// Asynchronous mode (MF_TRANSFORM_ASYNC). Enabled with the "FramesInFlight" property.
+	bool m_fAsync;
+	bool m_fDraining;                       // Drain requested; do not ask for more input.
+	bool m_fShutdown;
+	DWORD m_cNeedInputPending;              // METransformNeedInput events not yet answered.
+	DWORD m_cAsyncRenders;                  // Renders started on workers and not yet finished, flushed or not.
+	InFlightQueue<ComPtr<IMFSample>> m_inFlight;  // Output samples, in input order.
+	ComPtr<IMFMediaEventQueue> m_spEventQueue;
+
+	// Output samples allocated by the MFT: always in asynchronous mode, and in
+	// synchronous mode with the "ProvideSamples" property. Their buffers are
+	// shared with the pool, which outlives the MFT if downstream holds them.
+	bool m_fProvideSamples;
+	std::shared_ptr<ImagingEffects::FramePool> m_spFramePool;
+
+	std::atomic<uint64_t> m_cbCopied;       // Bytes gathered from unusable buffer layouts.
+
+	bool m_fInPlace;                        // "InPlace": filter the input sample when the chain allows it. Copied into each chain.
+	bool m_fBypass;                         // No effect configured: samples are forwarded untouched.
 
-	// Image transform function. (Changes based on the media type.)
-	IMAGE_TRANSFORM_FN  m_pTransformFn;
+	ImagingEffects::PixelFormat m_pixelFormat;          // Layout of the media type.
+	ImagingEffects::YuvMatrix m_yuvMatrix;              // Colour space of the media type.
+	ImagingEffects::YuvRange m_yuvRange;
 
+	// Effect configuration. The chains built from it are published in
+	// m_chain while streaming: built in BeginStreaming, replaced by
+	// SetProperties and withdrawn in EndStreaming.
 	Windows::Foundation::Collections::IVector<Nokia::Graphics::Imaging::IImageProvider^>^ m_imageProviders;
+	std::vector<ImagingEffects::NativeFilter> m_nativeFilters;
+	std::vector<ImagingEffects::NativeFilter> m_fallbackFilters;
+	RcuPtr<EffectChain> m_chain;
+	UINT64 m_cChainsPublished;
+
+	// Serializes rendering through the SDK. The IImageProviders belong to the
+	// app, and chains built from successive configurations may hold the same
+	// ones, so the lock is shared by every chain of the MFT. Set once.
+	const std::shared_ptr<CritSec> m_spSdkLock;
+
+	// Runs the native chains in bands on the PPL, decides what to do with
+	// late frames and keeps the per-stage latency of rendered frames. Has
+	// locks of its own; used without m_critSec. The fallback chain is the
+	// cheaper chain used to catch up.
+	ImagingEffects::EffectEngine m_engine;
+
+	// "Record": the input of rendered frames and the native configuration,
+	// written to a file for effectreplay. Read without the lock.
+	RcuPtr<ImagingEffects::FrameRecordWriter> m_recorder;
 };
\ No newline at end of file
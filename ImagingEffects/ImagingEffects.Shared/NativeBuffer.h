@@ -23,6 +23,14 @@ namespace ImagingEffects
 			return S_OK;
 		}
 
+		// Rebinds the buffer to a different block of memory. Used by the render
+		// graph to point long-lived SDK bitmaps at the current sample.
+		void SetBuffer(byte *buffer, UINT totalSize)
+		{
+			m_length = totalSize;
+			m_buffer = buffer;
+		}
+
 		STDMETHODIMP Buffer(byte **value)
 		{
 			*value = m_buffer;
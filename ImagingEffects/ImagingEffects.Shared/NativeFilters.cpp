@@ -0,0 +1,757 @@
+// Native point filters.
+//
+// Every filter is turned into one operation on the luma plane and one on
+// the interleaved chroma plane when the chain is built, and consecutive
+// point operations are then folded together (see Fuse). There are three
+// kinds of operations, each with a scalar reference kernel and SSE2 and
+// NEON kernels that produce identical results:
+//
+//   Linear   Fixed-point multiply-add, with separate offsets for even and
+//            odd bytes (U and V).
+//   Lut      Table lookup. This one is scalar on every instruction set:
+//            neither SSE2 nor NEON can gather from a 256-entry table.
+//   Gain     Per-pixel gain from a precomputed map, for the vignette.
+//
+// The kernels follow the instruction set selected for the conversions
+// (see GetConversionIsa); AVX2 processors use the SSE2 kernels. 3D tables
+// are applied by YuvCube, which has its own kernels.
+//
+// This file does not use the precompiled header so that it can be built
+// without Windows headers.
+
+#include "NativeFilters.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define FILTERS_X86 1
+#include <emmintrin.h>
+#endif
+
+#if defined(_M_ARM) || defined(_M_ARM64) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define FILTERS_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace ImagingEffects
+{
+	namespace
+	{
+		// Sepia tone (RGB 162, 138, 101) in BT.601 chroma.
+		const int SEPIA_U = 106;
+		const int SEPIA_V = 143;
+
+		// Luma rows of the NV12 strips YUY2 frames are filtered in. Even, so
+		// that strips start on a chroma row.
+		const uint32_t STRIP_ROWS = 16;
+
+		struct PointKernels
+		{
+			void(*linear)(const uint8_t *s, uint8_t *d, uint32_t cb, int16_t scale, int16_t biasEven, int16_t biasOdd);
+			void(*gain)(const uint8_t *s, uint8_t *d, const uint8_t *g, uint32_t cb, int16_t pivot);
+		};
+
+		inline uint8_t Clamp255(int v)
+		{
+			return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+		}
+
+		inline int16_t ToFixed(float value, float one, int minValue, int maxValue)
+		{
+			float scaled = floorf(value * one + 0.5f);
+			return (int16_t)(scaled < minValue ? minValue : (scaled > maxValue ? maxValue : scaled));
+		}
+
+		uint8_t *RowOf(const VideoPlane &plane, uint32_t row)
+		{
+			return plane.pData + (ptrdiff_t)row * plane.stride;
+		}
+
+		//-------------------------------------------------------------------
+		// Scalar reference kernels
+		//-------------------------------------------------------------------
+
+		// (s - 128) * 128 * scale / 65536, rounded down, is (s - 128) * scale / 512.
+		// This is the same arithmetic the SIMD kernels do in 16-bit lanes.
+		void LinearRow_Scalar(const uint8_t *s, uint8_t *d, uint32_t cb, int16_t scale, int16_t biasEven, int16_t biasOdd)
+		{
+			for (uint32_t i = 0; i < cb; i++)
+			{
+				int v = ((s[i] - 128) * 128 * scale) >> 16;
+				d[i] = Clamp255(v + ((i & 1) ? biasOdd : biasEven));
+			}
+		}
+
+		void GainRow_Scalar(const uint8_t *s, uint8_t *d, const uint8_t *g, uint32_t cb, int16_t pivot)
+		{
+			for (uint32_t i = 0; i < cb; i++)
+			{
+				d[i] = Clamp255(pivot + (((s[i] - pivot) * g[i]) >> 7));
+			}
+		}
+
+		void LutRow(const uint8_t *s, uint8_t *d, uint32_t cb, const uint8_t *lutEven, const uint8_t *lutOdd)
+		{
+			uint32_t i = 0;
+
+			for (; i + 2 <= cb; i += 2)
+			{
+				d[i] = lutEven[s[i]];
+				d[i + 1] = lutOdd[s[i + 1]];
+			}
+			if (i < cb)
+			{
+				d[i] = lutEven[s[i]];
+			}
+		}
+
+		const PointKernels g_ScalarKernels =
+		{
+			LinearRow_Scalar,
+			GainRow_Scalar
+		};
+
+#if defined(FILTERS_X86)
+		//-------------------------------------------------------------------
+		// SSE2 kernels
+		//-------------------------------------------------------------------
+
+		inline __m128i Linear_SSE2(__m128i v, __m128i scale, __m128i bias)
+		{
+			const __m128i c128 = _mm_set1_epi16(128);
+			v = _mm_slli_epi16(_mm_sub_epi16(v, c128), 7);
+			return _mm_adds_epi16(_mm_mulhi_epi16(v, scale), bias);
+		}
+
+		void LinearRow_SSE2(const uint8_t *s, uint8_t *d, uint32_t cb, int16_t scale, int16_t biasEven, int16_t biasOdd)
+		{
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i vScale = _mm_set1_epi16(scale);
+			const __m128i vBias = _mm_set1_epi32((int)(((uint32_t)(uint16_t)biasOdd << 16) | (uint16_t)biasEven));
+			uint32_t x = 0;
+
+			for (; x + 16 <= cb; x += 16)
+			{
+				__m128i v = _mm_loadu_si128((const __m128i *)(s + x));
+				__m128i lo = Linear_SSE2(_mm_unpacklo_epi8(v, zero), vScale, vBias);
+				__m128i hi = Linear_SSE2(_mm_unpackhi_epi8(v, zero), vScale, vBias);
+				_mm_storeu_si128((__m128i *)(d + x), _mm_packus_epi16(lo, hi));
+			}
+
+			// x is even, so the tail keeps the even/odd phase.
+			LinearRow_Scalar(s + x, d + x, cb - x, scale, biasEven, biasOdd);
+		}
+
+		void GainRow_SSE2(const uint8_t *s, uint8_t *d, const uint8_t *g, uint32_t cb, int16_t pivot)
+		{
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i vPivot = _mm_set1_epi16(pivot);
+			uint32_t x = 0;
+
+			for (; x + 16 <= cb; x += 16)
+			{
+				__m128i v = _mm_loadu_si128((const __m128i *)(s + x));
+				__m128i gv = _mm_loadu_si128((const __m128i *)(g + x));
+				__m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(v, zero), vPivot);
+				__m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(v, zero), vPivot);
+				lo = _mm_srai_epi16(_mm_mullo_epi16(lo, _mm_unpacklo_epi8(gv, zero)), 7);
+				hi = _mm_srai_epi16(_mm_mullo_epi16(hi, _mm_unpackhi_epi8(gv, zero)), 7);
+				_mm_storeu_si128((__m128i *)(d + x), _mm_packus_epi16(_mm_add_epi16(lo, vPivot), _mm_add_epi16(hi, vPivot)));
+			}
+
+			GainRow_Scalar(s + x, d + x, g + x, cb - x, pivot);
+		}
+
+		const PointKernels g_Sse2Kernels =
+		{
+			LinearRow_SSE2,
+			GainRow_SSE2
+		};
+#endif
+
+#if defined(FILTERS_NEON)
+		//-------------------------------------------------------------------
+		// NEON kernels
+		//-------------------------------------------------------------------
+
+		inline int16x8_t Linear_NEON(uint8x8_t v, int16_t scale, int16x8_t bias)
+		{
+			int16x8_t x = vreinterpretq_s16_u16(vmovl_u8(v));
+			x = vshlq_n_s16(vsubq_s16(x, vdupq_n_s16(128)), 7);
+			int32x4_t p0 = vmull_n_s16(vget_low_s16(x), scale);
+			int32x4_t p1 = vmull_n_s16(vget_high_s16(x), scale);
+			return vqaddq_s16(vcombine_s16(vshrn_n_s32(p0, 16), vshrn_n_s32(p1, 16)), bias);
+		}
+
+		void LinearRow_NEON(const uint8_t *s, uint8_t *d, uint32_t cb, int16_t scale, int16_t biasEven, int16_t biasOdd)
+		{
+			const int16x8_t vBias = vreinterpretq_s16_s32(vdupq_n_s32((int32_t)(((uint32_t)(uint16_t)biasOdd << 16) | (uint16_t)biasEven)));
+			uint32_t x = 0;
+
+			for (; x + 16 <= cb; x += 16)
+			{
+				uint8x16_t v = vld1q_u8(s + x);
+				int16x8_t lo = Linear_NEON(vget_low_u8(v), scale, vBias);
+				int16x8_t hi = Linear_NEON(vget_high_u8(v), scale, vBias);
+				vst1q_u8(d + x, vcombine_u8(vqmovun_s16(lo), vqmovun_s16(hi)));
+			}
+
+			LinearRow_Scalar(s + x, d + x, cb - x, scale, biasEven, biasOdd);
+		}
+
+		inline uint8x8_t Gain_NEON(uint8x8_t v, uint8x8_t g, int16x8_t pivot)
+		{
+			int16x8_t x = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v)), pivot);
+			x = vshrq_n_s16(vmulq_s16(x, vreinterpretq_s16_u16(vmovl_u8(g))), 7);
+			return vqmovun_s16(vaddq_s16(x, pivot));
+		}
+
+		void GainRow_NEON(const uint8_t *s, uint8_t *d, const uint8_t *g, uint32_t cb, int16_t pivot)
+		{
+			const int16x8_t vPivot = vdupq_n_s16(pivot);
+			uint32_t x = 0;
+
+			for (; x + 16 <= cb; x += 16)
+			{
+				uint8x16_t v = vld1q_u8(s + x);
+				uint8x16_t gv = vld1q_u8(g + x);
+				vst1q_u8(d + x, vcombine_u8(
+					Gain_NEON(vget_low_u8(v), vget_low_u8(gv), vPivot),
+					Gain_NEON(vget_high_u8(v), vget_high_u8(gv), vPivot)));
+			}
+
+			GainRow_Scalar(s + x, d + x, g + x, cb - x, pivot);
+		}
+
+		const PointKernels g_NeonKernels =
+		{
+			LinearRow_NEON,
+			GainRow_NEON
+		};
+#endif
+
+		const PointKernels *SelectKernels()
+		{
+			switch (GetConversionIsa())
+			{
+#if defined(FILTERS_X86)
+			case ConversionIsa_SSE2:
+			case ConversionIsa_AVX2:
+				return &g_Sse2Kernels;
+#endif
+#if defined(FILTERS_NEON)
+			case ConversionIsa_NEON:
+				return &g_NeonKernels;
+#endif
+			default:
+				return &g_ScalarKernels;
+			}
+		}
+
+		// Vignette gain at (x, y), in 1/128 steps. Never above 128: the gain
+		// kernels multiply in 16-bit lanes, where 255 * 128 is the largest
+		// product that fits.
+		uint8_t VignetteGain(float x, float y, float cx, float cy, float halfDiagonal, float radius, float falloff, float strength)
+		{
+			float r = sqrtf((x - cx) * (x - cx) + (y - cy) * (y - cy)) / halfDiagonal;
+			float t = falloff > 0.0f ? (r - radius) / falloff : 0.0f;
+			t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+			float g = 1.0f - strength * t * t * (3.0f - 2.0f * t);
+			g = g < 0.0f ? 0.0f : (g > 1.0f ? 1.0f : g);
+			return (uint8_t)floorf(g * 128.0f + 0.5f);
+		}
+
+		bool IsIdentity(const uint8_t luts[2][256])
+		{
+			for (int v = 0; v < 256; v++)
+			{
+				if (luts[0][v] != v || luts[1][v] != v)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		NativeFilter MakeFilter(NativeFilterType type)
+		{
+			NativeFilter filter;
+			filter.type = type;
+			filter.intensity = 1.0f;
+			filter.brightness = 0.0f;
+			filter.contrast = 1.0f;
+			filter.saturation = 1.0f;
+			for (int i = 0; i < 256; i++)
+			{
+				filter.curves[0][i] = filter.curves[1][i] = filter.curves[2][i] = (uint8_t)i;
+			}
+			filter.radius = 0.5f;
+			filter.strength = 0.0f;
+			return filter;
+		}
+
+		// Whether a filter computes each output pixel from the same input
+		// pixel only, and so may overwrite its input. A filter that reads
+		// neighbouring pixels would not be.
+		bool IsPointFilter(NativeFilterType type)
+		{
+			switch (type)
+			{
+			case NativeFilter_Grayscale:
+			case NativeFilter_Sepia:
+			case NativeFilter_BrightnessContrastSaturation:
+			case NativeFilter_Curves:
+			case NativeFilter_Vignette:
+			case NativeFilter_Lut3D:
+				return true;
+			}
+			return false;
+		}
+	}
+
+	NativeFilter MakeGrayscaleFilter()
+	{
+		return MakeFilter(NativeFilter_Grayscale);
+	}
+
+	NativeFilter MakeSepiaFilter(float intensity)
+	{
+		NativeFilter filter = MakeFilter(NativeFilter_Sepia);
+		filter.intensity = intensity < 0.0f ? 0.0f : (intensity > 1.0f ? 1.0f : intensity);
+		return filter;
+	}
+
+	NativeFilter MakeBrightnessContrastSaturationFilter(float brightness, float contrast, float saturation)
+	{
+		NativeFilter filter = MakeFilter(NativeFilter_BrightnessContrastSaturation);
+		filter.brightness = brightness;
+		filter.contrast = contrast;
+		filter.saturation = saturation;
+		return filter;
+	}
+
+	NativeFilter MakeCurvesFilter(const uint8_t *pY, const uint8_t *pU, const uint8_t *pV)
+	{
+		NativeFilter filter = MakeFilter(NativeFilter_Curves);
+		const uint8_t *tables[3] = { pY, pU, pV };
+		for (int c = 0; c < 3; c++)
+		{
+			if (tables[c] != nullptr)
+			{
+				memcpy(filter.curves[c], tables[c], 256);
+			}
+		}
+		return filter;
+	}
+
+	NativeFilter MakeVignetteFilter(float radius, float strength)
+	{
+		NativeFilter filter = MakeFilter(NativeFilter_Vignette);
+		filter.radius = radius < 0.0f ? 0.0f : radius;
+		filter.strength = strength < 0.0f ? 0.0f : (strength > 1.0f ? 1.0f : strength);
+		return filter;
+	}
+
+	NativeFilter MakeLut3DFilter(const std::shared_ptr<ColorCube> &cube)
+	{
+		NativeFilter filter = MakeFilter(NativeFilter_Lut3D);
+		filter.cube = cube;
+		return filter;
+	}
+
+	NativeFilterChain::NativeFilterChain(const std::vector<NativeFilter> &filters, PixelFormat format, uint32_t width, uint32_t height, YuvMatrix matrix, YuvRange range)
+		: m_format(format)
+		, m_width(width)
+		, m_height(height)
+		, m_fInPlace(true)
+		, m_cbStripStride(0)
+	{
+		// Build the operations of each filter, then fold them per plane
+		// between the 3D tables.
+		m_segments.push_back(Segment());
+		for (size_t i = 0; i < filters.size(); i++)
+		{
+			m_fInPlace = m_fInPlace && IsPointFilter(filters[i].type);
+
+			if (filters[i].type == NativeFilter_Lut3D)
+			{
+				if (filters[i].cube)
+				{
+					m_segments.push_back(Segment());
+					m_segments.back().cube = filters[i].cube->GetYuvCube(matrix, range);
+					m_segments.push_back(Segment());
+				}
+				continue;
+			}
+
+			Stage stage;
+			BuildStage(filters[i], &stage);
+
+			PlaneOp *pOps[2] = { &stage.luma, &stage.chroma };
+			for (uint32_t p = 0; p < 2; p++)
+			{
+				if (pOps[p]->kind != Op_None)
+				{
+					std::vector<PlaneOp> &ops = m_segments.back().ops[p];
+					ops.push_back(PlaneOp());
+					ops.back() = *pOps[p];
+					ops.back().gainMap.swap(pOps[p]->gainMap);
+				}
+			}
+		}
+
+		for (size_t i = 0; i < m_segments.size(); i++)
+		{
+			Fuse(&m_segments[i].ops[0]);
+			Fuse(&m_segments[i].ops[1]);
+		}
+
+		// Drop plane segments left with nothing to do, but keep the first one
+		// if it is the only one: it copies the source.
+		for (size_t i = 0; i < m_segments.size() && m_segments.size() > 1;)
+		{
+			const Segment &segment = m_segments[i];
+			if (!segment.cube && segment.ops[0].empty() && segment.ops[1].empty())
+			{
+				m_segments.erase(m_segments.begin() + i);
+			}
+			else
+			{
+				i++;
+			}
+		}
+
+		// The filters work on planes; YUY2 rows are filtered in an NV12 strip.
+		if (m_format == PixelFormat_YUY2)
+		{
+			m_cbStripStride = GetPaddedStride(GetMinimumStride(PixelFormat_NV12, width));
+			m_strips.SetFrameSize((size_t)m_cbStripStride * GetBufferRowCount(PixelFormat_NV12, STRIP_ROWS));
+		}
+	}
+
+	void NativeFilterChain::ReserveBands(size_t cBands)
+	{
+		if (m_format == PixelFormat_YUY2)
+		{
+			m_strips.Reserve(cBands);
+		}
+	}
+
+	void NativeFilterChain::Process(const VideoFrame &dest, const VideoFrame &src, uint32_t top, uint32_t bottom) const
+	{
+		if (bottom > m_height)
+		{
+			bottom = m_height;
+		}
+		if (top >= bottom)
+		{
+			return;
+		}
+
+		if (m_format == PixelFormat_YUY2)
+		{
+			ProcessYuy2(dest, src, top, bottom);
+		}
+		else
+		{
+			ApplyOps(dest, src, top, bottom);
+		}
+	}
+
+	// Filters a band of a YUY2 frame a strip of rows at a time: the rows are
+	// converted into an NV12 strip, filtered there and converted back. Each
+	// call has a strip of its own, from the pool, so any number of bands of
+	// any number of frames can be filtered at once.
+
+	void NativeFilterChain::ProcessYuy2(const VideoFrame &dest, const VideoFrame &src, uint32_t top, uint32_t bottom) const
+	{
+		uint8_t *pStrip = m_strips.Acquire();
+		if (pStrip == nullptr)
+		{
+			// Out of memory: the band is shown unfiltered rather than not at all.
+			ConvertVideoFrame(src, dest, top, bottom);
+			return;
+		}
+
+		const ptrdiff_t stride = m_cbStripStride;
+		uint8_t *pStripY = pStrip;
+		uint8_t *pStripUV = pStrip + stride * STRIP_ROWS;
+
+		for (uint32_t y = top; y < bottom; y += STRIP_ROWS)
+		{
+			const uint32_t cRows = (bottom - y < STRIP_ROWS) ? bottom - y : STRIP_ROWS;
+
+			ConvertYuy2ToNv12(RowOf(src.planes[0], y), src.planes[0].stride, pStripY, stride, pStripUV, stride, m_width, cRows);
+
+			for (uint32_t r = 0; r < cRows; r += 2)
+			{
+				uint8_t *rows[3] = { pStripY + stride * r, (r + 1 < cRows) ? pStripY + stride * (r + 1) : nullptr, pStripUV + stride * (r / 2) };
+				ApplyToRows(rows, rows, y + r);
+			}
+
+			ConvertNv12ToYuy2(pStripY, stride, pStripUV, stride, RowOf(dest.planes[0], y), dest.planes[0].stride, m_width, cRows);
+		}
+
+		m_strips.Release(pStrip);
+	}
+
+	void NativeFilterChain::BuildStage(const NativeFilter &filter, Stage *pStage) const
+	{
+		Stage &stage = *pStage;
+		stage.luma.kind = Op_None;
+		stage.chroma.kind = Op_None;
+
+		switch (filter.type)
+		{
+		case NativeFilter_Grayscale:
+			stage.chroma.kind = Op_Linear;
+			stage.chroma.scale = 0;
+			stage.chroma.bias[0] = stage.chroma.bias[1] = 128;
+			break;
+
+		case NativeFilter_Sepia:
+			// Blend the chroma towards the sepia tone.
+			stage.chroma.kind = Op_Linear;
+			stage.chroma.scale = ToFixed(1.0f - filter.intensity, 512.0f, 0, 512);
+			stage.chroma.bias[0] = 128 + ToFixed(filter.intensity, (float)(SEPIA_U - 128), -128, 127);
+			stage.chroma.bias[1] = 128 + ToFixed(filter.intensity, (float)(SEPIA_V - 128), -128, 127);
+			break;
+
+		case NativeFilter_BrightnessContrastSaturation:
+			stage.luma.kind = Op_Linear;
+			stage.luma.scale = ToFixed(filter.contrast, 512.0f, 0, 32767);
+			stage.luma.bias[0] = stage.luma.bias[1] = 128 + ToFixed(filter.brightness, 255.0f, -255, 255);
+			stage.chroma.kind = Op_Linear;
+			stage.chroma.scale = ToFixed(filter.saturation, 512.0f, 0, 32767);
+			stage.chroma.bias[0] = stage.chroma.bias[1] = 128;
+			break;
+
+		case NativeFilter_Curves:
+			stage.luma.kind = Op_Lut;
+			memcpy(stage.luma.luts[0], filter.curves[0], 256);
+			memcpy(stage.luma.luts[1], filter.curves[0], 256);
+			stage.chroma.kind = Op_Lut;
+			memcpy(stage.chroma.luts[0], filter.curves[1], 256);
+			memcpy(stage.chroma.luts[1], filter.curves[2], 256);
+			break;
+
+		case NativeFilter_Vignette:
+			BuildVignette(filter.radius, filter.strength, &stage);
+			break;
+
+		case NativeFilter_Lut3D:
+			// Applied as a segment of its own.
+			break;
+		}
+	}
+
+	// The gain falls off smoothly from 1 at the given radius to 1 - strength
+	// in the corners. Gains are stored in 1/128 steps, one per luma byte and
+	// one per chroma byte, so the kernels can stream them alongside the
+	// pixels.
+
+	void NativeFilterChain::BuildVignette(float radius, float strength, Stage *pStage) const
+	{
+		const float cx = m_width * 0.5f;
+		const float cy = m_height * 0.5f;
+		const float halfDiagonal = sqrtf(cx * cx + cy * cy);
+		const float falloff = radius < 1.0f ? 1.0f - radius : 0.0f;
+
+		PlaneOp &luma = pStage->luma;
+		luma.kind = Op_Gain;
+		luma.pivot = 0;
+		luma.gainStride = m_width;
+		luma.gainMap.resize((size_t)m_width * m_height);
+		for (uint32_t y = 0; y < m_height; y++)
+		{
+			for (uint32_t x = 0; x < m_width; x++)
+			{
+				luma.gainMap[(size_t)y * m_width + x] = VignetteGain(x + 0.5f, y + 0.5f, cx, cy, halfDiagonal, radius, falloff, strength);
+			}
+		}
+
+		// Chroma is scaled around neutral by the gain at the centre of each
+		// 2x2 block, for U and V alike.
+		const uint32_t cChroma = (m_width + 1) / 2;
+		const uint32_t cChromaRows = (m_height + 1) / 2;
+
+		PlaneOp &chroma = pStage->chroma;
+		chroma.kind = Op_Gain;
+		chroma.pivot = 128;
+		chroma.gainStride = cChroma * 2;
+		chroma.gainMap.resize((size_t)chroma.gainStride * cChromaRows);
+		for (uint32_t y = 0; y < cChromaRows; y++)
+		{
+			for (uint32_t x = 0; x < cChroma; x++)
+			{
+				uint8_t g = VignetteGain(2.0f * x + 1.0f, 2.0f * y + 1.0f, cx, cy, halfDiagonal, radius, falloff, strength);
+				chroma.gainMap[(size_t)y * chroma.gainStride + 2 * x] = g;
+				chroma.gainMap[(size_t)y * chroma.gainStride + 2 * x + 1] = g;
+			}
+		}
+	}
+
+	// Expands a linear or table operation into its even and odd tables.
+
+	void NativeFilterChain::ToTables(const PlaneOp &op, uint8_t luts[2][256])
+	{
+		if (op.kind == Op_Lut)
+		{
+			memcpy(luts, op.luts, sizeof(op.luts));
+			return;
+		}
+
+		uint8_t ramp[256];
+		for (int v = 0; v < 256; v++)
+		{
+			ramp[v] = (uint8_t)v;
+		}
+		LinearRow_Scalar(ramp, luts[0], 256, op.scale, op.bias[0], op.bias[0]);
+		LinearRow_Scalar(ramp, luts[1], 256, op.scale, op.bias[1], op.bias[1]);
+	}
+
+	// Folds runs of linear and table operations into single tables. Every
+	// operation of the run is evaluated with the scalar reference kernel,
+	// which the SIMD kernels match exactly, so the fused chain produces the
+	// same output as applying the filters one by one. Tables that end up as
+	// the identity are dropped.
+
+	void NativeFilterChain::Fuse(std::vector<PlaneOp> *pOps)
+	{
+		std::vector<PlaneOp> &ops = *pOps;
+		size_t cFused = 0;
+
+		for (size_t i = 0; i < ops.size(); i++)
+		{
+			PlaneOp &op = ops[i];
+			bool fPoint = (op.kind == Op_Linear || op.kind == Op_Lut);
+			PlaneOp *pPrevious = cFused > 0 ? &ops[cFused - 1] : nullptr;
+
+			if (fPoint && pPrevious != nullptr && (pPrevious->kind == Op_Linear || pPrevious->kind == Op_Lut))
+			{
+				uint8_t before[2][256];
+				uint8_t after[2][256];
+				ToTables(*pPrevious, before);
+				ToTables(op, after);
+
+				for (int e = 0; e < 2; e++)
+				{
+					for (int v = 0; v < 256; v++)
+					{
+						pPrevious->luts[e][v] = after[e][before[e][v]];
+					}
+				}
+				pPrevious->kind = Op_Lut;
+			}
+			else
+			{
+				if (cFused != i)
+				{
+					ops[cFused] = op;
+					ops[cFused].gainMap.swap(op.gainMap);
+				}
+				cFused++;
+			}
+		}
+
+		ops.resize(cFused);
+
+		// Drop tables that no longer change anything.
+		for (size_t i = 0; i < ops.size();)
+		{
+			if (ops[i].kind == Op_Lut && IsIdentity(ops[i].luts))
+			{
+				ops.erase(ops.begin() + i);
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+
+	// Runs the segments over the band, one chroma row and its luma rows at a
+	// time: the first segment reads src, the others work in place on the rows
+	// of dest while they are still in the cache.
+
+	void NativeFilterChain::ApplyOps(const VideoFrame &dest, const VideoFrame &src, uint32_t top, uint32_t bottom) const
+	{
+		for (uint32_t cy = top / 2; cy < (bottom + 1) / 2; cy++)
+		{
+			const uint32_t y0 = 2 * cy;
+			const bool fSecondRow = (y0 + 1 < bottom);
+
+			const uint8_t *sRows[3] = { RowOf(src.planes[0], y0), fSecondRow ? RowOf(src.planes[0], y0 + 1) : nullptr, RowOf(src.planes[1], cy) };
+			uint8_t *dRows[3] = { RowOf(dest.planes[0], y0), fSecondRow ? RowOf(dest.planes[0], y0 + 1) : nullptr, RowOf(dest.planes[1], cy) };
+
+			ApplyToRows(sRows, dRows, y0);
+		}
+	}
+
+	// Runs the segments over the luma rows y0 and y0 + 1 and their chroma row.
+	// The second luma row is null at the bottom of an odd-height frame.
+
+	void NativeFilterChain::ApplyToRows(const uint8_t *const sRows[3], uint8_t *const dRows[3], uint32_t y0) const
+	{
+		const PointKernels *k = SelectKernels();
+		const uint32_t cbChroma = ((m_width + 1) / 2) * 2;
+		const uint32_t cy = y0 / 2;
+
+		for (size_t i = 0; i < m_segments.size(); i++)
+		{
+			const Segment &segment = m_segments[i];
+			const uint8_t *const *in = (i == 0) ? sRows : dRows;
+
+			if (segment.cube)
+			{
+				segment.cube->ApplyToRows(in[0], in[1], in[2], dRows[0], dRows[1], dRows[2], m_width);
+				continue;
+			}
+
+			const uint32_t rows[3] = { y0, y0 + 1, cy };
+			const uint32_t cbRows[3] = { m_width, m_width, cbChroma };
+
+			for (uint32_t r = 0; r < 3; r++)
+			{
+				const std::vector<PlaneOp> &ops = segment.ops[r < 2 ? 0 : 1];
+				const uint8_t *s = in[r];
+				uint8_t *d = dRows[r];
+
+				if (d == nullptr)
+				{
+					continue;
+				}
+				if (ops.empty())
+				{
+					if (s != d)
+					{
+						memcpy(d, s, cbRows[r]);
+					}
+					continue;
+				}
+
+				for (size_t j = 0; j < ops.size(); j++)
+				{
+					const PlaneOp &op = ops[j];
+					const uint8_t *pIn = (j == 0) ? s : d;
+
+					switch (op.kind)
+					{
+					case Op_Linear:
+						k->linear(pIn, d, cbRows[r], op.scale, op.bias[0], op.bias[1]);
+						break;
+					case Op_Lut:
+						LutRow(pIn, d, cbRows[r], op.luts[0], op.luts[1]);
+						break;
+					case Op_Gain:
+						k->gain(pIn, d, &op.gainMap[(size_t)rows[r] * op.gainStride], cbRows[r], op.pivot);
+						break;
+					default:
+						break;
+					}
+				}
+			}
+		}
+	}
+}
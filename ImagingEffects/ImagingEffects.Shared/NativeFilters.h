@@ -0,0 +1,158 @@
+#pragma once
+
+// Built-in point filters that run directly on the Y and UV planes.
+//
+// These cover the common colour effects without going through the Nokia
+// Imaging SDK: no bitmaps, no conversion to RGB and no copies beyond the one
+// from the input to the output frame. When the effect is configured with
+// native filters only, the SDK is not used at all.
+//
+// All filters are expressed in YUV:
+//
+//   Grayscale                      Chroma set to neutral.
+//   Sepia                          Chroma pulled towards a sepia tone.
+//   BrightnessContrastSaturation   Linear map of luma around mid-grey, and
+//                                  of chroma around neutral.
+//   Curves                         One 256-entry table per channel (Y, U, V).
+//   Vignette                       Luma and chroma scaled down towards the
+//                                  corners.
+//   Lut3D                          Arbitrary colour transform from a 3D
+//                                  lookup table (see ColorCube.h).
+//
+// A NativeFilterChain is built for one frame size and is immutable, so any
+// number of bands, of any number of frames, may be processed with it in
+// parallel.
+//
+// When the chain is built, consecutive point operations on a plane (linear
+// maps and tables) are folded into a single table, and the remaining
+// operations are applied row by row. However long the chain is, each pixel
+// is read and written once. A 3D table cannot be folded into the per-plane
+// operations, so it splits the chain into segments; all segments are still
+// applied to a pair of rows before moving on to the next.
+//
+// This file does not depend on Windows headers.
+
+#include "ColorCube.h"
+#include "FramePool.h"
+#include "VideoFrame.h"
+
+#include <memory>
+#include <vector>
+
+namespace ImagingEffects
+{
+	enum NativeFilterType
+	{
+		NativeFilter_Grayscale,
+		NativeFilter_Sepia,
+		NativeFilter_BrightnessContrastSaturation,
+		NativeFilter_Curves,
+		NativeFilter_Vignette,
+		NativeFilter_Lut3D
+	};
+
+	// Parameters of one filter. Only the fields of its type are used; the
+	// Make* functions fill in the rest with neutral values.
+	struct NativeFilter
+	{
+		NativeFilterType type;
+		float intensity;        // Sepia: 0 (no tint) to 1 (full tone).
+		float brightness;       // -1 to 1, added to luma. 0 leaves it unchanged.
+		float contrast;         // 0 to 63, 1 leaves luma unchanged.
+		float saturation;       // 0 to 63, 1 leaves chroma unchanged.
+		uint8_t curves[3][256]; // Y, U and V tables.
+		float radius;           // Vignette: where darkening starts, as a fraction of the half diagonal.
+		float strength;         // Vignette: darkening in the corners, 0 to 1.
+		std::shared_ptr<ColorCube> cube;    // Lut3D. Shared by every chain built from the filter.
+	};
+
+	NativeFilter MakeGrayscaleFilter();
+	NativeFilter MakeSepiaFilter(float intensity);
+	NativeFilter MakeBrightnessContrastSaturationFilter(float brightness, float contrast, float saturation);
+
+	// Any of the tables may be null, which leaves that channel unchanged.
+	NativeFilter MakeCurvesFilter(const uint8_t *pY, const uint8_t *pU, const uint8_t *pV);
+
+	NativeFilter MakeVignetteFilter(float radius, float strength);
+	NativeFilter MakeLut3DFilter(const std::shared_ptr<ColorCube> &cube);
+
+	// NativeFilterChain class:
+	// Applies a list of filters to NV12 or YUY2 frames of a fixed size.
+
+	class NativeFilterChain
+	{
+	public:
+		// matrix and range describe the stream; they select the YUV tables of
+		// the Lut3D filters.
+		NativeFilterChain(const std::vector<NativeFilter> &filters, PixelFormat format, uint32_t width, uint32_t height, YuvMatrix matrix, YuvRange range);
+
+		// Filters rows [top, bottom) of src into dest. dest may be src if
+		// CanProcessInPlace returns true. For 4:2:0 frames top must be even.
+		void Process(const VideoFrame &dest, const VideoFrame &src, uint32_t top, uint32_t bottom) const;
+
+		// True if every filter of the chain computes a pixel from that pixel
+		// alone, so the chain can overwrite its source. Decided when the
+		// chain is built.
+		bool CanProcessInPlace() const { return m_fInPlace; }
+
+		// Sets aside the working memory for cBands bands filtered at once,
+		// so that filtering them allocates nothing. More bands at once still
+		// work; the memory for them is allocated the first time.
+		void ReserveBands(size_t cBands);
+
+	private:
+		// One operation on the bytes of a plane row. Even and odd bytes may
+		// use different parameters, which is how U and V are told apart in
+		// the interleaved chroma plane.
+		enum OpKind
+		{
+			Op_None,
+			Op_Linear,      // d = clamp((s - 128) * scale / 512 + bias)
+			Op_Lut,         // d = lut[s]
+			Op_Gain         // d = clamp(pivot + (s - pivot) * gain / 128), gain from a map
+		};
+
+		struct PlaneOp
+		{
+			OpKind kind;
+			int16_t scale;
+			int16_t bias[2];
+			uint8_t luts[2][256];
+			std::vector<uint8_t> gainMap;
+			uint32_t gainStride;
+			int16_t pivot;
+		};
+
+		struct Stage
+		{
+			PlaneOp luma;
+			PlaneOp chroma;
+		};
+
+		// Either fused operations for the luma and chroma planes, or a 3D
+		// table applied to both.
+		struct Segment
+		{
+			std::vector<PlaneOp> ops[2];
+			std::shared_ptr<const YuvCube> cube;
+		};
+
+		void BuildStage(const NativeFilter &filter, Stage *pStage) const;
+		void BuildVignette(float radius, float strength, Stage *pStage) const;
+		static void ToTables(const PlaneOp &op, uint8_t luts[2][256]);
+		static void Fuse(std::vector<PlaneOp> *pOps);
+		void ApplyOps(const VideoFrame &dest, const VideoFrame &src, uint32_t top, uint32_t bottom) const;
+		void ApplyToRows(const uint8_t *const sRows[3], uint8_t *const dRows[3], uint32_t y0) const;
+		void ProcessYuy2(const VideoFrame &dest, const VideoFrame &src, uint32_t top, uint32_t bottom) const;
+
+		PixelFormat m_format;
+		uint32_t m_width;
+		uint32_t m_height;
+		bool m_fInPlace;
+		std::vector<Segment> m_segments;    // Never empty; the first segment reads the source.
+
+		// NV12 strips for YUY2 streams, one per band being filtered.
+		uint32_t m_cbStripStride;
+		mutable FramePool m_strips;
+	};
+}
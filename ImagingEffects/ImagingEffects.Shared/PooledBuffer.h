@@ -0,0 +1,309 @@
+#pragma once
+
+#include "pch.h"
+#include "FramePool.h"
+#include <wrl.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace ImagingEffects
+{
+	// A Media Foundation buffer over a frame from a FramePool. The frame goes
+	// back to the pool when the last reference to the buffer is released,
+	// wherever downstream that happens.
+	//
+	// Rows are cRows rows of cbRow bytes, lStride apart. The 2D interfaces
+	// hand out the frame as it is; IMFMediaBuffer::Lock has to return the
+	// frame without padding, so if the rows are padded it returns a packed
+	// copy and writes it back on Unlock, as the Media Foundation buffers do.
+
+	class PooledBuffer : public Microsoft::WRL::RuntimeClass < Microsoft::WRL::RuntimeClassFlags<Microsoft::WRL::RuntimeClassType::ClassicCom>,
+		IMFMediaBuffer,
+		Microsoft::WRL::ChainInterfaces<IMF2DBuffer2, IMF2DBuffer> >
+	{
+	public:
+		PooledBuffer()
+			: m_pData(nullptr)
+			, m_lStride(0)
+			, m_cbRow(0)
+			, m_cRows(0)
+			, m_cbCurrent(0)
+			, m_cLocks(0)
+			, m_cLocks2D(0)
+		{
+		}
+
+		virtual ~PooledBuffer()
+		{
+			if (m_spPool)
+			{
+				m_spPool->Release(m_pData);
+			}
+		}
+
+		STDMETHODIMP RuntimeClassInitialize(const std::shared_ptr<FramePool> &spPool, LONG lStride, DWORD cbRow, DWORD cRows)
+		{
+			if (spPool == nullptr || lStride < (LONG)cbRow || (size_t)lStride * cRows > spPool->GetFrameSize())
+			{
+				return E_INVALIDARG;
+			}
+
+			m_pData = spPool->Acquire();
+			if (m_pData == nullptr)
+			{
+				return E_OUTOFMEMORY;
+			}
+
+			m_spPool = spPool;
+			m_lStride = lStride;
+			m_cbRow = cbRow;
+			m_cRows = cRows;
+			return S_OK;
+		}
+
+		// IMFMediaBuffer
+
+		STDMETHODIMP Lock(BYTE **ppbBuffer, DWORD *pcbMaxLength, DWORD *pcbCurrentLength)
+		{
+			if (ppbBuffer == nullptr)
+			{
+				return E_POINTER;
+			}
+
+			std::lock_guard<std::mutex> lock(m_lock);
+			if (IsContiguous())
+			{
+				*ppbBuffer = m_pData;
+			}
+			else
+			{
+				if (m_cLocks == 0)
+				{
+					m_packed.resize(GetPackedLength());
+					CopyRows(m_packed.data(), m_cbRow, m_pData, m_lStride);
+				}
+				*ppbBuffer = m_packed.data();
+			}
+			m_cLocks++;
+
+			if (pcbMaxLength)
+			{
+				*pcbMaxLength = GetPackedLength();
+			}
+			if (pcbCurrentLength)
+			{
+				*pcbCurrentLength = m_cbCurrent;
+			}
+			return S_OK;
+		}
+
+		STDMETHODIMP Unlock()
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			if (m_cLocks == 0)
+			{
+				return MF_E_INVALIDREQUEST;
+			}
+
+			if (--m_cLocks == 0 && !IsContiguous())
+			{
+				CopyRows(m_pData, m_lStride, m_packed.data(), m_cbRow);
+			}
+			return S_OK;
+		}
+
+		STDMETHODIMP GetCurrentLength(DWORD *pcbCurrentLength)
+		{
+			if (pcbCurrentLength == nullptr)
+			{
+				return E_POINTER;
+			}
+			*pcbCurrentLength = m_cbCurrent;
+			return S_OK;
+		}
+
+		STDMETHODIMP SetCurrentLength(DWORD cbCurrentLength)
+		{
+			if (cbCurrentLength > GetPackedLength())
+			{
+				return E_INVALIDARG;
+			}
+			m_cbCurrent = cbCurrentLength;
+			return S_OK;
+		}
+
+		STDMETHODIMP GetMaxLength(DWORD *pcbMaxLength)
+		{
+			if (pcbMaxLength == nullptr)
+			{
+				return E_POINTER;
+			}
+			*pcbMaxLength = GetPackedLength();
+			return S_OK;
+		}
+
+		// IMF2DBuffer
+
+		STDMETHODIMP Lock2D(BYTE **ppbScanline0, LONG *plPitch)
+		{
+			if (ppbScanline0 == nullptr || plPitch == nullptr)
+			{
+				return E_POINTER;
+			}
+
+			std::lock_guard<std::mutex> lock(m_lock);
+			*ppbScanline0 = m_pData;
+			*plPitch = m_lStride;
+			m_cLocks2D++;
+			return S_OK;
+		}
+
+		STDMETHODIMP Unlock2D()
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			if (m_cLocks2D == 0)
+			{
+				return MF_E_INVALIDREQUEST;
+			}
+			m_cLocks2D--;
+			return S_OK;
+		}
+
+		STDMETHODIMP GetScanline0AndPitch(BYTE **ppbScanline0, LONG *plPitch)
+		{
+			if (ppbScanline0 == nullptr || plPitch == nullptr)
+			{
+				return E_POINTER;
+			}
+
+			std::lock_guard<std::mutex> lock(m_lock);
+			if (m_cLocks2D == 0)
+			{
+				return MF_E_UNEXPECTED;
+			}
+			*ppbScanline0 = m_pData;
+			*plPitch = m_lStride;
+			return S_OK;
+		}
+
+		STDMETHODIMP IsContiguousFormat(BOOL *pfIsContiguous)
+		{
+			if (pfIsContiguous == nullptr)
+			{
+				return E_POINTER;
+			}
+			*pfIsContiguous = IsContiguous() ? TRUE : FALSE;
+			return S_OK;
+		}
+
+		STDMETHODIMP GetContiguousLength(DWORD *pcbLength)
+		{
+			if (pcbLength == nullptr)
+			{
+				return E_POINTER;
+			}
+			*pcbLength = GetPackedLength();
+			return S_OK;
+		}
+
+		STDMETHODIMP ContiguousCopyTo(BYTE *pbDestBuffer, DWORD cbDestBuffer)
+		{
+			if (pbDestBuffer == nullptr)
+			{
+				return E_POINTER;
+			}
+			if (cbDestBuffer < GetPackedLength())
+			{
+				return MF_E_BUFFERTOOSMALL;
+			}
+			CopyRows(pbDestBuffer, m_cbRow, m_pData, m_lStride);
+			return S_OK;
+		}
+
+		STDMETHODIMP ContiguousCopyFrom(const BYTE *pbSrcBuffer, DWORD cbSrcBuffer)
+		{
+			if (pbSrcBuffer == nullptr)
+			{
+				return E_POINTER;
+			}
+			if (cbSrcBuffer < GetPackedLength())
+			{
+				return E_INVALIDARG;
+			}
+			CopyRows(m_pData, m_lStride, pbSrcBuffer, m_cbRow);
+			return S_OK;
+		}
+
+		// IMF2DBuffer2
+
+		STDMETHODIMP Lock2DSize(MF2DBuffer_LockFlags lockFlags, BYTE **ppbScanline0, LONG *plPitch, BYTE **ppbBufferStart, DWORD *pcbBufferLength)
+		{
+			if (ppbBufferStart == nullptr || pcbBufferLength == nullptr)
+			{
+				return E_POINTER;
+			}
+
+			HRESULT hr = Lock2D(ppbScanline0, plPitch);
+			if (SUCCEEDED(hr))
+			{
+				*ppbBufferStart = m_pData;
+				*pcbBufferLength = (DWORD)m_lStride * m_cRows;
+			}
+			return hr;
+		}
+
+		STDMETHODIMP Copy2DTo(IMF2DBuffer2 *pDestBuffer)
+		{
+			if (pDestBuffer == nullptr)
+			{
+				return E_POINTER;
+			}
+
+			BYTE *pDest = nullptr;
+			LONG lDestPitch = 0;
+			BYTE *pDestStart = nullptr;
+			DWORD cbDest = 0;
+			HRESULT hr = pDestBuffer->Lock2DSize(MF2DBuffer_LockFlags_Write, &pDest, &lDestPitch, &pDestStart, &cbDest);
+			if (SUCCEEDED(hr))
+			{
+				if (abs(lDestPitch) < (LONG)m_cbRow)
+				{
+					hr = MF_E_BUFFERTOOSMALL;
+				}
+				else
+				{
+					CopyRows(pDest, lDestPitch, m_pData, m_lStride);
+				}
+				pDestBuffer->Unlock2D();
+			}
+			return hr;
+		}
+
+	private:
+		bool IsContiguous() const { return m_lStride == (LONG)m_cbRow; }
+		DWORD GetPackedLength() const { return m_cbRow * m_cRows; }
+
+		void CopyRows(BYTE *pDest, LONG lDestStride, const BYTE *pSrc, LONG lSrcStride) const
+		{
+			for (DWORD y = 0; y < m_cRows; y++)
+			{
+				CopyMemory(pDest, pSrc, m_cbRow);
+				pDest += lDestStride;
+				pSrc += lSrcStride;
+			}
+		}
+
+		std::shared_ptr<FramePool> m_spPool;
+		BYTE *m_pData;
+		LONG m_lStride;
+		DWORD m_cbRow;
+		DWORD m_cRows;
+		DWORD m_cbCurrent;
+
+		std::mutex m_lock;              // Guards the lock counts and the packed copy.
+		DWORD m_cLocks;                 // IMFMediaBuffer::Lock calls.
+		DWORD m_cLocks2D;               // IMF2DBuffer::Lock2D calls.
+		std::vector<BYTE> m_packed;     // Frame without padding, while locked through IMFMediaBuffer.
+	};
+}
@@ -0,0 +1,224 @@
+#include "pch.h"
+#include "RenderGraph.h"
+
+#include <robuffer.h>
+#include <ppl.h>
+
+using namespace Microsoft::WRL;
+using namespace concurrency;
+using namespace Windows::Storage::Streams;
+using namespace Nokia::Graphics::Imaging;
+using namespace Windows::Foundation::Collections;
+using namespace ImagingEffects;
+
+// Wraps a NativeBuffer in the IBuffer^ the SDK expects.
+static IBuffer^ AsIBuffer(ImagingEffects::NativeBuffer *pNativeBuffer)
+{
+	auto iinspectable = reinterpret_cast<IInspectable *>(pNativeBuffer);
+	return reinterpret_cast<IBuffer ^>(iinspectable);
+}
+
+RenderGraph::RenderGraph(
+	PixelFormat streamFormat,
+	UINT32 width,
+	UINT32 height,
+	const std::vector<FrameBand> &bands,
+	IVector<IImageProvider^>^ providers
+	)
+	: m_streamFormat(streamFormat)
+	, m_width(width)
+	, m_height(height)
+	, m_bands(bands)
+	, m_providers(providers)
+{
+	if (providers == nullptr || providers->Size == 0)
+	{
+		throw ref new InvalidArgumentException();
+	}
+
+	if (m_streamFormat != PixelFormat_NV12 && m_streamFormat != PixelFormat_YUY2)
+	{
+		throw ref new InvalidArgumentException();
+	}
+
+	m_input.cbStrides[0] = m_input.cbStrides[1] = 0;
+	m_output.cbStrides[0] = m_output.cbStrides[1] = 0;
+
+	// Streams that are not NV12 always go through the working frames, so the
+	// bitmaps can be created up front.
+	if (m_streamFormat != PixelFormat_NV12)
+	{
+		AllocateWorkFrames();
+		PrepareBitmap(&m_input, m_workInput);
+		PrepareBitmap(&m_output, m_workOutput);
+	}
+}
+
+RenderGraph::~RenderGraph()
+{
+}
+
+void RenderGraph::Render(const VideoFrame &dest, const VideoFrame &src)
+{
+	if (dest.width != m_width || dest.height != m_height || src.width != m_width || src.height != m_height)
+	{
+		throw ref new InvalidArgumentException();
+	}
+
+	const VideoFrame *pInput = &src;
+	const VideoFrame *pOutput = &dest;
+
+	if (!CanWrap(src))
+	{
+		AllocateWorkFrames();
+		ConvertBands(src, m_workInput);
+		pInput = &m_workInput;
+	}
+	if (!CanWrap(dest))
+	{
+		AllocateWorkFrames();
+		pOutput = &m_workOutput;
+	}
+
+	// The head of the chain keeps reading through m_input and the renderer
+	// keeps writing to m_output; they only change if the pitch does.
+	if (PrepareBitmap(&m_input, *pInput) || m_source == nullptr)
+	{
+		m_source = ref new BitmapImageSource(m_input.bitmap);
+	}
+	if (PrepareBitmap(&m_output, *pOutput) || m_renderer == nullptr)
+	{
+		m_renderer = ref new BitmapRenderer(m_providers->GetAt(m_providers->Size - 1), m_output.bitmap);
+	}
+
+	// Another graph may have rendered with the same providers since the last
+	// frame, and pointed the head of the chain at its own input.
+	((IImageConsumer^)m_providers->GetAt(0))->Source = m_source;
+
+	Bind(&m_input, pInput);
+	Bind(&m_output, pOutput);
+
+	try
+	{
+		RenderBoundBitmaps();
+	}
+	catch (...)
+	{
+		Bind(&m_input, nullptr);
+		Bind(&m_output, nullptr);
+		throw;
+	}
+
+	// Do not leave the bitmaps pointing at buffers that are about to be unlocked.
+	Bind(&m_input, nullptr);
+	Bind(&m_output, nullptr);
+
+	if (pOutput != &dest)
+	{
+		ConvertBands(m_workOutput, dest);
+	}
+}
+
+void RenderGraph::RenderBoundBitmaps()
+{
+	auto renderTask = create_task(m_renderer->RenderAsync());
+	renderTask.wait();
+}
+
+// The SDK takes an unsigned scanline per plane, so it can address top-down
+// NV12 frames with any pitch and any plane placement, but nothing else.
+
+bool RenderGraph::CanWrap(const VideoFrame &frame) const
+{
+	return frame.format == PixelFormat_NV12 && IsTopDown(frame);
+}
+
+// Make sure the bitmap has the pitch of the frame. Returns true if the
+// bitmap was (re)created.
+
+bool RenderGraph::PrepareBitmap(BoundBitmap *pBitmap, const VideoFrame &frame)
+{
+	UINT32 cbStrides[2] = { (UINT32)frame.planes[0].stride, (UINT32)frame.planes[1].stride };
+
+	if (pBitmap->cbStrides[0] == cbStrides[0] && pBitmap->cbStrides[1] == cbStrides[1])
+	{
+		return false;
+	}
+
+	CreateBitmap(pBitmap, cbStrides);
+	return true;
+}
+
+// Create an NV12 bitmap whose planes start out unbound.
+
+void RenderGraph::CreateBitmap(BoundBitmap *pBitmap, const UINT32 *pcbStrides)
+{
+	auto size = Windows::Foundation::Size((float)m_width, (float)m_height);
+
+	//Y buffer will be having a length of Stride x Height
+	//UV Buffer will be Width/2 and Height/2 and each will take 2 bytes
+	pBitmap->cbPlanes[0] = pcbStrides[0] * m_height;
+	pBitmap->cbPlanes[1] = pcbStrides[1] * ((m_height + 1) / 2);
+
+	for (UINT32 i = 0; i < 2; i++)
+	{
+		ThrowIfError(MakeAndInitialize<ImagingEffects::NativeBuffer>(&pBitmap->spPlanes[i], nullptr, pBitmap->cbPlanes[i]));
+	}
+
+	Platform::Array<unsigned int, 1U>^ scanlines = ref new Platform::Array<unsigned int>(2);      // for NV12 2 planes Y and UV.
+	Platform::Array<IBuffer^, 1U>^ buffers = ref new Platform::Array<IBuffer^>(2);
+
+	buffers[0] = AsIBuffer(pBitmap->spPlanes[0].Get());
+	buffers[1] = AsIBuffer(pBitmap->spPlanes[1].Get());
+
+	scanlines[0] = pcbStrides[0]; // YBuffer,  w items of 1 byte long
+	scanlines[1] = pcbStrides[1]; // UVBuffer, Each UV is 2 bytes long, and there are w/2 of them.
+
+	pBitmap->bitmap = ref new Bitmap(size, ColorMode::Yuv420Sp, scanlines, buffers);
+	pBitmap->cbStrides[0] = pcbStrides[0];
+	pBitmap->cbStrides[1] = pcbStrides[1];
+}
+
+// Point the planes of a bitmap at a frame in memory (or at nothing).
+
+void RenderGraph::Bind(BoundBitmap *pBitmap, const VideoFrame *pFrame)
+{
+	for (UINT32 i = 0; i < 2; i++)
+	{
+		BYTE *pPlane = pFrame != nullptr ? pFrame->planes[i].pData : nullptr;
+		pBitmap->spPlanes[i]->SetBuffer(pPlane, pBitmap->cbPlanes[i]);
+	}
+}
+
+// Allocate the NV12 working frames, tightly packed.
+
+void RenderGraph::AllocateWorkFrames()
+{
+	if (!m_workInputBuffer.empty())
+	{
+		return;
+	}
+
+	const UINT32 cbStride = GetMinimumStride(PixelFormat_NV12, m_width);
+	const size_t cbFrame = (size_t)cbStride * GetBufferRowCount(PixelFormat_NV12, m_height);
+
+	m_workInputBuffer.resize(cbFrame);
+	m_workOutputBuffer.resize(cbFrame);
+
+	if (!WrapVideoFrame(PixelFormat_NV12, m_width, m_height, m_workInputBuffer.data(), cbStride, nullptr, 0, &m_workInput) ||
+		!WrapVideoFrame(PixelFormat_NV12, m_width, m_height, m_workOutputBuffer.data(), cbStride, nullptr, 0, &m_workOutput))
+	{
+		throw ref new InvalidArgumentException();
+	}
+}
+
+// Copy or convert a frame, one band per task. Bands start on even rows, so
+// every band owns whole chroma rows.
+
+void RenderGraph::ConvertBands(const VideoFrame &src, const VideoFrame &dest)
+{
+	parallel_for(size_t(0), m_bands.size(), [&](size_t i)
+	{
+		ConvertVideoFrame(src, dest, m_bands[i].top, m_bands[i].bottom);
+	});
+}
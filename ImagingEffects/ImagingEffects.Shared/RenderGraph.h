@@ -0,0 +1,75 @@
+#pragma once
+#include "NativeBuffer.h"
+#include "VideoFrame.h"
+#include "FrameBands.h"
+#include <vector>
+
+// RenderGraph class:
+// Holds the Nokia Imaging SDK objects used to render one stream.
+//
+// The graph is built once per media type (in BeginStreaming) and torn down
+// in EndStreaming or when the type or the effect chain changes. For each
+// sample only the memory behind the input and output bitmaps, and the source
+// of the first provider, are rebound, so no SDK objects are created on the
+// streaming path.
+//
+// The effect chain always runs on NV12. Top-down NV12 frames are wrapped
+// in place, whatever their pitch; the bitmaps are recreated when the pitch
+// changes, which normally happens once. Frames the SDK cannot address
+// directly (other layouts, bottom-up images) are converted into NV12
+// working buffers on the way in and back on the way out, one band per task.
+
+class RenderGraph
+{
+public:
+	RenderGraph(
+		ImagingEffects::PixelFormat streamFormat,
+		UINT32 width,
+		UINT32 height,
+		const std::vector<FrameBand> &bands,
+		Windows::Foundation::Collections::IVector<Nokia::Graphics::Imaging::IImageProvider^>^ providers
+		);
+
+	~RenderGraph();
+
+	// Renders one frame from src into dest. Both must have the size of the stream.
+	// The providers are the app's and may be in other graphs too: the caller
+	// holds a lock that every graph with the same providers renders under.
+	void Render(const ImagingEffects::VideoFrame &dest, const ImagingEffects::VideoFrame &src);
+
+private:
+	// A Bitmap whose planes are backed by rebindable NativeBuffers.
+	struct BoundBitmap
+	{
+		Nokia::Graphics::Imaging::Bitmap^ bitmap;
+		ComPtr<ImagingEffects::NativeBuffer> spPlanes[2];
+		UINT32 cbPlanes[2];
+		UINT32 cbStrides[2];    // Zero until the bitmap is created.
+	};
+
+	bool CanWrap(const ImagingEffects::VideoFrame &frame) const;
+	bool PrepareBitmap(BoundBitmap *pBitmap, const ImagingEffects::VideoFrame &frame);
+	void CreateBitmap(BoundBitmap *pBitmap, const UINT32 *pcbStrides);
+	void Bind(BoundBitmap *pBitmap, const ImagingEffects::VideoFrame *pFrame);
+	void AllocateWorkFrames();
+	void ConvertBands(const ImagingEffects::VideoFrame &src, const ImagingEffects::VideoFrame &dest);
+	void RenderBoundBitmaps();
+
+	ImagingEffects::PixelFormat m_streamFormat;
+	UINT32 m_width;
+	UINT32 m_height;
+	std::vector<FrameBand> m_bands;
+
+	// NV12 working frames for frames that cannot be wrapped. Allocated on first use.
+	std::vector<BYTE> m_workInputBuffer;
+	std::vector<BYTE> m_workOutputBuffer;
+	ImagingEffects::VideoFrame m_workInput;
+	ImagingEffects::VideoFrame m_workOutput;
+
+	BoundBitmap m_input;
+	BoundBitmap m_output;
+
+	Windows::Foundation::Collections::IVector<Nokia::Graphics::Imaging::IImageProvider^>^ m_providers;
+	Nokia::Graphics::Imaging::BitmapImageSource^ m_source;
+	Nokia::Graphics::Imaging::BitmapRenderer^ m_renderer;
+};
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "pch.h"
+#include "VideoBufferLock.h"
+#include "VideoFrame.h"
+#include <memory>
+#include <vector>
+
+namespace ImagingEffects
+{
+	// Locks the buffers of a sample and describes them as one frame.
+	//
+	// A sample may hold the frame in one buffer, or in one buffer per plane
+	// (e.g. separate Y and UV buffers). Both are used where they are, without
+	// copying. Any other layout is first copied into a single buffer with
+	// IMFSample::ConvertToContiguousBuffer, which also replaces the sample's
+	// buffers, so output written to it ends up in the sample. The bytes
+	// copied are reported by GetBytesCopied.
+	//
+	// The time spent locking buffers, and the time spent describing them
+	// (and copying them, if it comes to that), are reported separately.
+
+	class SampleFrameLock
+	{
+	public:
+		// lDefaultStride is the stride of the first plane when a buffer does
+		// not report its own pitch.
+		SampleFrameLock(IMFSample *pSample, MF2DBuffer_LockFlags flags, PixelFormat format, UINT32 width, UINT32 height, LONG lDefaultStride)
+			: m_cbCopied(0)
+			, m_hnsLock(0)
+			, m_hnsWrap(0)
+		{
+			DWORD cBuffers = 0;
+			ThrowIfError(pSample->GetBufferCount(&cBuffers));
+
+			PlaneShape shapes[3];
+			const uint32_t cPlanes = GetPlaneShapes(format, width, height, lDefaultStride, shapes);
+
+			if (cBuffers == 1)
+			{
+				ComPtr<IMFMediaBuffer> spBuffer;
+				ThrowIfError(pSample->GetBufferByIndex(0, &spBuffer));
+				LockWhole(spBuffer.Get(), flags, format, width, height, lDefaultStride);
+				return;
+			}
+
+			if (cBuffers == cPlanes && LockPlanes(pSample, flags, format, width, height, shapes, cPlanes))
+			{
+				return;
+			}
+
+			// The layout cannot be mapped: gather the frame into one buffer.
+			m_locks.clear();
+			m_cbPlanes.clear();
+			m_buffers.clear();
+
+			DWORD cbTotal = 0;
+			ThrowIfError(pSample->GetTotalLength(&cbTotal));
+
+			ComPtr<IMFMediaBuffer> spBuffer;
+			LONGLONG hnsStart = MFGetSystemTime();
+			ThrowIfError(pSample->ConvertToContiguousBuffer(&spBuffer));
+			m_hnsWrap += MFGetSystemTime() - hnsStart;
+			m_cbCopied = cbTotal;
+
+			LockWhole(spBuffer.Get(), flags, format, width, height, lDefaultStride);
+		}
+
+		const VideoFrame& GetFrame() const { return m_frame; }
+
+		// Bytes ConvertToContiguousBuffer copied; 0 if the buffers were used
+		// in place.
+		uint64_t GetBytesCopied() const { return m_cbCopied; }
+
+		// Time spent locking the buffers, and describing or copying them, in
+		// 100 ns units.
+		LONGLONG GetLockTime() const { return m_hnsLock; }
+		LONGLONG GetWrapTime() const { return m_hnsWrap; }
+
+		// Sets the data length of every buffer to the size of what it holds.
+		void SetCurrentLength(DWORD cbImage)
+		{
+			if (m_buffers.size() == 1)
+			{
+				ThrowIfError(m_buffers[0]->SetCurrentLength(cbImage));
+				return;
+			}
+
+			for (size_t i = 0; i < m_buffers.size(); i++)
+			{
+				ThrowIfError(m_buffers[i]->SetCurrentLength(m_cbPlanes[i]));
+			}
+		}
+
+	private:
+		SampleFrameLock(const SampleFrameLock&);
+		SampleFrameLock& operator=(const SampleFrameLock&);
+
+		void LockWhole(IMFMediaBuffer *pBuffer, MF2DBuffer_LockFlags flags, PixelFormat format, UINT32 width, UINT32 height, LONG lDefaultStride)
+		{
+			const LONG lRowCount = GetBufferRowCount(format, height);
+			const LONG lRowSize = GetMinimumStride(format, width);
+
+			m_buffers.push_back(pBuffer);
+			LONGLONG hnsStart = MFGetSystemTime();
+			m_locks.push_back(std::unique_ptr<VideoBufferLock>(new VideoBufferLock(pBuffer, flags, lRowCount, lDefaultStride, lRowSize)));
+			LONGLONG hnsLocked = MFGetSystemTime();
+			m_hnsLock += hnsLocked - hnsStart;
+
+			VideoBufferLock &lock = *m_locks.back();
+			bool fWrapped = WrapVideoFrame(format, width, height, lock.GetTopRow(), lock.GetStride(), lock.GetBufferStart(), lock.GetBufferLength(), &m_frame);
+			m_hnsWrap += MFGetSystemTime() - hnsLocked;
+			if (!fWrapped)
+			{
+				ThrowException(MF_E_BUFFERTOOSMALL);
+			}
+		}
+
+		// One buffer per plane. Returns false if the buffers do not hold the
+		// planes (a buffer too small for its plane, for instance).
+		bool LockPlanes(IMFSample *pSample, MF2DBuffer_LockFlags flags, PixelFormat format, UINT32 width, UINT32 height, const PlaneShape *pShapes, uint32_t cPlanes)
+		{
+			BufferView views[3];
+
+			for (uint32_t i = 0; i < cPlanes; i++)
+			{
+				ComPtr<IMFMediaBuffer> spBuffer;
+				ThrowIfError(pSample->GetBufferByIndex(i, &spBuffer));
+
+				// A buffer without a pitch of its own holds its plane at the
+				// default stride, and may be too small for that. 2D buffers
+				// are checked against their pitch when they are locked.
+				const DWORD cbPlane = pShapes[i].cRows * (DWORD)abs(pShapes[i].stride);
+				ComPtr<IMF2DBuffer> sp2DBuffer;
+				if (FAILED(spBuffer.As(&sp2DBuffer)))
+				{
+					DWORD cbMax = 0;
+					ThrowIfError(spBuffer->GetMaxLength(&cbMax));
+					if (cbMax < cbPlane)
+					{
+						return false;
+					}
+				}
+
+				m_buffers.push_back(spBuffer);
+				m_cbPlanes.push_back(cbPlane);
+				LONGLONG hnsStart = MFGetSystemTime();
+				m_locks.push_back(std::unique_ptr<VideoBufferLock>(new VideoBufferLock(spBuffer.Get(), flags, pShapes[i].cRows, (LONG)pShapes[i].stride, pShapes[i].cbRow)));
+				m_hnsLock += MFGetSystemTime() - hnsStart;
+
+				VideoBufferLock &lock = *m_locks.back();
+				views[i].pTopRow = lock.GetTopRow();
+				views[i].stride = lock.GetStride();
+				views[i].pBufferStart = lock.GetBufferStart();
+				views[i].cbBuffer = lock.GetBufferLength();
+			}
+
+			LONGLONG hnsStart = MFGetSystemTime();
+			bool fWrapped = WrapVideoFrameBuffers(format, width, height, views, cPlanes, &m_frame);
+			m_hnsWrap += MFGetSystemTime() - hnsStart;
+			return fWrapped;
+		}
+
+		std::vector<ComPtr<IMFMediaBuffer>> m_buffers;
+		std::vector<DWORD> m_cbPlanes;                          // Data length of each plane buffer.
+		std::vector<std::unique_ptr<VideoBufferLock>> m_locks;  // Unlocked before m_buffers is released.
+		VideoFrame m_frame;
+		uint64_t m_cbCopied;
+		LONGLONG m_hnsLock;
+		LONGLONG m_hnsWrap;
+	};
+}
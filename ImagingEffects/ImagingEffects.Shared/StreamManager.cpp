@@ -0,0 +1,457 @@
+// Fair scheduling of many streams on shared threads.
+//
+// This file does not use the precompiled header so that it can be built
+// without Windows headers.
+
+#include "StreamManager.h"
+#include "TraceRecorder.h"
+
+#include <algorithm>
+#include <deque>
+
+namespace ImagingEffects
+{
+	namespace
+	{
+		// Cost assumed for a frame before any has been rendered, per pixel.
+		const uint64_t GUESS_NS_PER_PIXEL = 1;
+
+		// Moving averages give each new measurement a weight of 1/8.
+		const int AVERAGE_SHIFT = 3;
+
+		uint64_t UpdateAverage(uint64_t average, uint64_t sample)
+		{
+			return (uint64_t)((int64_t)average + (((int64_t)sample - (int64_t)average) >> AVERAGE_SHIFT));
+		}
+
+		bool MatchesFormat(const VideoFrame &frame, const StreamFormat &format)
+		{
+			return frame.format == format.pixelFormat && frame.width == format.width && frame.height == format.height;
+		}
+
+		void Summarize(const LatencyHistogram &histogram, LatencySummary *pSummary)
+		{
+			std::vector<uint64_t> counts(LATENCY_BUCKET_COUNT);
+			histogram.CopyCounts(&counts[0]);
+
+			uint64_t cTotal = 0;
+			for (size_t i = 0; i < counts.size(); i++)
+			{
+				cTotal += counts[i];
+			}
+
+			pSummary->cFrames = cTotal;
+			pSummary->p50 = LatencyHistogram::GetPercentile(&counts[0], cTotal, 0.5);
+			pSummary->p99 = LatencyHistogram::GetPercentile(&counts[0], cTotal, 0.99);
+			pSummary->p999 = LatencyHistogram::GetPercentile(&counts[0], cTotal, 0.999);
+		}
+	}
+
+	StreamConfig MakeStreamConfig(const StreamFormat &format, uint32_t frameRate)
+	{
+		StreamConfig config;
+		config.format = format;
+		config.weight = 1;
+		config.frameRate = frameRate;
+		config.policy = MakeDefaultSchedulerPolicy();
+		config.policy.fEnabled = true;
+		config.cMaxQueued = 2;
+		return config;
+	}
+
+	struct StreamManager::QueuedFrame
+	{
+		VideoFrame dest;
+		VideoFrame src;
+		FrameDone done;
+		uint64_t nsArrival;
+		uint64_t startTag;              // Virtual time at which the frame may be picked.
+	};
+
+	struct StreamManager::Stream
+	{
+		explicit Stream(const StreamConfig &config)
+			: format(config.format)
+			, weight(config.weight)
+			, frameRate(config.frameRate)
+			, cMaxQueued(config.cMaxQueued)
+			, engine(RunSerially, 1)
+			, finishTag(0)
+			, fBusy(false)
+			, fHaveCost(false)
+			, nsCost(0)
+			, cSubmitted(0)
+			, cRefused(0)
+		{
+			for (int i = 0; i < FrameAction_Count; i++)
+			{
+				cFrames[i] = 0;
+			}
+		}
+
+		StreamId id;
+		const StreamFormat format;
+		const uint32_t weight;
+		const uint32_t frameRate;
+		const size_t cMaxQueued;
+		EffectEngine engine;            // Thread-safe; used without the manager's lock.
+
+		// Guarded by the manager's lock.
+		std::deque<QueuedFrame> queue;
+		uint64_t finishTag;             // Virtual time at which the last queued frame is done.
+		bool fBusy;                     // A thread is rendering one of the stream's frames.
+		bool fHaveCost;
+		uint64_t nsCost;                // Average time to render a frame with the full chain.
+		uint64_t cSubmitted;
+		uint64_t cRefused;
+		uint64_t cFrames[FrameAction_Count];
+
+		// Lock-free.
+		LatencyHistogram latency;
+		LatencyHistogram queueWait;
+
+	private:
+		Stream(const Stream&);
+		Stream& operator=(const Stream&);
+	};
+
+	StreamManager::StreamManager(size_t cThreads, uint32_t maxLoadPercent)
+		: m_maxLoadPercent(maxLoadPercent)
+		, m_nextId(1)
+		, m_virtualTime(0)
+		, m_fClosing(false)
+	{
+		if (cThreads == 0)
+		{
+			cThreads = (std::max)(1u, std::thread::hardware_concurrency());
+		}
+
+		for (size_t i = 0; i < cThreads; i++)
+		{
+			m_workers.push_back(std::thread(&StreamManager::WorkerThread, this));
+		}
+	}
+
+	StreamManager::~StreamManager()
+	{
+		std::vector<FrameDone> dropped;
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_fClosing = true;
+			for (size_t i = 0; i < m_streams.size(); i++)
+			{
+				std::deque<QueuedFrame> &queue = m_streams[i]->queue;
+				for (size_t j = 0; j < queue.size(); j++)
+				{
+					dropped.push_back(queue[j].done);
+				}
+				queue.clear();
+			}
+		}
+		m_frameReady.notify_all();
+
+		for (size_t i = 0; i < m_workers.size(); i++)
+		{
+			m_workers[i].join();
+		}
+
+		for (size_t i = 0; i < dropped.size(); i++)
+		{
+			dropped[i](FrameAction_Drop);
+		}
+	}
+
+	bool StreamManager::AddStream(const StreamConfig &config, StreamId *pId)
+	{
+		if (config.weight == 0 || config.frameRate == 0 || config.cMaxQueued == 0)
+		{
+			return false;
+		}
+
+		std::shared_ptr<Stream> spStream = std::make_shared<Stream>(config);
+		spStream->engine.SetFilters(config.filters, config.fallbackFilters);
+		spStream->engine.SetSchedulerPolicy(config.policy);
+		if (!spStream->engine.SetFormat(config.format))
+		{
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (GetLoad(spStream.get()) * 100 > m_maxLoadPercent)
+		{
+			TraceRecorder::Get().Instant("StreamRefused", (int64_t)m_streams.size());
+			return false;
+		}
+
+		spStream->id = m_nextId++;
+		m_streams.push_back(spStream);
+		*pId = spStream->id;
+		return true;
+	}
+
+	bool StreamManager::RemoveStream(StreamId id)
+	{
+		std::deque<QueuedFrame> dropped;
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+
+			std::shared_ptr<Stream> spStream;
+			for (size_t i = 0; i < m_streams.size(); i++)
+			{
+				if (m_streams[i]->id == id)
+				{
+					spStream = m_streams[i];
+					m_streams.erase(m_streams.begin() + i);
+					break;
+				}
+			}
+			if (!spStream)
+			{
+				return false;
+			}
+
+			dropped.swap(spStream->queue);
+			while (spStream->fBusy)
+			{
+				m_streamIdle.wait(lock);
+			}
+		}
+
+		for (size_t i = 0; i < dropped.size(); i++)
+		{
+			dropped[i].done(FrameAction_Drop);
+		}
+		return true;
+	}
+
+	bool StreamManager::SetStreamFilters(StreamId id, const std::vector<NativeFilter> &filters, const std::vector<NativeFilter> &fallbackFilters)
+	{
+		std::shared_ptr<Stream> spStream;
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			spStream = FindStream(id);
+		}
+		if (!spStream)
+		{
+			return false;
+		}
+
+		spStream->engine.SetFilters(filters, fallbackFilters);
+
+		// The cost of the previous filters says nothing about the new ones.
+		std::lock_guard<std::mutex> lock(m_lock);
+		spStream->fHaveCost = false;
+		return true;
+	}
+
+	bool StreamManager::SubmitFrame(StreamId id, const VideoFrame &dest, const VideoFrame &src, const FrameDone &done)
+	{
+		const uint64_t nsArrival = TraceRecorder::Now();
+
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+
+			std::shared_ptr<Stream> spStream = FindStream(id);
+			if (!spStream || !MatchesFormat(dest, spStream->format) || !MatchesFormat(src, spStream->format))
+			{
+				return false;
+			}
+
+			if (spStream->queue.size() >= spStream->cMaxQueued)
+			{
+				spStream->cRefused++;
+				return false;
+			}
+
+			// A stream that has been idle starts at the current virtual time:
+			// it gains no credit for the time it did not use.
+			QueuedFrame frame;
+			frame.dest = dest;
+			frame.src = src;
+			frame.done = done;
+			frame.nsArrival = nsArrival;
+			frame.startTag = (std::max)(m_virtualTime, spStream->finishTag);
+			spStream->finishTag = frame.startTag + (std::max)((uint64_t)1, EstimateCost(*spStream) / spStream->weight);
+			spStream->queue.push_back(frame);
+			spStream->cSubmitted++;
+		}
+		m_frameReady.notify_one();
+		return true;
+	}
+
+	bool StreamManager::GetStreamStats(StreamId id, StreamStats *pStats) const
+	{
+		std::shared_ptr<Stream> spStream;
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			spStream = FindStream(id);
+			if (!spStream)
+			{
+				return false;
+			}
+
+			pStats->cSubmitted = spStream->cSubmitted;
+			pStats->cRefused = spStream->cRefused;
+			for (int i = 0; i < FrameAction_Count; i++)
+			{
+				pStats->cFrames[i] = spStream->cFrames[i];
+			}
+			pStats->nsCost = spStream->nsCost;
+		}
+
+		Summarize(spStream->latency, &pStats->latency);
+		Summarize(spStream->queueWait, &pStats->queueWait);
+		return true;
+	}
+
+	uint32_t StreamManager::GetLoadPercent() const
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		return (uint32_t)(GetLoad(nullptr) * 100 + 0.5);
+	}
+
+	void StreamManager::WorkerThread()
+	{
+		std::unique_lock<std::mutex> lock(m_lock);
+
+		for (;;)
+		{
+			// The reference keeps the stream alive if it is removed meanwhile.
+			std::shared_ptr<Stream> spStream;
+			while (!m_fClosing && !(spStream = PickStream()))
+			{
+				m_frameReady.wait(lock);
+			}
+			if (m_fClosing)
+			{
+				return;
+			}
+
+			QueuedFrame frame = spStream->queue.front();
+			spStream->queue.pop_front();
+			spStream->fBusy = true;
+			m_virtualTime = (std::max)(m_virtualTime, frame.startTag);
+			const int64_t hnsInterval = 10000000 / spStream->frameRate;
+			lock.unlock();
+
+			// The arrival time is the frame's time stamp, so that the time it
+			// waited counts against its latency budget.
+			const uint64_t nsPicked = TraceRecorder::Now();
+			spStream->queueWait.Record(nsPicked - frame.nsArrival);
+
+			FrameTiming timing;
+			timing.fHasTime = true;
+			timing.hnsTime = (int64_t)(frame.nsArrival / 100);
+			timing.hnsDuration = hnsInterval;
+
+			FrameAction action = FrameAction_Drop;
+			if (!spStream->engine.ProcessFrame(timing, frame.dest, frame.src, &action))
+			{
+				action = FrameAction_Drop;
+			}
+
+			const uint64_t nsDone = TraceRecorder::Now();
+			spStream->latency.Record(nsDone - frame.nsArrival);
+			frame.done(action);
+
+			lock.lock();
+			spStream->cFrames[action]++;
+			if (action == FrameAction_Process)
+			{
+				const uint64_t nsCost = nsDone - nsPicked;
+				spStream->nsCost = spStream->fHaveCost ? UpdateAverage(spStream->nsCost, nsCost) : nsCost;
+				spStream->fHaveCost = true;
+			}
+			spStream->fBusy = false;
+
+			m_streamIdle.notify_all();
+			if (!spStream->queue.empty())
+			{
+				m_frameReady.notify_one();
+			}
+		}
+	}
+
+	// Called with m_lock held.
+
+	std::shared_ptr<StreamManager::Stream> StreamManager::FindStream(StreamId id) const
+	{
+		for (size_t i = 0; i < m_streams.size(); i++)
+		{
+			if (m_streams[i]->id == id)
+			{
+				return m_streams[i];
+			}
+		}
+		return std::shared_ptr<Stream>();
+	}
+
+	// The stream whose next frame has the smallest start tag, among those not
+	// being served. Called with m_lock held.
+
+	std::shared_ptr<StreamManager::Stream> StreamManager::PickStream() const
+	{
+		std::shared_ptr<Stream> spBest;
+		for (size_t i = 0; i < m_streams.size(); i++)
+		{
+			const std::shared_ptr<Stream> &spStream = m_streams[i];
+			if (spStream->fBusy || spStream->queue.empty())
+			{
+				continue;
+			}
+			if (!spBest || spStream->queue.front().startTag < spBest->queue.front().startTag)
+			{
+				spBest = spStream;
+			}
+		}
+		return spBest;
+	}
+
+	// The time a frame of the stream is expected to take with the full chain:
+	// measured if it has been, else scaled by frame size from the streams
+	// that have been measured, else a guess. Called with m_lock held.
+
+	uint64_t StreamManager::EstimateCost(const Stream &stream) const
+	{
+		if (stream.fHaveCost)
+		{
+			return stream.nsCost;
+		}
+
+		uint64_t nsMeasured = 0;
+		uint64_t cMeasuredPixels = 0;
+		for (size_t i = 0; i < m_streams.size(); i++)
+		{
+			const Stream &other = *m_streams[i];
+			if (other.fHaveCost)
+			{
+				nsMeasured += other.nsCost;
+				cMeasuredPixels += (uint64_t)other.format.width * other.format.height;
+			}
+		}
+
+		const uint64_t cPixels = (uint64_t)stream.format.width * stream.format.height;
+		if (cMeasuredPixels == 0)
+		{
+			return cPixels * GUESS_NS_PER_PIXEL;
+		}
+		return (uint64_t)((double)nsMeasured * cPixels / cMeasuredPixels);
+	}
+
+	// Share of the threads' time the streams need, plus pExtra if it is not
+	// null. Called with m_lock held.
+
+	double StreamManager::GetLoad(const Stream *pExtra) const
+	{
+		double nsPerSecond = 0;
+		for (size_t i = 0; i < m_streams.size(); i++)
+		{
+			nsPerSecond += (double)EstimateCost(*m_streams[i]) * m_streams[i]->frameRate;
+		}
+		if (pExtra != nullptr)
+		{
+			nsPerSecond += (double)EstimateCost(*pExtra) * pExtra->frameRate;
+		}
+		return nsPerSecond / (1e9 * m_workers.size());
+	}
+}
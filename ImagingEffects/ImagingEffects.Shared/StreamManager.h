@@ -0,0 +1,149 @@
+#pragma once
+
+// Many streams rendered by one set of worker threads.
+//
+// A server that filters tens of camera feeds cannot give each one its own
+// threads: the feeds would compete for the processors with no regard for
+// how much each is owed. The stream manager owns the threads and decides
+// which stream's frame is rendered next:
+//
+// - Fair share. Frames are picked by start-time fair queuing: each frame
+//   is tagged, on arrival, with the virtual time at which its stream may
+//   next be served, and the frame with the smallest tag goes first. A
+//   stream's tags advance by its measured cost per frame divided by its
+//   weight, so that under load each stream gets processor time in
+//   proportion to its weight, whatever its frame size or filters. A stream
+//   that was idle starts at the current virtual time and gains no credit
+//   for the time it did not use.
+//
+// - Deadlines. Each stream has an EffectEngine whose scheduler (see
+//   FrameScheduler.h) is given the arrival time of each frame as its time
+//   stamp, so time spent in the queue counts against the stream's latency
+//   budget. A frame that can no longer be rendered in time is degraded,
+//   passed through or dropped as the stream's policy allows.
+//
+// - Admission. A stream declares its frame rate. AddStream refuses a stream
+//   when the measured cost of the streams already running, plus an estimate
+//   for the new one, would exceed the given share of the threads' time.
+//   SubmitFrame refuses a frame when the stream already has its maximum of
+//   frames waiting, so a stream that outruns its share cannot delay others.
+//
+// The frames of a stream are rendered one at a time, in arrival order, each
+// on a single thread: the parallelism comes from the streams. Frames are
+// handed back through a callback on the worker thread that rendered them.
+//
+// Usage:
+//
+//     StreamManager manager(0, 85);
+//     StreamId id;
+//     if (manager.AddStream(MakeStreamConfig(format, 30), &id)) ...
+//     manager.SubmitFrame(id, dest, src, [](FrameAction action) { ... });
+//
+// This file does not depend on Windows headers.
+
+#include "EffectEngine.h"
+
+#include <condition_variable>
+#include <thread>
+
+namespace ImagingEffects
+{
+	typedef uint32_t StreamId;
+
+	// Called once per submitted frame when it is done with. A dropped frame
+	// (FrameAction_Drop) has left its destination untouched.
+	typedef std::function<void(FrameAction action)> FrameDone;
+
+	struct StreamConfig
+	{
+		StreamFormat format;
+		std::vector<NativeFilter> filters;
+		std::vector<NativeFilter> fallbackFilters;
+		uint32_t weight;                // Share of the threads relative to other streams; at least 1.
+		uint32_t frameRate;             // Frames per second the stream is expected to submit.
+		SchedulerPolicy policy;         // What late frames may become. hnsMaxLatency 0 uses one frame interval.
+		size_t cMaxQueued;              // Frames that may wait for a thread; more are refused.
+	};
+
+	// A stream of the format with no filters, weight 1, late-frame
+	// scheduling enabled and a queue of two frames.
+	StreamConfig MakeStreamConfig(const StreamFormat &format, uint32_t frameRate);
+
+	struct StreamStats
+	{
+		uint64_t cSubmitted;            // Frames accepted by SubmitFrame.
+		uint64_t cRefused;              // Frames refused because the queue was full.
+		uint64_t cFrames[FrameAction_Count];    // Frames done, by action.
+		uint64_t nsCost;                // Average time to render a frame.
+		LatencySummary latency;         // Arrival to done, over every frame since the stream was added.
+		LatencySummary queueWait;       // Arrival to picked by a thread.
+	};
+
+	// StreamManager class:
+	// Renders the frames of many streams on shared threads.
+
+	class StreamManager
+	{
+	public:
+		// cThreads is the number of worker threads; 0 uses one per processor.
+		// Streams are admitted while the estimated load stays at or below
+		// maxLoadPercent of the threads' time.
+		StreamManager(size_t cThreads, uint32_t maxLoadPercent);
+
+		// Completes the frames still queued as dropped, waits for those being
+		// rendered, and stops the threads.
+		~StreamManager();
+
+		size_t GetThreadCount() const { return m_workers.size(); }
+
+		// Adds a stream. Returns false if the configuration is not valid (see
+		// EffectEngine::SetFormat) or admitting the stream would overload the
+		// threads.
+		bool AddStream(const StreamConfig &config, StreamId *pId);
+
+		// Removes a stream. Its queued frames are completed as dropped; a frame
+		// being rendered is waited for. Returns false if there is no such
+		// stream.
+		bool RemoveStream(StreamId id);
+
+		// Changes the filters of a stream. Frames already picked by a thread
+		// finish with the previous ones.
+		bool SetStreamFilters(StreamId id, const std::vector<NativeFilter> &filters, const std::vector<NativeFilter> &fallbackFilters);
+
+		// Queues a frame. dest and src must have the stream's format and stay
+		// valid until done is called. Returns false, without calling done, if
+		// there is no such stream, the frames do not match its format or its
+		// queue is full.
+		bool SubmitFrame(StreamId id, const VideoFrame &dest, const VideoFrame &src, const FrameDone &done);
+
+		bool GetStreamStats(StreamId id, StreamStats *pStats) const;
+
+		// Estimated load of the admitted streams, in percent of the threads'
+		// time. Guessed from the frame sizes until frames have been rendered.
+		uint32_t GetLoadPercent() const;
+
+	private:
+		StreamManager(const StreamManager&);
+		StreamManager& operator=(const StreamManager&);
+
+		struct QueuedFrame;
+		struct Stream;
+
+		void WorkerThread();
+		std::shared_ptr<Stream> FindStream(StreamId id) const;
+		std::shared_ptr<Stream> PickStream() const;
+		uint64_t EstimateCost(const Stream &stream) const;
+		double GetLoad(const Stream *pExtra) const;
+
+		const uint32_t m_maxLoadPercent;
+		std::vector<std::thread> m_workers;
+
+		mutable std::mutex m_lock;              // Guards what follows.
+		std::condition_variable m_frameReady;   // A frame was queued, or the manager is closing.
+		std::condition_variable m_streamIdle;   // A stream finished a frame.
+		std::vector<std::shared_ptr<Stream>> m_streams;
+		StreamId m_nextId;
+		uint64_t m_virtualTime;                 // Start tag of the frame last picked.
+		bool m_fClosing;
+	};
+}
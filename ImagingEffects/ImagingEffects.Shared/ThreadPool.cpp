@@ -0,0 +1,154 @@
+// Threads for the bands of a frame.
+//
+// This file does not use the precompiled header so that it can be built
+// without Windows headers.
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace ImagingEffects
+{
+	ThreadPool::ThreadPool(size_t cThreads)
+		: m_generation(0)
+		, m_pFn(nullptr)
+		, m_cItems(0)
+		, m_iNext(0)
+		, m_cDone(0)
+		, m_cActive(0)
+		, m_fClosing(false)
+	{
+		if (cThreads == 0)
+		{
+			cThreads = (std::max)(1u, std::thread::hardware_concurrency());
+		}
+
+		for (size_t i = 1; i < cThreads; i++)
+		{
+			m_workers.push_back(std::thread(&ThreadPool::WorkerThread, this));
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_fClosing = true;
+		}
+		m_jobReady.notify_all();
+
+		for (size_t i = 0; i < m_workers.size(); i++)
+		{
+			m_workers[i].join();
+		}
+	}
+
+	void ThreadPool::Run(size_t cItems, const std::function<void(size_t)> &fn)
+	{
+		if (m_workers.empty() || cItems <= 1)
+		{
+			RunSerially(cItems, fn);
+			return;
+		}
+
+		std::lock_guard<std::mutex> run(m_runLock);
+
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_pFn = &fn;
+			m_cItems = cItems;
+			m_iNext = 0;
+			m_cDone = 0;
+			m_generation++;
+		}
+		m_jobReady.notify_all();
+
+		TakeItems(fn, cItems);
+
+		// Wait for the items taken by workers, and for the workers to leave
+		// the job, so that none of them touches fn after this returns.
+		std::unique_lock<std::mutex> lock(m_lock);
+		while (m_cDone < m_cItems || m_cActive > 0)
+		{
+			m_jobDone.wait(lock);
+		}
+		m_pFn = nullptr;
+	}
+
+	ParallelFor ThreadPool::GetParallelFor()
+	{
+		ThreadPool *pPool = this;
+		return [pPool](size_t cItems, const std::function<void(size_t)> &fn)
+		{
+			pPool->Run(cItems, fn);
+		};
+	}
+
+	void ThreadPool::WorkerThread()
+	{
+		uint64_t generation = 0;
+
+		for (;;)
+		{
+			const std::function<void(size_t)> *pFn = nullptr;
+			size_t cItems = 0;
+			{
+				std::unique_lock<std::mutex> lock(m_lock);
+				while (!m_fClosing && m_generation == generation)
+				{
+					m_jobReady.wait(lock);
+				}
+				if (m_fClosing)
+				{
+					return;
+				}
+
+				generation = m_generation;
+				if (m_pFn == nullptr)
+				{
+					continue;   // Woke up after the job was over.
+				}
+
+				pFn = m_pFn;
+				cItems = m_cItems;
+				m_cActive++;
+			}
+
+			TakeItems(*pFn, cItems);
+
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				m_cActive--;
+			}
+			m_jobDone.notify_all();
+		}
+	}
+
+	void ThreadPool::TakeItems(const std::function<void(size_t)> &fn, size_t cItems)
+	{
+		for (;;)
+		{
+			size_t i = 0;
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				if (m_iNext >= cItems)
+				{
+					return;
+				}
+				i = m_iNext++;
+			}
+
+			fn(i);
+
+			bool fLast = false;
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				fLast = (++m_cDone == cItems);
+			}
+			if (fLast)
+			{
+				m_jobDone.notify_all();
+			}
+		}
+	}
+}
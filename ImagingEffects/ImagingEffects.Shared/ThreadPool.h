@@ -0,0 +1,67 @@
+#pragma once
+
+// Threads that render the bands of a frame, for hosts without the PPL.
+//
+// The pool starts its worker threads once and keeps them for its lifetime,
+// so a frame costs a wake-up rather than a thread start. The thread that
+// calls Run takes items too, so a pool of N threads has N - 1 workers, and a
+// pool of one thread runs everything on the caller.
+//
+// One Run executes at a time; concurrent callers (several streams sharing
+// the pool) take turns, each frame using every thread while it runs.
+//
+// This file does not depend on Windows headers.
+
+#include "FrameRenderer.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ImagingEffects
+{
+	// ThreadPool class:
+	// A fixed set of threads for ParallelFor.
+
+	class ThreadPool
+	{
+	public:
+		// cThreads counts the caller of Run; 0 uses one per processor.
+		explicit ThreadPool(size_t cThreads);
+		~ThreadPool();
+
+		size_t GetThreadCount() const { return m_workers.size() + 1; }
+
+		// Calls fn(0) to fn(cItems - 1) on the pool's threads and the calling
+		// thread, and returns once every call has returned. fn does not throw.
+		void Run(size_t cItems, const std::function<void(size_t)> &fn);
+
+		// A ParallelFor that runs on the pool. The pool must outlive it.
+		ParallelFor GetParallelFor();
+
+	private:
+		ThreadPool(const ThreadPool&);
+		ThreadPool& operator=(const ThreadPool&);
+
+		void WorkerThread();
+
+		// Takes items of the current job until there are none left.
+		void TakeItems(const std::function<void(size_t)> &fn, size_t cItems);
+
+		std::vector<std::thread> m_workers;
+
+		std::mutex m_runLock;                   // Serializes Run.
+
+		std::mutex m_lock;                      // Guards the job below.
+		std::condition_variable m_jobReady;     // A job was posted, or the pool is closing.
+		std::condition_variable m_jobDone;      // The last item finished, or a worker left the job.
+		uint64_t m_generation;                  // Counts jobs; workers compare it with the last they saw.
+		const std::function<void(size_t)> *m_pFn;
+		size_t m_cItems;
+		size_t m_iNext;                         // Next item to take.
+		size_t m_cDone;                         // Items finished.
+		size_t m_cActive;                       // Workers inside the job.
+		bool m_fClosing;
+	};
+}
@@ -0,0 +1,293 @@
+// Chrome trace event recorder.
+//
+// This file does not use the precompiled header so that it can be built
+// without Windows headers.
+
+#include "TraceRecorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#ifdef _MSC_VER
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL __thread
+#endif
+
+namespace ImagingEffects
+{
+	// TraceEvent: One slot of a ring. The fields are written by the ring's
+	// thread only and read by DumpJson under a sequence number: odd while the
+	// slot is being written, 2n + 2 once it holds the n-th event of the ring.
+	struct TraceEvent
+	{
+		std::atomic<uint64_t> seq;
+		std::atomic<uint64_t> t;
+		std::atomic<const char*> pszName;
+		std::atomic<int64_t> value;
+		std::atomic<uint32_t> phase;
+	};
+
+	// TraceRing: The events of one thread.
+	class TraceRing
+	{
+	public:
+		explicit TraceRing(uint32_t tid)
+			: m_tid(tid)
+			, m_cWritten(0)
+		{
+			for (uint32_t i = 0; i < TRACE_RING_EVENTS; i++)
+			{
+				m_events[i].seq.store(0, std::memory_order_relaxed);
+			}
+		}
+
+		// Called by the ring's thread only.
+		void Write(uint64_t t, TracePhase phase, const char *pszName, int64_t value)
+		{
+			const uint64_t n = m_cWritten.load(std::memory_order_relaxed);
+			TraceEvent &ev = m_events[n & (TRACE_RING_EVENTS - 1)];
+
+			ev.seq.store(2 * n + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			ev.t.store(t, std::memory_order_relaxed);
+			ev.pszName.store(pszName, std::memory_order_relaxed);
+			ev.value.store(value, std::memory_order_relaxed);
+			ev.phase.store((uint32_t)phase, std::memory_order_relaxed);
+			ev.seq.store(2 * n + 2, std::memory_order_release);
+
+			m_cWritten.store(n + 1, std::memory_order_release);
+		}
+
+		// Copy of an event, as read by DumpJson.
+		struct Copy
+		{
+			uint64_t t;
+			const char *pszName;
+			int64_t value;
+			uint32_t phase;
+			uint32_t tid;
+		};
+
+		// Appends the events still in the ring that are not older than tMin.
+		void Read(uint64_t tMin, std::vector<Copy> *pEvents) const
+		{
+			const uint64_t cWritten = m_cWritten.load(std::memory_order_acquire);
+			const uint64_t nFirst = (cWritten > TRACE_RING_EVENTS) ? cWritten - TRACE_RING_EVENTS : 0;
+
+			for (uint64_t n = nFirst; n < cWritten; n++)
+			{
+				const TraceEvent &ev = m_events[n & (TRACE_RING_EVENTS - 1)];
+
+				const uint64_t seq = ev.seq.load(std::memory_order_acquire);
+				if (seq != 2 * n + 2)
+				{
+					continue;   // Overwritten since cWritten was read.
+				}
+
+				Copy copy;
+				copy.t = ev.t.load(std::memory_order_relaxed);
+				copy.pszName = ev.pszName.load(std::memory_order_relaxed);
+				copy.value = ev.value.load(std::memory_order_relaxed);
+				copy.phase = ev.phase.load(std::memory_order_relaxed);
+				copy.tid = m_tid;
+
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (ev.seq.load(std::memory_order_relaxed) != seq)
+				{
+					continue;   // Overwritten while it was copied.
+				}
+
+				if (copy.t >= tMin)
+				{
+					pEvents->push_back(copy);
+				}
+			}
+		}
+
+	private:
+		TraceRing(const TraceRing&);
+		TraceRing& operator=(const TraceRing&);
+
+		const uint32_t m_tid;
+		std::atomic<uint64_t> m_cWritten;
+		TraceEvent m_events[TRACE_RING_EVENTS];
+	};
+
+	namespace
+	{
+		// The calling thread's ring, and whether it was refused one.
+		TRACE_THREAD_LOCAL TraceRing *t_pRing;
+		TRACE_THREAD_LOCAL bool t_fNoRing;
+
+		bool IsEarlier(const TraceRing::Copy &a, const TraceRing::Copy &b)
+		{
+			return a.t < b.t;
+		}
+
+		void AppendName(std::string *pJson, const char *pszName)
+		{
+			pJson->push_back('"');
+			for (const char *p = pszName; *p != '\0'; p++)
+			{
+				if (*p == '"' || *p == '\\')
+				{
+					pJson->push_back('\\');
+				}
+				pJson->push_back(*p);
+			}
+			pJson->push_back('"');
+		}
+
+		// Nanoseconds as microseconds with three decimals.
+		void AppendMicroseconds(std::string *pJson, uint64_t ns)
+		{
+			std::string fraction = std::to_string(ns % 1000);
+			pJson->append(std::to_string(ns / 1000));
+			pJson->append(".");
+			pJson->append(3 - fraction.size(), '0');
+			pJson->append(fraction);
+		}
+	}
+
+	TraceRecorder::TraceRecorder()
+		: m_fEnabled(false)
+		, m_tCleared(0)
+		, m_cLost(0)
+		, m_cRings(0)
+	{
+		for (uint32_t i = 0; i < TRACE_MAX_THREADS; i++)
+		{
+			m_rings[i].store(nullptr, std::memory_order_relaxed);
+		}
+	}
+
+	// Created on first use and never destroyed, so threads may record until
+	// the process ends. (Local statics are not initialized thread-safely by
+	// VS2013.)
+	TraceRecorder& TraceRecorder::Get()
+	{
+		static std::atomic<TraceRecorder*> s_pRecorder;
+		TraceRecorder *pRecorder = s_pRecorder.load(std::memory_order_acquire);
+		if (pRecorder == nullptr)
+		{
+			TraceRecorder *pNew = new TraceRecorder();
+			if (s_pRecorder.compare_exchange_strong(pRecorder, pNew, std::memory_order_acq_rel))
+			{
+				pRecorder = pNew;
+			}
+			else
+			{
+				delete pNew;
+			}
+		}
+		return *pRecorder;
+	}
+
+	uint64_t TraceRecorder::Now()
+	{
+#ifdef _WIN32
+		// The standard clocks of VS2013 are not precise enough.
+		LARGE_INTEGER frequency;
+		LARGE_INTEGER count;
+		QueryPerformanceFrequency(&frequency);
+		QueryPerformanceCounter(&count);
+		return (uint64_t)((double)count.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	void TraceRecorder::Record(TracePhase phase, const char *pszName, int64_t value)
+	{
+		if (!IsEnabled())
+		{
+			return;
+		}
+
+		TraceRing *pRing = GetThreadRing();
+		if (pRing == nullptr)
+		{
+			m_cLost.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		pRing->Write(Now(), phase, pszName, value);
+	}
+
+	TraceRing* TraceRecorder::GetThreadRing()
+	{
+		if (t_pRing != nullptr || t_fNoRing)
+		{
+			return t_pRing;
+		}
+
+		const uint32_t iRing = m_cRings.fetch_add(1, std::memory_order_relaxed);
+		if (iRing >= TRACE_MAX_THREADS)
+		{
+			t_fNoRing = true;
+			return nullptr;
+		}
+
+		// Chrome shows threads by id; number them from 1 in order of appearance.
+		t_pRing = new TraceRing(iRing + 1);
+		m_rings[iRing].store(t_pRing, std::memory_order_release);
+		return t_pRing;
+	}
+
+	std::string TraceRecorder::DumpJson() const
+	{
+		const uint64_t tMin = m_tCleared.load(std::memory_order_relaxed);
+
+		std::vector<TraceRing::Copy> events;
+		for (uint32_t i = 0; i < TRACE_MAX_THREADS; i++)
+		{
+			const TraceRing *pRing = m_rings[i].load(std::memory_order_acquire);
+			if (pRing != nullptr)
+			{
+				pRing->Read(tMin, &events);
+			}
+		}
+
+		// Threads are read one after another; merge them by time. The sort is
+		// stable so that events of a thread with the same time stay in order.
+		std::stable_sort(events.begin(), events.end(), IsEarlier);
+
+		std::string json("{ \"displayTimeUnit\": \"ns\", \"otherData\": { \"lostEvents\": ");
+		json.append(std::to_string(GetLostEvents()));
+		json.append(" },\n  \"traceEvents\": [");
+		for (size_t i = 0; i < events.size(); i++)
+		{
+			const TraceRing::Copy &ev = events[i];
+
+			json.append(i > 0 ? ",\n    { \"name\": " : "\n    { \"name\": ");
+			AppendName(&json, ev.pszName);
+			json.append(", \"ph\": \"");
+			json.push_back((char)ev.phase);
+			json.append("\", \"ts\": ");
+			AppendMicroseconds(&json, ev.t);
+			json.append(", \"pid\": 1, \"tid\": " + std::to_string(ev.tid));
+			if (ev.phase == TracePhase_Instant)
+			{
+				json.append(", \"s\": \"t\"");
+			}
+			if (ev.phase == TracePhase_Counter || ev.phase == TracePhase_Instant)
+			{
+				json.append(", \"args\": { \"value\": " + std::to_string(ev.value) + " }");
+			}
+			json.append(" }");
+		}
+		json.append(events.empty() ? "] }" : "\n  ] }");
+		return json;
+	}
+
+	void TraceRecorder::Clear()
+	{
+		m_tCleared.store(Now(), std::memory_order_relaxed);
+	}
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+// Timestamped events of the frame path, dumped as Chrome trace JSON.
+//
+// Each thread writes its events into a ring of its own, so recording never
+// waits for another thread: an event is a clock read and a few relaxed
+// stores. The rings keep the last TRACE_RING_EVENTS events of each thread;
+// older ones are overwritten. DumpJson() returns what the rings hold in the
+// Trace Event Format read by chrome://tracing (about:tracing) and Perfetto,
+// so the frames of a stream can be looked at one by one, with the gaps
+// between them.
+//
+// Event names are not copied: pass string literals, or strings that live
+// as long as the process.
+//
+// The recorder is created on first use and serves the whole process. It
+// records nothing until it is enabled. A thread's ring is allocated with its
+// first event and kept until the process ends, so the events of threads that
+// have finished can still be dumped. At most TRACE_MAX_THREADS threads are
+// recorded; the events of later threads are counted as lost.
+//
+// Usage:
+//
+//     TraceRecorder::Get().SetEnabled(true);
+//     {
+//         TraceScope scope("Render");              // "B" ... "E"
+//         ...
+//     }
+//     TraceRecorder::Get().Counter("FramesInFlight", cFrames);
+//     TraceRecorder::Get().Instant("Drop", cDropped);
+//     std::string json = TraceRecorder::Get().DumpJson();
+//
+// This file does not depend on Windows headers.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+namespace ImagingEffects
+{
+	const uint32_t TRACE_RING_EVENTS = 4096;     // Per thread. A power of two.
+	const uint32_t TRACE_MAX_THREADS = 64;
+
+	// Phases of the Trace Event Format.
+	enum TracePhase
+	{
+		TracePhase_Begin = 'B',
+		TracePhase_End = 'E',
+		TracePhase_Counter = 'C',   // A value over time, such as a queue depth.
+		TracePhase_Instant = 'i'    // Something that happened, such as a dropped frame.
+	};
+
+	class TraceRing;
+
+	// TraceRecorder class:
+	// The rings of every thread.
+
+	class TraceRecorder
+	{
+	public:
+		// Returns the recorder, creating it on first use.
+		static TraceRecorder& Get();
+
+		// Monotonic time in nanoseconds, as events are stamped.
+		static uint64_t Now();
+
+		// Turns recording on or off. Events recorded while off are not kept.
+		void SetEnabled(bool fEnabled) { m_fEnabled.store(fEnabled, std::memory_order_relaxed); }
+		bool IsEnabled() const { return m_fEnabled.load(std::memory_order_relaxed); }
+
+		// Record an event on the calling thread. Wait-free, except for the
+		// first event of a thread, which allocates its ring.
+		void Begin(const char *pszName) { Record(TracePhase_Begin, pszName, 0); }
+		void End(const char *pszName) { Record(TracePhase_End, pszName, 0); }
+		void Counter(const char *pszName, int64_t value) { Record(TracePhase_Counter, pszName, value); }
+		void Instant(const char *pszName, int64_t value) { Record(TracePhase_Instant, pszName, value); }
+		void Record(TracePhase phase, const char *pszName, int64_t value);
+
+		// Returns the events in the rings as Chrome trace JSON, oldest first.
+		// Recording goes on meanwhile; events overwritten while they are read
+		// are left out.
+		std::string DumpJson() const;
+
+		// Leaves the events recorded so far out of later dumps.
+		void Clear();
+
+		// Events not recorded because their thread has no ring.
+		uint64_t GetLostEvents() const { return m_cLost.load(std::memory_order_relaxed); }
+
+	private:
+		TraceRecorder();
+		TraceRecorder(const TraceRecorder&);
+		TraceRecorder& operator=(const TraceRecorder&);
+
+		TraceRing* GetThreadRing();
+
+		std::atomic<bool> m_fEnabled;
+		std::atomic<uint64_t> m_tCleared;               // Events before this are not dumped.
+		std::atomic<uint64_t> m_cLost;
+		std::atomic<uint32_t> m_cRings;                 // Slots claimed, including ones over the limit.
+		std::atomic<TraceRing*> m_rings[TRACE_MAX_THREADS];
+	};
+
+	// TraceScope class:
+	// Records a begin event now and the matching end event when it goes out
+	// of scope, or at End() if that comes first. Costs one load when the
+	// recorder is off.
+
+	class TraceScope
+	{
+	public:
+		explicit TraceScope(const char *pszName)
+			: m_pszName(TraceRecorder::Get().IsEnabled() ? pszName : nullptr)
+		{
+			if (m_pszName != nullptr)
+			{
+				TraceRecorder::Get().Begin(m_pszName);
+			}
+		}
+
+		~TraceScope()
+		{
+			End();
+		}
+
+		void End()
+		{
+			if (m_pszName != nullptr)
+			{
+				TraceRecorder::Get().End(m_pszName);
+				m_pszName = nullptr;
+			}
+		}
+
+	private:
+		TraceScope(const TraceScope&);
+		TraceScope& operator=(const TraceScope&);
+
+		const char *m_pszName;  // nullptr if no end event is due.
+	};
+}
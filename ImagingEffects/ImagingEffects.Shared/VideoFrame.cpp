@@ -0,0 +1,375 @@
+// Frame wrapping and frame-level copies and conversions.
+//
+// This file does not use the precompiled header so that it can be built
+// without Windows headers.
+
+#include "VideoFrame.h"
+
+#include <string.h>
+
+namespace ImagingEffects
+{
+	namespace
+	{
+		// Layout of one plane relative to the top row of the first plane.
+		struct PlaneLayout
+		{
+			ptrdiff_t offset;   // Offset of the top row.
+			ptrdiff_t stride;
+			uint32_t cRows;
+			uint32_t cbRow;     // Bytes of pixel data in a row.
+		};
+
+		// Fills in the layout of each of the format's planes and returns their
+		// number. All three layouts are zeroed first, so planes the format does
+		// not have (or every plane, for an unknown format) read as empty.
+		uint32_t GetPlaneLayouts(PixelFormat format, uint32_t width, uint32_t height, ptrdiff_t stride, PlaneLayout *pLayouts)
+		{
+			const uint32_t cChroma = (width + 1) / 2;
+			const uint32_t cChromaRows = (height + 1) / 2;
+
+			memset(pLayouts, 0, 3 * sizeof(PlaneLayout));
+
+			switch (format)
+			{
+			case PixelFormat_NV12:
+				pLayouts[0].offset = 0;
+				pLayouts[0].stride = stride;
+				pLayouts[0].cRows = height;
+				pLayouts[0].cbRow = width;
+				pLayouts[1].offset = stride * (ptrdiff_t)height;
+				pLayouts[1].stride = stride;
+				pLayouts[1].cRows = cChromaRows;
+				pLayouts[1].cbRow = cChroma * 2;
+				return 2;
+
+			case PixelFormat_YUY2:
+				pLayouts[0].offset = 0;
+				pLayouts[0].stride = stride;
+				pLayouts[0].cRows = height;
+				pLayouts[0].cbRow = cChroma * 4;
+				return 1;
+
+			case PixelFormat_I420:
+				pLayouts[0].offset = 0;
+				pLayouts[0].stride = stride;
+				pLayouts[0].cRows = height;
+				pLayouts[0].cbRow = width;
+				pLayouts[1].offset = stride * (ptrdiff_t)height;
+				pLayouts[1].stride = stride / 2;
+				pLayouts[1].cRows = cChromaRows;
+				pLayouts[1].cbRow = cChroma;
+				pLayouts[2].offset = pLayouts[1].offset + pLayouts[1].stride * (ptrdiff_t)cChromaRows;
+				pLayouts[2].stride = stride / 2;
+				pLayouts[2].cRows = cChromaRows;
+				pLayouts[2].cbRow = cChroma;
+				return 3;
+			}
+
+			return 0;
+		}
+
+		ptrdiff_t Abs(ptrdiff_t value)
+		{
+			return value < 0 ? -value : value;
+		}
+
+		// Checks that every row of a plane whose top row is at offset first
+		// in a buffer of cbBuffer bytes lies inside the buffer.
+		bool PlaneFits(ptrdiff_t first, ptrdiff_t stride, uint32_t cRows, uint32_t cbRow, size_t cbBuffer)
+		{
+			ptrdiff_t last = first + stride * (ptrdiff_t)(cRows - 1);
+			ptrdiff_t lowest = first < last ? first : last;
+			ptrdiff_t highest = (first < last ? last : first) + cbRow;
+
+			return lowest >= 0 && highest <= (ptrdiff_t)cbBuffer;
+		}
+
+		uint8_t *RowOf(const VideoPlane &plane, uint32_t row)
+		{
+			return plane.pData + (ptrdiff_t)row * plane.stride;
+		}
+
+		void CopyPlaneRows(const VideoPlane &src, const VideoPlane &dst, uint32_t top, uint32_t bottom, uint32_t cbRow)
+		{
+			for (uint32_t y = top; y < bottom; y++)
+			{
+				memcpy(RowOf(dst, y), RowOf(src, y), cbRow);
+			}
+		}
+	}
+
+	uint32_t GetMinimumStride(PixelFormat format, uint32_t width)
+	{
+		return format == PixelFormat_YUY2 ? ((width + 1) / 2) * 4 : (width + 1) & ~1;
+	}
+
+	uint32_t GetBufferRowCount(PixelFormat format, uint32_t height)
+	{
+		return format == PixelFormat_YUY2 ? height : height + (height + 1) / 2;
+	}
+
+	uint32_t GetDefaultStride(PixelFormat format, uint32_t width)
+	{
+		// For YUY2, two bytes per pixel rounded up to a multiple of 4 is the
+		// minimum stride already. Odd-width 4:2:0 rows need the extra byte
+		// for the last chroma sample.
+		return GetMinimumStride(format, width);
+	}
+
+	bool GetImageSize(PixelFormat format, uint32_t width, uint32_t height, uint32_t *pcbImage)
+	{
+		const uint64_t cbImage = (uint64_t)GetDefaultStride(format, width) * GetBufferRowCount(format, height);
+
+		if (cbImage > UINT32_MAX)
+		{
+			return false;
+		}
+
+		*pcbImage = (uint32_t)cbImage;
+		return true;
+	}
+
+	bool WrapVideoFrame(
+		PixelFormat format,
+		uint32_t width,
+		uint32_t height,
+		uint8_t *pTopRow,
+		ptrdiff_t stride,
+		const uint8_t *pBufferStart,
+		size_t cbBuffer,
+		VideoFrame *pFrame)
+	{
+		PlaneLayout layouts[3];
+		uint32_t cPlanes = GetPlaneLayouts(format, width, height, stride, layouts);
+
+		if (cPlanes == 0 || pTopRow == nullptr || width == 0 || height == 0)
+		{
+			return false;
+		}
+
+		// I420 halves the stride for the chroma planes, which has no sensible
+		// meaning for an odd or bottom-up stride.
+		if (format == PixelFormat_I420 && (stride < 0 || (stride & 1) != 0))
+		{
+			return false;
+		}
+
+		for (uint32_t i = 0; i < cPlanes; i++)
+		{
+			if (Abs(layouts[i].stride) < (ptrdiff_t)layouts[i].cbRow)
+			{
+				return false;
+			}
+		}
+
+		if (pBufferStart != nullptr)
+		{
+			// Work with offsets from the start of the buffer so that no pointer
+			// outside the buffer is ever formed.
+			if (pTopRow < pBufferStart || pTopRow >= pBufferStart + cbBuffer)
+			{
+				return false;
+			}
+			const ptrdiff_t base = pTopRow - pBufferStart;
+
+			for (uint32_t i = 0; i < cPlanes; i++)
+			{
+				const PlaneLayout &layout = layouts[i];
+				if (!PlaneFits(base + layout.offset, layout.stride, layout.cRows, layout.cbRow, cbBuffer))
+				{
+					return false;
+				}
+			}
+		}
+
+		pFrame->format = format;
+		pFrame->width = width;
+		pFrame->height = height;
+		pFrame->cPlanes = cPlanes;
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			pFrame->planes[i].pData = i < cPlanes ? pTopRow + layouts[i].offset : nullptr;
+			pFrame->planes[i].stride = i < cPlanes ? layouts[i].stride : 0;
+		}
+
+		return true;
+	}
+
+	uint32_t GetPlaneShapes(PixelFormat format, uint32_t width, uint32_t height, ptrdiff_t stride, PlaneShape *pShapes)
+	{
+		PlaneLayout layouts[3];
+		uint32_t cPlanes = GetPlaneLayouts(format, width, height, stride, layouts);
+		for (uint32_t i = 0; i < cPlanes; i++)
+		{
+			pShapes[i].stride = layouts[i].stride;
+			pShapes[i].cRows = layouts[i].cRows;
+			pShapes[i].cbRow = layouts[i].cbRow;
+		}
+		return cPlanes;
+	}
+
+	bool WrapVideoFrameBuffers(
+		PixelFormat format,
+		uint32_t width,
+		uint32_t height,
+		const BufferView *pBuffers,
+		uint32_t cBuffers,
+		VideoFrame *pFrame)
+	{
+		if (pBuffers == nullptr)
+		{
+			return false;
+		}
+
+		if (cBuffers == 1)
+		{
+			return WrapVideoFrame(format, width, height, pBuffers[0].pTopRow, pBuffers[0].stride, pBuffers[0].pBufferStart, pBuffers[0].cbBuffer, pFrame);
+		}
+
+		// Only the row counts and sizes are used; each buffer has its own stride.
+		PlaneLayout layouts[3];
+		uint32_t cPlanes = GetPlaneLayouts(format, width, height, 0, layouts);
+
+		if (cPlanes == 0 || cBuffers != cPlanes || width == 0 || height == 0)
+		{
+			return false;
+		}
+
+		for (uint32_t i = 0; i < cPlanes; i++)
+		{
+			const BufferView &buffer = pBuffers[i];
+			if (buffer.pTopRow == nullptr || Abs(buffer.stride) < (ptrdiff_t)layouts[i].cbRow)
+			{
+				return false;
+			}
+
+			if (buffer.pBufferStart != nullptr)
+			{
+				if (buffer.pTopRow < buffer.pBufferStart || buffer.pTopRow >= buffer.pBufferStart + buffer.cbBuffer)
+				{
+					return false;
+				}
+				if (!PlaneFits(buffer.pTopRow - buffer.pBufferStart, buffer.stride, layouts[i].cRows, layouts[i].cbRow, buffer.cbBuffer))
+				{
+					return false;
+				}
+			}
+		}
+
+		pFrame->format = format;
+		pFrame->width = width;
+		pFrame->height = height;
+		pFrame->cPlanes = cPlanes;
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			pFrame->planes[i].pData = i < cPlanes ? pBuffers[i].pTopRow : nullptr;
+			pFrame->planes[i].stride = i < cPlanes ? pBuffers[i].stride : 0;
+		}
+
+		return true;
+	}
+
+	bool IsTopDown(const VideoFrame &frame)
+	{
+		for (uint32_t i = 0; i < frame.cPlanes; i++)
+		{
+			if (frame.planes[i].stride < 0)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void ConvertVideoFrame(const VideoFrame &src, const VideoFrame &dst, uint32_t top, uint32_t bottom)
+	{
+		if (bottom > src.height)
+		{
+			bottom = src.height;
+		}
+		if (top >= bottom || src.width != dst.width || src.height != dst.height)
+		{
+			return;
+		}
+
+		const uint32_t width = src.width;
+		const uint32_t cRows = bottom - top;
+		const uint32_t chromaTop = top / 2;
+		const uint32_t chromaBottom = (bottom + 1) / 2;
+
+		if (src.format == dst.format)
+		{
+			PlaneLayout layouts[3];
+			if (GetPlaneLayouts(src.format, width, src.height, 0, layouts) != src.cPlanes)
+			{
+				return;
+			}
+
+			CopyPlaneRows(src.planes[0], dst.planes[0], top, bottom, layouts[0].cbRow);
+			for (uint32_t i = 1; i < src.cPlanes; i++)
+			{
+				CopyPlaneRows(src.planes[i], dst.planes[i], chromaTop, chromaBottom, layouts[i].cbRow);
+			}
+			return;
+		}
+
+		const VideoPlane *s = src.planes;
+		const VideoPlane *d = dst.planes;
+
+		if (src.format == PixelFormat_YUY2 && dst.format == PixelFormat_NV12)
+		{
+			ConvertYuy2ToNv12(
+				RowOf(s[0], top), s[0].stride,
+				RowOf(d[0], top), d[0].stride,
+				RowOf(d[1], chromaTop), d[1].stride,
+				width, cRows);
+		}
+		else if (src.format == PixelFormat_NV12 && dst.format == PixelFormat_YUY2)
+		{
+			ConvertNv12ToYuy2(
+				RowOf(s[0], top), s[0].stride,
+				RowOf(s[1], chromaTop), s[1].stride,
+				RowOf(d[0], top), d[0].stride,
+				width, cRows);
+		}
+		else if (src.format == PixelFormat_YUY2 && dst.format == PixelFormat_I420)
+		{
+			ConvertYuy2ToI420(
+				RowOf(s[0], top), s[0].stride,
+				RowOf(d[0], top), d[0].stride,
+				RowOf(d[1], chromaTop), d[1].stride,
+				RowOf(d[2], chromaTop), d[2].stride,
+				width, cRows);
+		}
+		else if (src.format == PixelFormat_I420 && dst.format == PixelFormat_YUY2)
+		{
+			ConvertI420ToYuy2(
+				RowOf(s[0], top), s[0].stride,
+				RowOf(s[1], chromaTop), s[1].stride,
+				RowOf(s[2], chromaTop), s[2].stride,
+				RowOf(d[0], top), d[0].stride,
+				width, cRows);
+		}
+		else if (src.format == PixelFormat_NV12 && dst.format == PixelFormat_I420)
+		{
+			ConvertNv12ToI420(
+				RowOf(s[0], top), s[0].stride,
+				RowOf(s[1], chromaTop), s[1].stride,
+				RowOf(d[0], top), d[0].stride,
+				RowOf(d[1], chromaTop), d[1].stride,
+				RowOf(d[2], chromaTop), d[2].stride,
+				width, cRows);
+		}
+		else if (src.format == PixelFormat_I420 && dst.format == PixelFormat_NV12)
+		{
+			ConvertI420ToNv12(
+				RowOf(s[0], top), s[0].stride,
+				RowOf(s[1], chromaTop), s[1].stride,
+				RowOf(s[2], chromaTop), s[2].stride,
+				RowOf(d[0], top), d[0].stride,
+				RowOf(d[1], chromaTop), d[1].stride,
+				width, cRows);
+		}
+	}
+}
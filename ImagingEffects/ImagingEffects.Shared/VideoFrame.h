@@ -0,0 +1,120 @@
+#pragma once
+
+// Describes a video frame in memory: one pointer and one stride per plane.
+//
+// Plane pointers always point at the top row of the plane, and strides are
+// the signed distance from one row to the next. A bottom-up image therefore
+// has negative strides and its top row at the highest address. Rows may be
+// padded (stride larger than the bytes the pixels need), and the planes do
+// not have to be contiguous.
+//
+// Frames are wrapped around existing memory; nothing is copied or owned.
+//
+// This file does not depend on Windows headers.
+
+#include "FormatConversion.h"
+
+namespace ImagingEffects
+{
+	struct VideoPlane
+	{
+		uint8_t *pData;         // Top row of the plane.
+		ptrdiff_t stride;       // Bytes from one row to the next. Negative if bottom-up.
+	};
+
+	struct VideoFrame
+	{
+		PixelFormat format;
+		uint32_t width;         // In pixels.
+		uint32_t height;        // In pixels.
+		uint32_t cPlanes;
+		VideoPlane planes[3];
+	};
+
+	// Returns the smallest stride, in bytes, a frame of the given width can
+	// have. Odd widths are rounded up to whole chroma samples.
+	uint32_t GetMinimumStride(PixelFormat format, uint32_t width);
+
+	// Returns the number of rows, of the first plane's stride, that a frame
+	// stored as a single buffer occupies (e.g. height * 3 / 2 for NV12).
+	uint32_t GetBufferRowCount(PixelFormat format, uint32_t height);
+
+	// Returns the stride to assume for a format when a media type does not
+	// give one: the minimum stride, i.e. the width (rounded up to even) for
+	// the planar formats, and two bytes per pixel rounded up to a multiple
+	// of 4 for YUY2.
+	uint32_t GetDefaultStride(PixelFormat format, uint32_t width);
+
+	// Computes the size, in bytes, of an image of the format stored at the
+	// default stride: about 12 bits per pixel for the 4:2:0 formats and 16
+	// for YUY2, with odd sizes rounded up to whole chroma samples. Returns
+	// false if the size does not fit in 32 bits.
+	bool GetImageSize(PixelFormat format, uint32_t width, uint32_t height, uint32_t *pcbImage);
+
+	// Wraps a frame stored in a single buffer, as Media Foundation lays it
+	// out: the planes follow each other in the direction of the stride, and
+	// the chroma planes of I420 use half the luma stride (so I420 frames
+	// must be top-down).
+	//
+	// pTopRow is the first byte of the top row of the first plane, and
+	// stride is the pitch of that plane. If pBufferStart is not null, the
+	// function checks that every row of every plane lies inside
+	// [pBufferStart, pBufferStart + cbBuffer).
+	//
+	// Returns false if the stride is too small for the width or the frame
+	// does not fit in the buffer.
+	bool WrapVideoFrame(
+		PixelFormat format,
+		uint32_t width,
+		uint32_t height,
+		uint8_t *pTopRow,
+		ptrdiff_t stride,
+		const uint8_t *pBufferStart,
+		size_t cbBuffer,
+		VideoFrame *pFrame);
+
+	// Size of one plane of a frame stored as Media Foundation lays it out.
+	struct PlaneShape
+	{
+		ptrdiff_t stride;       // Pitch of the plane's rows.
+		uint32_t cRows;
+		uint32_t cbRow;         // Bytes of pixel data in a row.
+	};
+
+	// Describes the planes of a frame whose first plane has the given
+	// stride. Returns the number of planes, or 0 for an unknown format.
+	uint32_t GetPlaneShapes(PixelFormat format, uint32_t width, uint32_t height, ptrdiff_t stride, PlaneShape *pShapes);
+
+	// One locked buffer of a sample.
+	struct BufferView
+	{
+		uint8_t *pTopRow;               // First byte of the top row.
+		ptrdiff_t stride;               // Pitch of the rows in this buffer.
+		const uint8_t *pBufferStart;    // Memory behind the buffer, or nullptr if unknown.
+		size_t cbBuffer;
+	};
+
+	// Wraps a frame stored in several buffers. A single buffer is wrapped
+	// as by WrapVideoFrame. Several buffers must hold one plane each, in
+	// plane order (Y and UV for NV12; Y, U and V for I420), and each may
+	// have its own stride; nothing is copied.
+	//
+	// Returns false for any other layout: the caller then has to copy the
+	// frame into one buffer.
+	bool WrapVideoFrameBuffers(
+		PixelFormat format,
+		uint32_t width,
+		uint32_t height,
+		const BufferView *pBuffers,
+		uint32_t cBuffers,
+		VideoFrame *pFrame);
+
+	// Returns true if every plane of the frame is stored top-down.
+	bool IsTopDown(const VideoFrame &frame);
+
+	// Copies or converts rows [top, bottom) of src into dst. The frames must
+	// have the same size. For 4:2:0 formats top must be even; the chroma rows
+	// of the band are processed with it. Bands of a frame may be processed
+	// in parallel.
+	void ConvertVideoFrame(const VideoFrame &src, const VideoFrame &dst, uint32_t top, uint32_t bottom);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+// Counts every allocation made through operator new, on every thread, so
+// that a test or a benchmark can tell what an operation allocates:
+//
+//     const uint64_t cBefore = GetAllocationCount();
+//     engine.ProcessFrame(...);
+//     CHECK_EQUAL(GetAllocationCount() - cBefore, 0u);
+//
+// The header replaces the global operator new and operator delete; the
+// array and sized forms come through these. Include it in one source file
+// of an executable only.
+//
+// This file does not depend on Windows headers.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+
+namespace ImagingEffectsTests
+{
+	inline std::atomic<uint64_t>& GetAllocationCounter()
+	{
+		static std::atomic<uint64_t> s_cAllocations(0);
+		return s_cAllocations;
+	}
+
+	// Returns the number of allocations made so far.
+	inline uint64_t GetAllocationCount()
+	{
+		return GetAllocationCounter().load();
+	}
+}
+
+void* operator new(size_t cb)
+{
+	ImagingEffectsTests::GetAllocationCounter().fetch_add(1, std::memory_order_relaxed);
+	void *p = malloc(cb != 0 ? cb : 1);
+	if (p == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void *p)
+{
+	free(p);
+}
+
+using ImagingEffectsTests::GetAllocationCount;
@@ -0,0 +1,432 @@
+// Tests of the 3D colour tables. An identity cube of each supported size
+// leaves NV12 and YUY2 frames unchanged, bit for bit, through the resampling
+// to YUV and the fixed-point interpolation. A grading cube renders what a
+// floating-point reference does (YUV to RGB, tetrahedral interpolation of
+// the RGB table, back to YUV) within a few codes, fewer the more points
+// the cube has, with every instruction set. The YUV tables are built once per matrix and range and then shared.
+
+#include "ColorCube.h"
+#include "FormatConversion.h"
+#include "NativeFilters.h"
+
+#include "TestFrames.h"
+#include "TestHarness.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+
+using namespace ImagingEffects;
+using namespace ImagingEffectsTests;
+
+namespace
+{
+	const ConversionIsa s_isas[] = { ConversionIsa_Scalar, ConversionIsa_SSE2, ConversionIsa_AVX2, ConversionIsa_NEON };
+	const uint32_t s_sizes[] = { 17, 33, 65 };
+
+	// Largest difference, in codes, allowed between a graded frame and the
+	// reference, for each size. The RGB table is resampled to a YUV lattice
+	// of the same size, so a curved grade, and the bend where colours leave
+	// the RGB gamut, are interpolated twice; the error shrinks with the
+	// spacing of the lattice (17 points: up to 5 codes, 33: 3, 65: 2).
+	const int s_tolerances[] = { 5, 3, 2 };
+
+	template <class Fn>
+	void ForEachIsa(Fn fn)
+	{
+		const ConversionIsa original = GetConversionIsa();
+		for (size_t i = 0; i < sizeof(s_isas) / sizeof(s_isas[0]); i++)
+		{
+			if (SetConversionIsa(s_isas[i]))
+			{
+				fn(s_isas[i]);
+			}
+		}
+		SetConversionIsa(original);
+	}
+
+	// A cube of size^3 points, red changing fastest, each the colour grade
+	// gives for the point.
+	template <class Grade>
+	std::vector<float> MakeRgb(uint32_t size, Grade grade)
+	{
+		std::vector<float> rgb;
+		for (uint32_t b = 0; b < size; b++)
+		{
+			for (uint32_t g = 0; g < size; g++)
+			{
+				for (uint32_t r = 0; r < size; r++)
+				{
+					const float in[3] = { r / (float)(size - 1), g / (float)(size - 1), b / (float)(size - 1) };
+					float out[3];
+					grade(in, out);
+					rgb.insert(rgb.end(), out, out + 3);
+				}
+			}
+		}
+		return rgb;
+	}
+
+	void Identity(const float *pIn, float *pOut)
+	{
+		pOut[0] = pIn[0];
+		pOut[1] = pIn[1];
+		pOut[2] = pIn[2];
+	}
+
+	// A warm, slightly lifted grade with some crosstalk between channels.
+	void Warm(const float *pIn, float *pOut)
+	{
+		pOut[0] = powf(pIn[0], 0.8f);
+		pOut[1] = 0.05f + 0.85f * pIn[1] + 0.1f * pIn[0] * pIn[2];
+		pOut[2] = 0.9f * pIn[2] * pIn[2] + 0.05f;
+	}
+
+	float Clamp01(float v)
+	{
+		return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+	}
+
+	// The reference: the stream's YUV to RGB, the RGB table interpolated
+	// tetrahedrally in floating point with colours outside the gamut keeping
+	// their distance from it, and back to YUV, each written out here from
+	// the definitions rather than taken from ColorCube.cpp.
+	class Reference
+	{
+	public:
+		Reference(const std::vector<float> &rgb, uint32_t size, YuvMatrix matrix, YuvRange range)
+			: m_rgb(rgb)
+			, m_size(size)
+		{
+			m_kr = (matrix == YuvMatrix_BT709) ? 0.2126f : 0.299f;
+			m_kb = (matrix == YuvMatrix_BT709) ? 0.0722f : 0.114f;
+			m_yOffset = (range == YuvRange_Video) ? 16.0f : 0.0f;
+			m_yScale = (range == YuvRange_Video) ? 219.0f : 255.0f;
+			m_cScale = (range == YuvRange_Video) ? 224.0f : 255.0f;
+		}
+
+		void Grade(uint8_t y, uint8_t u, uint8_t v, int *pYuv) const
+		{
+			const float l = (y - m_yOffset) / m_yScale;
+			const float cb = (u - 128.0f) / m_cScale;
+			const float cr = (v - 128.0f) / m_cScale;
+			float rgb[3];
+			rgb[0] = l + 2.0f * (1.0f - m_kr) * cr;
+			rgb[2] = l + 2.0f * (1.0f - m_kb) * cb;
+			rgb[1] = (l - m_kr * rgb[0] - m_kb * rgb[2]) / (1.0f - m_kr - m_kb);
+
+			float graded[3];
+			Lookup(rgb, graded);
+			for (int i = 0; i < 3; i++)
+			{
+				graded[i] += rgb[i] - Clamp01(rgb[i]);
+			}
+
+			const float gl = m_kr * graded[0] + (1.0f - m_kr - m_kb) * graded[1] + m_kb * graded[2];
+			const float out[3] =
+			{
+				m_yOffset + m_yScale * gl,
+				128.0f + m_cScale * (graded[2] - gl) / (2.0f * (1.0f - m_kb)),
+				128.0f + m_cScale * (graded[0] - gl) / (2.0f * (1.0f - m_kr))
+			};
+			for (int i = 0; i < 3; i++)
+			{
+				const float q = floorf(out[i] + 0.5f);
+				pYuv[i] = q < 0.0f ? 0 : (q > 255.0f ? 255 : (int)q);
+			}
+		}
+
+	private:
+		// The cell is split into six tetrahedra; the walk from the near
+		// corner to the far one takes the axes in order of their fractions.
+		void Lookup(const float *pIn, float *pOut) const
+		{
+			const size_t strides[3] = { 3, 3 * (size_t)m_size, 3 * (size_t)m_size * m_size };
+			size_t offset = 0;
+			float frac[3];
+			for (int i = 0; i < 3; i++)
+			{
+				const float position = Clamp01(pIn[i]) * (m_size - 1);
+				const uint32_t index = (std::min)((uint32_t)position, m_size - 2);
+				frac[i] = position - index;
+				offset += index * strides[i];
+			}
+
+			int order[3] = { 0, 1, 2 };
+			std::sort(order, order + 3, [&](int a, int b) { return frac[a] > frac[b]; });
+
+			float weights[4] = { 1.0f - frac[order[0]], frac[order[0]] - frac[order[1]], frac[order[1]] - frac[order[2]], frac[order[2]] };
+			for (int c = 0; c < 3; c++)
+			{
+				pOut[c] = 0.0f;
+			}
+			for (int k = 0; k < 4; k++)
+			{
+				for (int c = 0; c < 3; c++)
+				{
+					pOut[c] += weights[k] * m_rgb[offset + c];
+				}
+				if (k < 3)
+				{
+					offset += strides[order[k]];
+				}
+			}
+		}
+
+		const std::vector<float> &m_rgb;
+		uint32_t m_size;
+		float m_kr, m_kb;
+		float m_yOffset, m_yScale, m_cScale;
+	};
+
+	// The Y, U and V of a pixel of an NV12 or YUY2 frame.
+	void GetPixel(const VideoFrame &frame, uint32_t x, uint32_t y, uint8_t *pYuv)
+	{
+		if (frame.format == PixelFormat_NV12)
+		{
+			const uint8_t *pUV = frame.planes[1].pData + frame.planes[1].stride * (ptrdiff_t)(y / 2) + (x & ~1u);
+			pYuv[0] = frame.planes[0].pData[frame.planes[0].stride * (ptrdiff_t)y + x];
+			pYuv[1] = pUV[0];
+			pYuv[2] = pUV[1];
+		}
+		else
+		{
+			const uint8_t *pPair = frame.planes[0].pData + frame.planes[0].stride * (ptrdiff_t)y + 2 * (x & ~1u);
+			pYuv[0] = pPair[(x & 1) ? 2 : 0];
+			pYuv[1] = pPair[1];
+			pYuv[2] = pPair[3];
+		}
+	}
+
+	// An NV12 frame of noise, or a YUY2 frame made from one, so that both
+	// rows of each pair share their chroma as the NV12 strips the chain
+	// filters YUY2 in need for the frame to come back unchanged.
+	class NoiseFrame
+	{
+	public:
+		NoiseFrame(PixelFormat format, uint32_t width, uint32_t height, uint32_t seed)
+			: m_nv12(PixelFormat_NV12, width, height, 0, false, seed)
+			, m_frame(format, width, height)
+		{
+			ConvertVideoFrame(m_nv12.Get(), m_frame.Get(), 0, height);
+		}
+
+		const VideoFrame& Get() const { return m_frame.Get(); }
+
+	private:
+		TestFrame m_nv12;
+		TestFrame m_frame;
+	};
+
+	void Render(const std::shared_ptr<ColorCube> &cube, YuvMatrix matrix, YuvRange range, const VideoFrame &dest, const VideoFrame &src)
+	{
+		NativeFilterChain chain(std::vector<NativeFilter>(1, MakeLut3DFilter(cube)), src.format, src.width, src.height, matrix, range);
+		chain.Process(dest, src, 0, src.height);
+	}
+
+	// The largest difference between dest and the reference for src. A
+	// luma sample is graded with the chroma of its 2x2 block, chroma with
+	// the rounded average luma of the block.
+	int GetMaxError(const Reference &reference, const VideoFrame &dest, const VideoFrame &src)
+	{
+		int maxError = 0;
+		for (uint32_t y = 0; y < src.height; y++)
+		{
+			for (uint32_t x = 0; x < src.width; x++)
+			{
+				uint8_t in[3];
+				uint8_t out[3];
+				GetPixel(src, x, y, in);
+				GetPixel(dest, x, y, out);
+
+				const uint32_t x0 = x & ~1u;
+				const uint32_t y0 = y & ~1u;
+				const uint32_t x1 = (x0 + 1 < src.width) ? x0 + 1 : x0;
+				const uint32_t y1 = (y0 + 1 < src.height) ? y0 + 1 : y0;
+				uint8_t corners[4][3];
+				GetPixel(src, x0, y0, corners[0]);
+				GetPixel(src, x1, y0, corners[1]);
+				GetPixel(src, x0, y1, corners[2]);
+				GetPixel(src, x1, y1, corners[3]);
+				const uint8_t yAverage = (uint8_t)((corners[0][0] + corners[1][0] + corners[2][0] + corners[3][0] + 2) >> 2);
+
+				int luma[3];
+				int chroma[3];
+				reference.Grade(in[0], in[1], in[2], luma);
+				reference.Grade(yAverage, in[1], in[2], chroma);
+				maxError = (std::max)(maxError, abs(out[0] - luma[0]));
+				maxError = (std::max)(maxError, abs(out[1] - chroma[1]));
+				maxError = (std::max)(maxError, abs(out[2] - chroma[2]));
+			}
+		}
+		return maxError;
+	}
+}
+
+TEST(IdentityCubesLeaveEveryCodeUnchanged)
+{
+	// Every Y, U and V code, a row of V codes at a time.
+	uint8_t y[256];
+	uint8_t u[256];
+	uint8_t v[256];
+	uint8_t out[3][256];
+	for (int i = 0; i < 256; i++)
+	{
+		v[i] = (uint8_t)i;
+	}
+
+	for (size_t iSize = 0; iSize < sizeof(s_sizes) / sizeof(s_sizes[0]); iSize++)
+	{
+		const uint32_t size = s_sizes[iSize];
+		const std::vector<float> rgb = MakeRgb(size, Identity);
+		const std::shared_ptr<ColorCube> cube = ColorCube::Create(size, &rgb[0], rgb.size());
+		const std::shared_ptr<const YuvCube> yuvCube = cube->GetYuvCube(YuvMatrix_BT601, YuvRange_Video);
+
+		ForEachIsa([&](ConversionIsa)
+		{
+			uint32_t cMismatches = 0;
+			for (int iy = 0; iy < 256; iy++)
+			{
+				for (int iu = 0; iu < 256; iu++)
+				{
+					memset(y, iy, sizeof(y));
+					memset(u, iu, sizeof(u));
+					yuvCube->Interpolate(y, u, v, 256, out[0], out[1], out[2]);
+					for (int i = 0; i < 256; i++)
+					{
+						cMismatches += (out[0][i] != iy) + (out[1][i] != iu) + (out[2][i] != i);
+					}
+				}
+			}
+			CHECK_EQUAL(cMismatches, 0u);
+		});
+	}
+}
+
+TEST(IdentityCubesLeaveFramesUnchanged)
+{
+	const PixelFormat formats[] = { PixelFormat_NV12, PixelFormat_YUY2 };
+	const YuvMatrix matrices[] = { YuvMatrix_BT601, YuvMatrix_BT709 };
+	const YuvRange ranges[] = { YuvRange_Video, YuvRange_Full };
+
+	for (size_t iSize = 0; iSize < sizeof(s_sizes) / sizeof(s_sizes[0]); iSize++)
+	{
+		const uint32_t size = s_sizes[iSize];
+		const std::vector<float> rgb = MakeRgb(size, Identity);
+		const std::shared_ptr<ColorCube> cube = ColorCube::Create(size, &rgb[0], rgb.size());
+
+		ForEachIsa([&](ConversionIsa)
+		{
+			for (size_t iFormat = 0; iFormat < 2; iFormat++)
+			{
+				// Odd sizes too, for the last column and row of chroma blocks.
+				for (uint32_t width = 37; width <= 38; width++)
+				{
+					for (uint32_t height = 5; height <= 6; height++)
+					{
+						if (formats[iFormat] == PixelFormat_YUY2 && (width & 1))
+						{
+							continue;
+						}
+						const NoiseFrame src(formats[iFormat], width, height, size + width + height);
+						TestFrame dest(formats[iFormat], width, height);
+						Render(cube, matrices[(width + height) & 1], ranges[height & 1], dest.Get(), src.Get());
+						CHECK(FramesEqual(dest.Get(), src.Get()));
+					}
+				}
+			}
+		});
+	}
+}
+
+TEST(GradedFramesMatchTheFloatReference)
+{
+	const PixelFormat formats[] = { PixelFormat_NV12, PixelFormat_YUY2 };
+	const YuvMatrix matrices[] = { YuvMatrix_BT601, YuvMatrix_BT709 };
+	const YuvRange ranges[] = { YuvRange_Video, YuvRange_Full };
+
+	for (size_t iSize = 0; iSize < sizeof(s_sizes) / sizeof(s_sizes[0]); iSize++)
+	{
+		const uint32_t size = s_sizes[iSize];
+		const std::vector<float> rgb = MakeRgb(size, Warm);
+		const std::shared_ptr<ColorCube> cube = ColorCube::Create(size, &rgb[0], rgb.size());
+
+		for (size_t iMatrix = 0; iMatrix < 2; iMatrix++)
+		{
+			for (size_t iRange = 0; iRange < 2; iRange++)
+			{
+				const Reference reference(rgb, size, matrices[iMatrix], ranges[iRange]);
+				ForEachIsa([&](ConversionIsa)
+				{
+					for (size_t iFormat = 0; iFormat < 2; iFormat++)
+					{
+						// Wide enough for the vector loop, with a tail, and
+						// odd rows for NV12.
+						const uint32_t width = formats[iFormat] == PixelFormat_NV12 ? 147 : 146;
+						const uint32_t height = formats[iFormat] == PixelFormat_NV12 ? 35 : 34;
+						const NoiseFrame src(formats[iFormat], width, height, size);
+						TestFrame dest(formats[iFormat], width, height);
+						Render(cube, matrices[iMatrix], ranges[iRange], dest.Get(), src.Get());
+						const int maxError = GetMaxError(reference, dest.Get(), src.Get());
+						if (maxError > s_tolerances[iSize])
+						{
+							fprintf(stderr, "%u points, matrix %u, range %u, format %u: off by %d codes\n",
+								size, (unsigned)iMatrix, (unsigned)iRange, (unsigned)iFormat, maxError);
+						}
+						CHECK(maxError <= s_tolerances[iSize]);
+					}
+				});
+			}
+		}
+	}
+}
+
+TEST(YuvTablesAreBuiltOncePerMatrixAndRange)
+{
+	const std::vector<float> rgb = MakeRgb(17, Warm);
+	const std::shared_ptr<ColorCube> cube = ColorCube::Create(17, &rgb[0], rgb.size());
+
+	const std::shared_ptr<const YuvCube> tables[4] =
+	{
+		cube->GetYuvCube(YuvMatrix_BT601, YuvRange_Video),
+		cube->GetYuvCube(YuvMatrix_BT601, YuvRange_Full),
+		cube->GetYuvCube(YuvMatrix_BT709, YuvRange_Video),
+		cube->GetYuvCube(YuvMatrix_BT709, YuvRange_Full)
+	};
+	for (int i = 0; i < 4; i++)
+	{
+		CHECK(tables[i] != nullptr);
+		for (int j = 0; j < i; j++)
+		{
+			CHECK(tables[i] != tables[j]);
+		}
+	}
+
+	// The same table comes back, whichever thread asks.
+	CHECK(cube->GetYuvCube(YuvMatrix_BT601, YuvRange_Video) == tables[0]);
+	CHECK(cube->GetYuvCube(YuvMatrix_BT709, YuvRange_Full) == tables[3]);
+
+	std::shared_ptr<const YuvCube> fromThreads[4];
+	std::thread threads[4];
+	for (int i = 0; i < 4; i++)
+	{
+		threads[i] = std::thread([&, i]()
+		{
+			fromThreads[i] = cube->GetYuvCube(i & 2 ? YuvMatrix_BT709 : YuvMatrix_BT601, i & 1 ? YuvRange_Full : YuvRange_Video);
+		});
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		threads[i].join();
+		CHECK(fromThreads[i] == tables[i]);
+	}
+
+	// Another cube has tables of its own.
+	const std::shared_ptr<ColorCube> other = ColorCube::Create(17, &rgb[0], rgb.size());
+	CHECK(other->GetYuvCube(YuvMatrix_BT601, YuvRange_Video) != tables[0]);
+}
+
+int main() { return RunTests(); }
@@ -0,0 +1,189 @@
+// Stress tests of the effect engine: several threads submit frames to one
+// engine at once, on one thread each or sharing a pool, while another
+// thread swaps the effects. Every frame must come out exactly as a serial
+// render with one of the effect lists gives it: two frames in flight never
+// share working memory, and a frame never mixes two chains.
+
+#include "EffectEngine.h"
+#include "ThreadPool.h"
+
+#include "TestFrames.h"
+#include "TestHarness.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+using namespace ImagingEffects;
+using namespace ImagingEffectsTests;
+
+namespace
+{
+	const uint32_t WIDTH = 640;
+	const uint32_t HEIGHT = 480;
+	const uint32_t SUBMITTER_COUNT = 3;
+	const uint32_t FRAMES_PER_SUBMITTER = 100;
+	const uint32_t SOURCE_COUNT = 2;
+	const uint32_t CHAIN_COUNT = 2;
+
+	std::vector<NativeFilter> MakeChain(uint32_t iChain)
+	{
+		std::vector<NativeFilter> filters;
+		if (iChain == 0)
+		{
+			filters.push_back(MakeBrightnessContrastSaturationFilter(0.1f, 1.2f, 0.8f));
+		}
+		else
+		{
+			filters.push_back(MakeBrightnessContrastSaturationFilter(-0.2f, 0.9f, 1.4f));
+			filters.push_back(MakeVignetteFilter(0.3f, 0.9f));
+		}
+		return filters;
+	}
+
+	// What each source frame looks like through each chain, rendered on one
+	// thread in one band.
+	class ExpectedFrames
+	{
+	public:
+		explicit ExpectedFrames(const StreamFormat &format)
+		{
+			for (uint32_t iSource = 0; iSource < SOURCE_COUNT; iSource++)
+			{
+				m_sources[iSource].reset(new TestFrame(format.pixelFormat, format.width, format.height, 0, false, 100 + iSource));
+				for (uint32_t iChain = 0; iChain < CHAIN_COUNT; iChain++)
+				{
+					FrameRenderer renderer(format, MakeChain(iChain), std::vector<NativeFilter>(), 1);
+					m_expected[iSource][iChain].reset(new TestFrame(format.pixelFormat, format.width, format.height));
+					renderer.Render(FrameAction_Process, m_expected[iSource][iChain]->Get(), m_sources[iSource]->Get(), RunSerially);
+				}
+			}
+			CHECK(!FramesEqual(m_expected[0][0]->Get(), m_expected[0][1]->Get()));
+		}
+
+		const VideoFrame& GetSource(uint32_t iSource) const { return m_sources[iSource]->Get(); }
+
+		// True if the frame is the source through one of the chains.
+		bool Matches(uint32_t iSource, const VideoFrame &frame) const
+		{
+			for (uint32_t iChain = 0; iChain < CHAIN_COUNT; iChain++)
+			{
+				if (FramesEqual(frame, m_expected[iSource][iChain]->Get()))
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+	private:
+		std::unique_ptr<TestFrame> m_sources[SOURCE_COUNT];
+		std::unique_ptr<TestFrame> m_expected[SOURCE_COUNT][CHAIN_COUNT];
+	};
+
+	// Runs the submitters against the engine, swapping chains meanwhile if
+	// fSwap is true. Returns the number of frames that matched no chain.
+	uint32_t Stress(EffectEngine *pEngine, const StreamFormat &format, const ExpectedFrames &expected, bool fSwap)
+	{
+		pEngine->SetFilters(MakeChain(0), std::vector<NativeFilter>());
+		pEngine->SetFormat(format);
+
+		std::atomic<uint32_t> cWrong(0);
+		std::atomic<uint32_t> cRunning(SUBMITTER_COUNT);
+		std::vector<std::thread> threads;
+
+		for (uint32_t iSubmitter = 0; iSubmitter < SUBMITTER_COUNT; iSubmitter++)
+		{
+			threads.push_back(std::thread([pEngine, &format, &expected, &cWrong, &cRunning, iSubmitter]()
+			{
+				TestFrame dest(format.pixelFormat, format.width, format.height, 0, false, 200 + iSubmitter);
+				for (uint32_t i = 0; i < FRAMES_PER_SUBMITTER; i++)
+				{
+					const uint32_t iSource = (i + iSubmitter) % SOURCE_COUNT;
+					const FrameTiming timing = { true, (int64_t)i * 333333, 333333 };
+					FrameAction action = FrameAction_Drop;
+					if (!pEngine->ProcessFrame(timing, dest.Get(), expected.GetSource(iSource), &action) ||
+						action != FrameAction_Process ||
+						!expected.Matches(iSource, dest.Get()))
+					{
+						cWrong++;
+					}
+				}
+				cRunning--;
+			}));
+		}
+
+		if (fSwap)
+		{
+			threads.push_back(std::thread([pEngine, &cRunning]()
+			{
+				for (uint32_t iChain = 1; cRunning.load() > 0; iChain = (iChain + 1) % CHAIN_COUNT)
+				{
+					pEngine->SetFilters(MakeChain(iChain), std::vector<NativeFilter>());
+					std::this_thread::yield();
+				}
+			}));
+		}
+
+		for (size_t i = 0; i < threads.size(); i++)
+		{
+			threads[i].join();
+		}
+		return cWrong.load();
+	}
+}
+
+TEST(ThreadsSubmittingToOneEngine)
+{
+	const StreamFormat format = MakeStreamFormat(PixelFormat_YUY2, WIDTH, HEIGHT);
+	const ExpectedFrames expected(format);
+
+	// Each submitter renders its bands itself.
+	EffectEngine serial(RunSerially, 8);
+	CHECK_EQUAL(Stress(&serial, format, expected, false), 0u);
+
+	// The submitters share the pool's threads.
+	ThreadPool pool(4);
+	EffectEngine pooled(pool.GetParallelFor(), 8);
+	CHECK_EQUAL(Stress(&pooled, format, expected, false), 0u);
+	CHECK_EQUAL(pooled.GetSchedulerStats().cFrames[FrameAction_Process], (uint64_t)(SUBMITTER_COUNT * FRAMES_PER_SUBMITTER));
+}
+
+TEST(SwappingEffectsWhileSubmitting)
+{
+	const StreamFormat format = MakeStreamFormat(PixelFormat_YUY2, WIDTH, HEIGHT);
+	const ExpectedFrames expected(format);
+
+	EffectEngine serial(RunSerially, 8);
+	CHECK_EQUAL(Stress(&serial, format, expected, true), 0u);
+
+	ThreadPool pool(4);
+	EffectEngine pooled(pool.GetParallelFor(), 8);
+	CHECK_EQUAL(Stress(&pooled, format, expected, true), 0u);
+}
+
+TEST(EnginesSharingAPool)
+{
+	const StreamFormat yuy2 = MakeStreamFormat(PixelFormat_YUY2, WIDTH, HEIGHT);
+	const StreamFormat nv12 = MakeStreamFormat(PixelFormat_NV12, WIDTH, HEIGHT);
+	const ExpectedFrames expectedYuy2(yuy2);
+	const ExpectedFrames expectedNv12(nv12);
+
+	ThreadPool pool(4);
+	EffectEngine engineYuy2(pool.GetParallelFor(), 8);
+	EffectEngine engineNv12(pool.GetParallelFor(), 8);
+
+	uint32_t cWrongNv12 = 0;
+	std::thread other([&engineNv12, &nv12, &expectedNv12, &cWrongNv12]()
+	{
+		cWrongNv12 = Stress(&engineNv12, nv12, expectedNv12, true);
+	});
+	CHECK_EQUAL(Stress(&engineYuy2, yuy2, expectedYuy2, true), 0u);
+	other.join();
+	CHECK_EQUAL(cWrongNv12, 0u);
+}
+
+int main()
+{
+	return RunTests();
+}
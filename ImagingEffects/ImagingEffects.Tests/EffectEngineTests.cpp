@@ -0,0 +1,139 @@
+// Tests of the effect engine: the formats it accepts, and that its frames
+// match a renderer run on one thread, whether the host calls ProcessFrame or
+// its steps.
+
+#include "EffectEngine.h"
+#include "ThreadPool.h"
+
+#include "TestFrames.h"
+#include "TestHarness.h"
+
+using namespace ImagingEffects;
+using namespace ImagingEffectsTests;
+
+namespace
+{
+	std::vector<NativeFilter> MakeTestFilters()
+	{
+		std::vector<NativeFilter> filters;
+		filters.push_back(MakeBrightnessContrastSaturationFilter(0.1f, 1.2f, 0.8f));
+		filters.push_back(MakeSepiaFilter(0.5f));
+		return filters;
+	}
+
+	FrameTiming MakeTiming(int64_t hnsTime)
+	{
+		FrameTiming timing;
+		timing.fHasTime = true;
+		timing.hnsTime = hnsTime;
+		timing.hnsDuration = 333333;
+		return timing;
+	}
+}
+
+TEST(RejectsFormatsTheFiltersCannotHandle)
+{
+	EffectEngine engine(RunSerially);
+	CHECK(!engine.SetFormat(MakeStreamFormat(PixelFormat_I420, 64, 48)));
+	CHECK(!engine.SetFormat(MakeStreamFormat(PixelFormat_NV12, 0, 48)));
+	CHECK(!engine.SetFormat(MakeStreamFormat(PixelFormat_NV12, 64, 0)));
+	CHECK(engine.GetRenderer() == nullptr);
+
+	CHECK(engine.SetFormat(MakeStreamFormat(PixelFormat_NV12, 64, 48)));
+	CHECK(!engine.SetFormat(MakeStreamFormat(PixelFormat_I420, 64, 48)));
+	CHECK_EQUAL(engine.GetRenderer()->GetFormat().pixelFormat, PixelFormat_NV12);
+}
+
+TEST(RejectsFramesOfAnotherFormat)
+{
+	EffectEngine engine(RunSerially);
+	TestFrame src(PixelFormat_NV12, 64, 48);
+	TestFrame dest(PixelFormat_NV12, 64, 48);
+	FrameAction action = FrameAction_Process;
+
+	// No format yet.
+	CHECK(!engine.ProcessFrame(MakeTiming(0), dest.Get(), src.Get(), &action));
+
+	engine.SetFormat(MakeStreamFormat(PixelFormat_NV12, 64, 48));
+	TestFrame otherSize(PixelFormat_NV12, 64, 50);
+	TestFrame otherFormat(PixelFormat_YUY2, 64, 48);
+	CHECK(!engine.ProcessFrame(MakeTiming(0), otherSize.Get(), src.Get(), &action));
+	CHECK(!engine.ProcessFrame(MakeTiming(0), dest.Get(), otherFormat.Get(), &action));
+	CHECK(engine.ProcessFrame(MakeTiming(0), dest.Get(), src.Get(), &action));
+	CHECK_EQUAL(action, FrameAction_Process);
+}
+
+TEST(MatchesASerialRender)
+{
+	const PixelFormat formats[] = { PixelFormat_NV12, PixelFormat_YUY2 };
+	for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+	{
+		const StreamFormat format = MakeStreamFormat(formats[i], 322, 182);
+		ThreadPool pool(4);
+		EffectEngine engine(pool.GetParallelFor(), 7);
+		engine.SetFilters(MakeTestFilters(), std::vector<NativeFilter>());
+		CHECK(engine.SetFormat(format));
+
+		FrameRenderer reference(format, MakeTestFilters(), std::vector<NativeFilter>(), 1);
+
+		TestFrame src(format.pixelFormat, format.width, format.height, 0, false, 7);
+		TestFrame dest(format.pixelFormat, format.width, format.height, 0, false, 8);
+		TestFrame expected(format.pixelFormat, format.width, format.height, 0, false, 9);
+
+		FrameAction action = FrameAction_Drop;
+		CHECK(engine.ProcessFrame(MakeTiming(0), dest.Get(), src.Get(), &action));
+		CHECK_EQUAL(action, FrameAction_Process);
+		reference.Render(FrameAction_Process, expected.Get(), src.Get(), RunSerially);
+		CHECK(FramesEqual(dest.Get(), expected.Get()));
+	}
+}
+
+TEST(StepsMatchProcessFrame)
+{
+	const StreamFormat format = MakeStreamFormat(PixelFormat_NV12, 128, 72);
+	EffectEngine engine(RunSerially, 3);
+	engine.SetFormat(format);
+
+	// A renderer the host keeps itself, as the transform does.
+	std::shared_ptr<const FrameRenderer> spRenderer = engine.BuildRenderer(format, MakeTestFilters(), std::vector<NativeFilter>());
+	CHECK_EQUAL(spRenderer->GetBands().size(), 3u);
+
+	TestFrame src(format.pixelFormat, format.width, format.height, 0, false, 3);
+	TestFrame dest(format.pixelFormat, format.width, format.height, 0, false, 4);
+	TestFrame expected(format.pixelFormat, format.width, format.height, 0, false, 5);
+
+	const FrameAction action = engine.ScheduleFrame(MakeTiming(0), spRenderer->HasFallback());
+	CHECK_EQUAL(action, FrameAction_Process);
+	engine.RenderFrame(*spRenderer, action, dest.Get(), src.Get());
+
+	uint64_t stageNs[FrameStage_Count] = {};
+	stageNs[FrameStage_Render] = 1000;
+	stageNs[FrameStage_Total] = 2000;
+	engine.CompleteFrame(action, 1000, stageNs);
+
+	spRenderer->Render(FrameAction_Process, expected.Get(), src.Get(), RunSerially);
+	CHECK(FramesEqual(dest.Get(), expected.Get()));
+
+	CHECK_EQUAL(engine.GetSchedulerStats().cFrames[FrameAction_Process], 1u);
+	LatencySummary latency[FrameStage_Count];
+	engine.GetLatency(latency);
+	CHECK_EQUAL(latency[FrameStage_Total].cFrames, 1u);
+}
+
+TEST(CopiesFramesWithoutFilters)
+{
+	const StreamFormat format = MakeStreamFormat(PixelFormat_YUY2, 33, 17);
+	EffectEngine engine(RunSerially);
+	engine.SetFormat(format);
+
+	TestFrame src(format.pixelFormat, format.width, format.height, 0, false, 1);
+	TestFrame dest(format.pixelFormat, format.width, format.height, 96, true, 2);
+	FrameAction action = FrameAction_Drop;
+	CHECK(engine.ProcessFrame(MakeTiming(0), dest.Get(), src.Get(), &action));
+	CHECK(FramesEqual(dest.Get(), src.Get()));
+}
+
+int main()
+{
+	return RunTests();
+}
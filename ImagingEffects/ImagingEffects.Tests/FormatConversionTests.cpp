@@ -0,0 +1,314 @@
+// Tests of the conversion kernels. Every instruction set the processor
+// supports is compared with a pixel-by-pixel reference written here, for
+// every pair of formats, at every width up to a few vector lengths (odd
+// ones included), odd heights, padded rows and bottom-up frames. The
+// chroma average is checked for every pair of input values.
+
+#include "FormatConversion.h"
+#include "VideoFrame.h"
+
+#include "TestFrames.h"
+#include "TestHarness.h"
+
+using namespace ImagingEffects;
+using namespace ImagingEffectsTests;
+
+namespace
+{
+	const ConversionIsa s_isas[] = { ConversionIsa_Scalar, ConversionIsa_SSE2, ConversionIsa_AVX2, ConversionIsa_NEON };
+	const PixelFormat s_formats[] = { PixelFormat_NV12, PixelFormat_YUY2, PixelFormat_I420 };
+
+	bool IsPlanar(PixelFormat format)
+	{
+		return format != PixelFormat_YUY2;
+	}
+
+	uint8_t GetY(const VideoFrame &frame, uint32_t x, uint32_t y)
+	{
+		const uint8_t *pRow = frame.planes[0].pData + frame.planes[0].stride * (ptrdiff_t)y;
+		return IsPlanar(frame.format) ? pRow[x] : pRow[4 * (x / 2) + 2 * (x & 1)];
+	}
+
+	// Chroma sample cx of row cy, in the format's own chroma rows (every row
+	// for YUY2, every other row for the 4:2:0 formats). iChannel is 0 for U
+	// and 1 for V.
+	uint8_t GetChroma(const VideoFrame &frame, uint32_t cx, uint32_t cy, int iChannel)
+	{
+		switch (frame.format)
+		{
+		case PixelFormat_NV12:
+			return frame.planes[1].pData[frame.planes[1].stride * (ptrdiff_t)cy + 2 * cx + iChannel];
+		case PixelFormat_YUY2:
+			return frame.planes[0].pData[frame.planes[0].stride * (ptrdiff_t)cy + 4 * cx + 1 + 2 * iChannel];
+		default:
+			return frame.planes[1 + iChannel].pData[frame.planes[1 + iChannel].stride * (ptrdiff_t)cy + cx];
+		}
+	}
+
+	// The chroma dst should hold at row cy: 4:2:0 from 4:2:2 averages a row
+	// pair (an odd last row with itself), 4:2:2 from 4:2:0 repeats each row.
+	uint8_t ExpectedChroma(const VideoFrame &src, PixelFormat dstFormat, uint32_t cx, uint32_t cy, int iChannel)
+	{
+		if (IsPlanar(src.format) == IsPlanar(dstFormat))
+		{
+			return GetChroma(src, cx, cy, iChannel);
+		}
+		if (IsPlanar(dstFormat))
+		{
+			const uint32_t cyNext = (2 * cy + 1 < src.height) ? 2 * cy + 1 : 2 * cy;
+			return (uint8_t)((GetChroma(src, cx, 2 * cy, iChannel) + GetChroma(src, cx, cyNext, iChannel) + 1) / 2);
+		}
+		return GetChroma(src, cx, cy / 2, iChannel);
+	}
+
+	// True if dst is src converted: the same luma (an odd YUY2 row ends with
+	// its last sample repeated) and the chroma above.
+	bool IsConversionOf(const VideoFrame &dst, const VideoFrame &src)
+	{
+		const uint32_t cChroma = (src.width + 1) / 2;
+		const uint32_t cChromaRows = IsPlanar(dst.format) ? (src.height + 1) / 2 : src.height;
+
+		for (uint32_t y = 0; y < src.height; y++)
+		{
+			for (uint32_t x = 0; x < src.width; x++)
+			{
+				if (GetY(dst, x, y) != GetY(src, x, y))
+				{
+					return false;
+				}
+			}
+			if (!IsPlanar(dst.format) && (src.width & 1) && GetY(dst, src.width, y) != GetY(src, src.width - 1, y))
+			{
+				return false;
+			}
+		}
+
+		for (uint32_t cy = 0; cy < cChromaRows; cy++)
+		{
+			for (uint32_t cx = 0; cx < cChroma; cx++)
+			{
+				for (int iChannel = 0; iChannel < 2; iChannel++)
+				{
+					if (GetChroma(dst, cx, cy, iChannel) != ExpectedChroma(src, dst.format, cx, cy, iChannel))
+					{
+						return false;
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	// Converts with the kernel for the pair of formats. Returns false for a
+	// pair that has none (the same format twice).
+	bool Convert(const VideoFrame &src, const VideoFrame &dst)
+	{
+		const VideoPlane *s = src.planes;
+		const VideoPlane *d = dst.planes;
+		const uint32_t w = src.width;
+		const uint32_t h = src.height;
+
+		if (src.format == PixelFormat_YUY2 && dst.format == PixelFormat_NV12)
+		{
+			ConvertYuy2ToNv12(s[0].pData, s[0].stride, d[0].pData, d[0].stride, d[1].pData, d[1].stride, w, h);
+		}
+		else if (src.format == PixelFormat_NV12 && dst.format == PixelFormat_YUY2)
+		{
+			ConvertNv12ToYuy2(s[0].pData, s[0].stride, s[1].pData, s[1].stride, d[0].pData, d[0].stride, w, h);
+		}
+		else if (src.format == PixelFormat_YUY2 && dst.format == PixelFormat_I420)
+		{
+			ConvertYuy2ToI420(s[0].pData, s[0].stride, d[0].pData, d[0].stride, d[1].pData, d[1].stride, d[2].pData, d[2].stride, w, h);
+		}
+		else if (src.format == PixelFormat_I420 && dst.format == PixelFormat_YUY2)
+		{
+			ConvertI420ToYuy2(s[0].pData, s[0].stride, s[1].pData, s[1].stride, s[2].pData, s[2].stride, d[0].pData, d[0].stride, w, h);
+		}
+		else if (src.format == PixelFormat_NV12 && dst.format == PixelFormat_I420)
+		{
+			ConvertNv12ToI420(s[0].pData, s[0].stride, s[1].pData, s[1].stride, d[0].pData, d[0].stride, d[1].pData, d[1].stride, d[2].pData, d[2].stride, w, h);
+		}
+		else if (src.format == PixelFormat_I420 && dst.format == PixelFormat_NV12)
+		{
+			ConvertI420ToNv12(s[0].pData, s[0].stride, s[1].pData, s[1].stride, s[2].pData, s[2].stride, d[0].pData, d[0].stride, d[1].pData, d[1].stride, w, h);
+		}
+		else
+		{
+			return false;
+		}
+		return true;
+	}
+
+	// Runs fn once with each instruction set the processor supports, then
+	// restores the one that was in use.
+	template <class Fn>
+	void ForEachIsa(Fn fn)
+	{
+		const ConversionIsa original = GetConversionIsa();
+		for (size_t i = 0; i < sizeof(s_isas) / sizeof(s_isas[0]); i++)
+		{
+			if (SetConversionIsa(s_isas[i]))
+			{
+				fn(s_isas[i]);
+			}
+		}
+		SetConversionIsa(original);
+	}
+}
+
+TEST(EveryPairOfFormatsAtEveryWidth)
+{
+	ForEachIsa([](ConversionIsa isa)
+	{
+		int cFailures = 0;
+		for (size_t iSrc = 0; iSrc < 3; iSrc++)
+		{
+			for (size_t iDst = 0; iDst < 3; iDst++)
+			{
+				for (uint32_t width = 1; width <= 140; width++)
+				{
+					for (uint32_t height = 1; height <= 5; height++)
+					{
+						const PixelFormat srcFormat = s_formats[iSrc];
+						const PixelFormat dstFormat = s_formats[iDst];
+						TestFrame src(srcFormat, width, height, 0, false, width * 8 + height);
+						TestFrame dst(dstFormat, width, height, 0, false, 0);
+						if (Convert(src.Get(), dst.Get()) && !IsConversionOf(dst.Get(), src.Get()))
+						{
+							if (cFailures++ < 10)
+							{
+								fprintf(stderr, "isa %d: %d to %d at %ux%u\n", (int)isa, (int)srcFormat, (int)dstFormat, width, height);
+							}
+						}
+					}
+				}
+			}
+		}
+		CHECK_EQUAL(cFailures, 0);
+	});
+}
+
+TEST(PaddedAndBottomUpFrames)
+{
+	ForEachIsa([](ConversionIsa isa)
+	{
+		int cFailures = 0;
+		for (size_t iSrc = 0; iSrc < 3; iSrc++)
+		{
+			for (size_t iDst = 0; iDst < 3; iDst++)
+			{
+				const PixelFormat srcFormat = s_formats[iSrc];
+				const PixelFormat dstFormat = s_formats[iDst];
+				const uint32_t widths[] = { 1, 17, 63, 99 };
+				for (size_t iWidth = 0; iWidth < 4; iWidth++)
+				{
+					const uint32_t width = widths[iWidth];
+					const uint32_t height = 7;
+
+					// Padded rows, and bottom-up frames for the formats a
+					// single buffer can hold that way (not I420).
+					const uint32_t srcStride = GetMinimumStride(srcFormat, width) + 38;
+					const uint32_t dstStride = GetMinimumStride(dstFormat, width) + 70;
+					TestFrame src(srcFormat, width, height, srcStride, srcFormat != PixelFormat_I420, 5);
+					TestFrame dst(dstFormat, width, height, dstStride, dstFormat != PixelFormat_I420, 6);
+					const std::vector<uint8_t> dstBefore = dst.GetBuffer();
+
+					if (!Convert(src.Get(), dst.Get()))
+					{
+						continue;
+					}
+					if (!IsConversionOf(dst.Get(), src.Get()))
+					{
+						if (cFailures++ < 10)
+						{
+							fprintf(stderr, "isa %d: %d to %d at width %u\n", (int)isa, (int)srcFormat, (int)dstFormat, width);
+						}
+					}
+
+					// Only the pixels are written, never the padding.
+					PlaneShape shapes[3];
+					const uint32_t cPlanes = GetPlaneShapes(dstFormat, width, height, 0, shapes);
+					const VideoFrame &frame = dst.Get();
+					std::vector<uint8_t> pixels(dst.GetBuffer().size(), 0);
+					for (uint32_t i = 0; i < cPlanes; i++)
+					{
+						for (uint32_t row = 0; row < shapes[i].cRows; row++)
+						{
+							const size_t offset = (frame.planes[i].pData + frame.planes[i].stride * (ptrdiff_t)row) - &dst.GetBuffer()[0];
+							memset(&pixels[offset], 1, shapes[i].cbRow);
+						}
+					}
+					for (size_t i = 0; i < pixels.size(); i++)
+					{
+						if (!pixels[i] && dst.GetBuffer()[i] != dstBefore[i])
+						{
+							cFailures++;
+							break;
+						}
+					}
+				}
+			}
+		}
+		CHECK_EQUAL(cFailures, 0);
+	});
+}
+
+// Rows 2k and 2k + 1 of a YUY2 frame hold chroma k and j in sample j, so the
+// NV12 and I420 chroma of the frame is the average of every pair of values.
+TEST(ChromaAverageOfEveryPair)
+{
+	TestFrame src(PixelFormat_YUY2, 512, 512);
+	const VideoFrame &frame = src.Get();
+	for (uint32_t k = 0; k < 256; k++)
+	{
+		uint8_t *pTop = frame.planes[0].pData + frame.planes[0].stride * (ptrdiff_t)(2 * k);
+		uint8_t *pBottom = pTop + frame.planes[0].stride;
+		for (uint32_t j = 0; j < 256; j++)
+		{
+			pTop[4 * j + 1] = (uint8_t)k;
+			pBottom[4 * j + 1] = (uint8_t)j;
+			pTop[4 * j + 3] = (uint8_t)(255 - j);
+			pBottom[4 * j + 3] = (uint8_t)(255 - k);
+		}
+	}
+
+	ForEachIsa([&](ConversionIsa)
+	{
+		TestFrame nv12(PixelFormat_NV12, 512, 512);
+		TestFrame i420(PixelFormat_I420, 512, 512);
+		Convert(frame, nv12.Get());
+		Convert(frame, i420.Get());
+
+		int cWrong = 0;
+		for (uint32_t k = 0; k < 256; k++)
+		{
+			for (uint32_t j = 0; j < 256; j++)
+			{
+				const uint8_t u = (uint8_t)((k + j + 1) / 2);
+				const uint8_t v = (uint8_t)((255 - j + 255 - k + 1) / 2);
+				if (GetChroma(nv12.Get(), j, k, 0) != u || GetChroma(nv12.Get(), j, k, 1) != v ||
+					GetChroma(i420.Get(), j, k, 0) != u || GetChroma(i420.Get(), j, k, 1) != v)
+				{
+					cWrong++;
+				}
+			}
+		}
+		CHECK_EQUAL(cWrong, 0);
+	});
+}
+
+TEST(OnlySupportedInstructionSetsCanBeForced)
+{
+	CHECK(SetConversionIsa(ConversionIsa_Scalar));
+	CHECK_EQUAL(GetConversionIsa(), ConversionIsa_Scalar);
+#if defined(__x86_64__) || defined(_M_X64)
+	CHECK(SetConversionIsa(ConversionIsa_SSE2));
+	CHECK(!SetConversionIsa(ConversionIsa_NEON));
+	CHECK_EQUAL(GetConversionIsa(), ConversionIsa_SSE2);
+#endif
+}
+
+int main()
+{
+	return RunTests();
+}
@@ -0,0 +1,81 @@
+// Tests that rendering a frame allocates nothing once a stream is set up:
+// whatever a frame needs is built with the chains, not per frame.
+//
+// Every allocation through operator new is counted, on every thread, as in
+// effectbench.
+
+#include "EffectEngine.h"
+#include "ThreadPool.h"
+
+#include "AllocationCounter.h"
+#include "TestFrames.h"
+#include "TestHarness.h"
+
+using namespace ImagingEffects;
+using namespace ImagingEffectsTests;
+
+namespace
+{
+	// Frames rendered before counting, for one-time allocations.
+	const uint32_t WARMUP_FRAMES = 3;
+	const uint32_t COUNTED_FRAMES = 20;
+
+	// Allocations per frame rendered by an engine with the filters.
+	uint64_t CountAllocations(PixelFormat pixelFormat, const std::vector<NativeFilter> &filters, const ParallelFor &parallelFor)
+	{
+		const StreamFormat format = MakeStreamFormat(pixelFormat, 640, 360);
+		EffectEngine engine(parallelFor, 8);
+		engine.SetFilters(filters, std::vector<NativeFilter>());
+		engine.SetFormat(format);
+
+		TestFrame src(format.pixelFormat, format.width, format.height);
+		TestFrame dest(format.pixelFormat, format.width, format.height);
+		FrameTiming timing = { true, 0, 333333 };
+		FrameAction action;
+
+		for (uint32_t i = 0; i < WARMUP_FRAMES; i++, timing.hnsTime += timing.hnsDuration)
+		{
+			engine.ProcessFrame(timing, dest.Get(), src.Get(), &action);
+		}
+
+		const uint64_t cAllocationsStart = GetAllocationCount();
+		for (uint32_t i = 0; i < COUNTED_FRAMES; i++, timing.hnsTime += timing.hnsDuration)
+		{
+			engine.ProcessFrame(timing, dest.Get(), src.Get(), &action);
+		}
+		return GetAllocationCount() - cAllocationsStart;
+	}
+
+	std::vector<NativeFilter> MakeChain()
+	{
+		std::vector<NativeFilter> filters;
+		filters.push_back(MakeBrightnessContrastSaturationFilter(0.1f, 1.2f, 0.8f));
+		filters.push_back(MakeVignetteFilter(0.5f, 0.6f));
+		filters.push_back(MakeGrayscaleFilter());
+		return filters;
+	}
+}
+
+TEST(CopiesAllocateNothing)
+{
+	CHECK_EQUAL(CountAllocations(PixelFormat_NV12, std::vector<NativeFilter>(), RunSerially), 0u);
+	CHECK_EQUAL(CountAllocations(PixelFormat_YUY2, std::vector<NativeFilter>(), RunSerially), 0u);
+}
+
+TEST(FiltersAllocateNothing)
+{
+	CHECK_EQUAL(CountAllocations(PixelFormat_NV12, MakeChain(), RunSerially), 0u);
+	CHECK_EQUAL(CountAllocations(PixelFormat_YUY2, MakeChain(), RunSerially), 0u);
+}
+
+TEST(BandsOnAPoolAllocateNothing)
+{
+	ThreadPool pool(4);
+	CHECK_EQUAL(CountAllocations(PixelFormat_NV12, MakeChain(), pool.GetParallelFor()), 0u);
+	CHECK_EQUAL(CountAllocations(PixelFormat_YUY2, MakeChain(), pool.GetParallelFor()), 0u);
+}
+
+int main()
+{
+	return RunTests();
+}
@@ -0,0 +1,127 @@
+// Tests of band-parallel rendering: how frames are split into bands, and
+// that rendering the bands on several threads gives exactly the frame a
+// single band on one thread gives.
+
+#include "FrameBands.h"
+#include "FrameRenderer.h"
+#include "ThreadPool.h"
+
+#include "TestFrames.h"
+#include "TestHarness.h"
+
+using namespace ImagingEffects;
+using namespace ImagingEffectsTests;
+
+namespace
+{
+	// True if the bands cover [top, bottom) in order, without gaps or
+	// overlaps, none is empty, and every boundary inside is aligned.
+	bool BandsCover(const std::vector<FrameBand> &bands, uint32_t top, uint32_t bottom, uint32_t rowAlign)
+	{
+		uint32_t row = top;
+		for (size_t i = 0; i < bands.size(); i++)
+		{
+			if (bands[i].top != row || bands[i].bottom <= bands[i].top)
+			{
+				return false;
+			}
+			if (bands[i].bottom != bottom && (bands[i].bottom - top) % rowAlign != 0)
+			{
+				return false;
+			}
+			row = bands[i].bottom;
+		}
+		return row == bottom;
+	}
+
+	std::vector<NativeFilter> MakeEveryFilter()
+	{
+		uint8_t curve[256];
+		for (int i = 0; i < 256; i++)
+		{
+			curve[i] = (uint8_t)(255 - i);
+		}
+
+		std::vector<NativeFilter> filters;
+		filters.push_back(MakeBrightnessContrastSaturationFilter(-0.1f, 1.5f, 1.3f));
+		filters.push_back(MakeCurvesFilter(curve, nullptr, curve));
+		filters.push_back(MakeSepiaFilter(0.3f));
+		filters.push_back(MakeVignetteFilter(0.3f, 0.9f));
+		filters.push_back(MakeGrayscaleFilter());
+		return filters;
+	}
+}
+
+TEST(SplitsIntoAlignedBands)
+{
+	std::vector<FrameBand> bands;
+	for (uint32_t cRows = 1; cRows <= 70; cRows++)
+	{
+		for (size_t cBands = 1; cBands <= 12; cBands++)
+		{
+			for (uint32_t rowAlign = 1; rowAlign <= 2; rowAlign++)
+			{
+				const size_t cSplit = SplitIntoBands(4, 4 + cRows, cBands, rowAlign, &bands);
+				CHECK_EQUAL(cSplit, bands.size());
+				CHECK(cSplit >= 1 && cSplit <= cBands);
+				CHECK(BandsCover(bands, 4, 4 + cRows, rowAlign));
+			}
+		}
+	}
+}
+
+TEST(SpreadsRowsEvenly)
+{
+	std::vector<FrameBand> bands;
+	SplitIntoBands(0, 1080, 16, 2, &bands);
+	CHECK_EQUAL(bands.size(), 16u);
+	for (size_t i = 0; i < bands.size(); i++)
+	{
+		const uint32_t cRows = bands[i].bottom - bands[i].top;
+		CHECK(cRows == 66 || cRows == 68);
+	}
+}
+
+TEST(SplitsEmptyRangesIntoNothing)
+{
+	std::vector<FrameBand> bands(3);
+	CHECK_EQUAL(SplitIntoBands(10, 10, 4, 2, &bands), 0u);
+	CHECK(bands.empty());
+	CHECK_EQUAL(SplitIntoBands(0, 5, 0, 0, &bands), 1u);
+	CHECK(BandsCover(bands, 0, 5, 1));
+}
+
+TEST(BandsMatchASingleBand)
+{
+	const PixelFormat formats[] = { PixelFormat_NV12, PixelFormat_YUY2 };
+	const uint32_t heights[] = { 1, 2, 31, 97, 240 };
+	ThreadPool pool(4);
+
+	for (size_t iFormat = 0; iFormat < sizeof(formats) / sizeof(formats[0]); iFormat++)
+	{
+		for (size_t iHeight = 0; iHeight < sizeof(heights) / sizeof(heights[0]); iHeight++)
+		{
+			const StreamFormat format = MakeStreamFormat(formats[iFormat], 174, heights[iHeight]);
+			FrameRenderer single(format, MakeEveryFilter(), std::vector<NativeFilter>(), 1);
+			FrameRenderer banded(format, MakeEveryFilter(), std::vector<NativeFilter>(), 13);
+			CHECK(banded.GetBands().size() > 1 || heights[iHeight] <= 2);
+
+			TestFrame src(format.pixelFormat, format.width, format.height, 0, false, 11);
+			TestFrame expected(format.pixelFormat, format.width, format.height, 0, false, 12);
+			TestFrame actual(format.pixelFormat, format.width, format.height, 0, false, 13);
+
+			single.Render(FrameAction_Process, expected.Get(), src.Get(), RunSerially);
+			banded.Render(FrameAction_Process, actual.Get(), src.Get(), pool.GetParallelFor());
+			CHECK(FramesEqual(actual.Get(), expected.Get()));
+
+			// Copies too, for actions without a chain.
+			banded.Render(FrameAction_PassThrough, actual.Get(), src.Get(), pool.GetParallelFor());
+			CHECK(FramesEqual(actual.Get(), src.Get()));
+		}
+	}
+}
+
+int main()
+{
+	return RunTests();
+}
@@ -0,0 +1,207 @@
+// Tests of frames stored in several buffers, as in a sample with one buffer
+// per plane: the supported layouts are wrapped where they lie, each plane
+// with its own stride, and render as the same frame in one buffer does;
+// every other layout is refused, so that the caller copies it.
+
+#include "FrameRenderer.h"
+#include "VideoFrame.h"
+
+#include "TestFrames.h"
+#include "TestHarness.h"
+
+using namespace ImagingEffects;
+using namespace ImagingEffectsTests;
+
+namespace
+{
+	// FakeSample class:
+	// A sample holding each plane of a frame in a buffer of its own.
+
+	class FakeSample
+	{
+	public:
+		// strides gives the pitch of each plane's rows; a negative pitch
+		// stores that plane bottom-up.
+		FakeSample(PixelFormat format, uint32_t width, uint32_t height, const ptrdiff_t *strides, uint32_t seed)
+			: m_cBuffers(0)
+		{
+			PlaneShape shapes[3];
+			m_cBuffers = GetPlaneShapes(format, width, height, 0, shapes);
+
+			uint32_t state = seed * 2654435761u + 1;
+			for (uint32_t i = 0; i < m_cBuffers; i++)
+			{
+				const size_t cbPitch = (size_t)(strides[i] < 0 ? -strides[i] : strides[i]);
+				m_buffers[i].resize(cbPitch * shapes[i].cRows);
+				for (size_t cb = 0; cb < m_buffers[i].size(); cb++)
+				{
+					state = state * 1664525u + 1013904223u;
+					m_buffers[i][cb] = (uint8_t)(state >> 24);
+				}
+
+				m_views[i].pTopRow = (strides[i] < 0) ? &m_buffers[i][cbPitch * (shapes[i].cRows - 1)] : &m_buffers[i][0];
+				m_views[i].stride = strides[i];
+				m_views[i].pBufferStart = &m_buffers[i][0];
+				m_views[i].cbBuffer = m_buffers[i].size();
+			}
+		}
+
+		BufferView* GetViews() { return m_views; }
+		uint32_t GetBufferCount() const { return m_cBuffers; }
+
+		// True if the frame's planes are this sample's buffers, not a copy.
+		bool IsWrappedInPlace(const VideoFrame &frame) const
+		{
+			if (frame.cPlanes != m_cBuffers)
+			{
+				return false;
+			}
+			for (uint32_t i = 0; i < m_cBuffers; i++)
+			{
+				if (frame.planes[i].pData != m_views[i].pTopRow || frame.planes[i].stride != m_views[i].stride)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+	private:
+		FakeSample(const FakeSample&);
+		FakeSample& operator=(const FakeSample&);
+
+		std::vector<uint8_t> m_buffers[3];
+		BufferView m_views[3];
+		uint32_t m_cBuffers;
+	};
+
+	// Copies a frame into one buffer, at the minimum stride.
+	void CopyToFrame(const VideoFrame &src, const TestFrame &dst)
+	{
+		ConvertVideoFrame(src, dst.Get(), 0, src.height);
+	}
+}
+
+TEST(PlaneBuffersAreWrappedInPlace)
+{
+	const ptrdiff_t nv12Strides[] = { 192, 256 };
+	FakeSample nv12(PixelFormat_NV12, 175, 33, nv12Strides, 1);
+	VideoFrame frame;
+	CHECK(WrapVideoFrameBuffers(PixelFormat_NV12, 175, 33, nv12.GetViews(), nv12.GetBufferCount(), &frame));
+	CHECK(nv12.IsWrappedInPlace(frame));
+	CHECK(IsTopDown(frame));
+
+	const ptrdiff_t i420Strides[] = { 176, -96, 128 };
+	FakeSample i420(PixelFormat_I420, 175, 33, i420Strides, 2);
+	CHECK(WrapVideoFrameBuffers(PixelFormat_I420, 175, 33, i420.GetViews(), i420.GetBufferCount(), &frame));
+	CHECK(i420.IsWrappedInPlace(frame));
+	CHECK(!IsTopDown(frame));
+}
+
+TEST(PlaneBuffersHoldTheSameFrame)
+{
+	const PixelFormat formats[] = { PixelFormat_NV12, PixelFormat_I420 };
+	const ptrdiff_t strides[] = { 320, -320, 192 };
+
+	// Each plane of the wrapped frame is the plane of its buffer: copying
+	// it out and back in changes nothing.
+	for (size_t iFormat = 0; iFormat < 2; iFormat++)
+	{
+		FakeSample sample(formats[iFormat], 300, 20, strides, 3);
+		VideoFrame frame;
+		CHECK(WrapVideoFrameBuffers(formats[iFormat], 300, 20, sample.GetViews(), sample.GetBufferCount(), &frame));
+
+		TestFrame copy(formats[iFormat], 300, 20, 0, false, 4);
+		CopyToFrame(frame, copy);
+		CHECK(FramesEqual(copy.Get(), frame));
+
+		FakeSample other(formats[iFormat], 300, 20, strides, 5);
+		VideoFrame otherFrame;
+		CHECK(WrapVideoFrameBuffers(formats[iFormat], 300, 20, other.GetViews(), other.GetBufferCount(), &otherFrame));
+		ConvertVideoFrame(copy.Get(), otherFrame, 0, 20);
+		CHECK(FramesEqual(otherFrame, frame));
+	}
+}
+
+TEST(RendersAsOneBufferDoes)
+{
+	const StreamFormat format = MakeStreamFormat(PixelFormat_NV12, 256, 64);
+	std::vector<NativeFilter> filters;
+	filters.push_back(MakeBrightnessContrastSaturationFilter(0.1f, 1.2f, 0.8f));
+	filters.push_back(MakeVignetteFilter(0.4f, 0.8f));
+	FrameRenderer renderer(format, filters, std::vector<NativeFilter>(), 4);
+
+	const ptrdiff_t srcStrides[] = { 256, 320 };
+	const ptrdiff_t dstStrides[] = { -384, 256 };
+	FakeSample src(PixelFormat_NV12, 256, 64, srcStrides, 6);
+	FakeSample dst(PixelFormat_NV12, 256, 64, dstStrides, 7);
+	VideoFrame srcFrame;
+	VideoFrame dstFrame;
+	CHECK(WrapVideoFrameBuffers(PixelFormat_NV12, 256, 64, src.GetViews(), src.GetBufferCount(), &srcFrame));
+	CHECK(WrapVideoFrameBuffers(PixelFormat_NV12, 256, 64, dst.GetViews(), dst.GetBufferCount(), &dstFrame));
+
+	TestFrame contiguousSrc(PixelFormat_NV12, 256, 64, 0, false, 8);
+	TestFrame expected(PixelFormat_NV12, 256, 64, 0, false, 9);
+	CopyToFrame(srcFrame, contiguousSrc);
+
+	renderer.Render(FrameAction_Process, expected.Get(), contiguousSrc.Get(), RunSerially);
+	renderer.Render(FrameAction_Process, dstFrame, srcFrame, RunSerially);
+	CHECK(FramesEqual(dstFrame, expected.Get()));
+
+	// In place, over the sample's own buffers.
+	renderer.Render(FrameAction_Process, srcFrame, srcFrame, RunSerially);
+	CHECK(FramesEqual(srcFrame, expected.Get()));
+}
+
+TEST(OtherLayoutsAreRefused)
+{
+	const ptrdiff_t strides[] = { 128, 128, 64 };
+	FakeSample nv12(PixelFormat_NV12, 128, 16, strides, 10);
+	FakeSample i420(PixelFormat_I420, 128, 16, strides, 11);
+	VideoFrame frame;
+
+	// Not one buffer per plane.
+	CHECK(!WrapVideoFrameBuffers(PixelFormat_YUY2, 64, 16, nv12.GetViews(), 2, &frame));
+	CHECK(!WrapVideoFrameBuffers(PixelFormat_NV12, 128, 16, i420.GetViews(), 3, &frame));
+	CHECK(!WrapVideoFrameBuffers(PixelFormat_I420, 128, 16, i420.GetViews(), 2, &frame));
+	CHECK(!WrapVideoFrameBuffers(PixelFormat_NV12, 128, 16, nullptr, 2, &frame));
+	CHECK(!WrapVideoFrameBuffers(PixelFormat_NV12, 0, 16, nv12.GetViews(), 2, &frame));
+
+	// A plane that does not fit its buffer, or rows shorter than the plane's.
+	CHECK(!WrapVideoFrameBuffers(PixelFormat_NV12, 128, 18, nv12.GetViews(), 2, &frame));
+	CHECK(!WrapVideoFrameBuffers(PixelFormat_I420, 130, 16, i420.GetViews(), 3, &frame));
+
+	BufferView views[2] = { nv12.GetViews()[0], nv12.GetViews()[1] };
+	views[1].pTopRow += 1;
+	CHECK(!WrapVideoFrameBuffers(PixelFormat_NV12, 128, 16, views, 2, &frame));
+	views[1] = nv12.GetViews()[1];
+	views[1].stride = 100;
+	CHECK(!WrapVideoFrameBuffers(PixelFormat_NV12, 128, 16, views, 2, &frame));
+	views[1] = nv12.GetViews()[1];
+	views[1].pTopRow = nullptr;
+	CHECK(!WrapVideoFrameBuffers(PixelFormat_NV12, 128, 16, views, 2, &frame));
+
+	// Without the buffer bounds, only the strides can be checked.
+	views[1] = nv12.GetViews()[1];
+	views[0].pBufferStart = nullptr;
+	views[1].pBufferStart = nullptr;
+	CHECK(WrapVideoFrameBuffers(PixelFormat_NV12, 128, 16, views, 2, &frame));
+}
+
+TEST(OneBufferIsWrappedAsAWholeFrame)
+{
+	TestFrame whole(PixelFormat_NV12, 100, 10, 128, true, 12);
+	const VideoFrame &expected = whole.Get();
+	BufferView view = { expected.planes[0].pData, expected.planes[0].stride, &whole.GetBuffer()[0], whole.GetBuffer().size() };
+
+	VideoFrame frame;
+	CHECK(WrapVideoFrameBuffers(PixelFormat_NV12, 100, 10, &view, 1, &frame));
+	CHECK_EQUAL(frame.cPlanes, 2u);
+	CHECK(frame.planes[1].pData == expected.planes[1].pData);
+	CHECK_EQUAL(frame.planes[1].stride, expected.planes[1].stride);
+}
+
+int main()
+{
+	return RunTests();
+}
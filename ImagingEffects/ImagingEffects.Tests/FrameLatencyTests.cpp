@@ -0,0 +1,206 @@
+// Tests of the latency histograms: every value falls in a bucket whose
+// upper bound is at most 1/32 above it, percentiles of known distributions
+// are reported within that bound and never below the true value, windows
+// forget old frames, and no value is lost when threads record at once.
+
+#include "FrameLatency.h"
+
+#include "TestHarness.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <random>
+#include <thread>
+
+using namespace ImagingEffects;
+
+namespace
+{
+	// The largest error a bucket allows: its width is 1/32 of its lowest value.
+	bool IsWithinBound(uint64_t reported, uint64_t value)
+	{
+		return reported >= value && reported - value <= value / 32;
+	}
+
+	// The true percentile of sorted values, with the histogram's rank rule.
+	uint64_t GetTruePercentile(const std::vector<uint64_t> &sorted, double q)
+	{
+		size_t rank = (size_t)ceil(q * (double)sorted.size());
+		rank = (std::max)(rank, (size_t)1);
+		return sorted[(std::min)(rank, sorted.size()) - 1];
+	}
+
+	// Records the values, then checks the percentiles read back.
+	bool PercentilesMatch(std::vector<uint64_t> values)
+	{
+		LatencyHistogram histogram;
+		for (size_t i = 0; i < values.size(); i++)
+		{
+			histogram.Record(values[i]);
+		}
+		std::sort(values.begin(), values.end());
+
+		std::vector<uint64_t> counts(LATENCY_BUCKET_COUNT);
+		histogram.CopyCounts(counts.data());
+
+		const double quantiles[] = { 0.5, 0.9, 0.99, 0.999, 1.0 };
+		for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++)
+		{
+			const uint64_t reported = LatencyHistogram::GetPercentile(counts.data(), values.size(), quantiles[i]);
+			if (!IsWithinBound(reported, GetTruePercentile(values, quantiles[i])))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void RecordFrames(FrameLatencyStats *pStats, uint32_t cFrames, uint64_t ns)
+	{
+		uint64_t stageNs[FrameStage_Count];
+		for (int stage = 0; stage < FrameStage_Count; stage++)
+		{
+			stageNs[stage] = ns;
+		}
+		for (uint32_t i = 0; i < cFrames; i++)
+		{
+			pStats->RecordFrame(stageNs);
+		}
+	}
+}
+
+TEST(SmallValuesAreExact)
+{
+	for (uint64_t ns = 0; ns < 32; ns++)
+	{
+		CHECK_EQUAL(LatencyHistogram::GetBucketUpperBound(LatencyHistogram::GetBucket(ns)), ns);
+	}
+}
+
+TEST(BucketsAreAtMostAThirtySecondWide)
+{
+	// Each bucket starts right after the one before, up to the last.
+	for (uint32_t iBucket = 0; iBucket < LATENCY_BUCKET_COUNT - 1; iBucket++)
+	{
+		const uint64_t upper = LatencyHistogram::GetBucketUpperBound(iBucket);
+		CHECK_EQUAL(LatencyHistogram::GetBucket(upper), iBucket);
+		CHECK_EQUAL(LatencyHistogram::GetBucket(upper + 1), iBucket + 1);
+		CHECK(iBucket == 0 || upper > LatencyHistogram::GetBucketUpperBound(iBucket - 1));
+	}
+
+	std::mt19937_64 random(1);
+	for (int i = 0; i < 100000; i++)
+	{
+		// Spread over every power of two up to a minute.
+		const uint64_t ns = random() >> (28 + random() % 36);
+		if (ns >= 60000000000ull)
+		{
+			continue;
+		}
+		const uint32_t iBucket = LatencyHistogram::GetBucket(ns);
+		CHECK(IsWithinBound(LatencyHistogram::GetBucketUpperBound(iBucket), ns));
+	}
+
+	// Longer values land in the last bucket.
+	CHECK_EQUAL(LatencyHistogram::GetBucket(~0ull), LATENCY_BUCKET_COUNT - 1);
+}
+
+TEST(PercentilesOfKnownDistributions)
+{
+	std::vector<uint64_t> uniform;
+	for (uint64_t i = 1; i <= 100000; i++)
+	{
+		uniform.push_back(i * 1000);
+	}
+	CHECK(PercentilesMatch(uniform));
+
+	// Frame times: mostly around 8 ms, with a long exponential tail.
+	std::mt19937 random(2);
+	std::normal_distribution<double> body(8000000.0, 500000.0);
+	std::exponential_distribution<double> tail(1.0 / 20000000.0);
+	std::vector<uint64_t> frames;
+	for (int i = 0; i < 100000; i++)
+	{
+		const double ns = (i % 50 == 0) ? 8000000.0 + tail(random) : body(random);
+		frames.push_back((uint64_t)(std::max)(ns, 1.0));
+	}
+	CHECK(PercentilesMatch(frames));
+
+	// One value, many times.
+	CHECK(PercentilesMatch(std::vector<uint64_t>(1000, 16666667)));
+}
+
+TEST(NoValuesGiveZero)
+{
+	std::vector<uint64_t> counts(LATENCY_BUCKET_COUNT, 0);
+	CHECK_EQUAL(LatencyHistogram::GetPercentile(counts.data(), 0, 0.5), 0u);
+
+	FrameLatencyStats stats(10);
+	LatencySummary summaries[FrameStage_Count];
+	stats.GetSummaries(summaries);
+	CHECK_EQUAL(summaries[FrameStage_Total].cFrames, 0u);
+	CHECK_EQUAL(summaries[FrameStage_Total].p999, 0u);
+}
+
+TEST(WindowsForgetOldFrames)
+{
+	FrameLatencyStats stats(100);
+	LatencySummary summaries[FrameStage_Count];
+
+	RecordFrames(&stats, 100, 1000000);
+	stats.GetSummaries(summaries);
+	CHECK_EQUAL(summaries[FrameStage_Render].cFrames, 100u);
+	CHECK(IsWithinBound(summaries[FrameStage_Render].p50, 1000000));
+
+	// The first window is closed; once the second is full, the first goes.
+	RecordFrames(&stats, 100, 5000000);
+	stats.GetSummaries(summaries);
+	CHECK_EQUAL(summaries[FrameStage_Render].cFrames, 100u);
+	CHECK(IsWithinBound(summaries[FrameStage_Render].p50, 5000000));
+
+	// A window that is not full yet adds to the closed one.
+	RecordFrames(&stats, 50, 2000000);
+	stats.GetSummaries(summaries);
+	CHECK_EQUAL(summaries[FrameStage_Render].cFrames, 150u);
+	CHECK(IsWithinBound(summaries[FrameStage_Render].p50, 5000000));
+	CHECK(IsWithinBound(summaries[FrameStage_Total].p999, 5000000));
+}
+
+TEST(ThreadsRecordingAtOnce)
+{
+	const int THREAD_COUNT = 4;
+	const uint32_t FRAMES_PER_THREAD = 100000;
+	FrameLatencyStats stats(THREAD_COUNT * FRAMES_PER_THREAD);
+
+	std::vector<std::thread> threads;
+	for (int iThread = 0; iThread < THREAD_COUNT; iThread++)
+	{
+		threads.push_back(std::thread([&stats, iThread]()
+		{
+			RecordFrames(&stats, FRAMES_PER_THREAD, 1000 * (iThread + 1));
+		}));
+	}
+
+	// Reading meanwhile is allowed.
+	LatencySummary summaries[FrameStage_Count];
+	stats.GetSummaries(summaries);
+
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+
+	stats.GetSummaries(summaries);
+	for (int stage = 0; stage < FrameStage_Count; stage++)
+	{
+		CHECK_EQUAL(summaries[stage].cFrames, (uint64_t)(THREAD_COUNT * FRAMES_PER_THREAD));
+		CHECK(IsWithinBound(summaries[stage].p50, 2000));
+		CHECK(IsWithinBound(summaries[stage].p999, 4000));
+	}
+}
+
+int main()
+{
+	return RunTests();
+}
@@ -0,0 +1,235 @@
+// Tests of the pool of output frames: buffers are aligned and reused, the
+// pool grows only when every buffer is in use and remembers how many were,
+// buffers of an old frame size are freed rather than kept, and every buffer
+// is freed in the end. Threads sharing the pool never get the same buffer.
+
+#include "FramePool.h"
+
+#include "TestHarness.h"
+
+#include <string.h>
+#include <thread>
+#include <vector>
+
+using namespace ImagingEffects;
+
+namespace
+{
+	bool IsAligned(const uint8_t *pData)
+	{
+		return ((uintptr_t)pData % FRAME_POOL_ALIGNMENT) == 0;
+	}
+}
+
+TEST(StridesArePaddedToTheAlignment)
+{
+	CHECK_EQUAL(GetPaddedStride(0), 0u);
+	CHECK_EQUAL(GetPaddedStride(1), 64u);
+	CHECK_EQUAL(GetPaddedStride(64), 64u);
+	CHECK_EQUAL(GetPaddedStride(65), 128u);
+	CHECK_EQUAL(GetPaddedStride(1280), 1280u);
+	CHECK_EQUAL(GetPaddedStride(1281 * 2), 2624u);
+}
+
+TEST(BuffersAreAligned)
+{
+	FramePool pool;
+	std::vector<uint8_t*> buffers;
+	for (size_t cbFrame = 1; cbFrame < 300; cbFrame += 7)
+	{
+		pool.SetFrameSize(cbFrame);
+		uint8_t *pData = pool.Acquire();
+		CHECK(pData != nullptr && IsAligned(pData));
+
+		// The whole frame is usable.
+		memset(pData, 0xAB, cbFrame);
+		buffers.push_back(pData);
+	}
+
+	for (size_t i = 0; i < buffers.size(); i++)
+	{
+		pool.Release(buffers[i]);
+	}
+
+	// Only the buffer of the current size is kept.
+	const FramePoolStats stats = pool.GetStats();
+	CHECK_EQUAL(stats.cAllocated, 1u);
+	CHECK_EQUAL(stats.cIdle, 1u);
+}
+
+TEST(ReleasedBuffersAreReused)
+{
+	FramePool pool;
+	pool.SetFrameSize(640 * 480 * 2);
+
+	uint8_t *pFirst = pool.Acquire();
+	pool.Release(pFirst);
+	for (int i = 0; i < 100; i++)
+	{
+		uint8_t *pData = pool.Acquire();
+		CHECK(pData == pFirst);
+		pool.Release(pData);
+	}
+
+	const FramePoolStats stats = pool.GetStats();
+	CHECK_EQUAL(stats.cAllocated, 1u);
+	CHECK_EQUAL(stats.cIdle, 1u);
+	CHECK_EQUAL(stats.cHighWater, 1u);
+}
+
+TEST(GrowsOnlyWhenEveryBufferIsInUse)
+{
+	FramePool pool;
+	pool.SetFrameSize(4096);
+
+	uint8_t *buffers[3];
+	for (int i = 0; i < 3; i++)
+	{
+		buffers[i] = pool.Acquire();
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		pool.Release(buffers[i]);
+	}
+
+	// Two at a time from now on: no more buffers, and the mark stays.
+	for (int round = 0; round < 10; round++)
+	{
+		uint8_t *pA = pool.Acquire();
+		uint8_t *pB = pool.Acquire();
+		CHECK(pA != pB);
+		pool.Release(pB);
+		pool.Release(pA);
+	}
+
+	FramePoolStats stats = pool.GetStats();
+	CHECK_EQUAL(stats.cAllocated, 3u);
+	CHECK_EQUAL(stats.cHighWater, 3u);
+
+	// Trimming frees the idle buffers and leaves those in use.
+	uint8_t *pInUse = pool.Acquire();
+	pool.Trim();
+	stats = pool.GetStats();
+	CHECK_EQUAL(stats.cAllocated, 1u);
+	CHECK_EQUAL(stats.cIdle, 0u);
+
+	pool.Release(pInUse);
+	pool.Trim();
+	CHECK_EQUAL(pool.GetStats().cAllocated, 0u);
+}
+
+TEST(ReservedBuffersAreHandedOutFirst)
+{
+	FramePool pool;
+	pool.SetFrameSize(512);
+	CHECK(pool.Reserve(3));
+	FramePoolStats stats = pool.GetStats();
+	CHECK_EQUAL(stats.cAllocated, 3u);
+	CHECK_EQUAL(stats.cIdle, 3u);
+	CHECK_EQUAL(stats.cHighWater, 0u);
+
+	uint8_t *buffers[3];
+	for (int i = 0; i < 3; i++)
+	{
+		buffers[i] = pool.Acquire();
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		pool.Release(buffers[i]);
+	}
+	stats = pool.GetStats();
+	CHECK_EQUAL(stats.cAllocated, 3u);
+	CHECK_EQUAL(stats.cHighWater, 3u);
+
+	// Buffers that exist count toward the reservation.
+	CHECK(pool.Reserve(2));
+	CHECK_EQUAL(pool.GetStats().cAllocated, 3u);
+}
+
+TEST(BuffersOfAnOldSizeAreFreed)
+{
+	FramePool pool;
+	pool.SetFrameSize(1000);
+	uint8_t *pOld = pool.Acquire();
+	pool.Release(pool.Acquire());
+	CHECK_EQUAL(pool.GetStats().cAllocated, 2u);
+
+	// The idle buffer goes right away, the one in use when it comes back.
+	pool.SetFrameSize(2000);
+	CHECK_EQUAL(pool.GetStats().cAllocated, 1u);
+	pool.Release(pOld);
+	FramePoolStats stats = pool.GetStats();
+	CHECK_EQUAL(stats.cAllocated, 0u);
+	CHECK_EQUAL(stats.cIdle, 0u);
+
+	uint8_t *pNew = pool.Acquire();
+	memset(pNew, 0, 2000);
+	pool.Release(pNew);
+	stats = pool.GetStats();
+	CHECK_EQUAL(stats.cbFrame, 2000u);
+	CHECK_EQUAL(stats.cAllocated, 1u);
+
+	// Setting the same size again keeps it.
+	pool.SetFrameSize(2000);
+	CHECK_EQUAL(pool.GetStats().cIdle, 1u);
+}
+
+TEST(ThreadsNeverShareABuffer)
+{
+	const int THREAD_COUNT = 4;
+	const int ROUNDS = 20000;
+	const size_t FRAME_SIZE = 256;
+	FramePool pool;
+	pool.SetFrameSize(FRAME_SIZE);
+
+	std::vector<int> cErrors(THREAD_COUNT, 0);
+	std::vector<std::thread> threads;
+	for (int iThread = 0; iThread < THREAD_COUNT; iThread++)
+	{
+		threads.push_back(std::thread([&pool, &cErrors, iThread]()
+		{
+			// Mark the buffer while holding it; another owner would change it.
+			for (int i = 0; i < ROUNDS; i++)
+			{
+				uint8_t *pData = pool.Acquire();
+				if (pData == nullptr || !IsAligned(pData))
+				{
+					cErrors[iThread]++;
+					continue;
+				}
+
+				memset(pData, iThread, FRAME_SIZE);
+				std::this_thread::yield();
+				for (size_t cb = 0; cb < FRAME_SIZE; cb++)
+				{
+					if (pData[cb] != iThread)
+					{
+						cErrors[iThread]++;
+						break;
+					}
+				}
+				pool.Release(pData);
+			}
+		}));
+	}
+
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+
+	for (int iThread = 0; iThread < THREAD_COUNT; iThread++)
+	{
+		CHECK_EQUAL(cErrors[iThread], 0);
+	}
+
+	const FramePoolStats stats = pool.GetStats();
+	CHECK(stats.cHighWater >= 1 && stats.cHighWater <= (size_t)THREAD_COUNT);
+	CHECK_EQUAL(stats.cAllocated, stats.cIdle);
+	CHECK_EQUAL(stats.cAllocated, stats.cHighWater);
+}
+
+int main()
+{
+	return RunTests();
+}
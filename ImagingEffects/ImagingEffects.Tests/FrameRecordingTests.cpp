@@ -0,0 +1,623 @@
+// Tests of recordings of effect input. A recording read back gives the
+// frames, their times and the configurations in the order they were
+// written, whatever the layout of the frames in memory, and skips records
+// of kinds it does not know. Replayed through the effect engine, as
+// effectreplay does, a fixed recording renders the same frames with every
+// instruction set and thread count, and their hashes match golden values.
+// A recording cut anywhere, or with a damaged record, is refused where the
+// damage is; the records before it are read.
+//
+// The replay recording and its hashes are left in the working directory
+// for the effectreplay test, which checks the tool against them.
+
+#include "EffectEngine.h"
+#include "FormatConversion.h"
+#include "FrameRecording.h"
+#include "ThreadPool.h"
+
+#include "TestFrames.h"
+#include "TestHarness.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace ImagingEffects;
+using namespace ImagingEffectsTests;
+
+namespace
+{
+	const ConversionIsa s_isas[] = { ConversionIsa_Scalar, ConversionIsa_SSE2, ConversionIsa_AVX2, ConversionIsa_NEON };
+
+	const char *const REPLAY_PATH = "framerecordingtests-replay.rec";
+	const char *const REPLAY_HASHES_PATH = "framerecordingtests-replay.txt";
+	const char *const SCRATCH_PATH = "framerecordingtests-scratch.rec";
+
+	// The hashes of the frames of the replay recording, rendered. A change
+	// to what a filter renders changes them; check the new output before
+	// updating them.
+	const uint64_t s_goldenHashes[] =
+	{
+		0x2711582c02625805ull,
+		0x4557840b139aa0beull,
+		0x5ed6dd4f4acf6b08ull,
+		0x2ba8ce4c00fefc8dull,
+		0x378cc025d6dfad93ull,
+		0x4f49f9e7392454d7ull,
+	};
+
+	// Runs fn once with each instruction set the processor supports, then
+	// restores the one that was in use.
+	template <class Fn>
+	void ForEachIsa(Fn fn)
+	{
+		const ConversionIsa original = GetConversionIsa();
+		for (size_t i = 0; i < sizeof(s_isas) / sizeof(s_isas[0]); i++)
+		{
+			if (SetConversionIsa(s_isas[i]))
+			{
+				fn(s_isas[i]);
+			}
+		}
+		SetConversionIsa(original);
+	}
+
+	std::vector<uint8_t> ReadFileBytes(const char *pszPath)
+	{
+		std::vector<uint8_t> bytes;
+		FILE *pFile = fopen(pszPath, "rb");
+		if (pFile != nullptr)
+		{
+			uint8_t buffer[4096];
+			size_t cb;
+			while ((cb = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+			{
+				bytes.insert(bytes.end(), buffer, buffer + cb);
+			}
+			fclose(pFile);
+		}
+		return bytes;
+	}
+
+	void WriteFileBytes(const char *pszPath, const std::vector<uint8_t> &bytes, size_t cb)
+	{
+		FILE *pFile = fopen(pszPath, "wb");
+		if (pFile != nullptr)
+		{
+			if (cb > 0)
+			{
+				fwrite(&bytes[0], 1, cb, pFile);
+			}
+			fclose(pFile);
+		}
+	}
+
+	// Where each record of a recording ends, from the sizes in their headers.
+	std::vector<size_t> GetRecordEnds(const std::vector<uint8_t> &bytes)
+	{
+		std::vector<size_t> ends;
+		size_t pos = 8;
+		while (pos + 5 <= bytes.size())
+		{
+			const uint32_t cbPayload = (uint32_t)bytes[pos + 1] | ((uint32_t)bytes[pos + 2] << 8) |
+				((uint32_t)bytes[pos + 3] << 16) | ((uint32_t)bytes[pos + 4] << 24);
+			pos += 5 + cbPayload;
+			ends.push_back(pos);
+		}
+		return ends;
+	}
+
+	void Put32(std::vector<uint8_t> *pBytes, size_t pos, uint32_t value)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			(*pBytes)[pos + i] = (uint8_t)(value >> (8 * i));
+		}
+	}
+
+	// What reading a whole recording gave.
+	struct ReadOutcome
+	{
+		bool fOpened;
+		bool fAtEnd;                // Every record was read.
+		uint32_t cRecords;
+		uint32_t cFrames;
+	};
+
+	ReadOutcome ReadRecording(const char *pszPath)
+	{
+		ReadOutcome outcome = {};
+		FrameRecordReader reader;
+		outcome.fOpened = reader.Open(fopen(pszPath, "rb"));
+		if (outcome.fOpened)
+		{
+			RecordKind kind;
+			while (reader.ReadNext(&kind))
+			{
+				outcome.cRecords++;
+				outcome.cFrames += (kind == RecordKind_Frame);
+			}
+			outcome.fAtEnd = reader.IsAtEnd();
+		}
+		return outcome;
+	}
+
+	ReadOutcome ReadBytes(const std::vector<uint8_t> &bytes)
+	{
+		WriteFileBytes(SCRATCH_PATH, bytes, bytes.size());
+		return ReadRecording(SCRATCH_PATH);
+	}
+
+	bool FiltersEqual(const NativeFilter &a, const NativeFilter &b)
+	{
+		if (a.type != b.type)
+		{
+			return false;
+		}
+
+		switch (a.type)
+		{
+		case NativeFilter_Sepia:
+			return a.intensity == b.intensity;
+
+		case NativeFilter_BrightnessContrastSaturation:
+			return a.brightness == b.brightness && a.contrast == b.contrast && a.saturation == b.saturation;
+
+		case NativeFilter_Curves:
+			return memcmp(a.curves, b.curves, sizeof(a.curves)) == 0;
+
+		case NativeFilter_Vignette:
+			return a.radius == b.radius && a.strength == b.strength;
+
+		case NativeFilter_Lut3D:
+			return a.cube && b.cube && a.cube->GetSize() == b.cube->GetSize() && a.cube->GetRgb() == b.cube->GetRgb();
+
+		default:
+			return true;
+		}
+	}
+
+	bool FilterListsEqual(const std::vector<NativeFilter> &a, const std::vector<NativeFilter> &b)
+	{
+		if (a.size() != b.size())
+		{
+			return false;
+		}
+		for (size_t i = 0; i < a.size(); i++)
+		{
+			if (!FiltersEqual(a[i], b[i]))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// A 17-point cube that tints: red up, blue down.
+	std::shared_ptr<ColorCube> MakeTintCube()
+	{
+		const uint32_t size = 17;
+		std::vector<float> rgb;
+		for (uint32_t b = 0; b < size; b++)
+		{
+			for (uint32_t g = 0; g < size; g++)
+			{
+				for (uint32_t r = 0; r < size; r++)
+				{
+					rgb.push_back((std::min)(1.0f, r / 16.0f * 1.1f));
+					rgb.push_back(g / 16.0f);
+					rgb.push_back(b / 16.0f * 0.9f);
+				}
+			}
+		}
+		return ColorCube::Create(size, &rgb[0], rgb.size());
+	}
+
+	std::vector<uint8_t> MakeCurve(int offset)
+	{
+		std::vector<uint8_t> curve(256);
+		for (int i = 0; i < 256; i++)
+		{
+			const int value = 255 - i + offset;
+			curve[i] = (uint8_t)(value < 0 ? 0 : (value > 255 ? 255 : value));
+		}
+		return curve;
+	}
+
+	EffectConfig MakeConfig(bool fLut3D)
+	{
+		const std::vector<uint8_t> curve = MakeCurve(8);
+
+		EffectConfig config;
+		config.filters.push_back(MakeSepiaFilter(0.4f));
+		config.filters.push_back(MakeBrightnessContrastSaturationFilter(0.1f, 1.2f, 0.8f));
+		config.filters.push_back(MakeCurvesFilter(&curve[0], nullptr, &curve[0]));
+		config.filters.push_back(MakeVignetteFilter(0.5f, 0.6f));
+		if (fLut3D)
+		{
+			config.filters.push_back(MakeLut3DFilter(MakeTintCube()));
+		}
+		config.fallbackFilters.push_back(MakeGrayscaleFilter());
+		config.policy = MakeDefaultSchedulerPolicy();
+		config.fHasSdkEffects = false;
+		return config;
+	}
+
+	FrameTiming MakeTiming(uint32_t iFrame)
+	{
+		FrameTiming timing;
+		timing.fHasTime = true;
+		timing.hnsTime = 333333 * (int64_t)iFrame;
+		timing.hnsDuration = 333333;
+		return timing;
+	}
+
+	// Writes the replay recording: NV12 frames with one chain, then with
+	// another, then YUY2 frames. Returns false if a write fails.
+	bool WriteReplayRecording(const char *pszPath)
+	{
+		FrameRecordWriter writer;
+		bool fOk = writer.Open(fopen(pszPath, "wb"));
+
+		const StreamFormat nv12 = MakeStreamFormat(PixelFormat_NV12, 96, 64);
+		const StreamFormat yuy2 = MakeStreamFormat(PixelFormat_YUY2, 64, 32);
+		fOk = fOk && writer.WriteConfig(MakeConfig(false));
+		for (uint32_t i = 0; i < 2; i++)
+		{
+			TestFrame frame(PixelFormat_NV12, nv12.width, nv12.height, 128, false, 10 + i);
+			fOk = fOk && writer.WriteFrame(nv12, MakeTiming(i), frame.Get());
+		}
+
+		fOk = fOk && writer.WriteConfig(MakeConfig(true));
+		for (uint32_t i = 2; i < 4; i++)
+		{
+			TestFrame frame(PixelFormat_NV12, nv12.width, nv12.height, 0, true, 10 + i);
+			fOk = fOk && writer.WriteFrame(nv12, MakeTiming(i), frame.Get());
+		}
+
+		for (uint32_t i = 4; i < 6; i++)
+		{
+			TestFrame frame(PixelFormat_YUY2, yuy2.width, yuy2.height, 0, false, 10 + i);
+			fOk = fOk && writer.WriteFrame(yuy2, MakeTiming(i), frame.Get());
+		}
+
+		return writer.Close() && fOk;
+	}
+
+	// Renders a recording as effectreplay does, with the scheduler off, and
+	// hashes each output frame.
+	bool Replay(const char *pszPath, size_t cThreads, std::vector<uint64_t> *pHashes)
+	{
+		FrameRecordReader reader;
+		if (!reader.Open(fopen(pszPath, "rb")))
+		{
+			return false;
+		}
+
+		ThreadPool pool(cThreads);
+		EffectEngine engine(pool.GetParallelFor());
+		SchedulerPolicy policy = MakeDefaultSchedulerPolicy();
+		policy.fEnabled = false;
+		engine.SetSchedulerPolicy(policy);
+
+		pHashes->clear();
+		std::unique_ptr<TestFrame> spOutput;
+		RecordKind kind;
+		while (reader.ReadNext(&kind))
+		{
+			if (kind == RecordKind_Format)
+			{
+				const StreamFormat &format = reader.GetFormat();
+				if (!engine.SetFormat(format))
+				{
+					return false;
+				}
+				spOutput.reset(new TestFrame(format.pixelFormat, format.width, format.height));
+			}
+			else if (kind == RecordKind_Config)
+			{
+				engine.SetFilters(reader.GetConfig().filters, reader.GetConfig().fallbackFilters);
+			}
+			else if (kind == RecordKind_Frame && spOutput)
+			{
+				FrameAction action;
+				if (!engine.ProcessFrame(reader.GetTiming(), spOutput->Get(), reader.GetFrame(), &action) || action != FrameAction_Process)
+				{
+					return false;
+				}
+				pHashes->push_back(HashVideoFrame(spOutput->Get()));
+			}
+		}
+		return reader.IsAtEnd();
+	}
+
+	// A small recording to damage: a config and two tiny frames.
+	std::vector<uint8_t> MakeSmallRecording()
+	{
+		FrameRecordWriter writer;
+		writer.Open(fopen(SCRATCH_PATH, "wb"));
+		writer.WriteConfig(MakeConfig(false));
+		const StreamFormat format = MakeStreamFormat(PixelFormat_NV12, 16, 8);
+		for (uint32_t i = 0; i < 2; i++)
+		{
+			TestFrame frame(PixelFormat_NV12, format.width, format.height, 0, false, i);
+			writer.WriteFrame(format, MakeTiming(i), frame.Get());
+		}
+		writer.Close();
+		return ReadFileBytes(SCRATCH_PATH);
+	}
+}
+
+TEST(RecordingsReadBackAsWritten)
+{
+	const StreamFormat nv12 = MakeStreamFormat(PixelFormat_NV12, 64, 48);
+	StreamFormat yuy2 = MakeStreamFormat(PixelFormat_YUY2, 32, 16);
+	yuy2.yuvMatrix = YuvMatrix_BT709;
+	yuy2.yuvRange = YuvRange_Full;
+
+	EffectConfig first = MakeConfig(true);
+	first.policy.fEnabled = true;
+	first.policy.hnsMaxLatency = 123456;
+	first.policy.fAllowPassThrough = true;
+	first.policy.fAllowDrop = false;
+	first.policy.cMaxConsecutiveDrops = 7;
+	first.fHasSdkEffects = true;
+	EffectConfig second = MakeConfig(false);
+	second.fallbackFilters.clear();
+
+	// Padded and bottom-up frames are packed top-down.
+	TestFrame padded(PixelFormat_NV12, nv12.width, nv12.height, 80, false, 1);
+	TestFrame bottomUp(PixelFormat_NV12, nv12.width, nv12.height, 0, true, 2);
+	TestFrame packed(PixelFormat_YUY2, yuy2.width, yuy2.height, 0, false, 3);
+	FrameTiming untimed = {};
+
+	FrameRecordWriter writer;
+	CHECK(writer.Open(fopen(SCRATCH_PATH, "wb")));
+	CHECK(writer.WriteConfig(first));
+	CHECK(writer.WriteFrame(nv12, MakeTiming(0), padded.Get()));
+	CHECK(writer.WriteFrame(nv12, MakeTiming(1), bottomUp.Get()));
+	CHECK(writer.WriteConfig(second));
+	CHECK(writer.WriteFrame(yuy2, untimed, packed.Get()));
+
+	// A frame that does not match its format is not written.
+	CHECK(!writer.WriteFrame(nv12, MakeTiming(3), packed.Get()));
+	CHECK_EQUAL(writer.GetFrameCount(), 3u);
+	CHECK(writer.Close());
+
+	FrameRecordReader reader;
+	CHECK(reader.Open(fopen(SCRATCH_PATH, "rb")));
+
+	RecordKind kind = RecordKind_Format;
+	CHECK(reader.ReadNext(&kind) && kind == RecordKind_Config);
+	CHECK(FilterListsEqual(reader.GetConfig().filters, first.filters));
+	CHECK(FilterListsEqual(reader.GetConfig().fallbackFilters, first.fallbackFilters));
+	CHECK(reader.GetConfig().policy.fEnabled);
+	CHECK_EQUAL(reader.GetConfig().policy.hnsMaxLatency, (int64_t)123456);
+	CHECK(reader.GetConfig().policy.fAllowPassThrough);
+	CHECK(!reader.GetConfig().policy.fAllowDrop);
+	CHECK_EQUAL(reader.GetConfig().policy.cMaxConsecutiveDrops, 7u);
+	CHECK(reader.GetConfig().fHasSdkEffects);
+
+	// The format comes before the first frame of it.
+	CHECK(reader.ReadNext(&kind) && kind == RecordKind_Format);
+	CHECK_EQUAL(reader.GetFormat().pixelFormat, PixelFormat_NV12);
+	CHECK_EQUAL(reader.GetFormat().width, nv12.width);
+	CHECK_EQUAL(reader.GetFormat().height, nv12.height);
+	CHECK_EQUAL(reader.GetFormat().yuvMatrix, nv12.yuvMatrix);
+	CHECK_EQUAL(reader.GetFormat().yuvRange, nv12.yuvRange);
+
+	const TestFrame *const nv12Frames[] = { &padded, &bottomUp };
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		CHECK(reader.ReadNext(&kind) && kind == RecordKind_Frame);
+		CHECK(FramesEqual(reader.GetFrame(), nv12Frames[i]->Get()));
+		CHECK(reader.GetTiming().fHasTime);
+		CHECK_EQUAL(reader.GetTiming().hnsTime, MakeTiming(i).hnsTime);
+		CHECK_EQUAL(reader.GetTiming().hnsDuration, MakeTiming(i).hnsDuration);
+		CHECK_EQUAL(HashVideoFrame(reader.GetFrame()), HashVideoFrame(nv12Frames[i]->Get()));
+	}
+
+	CHECK(reader.ReadNext(&kind) && kind == RecordKind_Config);
+	CHECK(FilterListsEqual(reader.GetConfig().filters, second.filters));
+	CHECK(reader.GetConfig().fallbackFilters.empty());
+	CHECK(!reader.GetConfig().fHasSdkEffects);
+
+	CHECK(reader.ReadNext(&kind) && kind == RecordKind_Format);
+	CHECK_EQUAL(reader.GetFormat().pixelFormat, PixelFormat_YUY2);
+	CHECK_EQUAL(reader.GetFormat().yuvMatrix, YuvMatrix_BT709);
+	CHECK_EQUAL(reader.GetFormat().yuvRange, YuvRange_Full);
+
+	CHECK(reader.ReadNext(&kind) && kind == RecordKind_Frame);
+	CHECK(FramesEqual(reader.GetFrame(), packed.Get()));
+	CHECK(!reader.GetTiming().fHasTime);
+
+	CHECK(!reader.ReadNext(&kind));
+	CHECK(reader.IsAtEnd());
+}
+
+TEST(UnknownRecordsAreSkipped)
+{
+	std::vector<uint8_t> bytes = MakeSmallRecording();
+	const ReadOutcome original = ReadBytes(bytes);
+
+	// A record of a kind added later, after the header.
+	const uint8_t unknown[] = { 9, 3, 0, 0, 0, 'a', 'b', 'c' };
+	bytes.insert(bytes.begin() + 8, unknown, unknown + sizeof(unknown));
+	const ReadOutcome outcome = ReadBytes(bytes);
+	CHECK(outcome.fAtEnd);
+	CHECK_EQUAL(outcome.cRecords, original.cRecords);
+	CHECK_EQUAL(outcome.cFrames, 2u);
+}
+
+TEST(ReplaysMatchTheGoldenHashes)
+{
+	CHECK(WriteReplayRecording(REPLAY_PATH));
+
+	std::vector<uint64_t> reference;
+	CHECK(Replay(REPLAY_PATH, 1, &reference));
+	CHECK_EQUAL(reference.size(), (size_t)6);
+
+	// Every instruction set and thread count renders the same frames.
+	ForEachIsa([&](ConversionIsa isa)
+	{
+		const size_t threadCounts[] = { 1, 3 };
+		for (size_t i = 0; i < 2; i++)
+		{
+			std::vector<uint64_t> hashes;
+			CHECK(Replay(REPLAY_PATH, threadCounts[i], &hashes));
+			if (hashes != reference)
+			{
+				printf("  ISA %d on %u threads renders other frames\n", (int)isa, (uint32_t)threadCounts[i]);
+				CHECK(hashes == reference);
+			}
+		}
+	});
+
+	const std::vector<uint64_t> golden(s_goldenHashes, s_goldenHashes + sizeof(s_goldenHashes) / sizeof(s_goldenHashes[0]));
+	if (reference != golden)
+	{
+		for (size_t i = 0; i < reference.size(); i++)
+		{
+			printf("  frame %u: 0x%016llxull\n", (uint32_t)i, (unsigned long long)reference[i]);
+		}
+	}
+	CHECK(reference == golden);
+
+	// For the effectreplay test, as --hashes writes them.
+	FILE *pFile = fopen(REPLAY_HASHES_PATH, "w");
+	CHECK(pFile != nullptr);
+	if (pFile != nullptr)
+	{
+		for (size_t i = 0; i < golden.size(); i++)
+		{
+			fprintf(pFile, "%llu %016llx\n", (unsigned long long)i, (unsigned long long)golden[i]);
+		}
+		fclose(pFile);
+	}
+}
+
+TEST(TruncatedRecordingsAreRefused)
+{
+	const std::vector<uint8_t> bytes = MakeSmallRecording();
+	const std::vector<size_t> ends = GetRecordEnds(bytes);
+	CHECK_EQUAL(ends.size(), (size_t)4);
+	CHECK_EQUAL(ends.back(), bytes.size());
+
+	// Cut at a record boundary, the recording is shorter but whole; cut
+	// anywhere else, the records before the cut are read and the rest is
+	// refused.
+	uint32_t cWrong = 0;
+	for (size_t cb = 0; cb < bytes.size(); cb++)
+	{
+		WriteFileBytes(SCRATCH_PATH, bytes, cb);
+		const ReadOutcome outcome = ReadRecording(SCRATCH_PATH);
+
+		uint32_t cWhole = 0;
+		bool fBoundary = (cb == 8);
+		for (size_t i = 0; i < ends.size(); i++)
+		{
+			cWhole += (ends[i] <= cb);
+			fBoundary |= (ends[i] == cb);
+		}
+
+		const bool fRight = (cb < 8) ? !outcome.fOpened :
+			(outcome.fOpened && outcome.fAtEnd == fBoundary && outcome.cRecords == cWhole);
+		cWrong += !fRight;
+	}
+	CHECK_EQUAL(cWrong, 0u);
+}
+
+TEST(DamagedRecordingsAreRefused)
+{
+	const std::vector<uint8_t> bytes = MakeSmallRecording();
+	const std::vector<size_t> ends = GetRecordEnds(bytes);
+	const size_t configStart = 8;
+	const size_t formatStart = ends[0];
+	const size_t frameStart = ends[1];
+	const size_t firstFilter = configStart + 5 + 16 + 4;
+
+	CHECK(ReadBytes(bytes).fAtEnd);
+
+	std::vector<uint8_t> damaged = bytes;
+	damaged[0] = 'X';
+	CHECK(!ReadBytes(damaged).fOpened);
+
+	damaged = bytes;
+	Put32(&damaged, 4, 2);
+	CHECK(!ReadBytes(damaged).fOpened);
+
+	// A record larger than any recording has.
+	damaged = bytes;
+	Put32(&damaged, configStart + 1, 0xFFFFFFFF);
+	ReadOutcome outcome = ReadBytes(damaged);
+	CHECK(outcome.fOpened && !outcome.fAtEnd && outcome.cRecords == 0);
+
+	// A filter of an unknown type.
+	damaged = bytes;
+	damaged[firstFilter] = 99;
+	outcome = ReadBytes(damaged);
+	CHECK(!outcome.fAtEnd && outcome.cRecords == 0);
+
+	// A pixel format, size or colour space that does not exist.
+	const size_t formatFields[] = { 0, 4, 8, 12, 16 };
+	const uint32_t badValues[] = { 7, 0, 0, 5, 5 };
+	for (size_t i = 0; i < 5; i++)
+	{
+		damaged = bytes;
+		Put32(&damaged, formatStart + 5 + formatFields[i], badValues[i]);
+		outcome = ReadBytes(damaged);
+		CHECK(!outcome.fAtEnd && outcome.cRecords == 1);
+	}
+
+	// A frame of the wrong size for its format.
+	damaged = bytes;
+	Put32(&damaged, frameStart + 1, (uint32_t)(ends[2] - frameStart - 5 - 1));
+	outcome = ReadBytes(damaged);
+	CHECK(!outcome.fAtEnd && outcome.cRecords == 2);
+
+	// A frame before any format.
+	damaged.assign(bytes.begin(), bytes.begin() + 8);
+	damaged.insert(damaged.end(), bytes.begin() + frameStart, bytes.begin() + ends[2]);
+	outcome = ReadBytes(damaged);
+	CHECK(!outcome.fAtEnd && outcome.cRecords == 0);
+
+	// A cube of a size the tables do not come in, or larger than any.
+	std::vector<uint8_t> lut3D;
+	{
+		EffectConfig config = MakeConfig(true);
+		config.filters.erase(config.filters.begin(), config.filters.end() - 1);
+		FrameRecordWriter writer;
+		writer.Open(fopen(SCRATCH_PATH, "wb"));
+		writer.WriteConfig(config);
+		writer.Close();
+		lut3D = ReadFileBytes(SCRATCH_PATH);
+	}
+	CHECK(ReadBytes(lut3D).fAtEnd);
+	const uint32_t badSizes[] = { 16, 66, 0xFFFFFFFF };
+	for (size_t i = 0; i < 3; i++)
+	{
+		damaged = lut3D;
+		Put32(&damaged, firstFilter + 1, badSizes[i]);
+		outcome = ReadBytes(damaged);
+		CHECK(!outcome.fAtEnd && outcome.cRecords == 0);
+	}
+
+	// Any byte flipped: the reader stops or reads on, but reads no more
+	// frames than there were.
+	uint32_t cWrong = 0;
+	for (size_t i = 0; i < bytes.size(); i++)
+	{
+		damaged = bytes;
+		damaged[i] ^= 0xFF;
+		outcome = ReadBytes(damaged);
+		cWrong += (outcome.cFrames > 2);
+	}
+	CHECK_EQUAL(cWrong, 0u);
+
+	remove(SCRATCH_PATH);
+}
+
+int main() { return RunTests(); }
@@ -0,0 +1,238 @@
+// Tests of the frame scheduler, driven by a simulated clock: which action
+// each frame gets for given costs and deadlines, the limit on drops in a
+// row, and that a chain slower than the frame rate no longer makes latency
+// grow once scheduling is enabled.
+
+#include "FrameScheduler.h"
+
+#include "TestHarness.h"
+
+#include <algorithm>
+
+using namespace ImagingEffects;
+
+namespace
+{
+	const int64_t FRAME_DURATION = 333333;
+
+	SchedulerPolicy MakeEnabledPolicy()
+	{
+		SchedulerPolicy policy = MakeDefaultSchedulerPolicy();
+		policy.fEnabled = true;
+		return policy;
+	}
+
+	// Measures every action once, with the given costs.
+	void RecordCosts(FrameScheduler *pScheduler, int64_t hnsProcess, int64_t hnsDegrade, int64_t hnsPassThrough)
+	{
+		pScheduler->RecordCost(FrameAction_Process, hnsProcess);
+		pScheduler->RecordCost(FrameAction_Degrade, hnsDegrade);
+		pScheduler->RecordCost(FrameAction_PassThrough, hnsPassThrough);
+		pScheduler->RecordCost(FrameAction_Drop, 0);
+	}
+
+	// A camera delivering a frame every FRAME_DURATION to a transform that
+	// handles one frame at a time, each action taking a fixed time.
+	struct Simulation
+	{
+		int64_t hnsCost[FrameAction_Count];
+		int64_t hnsMaxLatency;          // Arrival to output, over the second half.
+
+		Simulation(int64_t hnsProcess, int64_t hnsDegrade, int64_t hnsPassThrough)
+			: hnsMaxLatency(0)
+		{
+			hnsCost[FrameAction_Process] = hnsProcess;
+			hnsCost[FrameAction_Degrade] = hnsDegrade;
+			hnsCost[FrameAction_PassThrough] = hnsPassThrough;
+			hnsCost[FrameAction_Drop] = 0;
+		}
+
+		void Run(FrameScheduler *pScheduler, uint32_t cFrames, bool fCanDegrade)
+		{
+			int64_t hnsNow = 0;
+			for (uint32_t i = 0; i < cFrames; i++)
+			{
+				const int64_t hnsArrival = i * FRAME_DURATION;
+				hnsNow = (std::max)(hnsNow, hnsArrival);
+
+				const FrameAction action = pScheduler->Decide(hnsNow, true, hnsArrival, FRAME_DURATION, fCanDegrade);
+				hnsNow += hnsCost[action];
+				pScheduler->RecordCost(action, hnsCost[action]);
+
+				if (action != FrameAction_Drop && i >= cFrames / 2)
+				{
+					hnsMaxLatency = (std::max)(hnsMaxLatency, hnsNow - hnsArrival);
+				}
+			}
+		}
+	};
+}
+
+TEST(DisabledProcessesEveryFrame)
+{
+	FrameScheduler scheduler;
+	RecordCosts(&scheduler, 10 * FRAME_DURATION, 0, 0);
+
+	// However late the frames are.
+	for (int i = 0; i < 10; i++)
+	{
+		CHECK_EQUAL(scheduler.Decide(100 * FRAME_DURATION, true, i * FRAME_DURATION, FRAME_DURATION, true), FrameAction_Process);
+	}
+	CHECK_EQUAL(scheduler.GetStats().cFrames[FrameAction_Process], 10u);
+}
+
+TEST(FramesWithoutTimeStampsAreProcessed)
+{
+	FrameScheduler scheduler;
+	scheduler.SetPolicy(MakeEnabledPolicy());
+	RecordCosts(&scheduler, 10 * FRAME_DURATION, 0, 0);
+	CHECK_EQUAL(scheduler.Decide(0, false, 0, 0, true), FrameAction_Process);
+}
+
+TEST(PicksTheFirstActionThatFits)
+{
+	FrameScheduler scheduler;
+	scheduler.SetPolicy(MakeEnabledPolicy());
+
+	// The first frame sets the arrival offset to 0, so each frame's deadline
+	// is its time stamp plus one duration.
+	CHECK_EQUAL(scheduler.Decide(0, true, 0, FRAME_DURATION, true), FrameAction_Process);
+	RecordCosts(&scheduler, 300000, 200000, 10000);
+
+	int64_t hnsTime = FRAME_DURATION;
+	CHECK_EQUAL(scheduler.Decide(hnsTime, true, hnsTime, FRAME_DURATION, true), FrameAction_Process);
+	hnsTime += FRAME_DURATION;
+	CHECK_EQUAL(scheduler.Decide(hnsTime + 100000, true, hnsTime, FRAME_DURATION, true), FrameAction_Degrade);
+	hnsTime += FRAME_DURATION;
+	CHECK_EQUAL(scheduler.Decide(hnsTime + 100000, true, hnsTime, FRAME_DURATION, false), FrameAction_PassThrough);
+	hnsTime += FRAME_DURATION;
+	CHECK_EQUAL(scheduler.Decide(hnsTime + 200000, true, hnsTime, FRAME_DURATION, true), FrameAction_PassThrough);
+	hnsTime += FRAME_DURATION;
+	CHECK_EQUAL(scheduler.Decide(hnsTime + FRAME_DURATION, true, hnsTime, FRAME_DURATION, true), FrameAction_Drop);
+
+	const SchedulerStats stats = scheduler.GetStats();
+	CHECK_EQUAL(stats.cFrames[FrameAction_Process], 2u);
+	CHECK_EQUAL(stats.cFrames[FrameAction_Degrade], 1u);
+	CHECK_EQUAL(stats.cFrames[FrameAction_PassThrough], 2u);
+	CHECK_EQUAL(stats.cFrames[FrameAction_Drop], 1u);
+	CHECK_EQUAL(stats.hnsCost[FrameAction_Process], 300000);
+}
+
+TEST(DropsAreLimited)
+{
+	FrameScheduler scheduler;
+	SchedulerPolicy policy = MakeEnabledPolicy();
+	policy.fAllowPassThrough = false;
+	policy.cMaxConsecutiveDrops = 3;
+	scheduler.SetPolicy(policy);
+
+	CHECK_EQUAL(scheduler.Decide(0, true, 0, FRAME_DURATION, false), FrameAction_Process);
+	RecordCosts(&scheduler, 2 * FRAME_DURATION, 0, 0);
+
+	// Every frame is late; after three drops one is shown anyway, with the
+	// only action left.
+	uint32_t cDrops = 0;
+	for (int i = 1; i <= 12; i++)
+	{
+		const FrameAction action = scheduler.Decide(i * FRAME_DURATION, true, i * FRAME_DURATION, FRAME_DURATION, false);
+		if (i % 4 == 0)
+		{
+			CHECK_EQUAL(action, FrameAction_Process);
+		}
+		else
+		{
+			CHECK_EQUAL(action, FrameAction_Drop);
+			cDrops++;
+		}
+	}
+	CHECK_EQUAL(scheduler.GetStats().cFrames[FrameAction_Drop], (uint64_t)cDrops);
+
+	// Without drops, the late frame is processed.
+	policy.fAllowDrop = false;
+	scheduler.SetPolicy(policy);
+	CHECK_EQUAL(scheduler.Decide(13 * FRAME_DURATION, true, 13 * FRAME_DURATION, FRAME_DURATION, false), FrameAction_Process);
+}
+
+TEST(LateFramesUseTheCheapestOutput)
+{
+	FrameScheduler scheduler;
+	SchedulerPolicy policy = MakeEnabledPolicy();
+	policy.fAllowDrop = false;
+	scheduler.SetPolicy(policy);
+
+	CHECK_EQUAL(scheduler.Decide(0, true, 0, FRAME_DURATION, true), FrameAction_Process);
+	RecordCosts(&scheduler, 3 * FRAME_DURATION, 2 * FRAME_DURATION, FRAME_DURATION / 2);
+
+	// Nothing fits a frame that arrives a full duration late.
+	CHECK_EQUAL(scheduler.Decide(2 * FRAME_DURATION, true, FRAME_DURATION, FRAME_DURATION, true), FrameAction_PassThrough);
+	policy.fAllowPassThrough = false;
+	scheduler.SetPolicy(policy);
+	CHECK_EQUAL(scheduler.Decide(3 * FRAME_DURATION, true, 2 * FRAME_DURATION, FRAME_DURATION, true), FrameAction_Degrade);
+}
+
+TEST(UnmeasuredActionsAreTried)
+{
+	FrameScheduler scheduler;
+	scheduler.SetPolicy(MakeEnabledPolicy());
+	CHECK_EQUAL(scheduler.Decide(0, true, 0, FRAME_DURATION, true), FrameAction_Process);
+	scheduler.RecordCost(FrameAction_Process, 2 * FRAME_DURATION);
+
+	// Degrade has never run, so it is assumed to fit.
+	CHECK_EQUAL(scheduler.Decide(FRAME_DURATION, true, FRAME_DURATION, FRAME_DURATION, true), FrameAction_Degrade);
+
+	// A new chain is measured again.
+	scheduler.ResetCosts();
+	CHECK_EQUAL(scheduler.Decide(2 * FRAME_DURATION, true, 2 * FRAME_DURATION, FRAME_DURATION, true), FrameAction_Process);
+	CHECK_EQUAL(scheduler.GetStats().hnsCost[FrameAction_Process], 0);
+}
+
+TEST(TheFullChainIsProbed)
+{
+	FrameScheduler scheduler;
+	scheduler.SetPolicy(MakeEnabledPolicy());
+	CHECK_EQUAL(scheduler.Decide(0, true, 0, FRAME_DURATION, true), FrameAction_Process);
+	RecordCosts(&scheduler, 2 * FRAME_DURATION, 0, 0);
+
+	// Degraded for a while, then processed once to measure the chain again.
+	int iProbe = 0;
+	for (int i = 1; i <= 100 && iProbe == 0; i++)
+	{
+		if (scheduler.Decide(i * FRAME_DURATION, true, i * FRAME_DURATION, FRAME_DURATION, true) == FrameAction_Process)
+		{
+			iProbe = i;
+		}
+	}
+	CHECK_EQUAL(iProbe, 31);
+}
+
+TEST(LatencyStaysBoundedWhenTheChainIsTooSlow)
+{
+	const uint32_t FRAME_COUNT = 600;
+
+	// Without scheduling, every frame adds half a frame of latency.
+	FrameScheduler unscheduled;
+	Simulation slow(FRAME_DURATION * 3 / 2, FRAME_DURATION / 2, FRAME_DURATION / 20);
+	slow.Run(&unscheduled, FRAME_COUNT, true);
+	CHECK(slow.hnsMaxLatency > 100 * FRAME_DURATION);
+
+	// With it, a cheaper chain keeps up.
+	FrameScheduler degrading;
+	degrading.SetPolicy(MakeEnabledPolicy());
+	Simulation withDegrade(FRAME_DURATION * 3 / 2, FRAME_DURATION / 2, FRAME_DURATION / 20);
+	withDegrade.Run(&degrading, FRAME_COUNT, true);
+	CHECK(withDegrade.hnsMaxLatency <= 3 * FRAME_DURATION);
+	CHECK(degrading.GetStats().cFrames[FrameAction_Degrade] > FRAME_COUNT / 2);
+
+	// And without one, passing through and dropping keep up.
+	FrameScheduler passing;
+	passing.SetPolicy(MakeEnabledPolicy());
+	Simulation withoutDegrade(FRAME_DURATION * 3 / 2, 0, FRAME_DURATION / 20);
+	withoutDegrade.Run(&passing, FRAME_COUNT, false);
+	CHECK(withoutDegrade.hnsMaxLatency <= 3 * FRAME_DURATION);
+	CHECK_EQUAL(passing.GetStats().cFrames[FrameAction_Degrade], 0u);
+}
+
+int main()
+{
+	return RunTests();
+}
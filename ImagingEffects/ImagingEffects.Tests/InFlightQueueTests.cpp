@@ -0,0 +1,191 @@
+// Tests of the queue of frames in flight: frames that finish in any order
+// leave it in time stamp order, it never holds more than its capacity, and
+// flushed or dropped frames never come out.
+
+#include "InFlightQueue.h"
+
+#include "TestHarness.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+
+namespace
+{
+	const int64_t FRAME_DURATION = 333333;
+}
+
+TEST(FramesLeaveInTimeStampOrder)
+{
+	InFlightQueue<int> queue(4);
+	std::mt19937 random(1);
+	std::vector<uint64_t> tickets;
+	int cSubmitted = 0;
+	int cDelivered = 0;
+	int64_t hnsLast = -1;
+
+	while (cDelivered < 1000)
+	{
+		// Fill the queue, then finish the frames in a random order.
+		uint64_t ticket;
+		while (cSubmitted < 1000 && queue.Reserve(cSubmitted * FRAME_DURATION, &ticket))
+		{
+			tickets.push_back(ticket);
+			cSubmitted++;
+		}
+		CHECK(queue.GetCount() <= 4);
+		CHECK(queue.IsFull() || cSubmitted == 1000);
+
+		std::shuffle(tickets.begin(), tickets.end(), random);
+		const size_t cToComplete = 1 + random() % tickets.size();
+		for (size_t i = 0; i < cToComplete; i++)
+		{
+			CHECK(queue.Complete(tickets.back(), (int)tickets.back()));
+			tickets.pop_back();
+		}
+
+		int item;
+		int64_t hnsTime;
+		while (queue.PopReady(&item, &hnsTime))
+		{
+			CHECK(hnsTime > hnsLast);
+			CHECK_EQUAL(hnsTime, (int64_t)item * FRAME_DURATION);
+			hnsLast = hnsTime;
+			cDelivered++;
+		}
+	}
+
+	CHECK(queue.IsEmpty());
+}
+
+TEST(EachFrameIsSignaledOnce)
+{
+	InFlightQueue<int> queue(3);
+	uint64_t tickets[3];
+	for (int i = 0; i < 3; i++)
+	{
+		CHECK(queue.Reserve(i, &tickets[i]));
+	}
+
+	// The last frame is not ready until the ones before it are.
+	CHECK(queue.Complete(tickets[2], 2));
+	CHECK_EQUAL(queue.TakeNewlyReady(), 0u);
+	CHECK(queue.Complete(tickets[0], 0));
+	CHECK_EQUAL(queue.TakeNewlyReady(), 1u);
+	CHECK(queue.Complete(tickets[1], 1));
+	CHECK_EQUAL(queue.TakeNewlyReady(), 2u);
+	CHECK_EQUAL(queue.TakeNewlyReady(), 0u);
+
+	int item;
+	CHECK(queue.PopReady(&item));
+	CHECK_EQUAL(item, 0);
+	CHECK_EQUAL(queue.TakeNewlyReady(), 0u);
+}
+
+TEST(DroppedFramesNeverComeOut)
+{
+	InFlightQueue<int> queue(4);
+	uint64_t tickets[4];
+	for (int i = 0; i < 4; i++)
+	{
+		CHECK(queue.Reserve(i, &tickets[i]));
+	}
+
+	CHECK(queue.Drop(tickets[0]));
+	CHECK(queue.Complete(tickets[1], 1));
+	CHECK(queue.Drop(tickets[2]));
+	CHECK(queue.Complete(tickets[3], 3));
+	CHECK_EQUAL(queue.GetReadyCount(), 2u);
+
+	int item;
+	CHECK(queue.PopReady(&item));
+	CHECK_EQUAL(item, 1);
+	CHECK(queue.PopReady(&item));
+	CHECK_EQUAL(item, 3);
+	CHECK(!queue.PopReady(&item));
+	CHECK(queue.IsEmpty());
+}
+
+TEST(FlushedFramesAreRecognized)
+{
+	InFlightQueue<int> queue(2);
+	uint64_t stale;
+	CHECK(queue.Reserve(0, &stale));
+	queue.Clear();
+
+	// A render that was running during the flush finishes afterwards.
+	uint64_t ticket;
+	CHECK(queue.Reserve(1, &ticket));
+	CHECK(ticket != stale);
+	CHECK(!queue.Complete(stale, 100));
+	CHECK(!queue.Drop(stale));
+	CHECK(queue.Complete(ticket, 1));
+
+	int item;
+	CHECK(queue.PopReady(&item));
+	CHECK_EQUAL(item, 1);
+}
+
+// As the transform uses it: one thread submits under the owner's lock,
+// workers finish the frames after random delays, and the frames are handed
+// out as they become ready.
+TEST(WorkersFinishingOutOfOrder)
+{
+	const int FRAME_COUNT = 400;
+	InFlightQueue<int> queue(4);
+	std::mutex lock;
+	std::vector<std::thread> workers;
+	std::vector<int> delivered;
+
+	for (int i = 0; i < FRAME_COUNT; i++)
+	{
+		uint64_t ticket = 0;
+		for (;;)
+		{
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				int item;
+				while (queue.PopReady(&item))
+				{
+					delivered.push_back(item);
+				}
+				if (queue.Reserve(i * FRAME_DURATION, &ticket))
+				{
+					break;
+				}
+			}
+			std::this_thread::yield();
+		}
+
+		workers.push_back(std::thread([&queue, &lock, ticket, i]()
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds((i * 7919) % 500));
+			std::lock_guard<std::mutex> guard(lock);
+			queue.Complete(ticket, i);
+		}));
+	}
+
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+
+	int item;
+	while (queue.PopReady(&item))
+	{
+		delivered.push_back(item);
+	}
+
+	CHECK_EQUAL(delivered.size(), (size_t)FRAME_COUNT);
+	for (size_t i = 0; i < delivered.size(); i++)
+	{
+		CHECK_EQUAL(delivered[i], (int)i);
+	}
+}
+
+int main()
+{
+	return RunTests();
+}
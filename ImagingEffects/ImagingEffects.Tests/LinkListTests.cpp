@@ -0,0 +1,221 @@
+// Tests of the linked list the transform queues its samples in: items come
+// out in the order they went in, removed nodes are reused, so that a list
+// that has held its largest number of items (or reserved room for them) no
+// longer touches the heap, and a list of COM pointers holds one reference to
+// each item it holds.
+//
+// Every allocation through operator new is counted, as in effectbench.
+
+#include "WindowsShim.h"
+
+#include <assert.h>
+
+#include "LinkList.h"
+
+#include "AllocationCounter.h"
+#include "TestHarness.h"
+
+#include <chrono>
+#include <stdio.h>
+
+namespace
+{
+	// A COM object that only counts its references.
+	class CountedObject : public IUnknown
+	{
+	public:
+		CountedObject() : m_cRef(1)
+		{
+		}
+
+		ULONG AddRef()
+		{
+			return ++m_cRef;
+		}
+
+		ULONG Release()
+		{
+			return --m_cRef;
+		}
+
+		ULONG GetRefCount() const { return m_cRef; }
+
+	private:
+		ULONG m_cRef;
+	};
+
+	// Inserts cItems items at the back, then removes them from the front,
+	// checking the order.
+	bool FillAndDrain(List<int> *pList, int cItems)
+	{
+		for (int i = 0; i < cItems; i++)
+		{
+			if (FAILED(pList->InsertBack(i)))
+			{
+				return false;
+			}
+		}
+
+		for (int i = 0; i < cItems; i++)
+		{
+			int item = -1;
+			if (FAILED(pList->RemoveFront(&item)) || item != i)
+			{
+				return false;
+			}
+		}
+		return pList->IsEmpty();
+	}
+}
+
+TEST(ItemsLeaveInOrder)
+{
+	List<int> list;
+	CHECK(SUCCEEDED(list.InsertBack(2)));
+	CHECK(SUCCEEDED(list.InsertFront(1)));
+	CHECK(SUCCEEDED(list.InsertBack(3)));
+	CHECK(SUCCEEDED(list.InsertPos(list.FrontPosition(), 0)));
+	CHECK_EQUAL(list.GetCount(), 4u);
+
+	int expected = 0;
+	for (List<int>::POSITION pos = list.FrontPosition(); pos != list.EndPosition(); pos = list.Next(pos))
+	{
+		int item = -1;
+		CHECK(SUCCEEDED(list.GetItemPos(pos, &item)));
+		CHECK_EQUAL(item, expected++);
+	}
+	CHECK_EQUAL(expected, 4);
+
+	int item = -1;
+	CHECK(SUCCEEDED(list.RemoveBack(&item)));
+	CHECK_EQUAL(item, 3);
+	CHECK(SUCCEEDED(list.RemoveFront(&item)));
+	CHECK_EQUAL(item, 0);
+
+	list.Clear();
+	CHECK(list.IsEmpty());
+	CHECK(FAILED(list.RemoveFront(&item)));
+	CHECK(list.FrontPosition() == list.EndPosition());
+}
+
+TEST(RemovedNodesAreReused)
+{
+	List<int> list;
+	CHECK(FillAndDrain(&list, 16));
+	CHECK_EQUAL(list.GetFreeCount(), 16u);
+
+	// Up to the largest number of items held so far, nothing is allocated.
+	const uint64_t cBefore = GetAllocationCount();
+	for (int i = 0; i < 100; i++)
+	{
+		CHECK(FillAndDrain(&list, 1 + i % 16));
+	}
+	CHECK_EQUAL(GetAllocationCount() - cBefore, 0u);
+
+	// Clear recycles the nodes too.
+	for (int i = 0; i < 16; i++)
+	{
+		list.InsertBack(i);
+	}
+	list.Clear();
+	CHECK_EQUAL(list.GetFreeCount(), 16u);
+
+	// One more item than ever before takes one node from the heap.
+	CHECK(FillAndDrain(&list, 17));
+	CHECK_EQUAL(GetAllocationCount() - cBefore, 1u);
+	CHECK_EQUAL(list.GetFreeCount(), 17u);
+}
+
+TEST(ReservedNodesAreUsedFirst)
+{
+	uint64_t cBefore = GetAllocationCount();
+	List<int> preallocated(8);
+	CHECK_EQUAL(preallocated.GetFreeCount(), 8u);
+	CHECK_EQUAL(GetAllocationCount() - cBefore, 8u);
+
+	// Reserve counts the items already held.
+	List<int> list;
+	list.InsertBack(0);
+	list.InsertBack(1);
+	CHECK(SUCCEEDED(list.Reserve(10)));
+	CHECK_EQUAL(list.GetFreeCount(), 8u);
+	CHECK(SUCCEEDED(list.Reserve(4)));
+	CHECK_EQUAL(list.GetFreeCount(), 8u);
+
+	cBefore = GetAllocationCount();
+	CHECK(FillAndDrain(&preallocated, 8));
+	for (int i = 2; i < 10; i++)
+	{
+		list.InsertBack(i);
+	}
+	CHECK_EQUAL(GetAllocationCount() - cBefore, 0u);
+	CHECK_EQUAL(list.GetCount(), 10u);
+	CHECK_EQUAL(list.GetFreeCount(), 0u);
+
+	// Trim gives back only the free nodes.
+	list.RemoveFront(nullptr);
+	list.RemoveFront(nullptr);
+	list.Trim();
+	CHECK_EQUAL(list.GetFreeCount(), 0u);
+	CHECK_EQUAL(list.GetCount(), 8u);
+}
+
+TEST(ComPtrListHoldsOneReference)
+{
+	CountedObject objects[3];
+	{
+		ComPtrList<IUnknown> list(2);
+		for (int i = 0; i < 3; i++)
+		{
+			CHECK(SUCCEEDED(list.InsertBack(&objects[i])));
+			CHECK_EQUAL(objects[i].GetRefCount(), 2u);
+		}
+		CHECK(FAILED(list.InsertBack(nullptr)));
+		CHECK_EQUAL(list.GetCount(), 3u);
+
+		// What comes out comes with a reference of its own.
+		IUnknown *pItem = nullptr;
+		CHECK(SUCCEEDED(list.GetFront(&pItem)));
+		CHECK(pItem == &objects[0]);
+		CHECK_EQUAL(objects[0].GetRefCount(), 3u);
+		pItem->Release();
+
+		CHECK(SUCCEEDED(list.RemoveFront(&pItem)));
+		CHECK(pItem == &objects[0]);
+		CHECK_EQUAL(objects[0].GetRefCount(), 2u);
+		pItem->Release();
+
+		CHECK(SUCCEEDED(list.RemoveFront(nullptr)));
+		CHECK_EQUAL(objects[1].GetRefCount(), 1u);
+
+		// The list releases what it still holds when it goes away.
+		CHECK_EQUAL(objects[2].GetRefCount(), 2u);
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		CHECK_EQUAL(objects[i].GetRefCount(), 1u);
+	}
+}
+
+// Not a check, but what a queue of samples costs once warmed up.
+TEST(WarmThroughput)
+{
+	const int ROUNDS = 200000;
+	List<int> list(4);
+
+	const uint64_t cBefore = GetAllocationCount();
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < ROUNDS; i++)
+	{
+		CHECK(FillAndDrain(&list, 4));
+	}
+	const double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	CHECK_EQUAL(GetAllocationCount() - cBefore, 0u);
+
+	printf("  %.1f ns per insert and remove\n", ns / (ROUNDS * 4.0));
+}
+
+int main()
+{
+	return RunTests();
+}
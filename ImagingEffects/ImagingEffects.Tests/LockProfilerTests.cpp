@@ -0,0 +1,194 @@
+// Tests of the lock profiler that CritSec feeds when CRITSEC_PROFILING is
+// defined: times fall in power-of-two buckets, each call site of a lock
+// counts its own acquisitions, contended acquisitions and wait and hold
+// times (a recursive acquisition is part of the outer one, and an
+// AutoUnlock takes the lock back for the site it released it from), and
+// SnapshotJson lists every site with its counters.
+//
+// The profiler is one per process, so each test uses locks of its own name.
+
+#define CRITSEC_PROFILING
+
+#include "WindowsShim.h"
+
+#include "CritSec.h"
+
+#include "TestHarness.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+namespace
+{
+	// The counters of a site, which must have been created already.
+	const LockSiteStats& FindSite(const char *pszLock, const char *pszSite)
+	{
+		return *LockProfiler::Get().GetSite(pszLock, pszSite);
+	}
+}
+
+TEST(TimesFallInPowerOfTwoBuckets)
+{
+	CHECK_EQUAL(LockDuration::GetBucketIndex(0), (size_t)0);
+	CHECK_EQUAL(LockDuration::GetBucketIndex(1), (size_t)1);
+	CHECK_EQUAL(LockDuration::GetBucketIndex(2), (size_t)2);
+	CHECK_EQUAL(LockDuration::GetBucketIndex(3), (size_t)2);
+	CHECK_EQUAL(LockDuration::GetBucketIndex(4), (size_t)3);
+
+	// Bucket i holds [2^(i-1), 2^i).
+	for (size_t i = 1; i < LOCK_PROFILER_BUCKETS - 1; i++)
+	{
+		CHECK_EQUAL(LockDuration::GetBucketIndex((uint64_t)1 << (i - 1)), i);
+		CHECK_EQUAL(LockDuration::GetBucketIndex(((uint64_t)1 << i) - 1), i);
+	}
+
+	// The last bucket holds everything longer.
+	CHECK_EQUAL(LockDuration::GetBucketIndex((uint64_t)1 << (LOCK_PROFILER_BUCKETS - 2)), LOCK_PROFILER_BUCKETS - 1);
+	CHECK_EQUAL(LockDuration::GetBucketIndex(UINT64_MAX), LOCK_PROFILER_BUCKETS - 1);
+}
+
+TEST(DurationsKeepTotalMaximumAndHistogram)
+{
+	LockDuration duration;
+	duration.Record(0);
+	duration.Record(5);
+	duration.Record(7);
+	duration.Record(1000);
+
+	CHECK_EQUAL(duration.GetTotal(), 1012u);
+	CHECK_EQUAL(duration.GetMax(), 1000u);
+	CHECK_EQUAL(duration.GetBucket(0), 1u);
+	CHECK_EQUAL(duration.GetBucket(3), 2u);
+	CHECK_EQUAL(duration.GetBucket(10), 1u);
+
+	// Printed up to the last bucket that is not empty.
+	std::string json;
+	duration.AppendJson(&json);
+	CHECK_EQUAL(json, std::string("{ \"total\": 1012, \"max\": 1000, \"histogram\": [ 1, 0, 0, 2, 0, 0, 0, 0, 0, 0, 1 ] }"));
+
+	duration.Reset();
+	json.clear();
+	duration.AppendJson(&json);
+	CHECK_EQUAL(json, std::string("{ \"total\": 0, \"max\": 0, \"histogram\": [ ] }"));
+}
+
+TEST(ContentionIsCountedPerCallSite)
+{
+	const uint64_t HOLD_NS = 20 * 1000 * 1000;
+
+	CritSec lock("ContendedLock");
+	std::atomic<bool> fHeld(false);
+
+	// The holder takes the lock and keeps it while the waiter asks for it.
+	std::thread holder([&]()
+	{
+		AutoLock autoLock(lock, "Holder");
+		fHeld = true;
+		std::this_thread::sleep_for(std::chrono::nanoseconds(HOLD_NS));
+	});
+	while (!fHeld)
+	{
+		std::this_thread::yield();
+	}
+	{
+		AutoLock autoLock(lock, "Waiter");
+	}
+	holder.join();
+
+	// Uncontended, from the same site.
+	for (int i = 0; i < 10; i++)
+	{
+		AutoLock autoLock(lock, "Waiter");
+	}
+
+	const LockSiteStats &holderSite = FindSite("ContendedLock", "Holder");
+	const LockSiteStats &waiterSite = FindSite("ContendedLock", "Waiter");
+	CHECK_EQUAL(holderSite.GetAcquisitions(), 1u);
+	CHECK_EQUAL(holderSite.GetContended(), 0u);
+	CHECK(holderSite.GetHold().GetMax() >= HOLD_NS);
+	CHECK_EQUAL(holderSite.GetHold().GetBucket(LockDuration::GetBucketIndex(holderSite.GetHold().GetMax())), 1u);
+
+	CHECK_EQUAL(waiterSite.GetAcquisitions(), 11u);
+	CHECK_EQUAL(waiterSite.GetContended(), 1u);
+	CHECK(waiterSite.GetWait().GetMax() >= HOLD_NS / 2);
+	CHECK(waiterSite.GetWait().GetMax() <= holderSite.GetHold().GetMax() + HOLD_NS);
+
+	// An uncontended acquisition is counted as no wait.
+	CHECK_EQUAL(waiterSite.GetWait().GetBucket(0), 10u);
+	CHECK_EQUAL(waiterSite.GetWait().GetTotal(), waiterSite.GetWait().GetMax());
+}
+
+TEST(NestedAcquisitionsBelongToTheOuterOne)
+{
+	CritSec lock("NestedLock");
+	{
+		AutoLock outer(lock, "Outer");
+		AutoLock inner(lock, "Inner");
+	}
+
+	const LockSiteStats &outer = FindSite("NestedLock", "Outer");
+	const LockSiteStats &inner = FindSite("NestedLock", "Inner");
+	CHECK_EQUAL(outer.GetAcquisitions(), 1u);
+	CHECK_EQUAL(inner.GetAcquisitions(), 0u);
+
+	// One hold, released by the outer AutoLock.
+	uint64_t cHolds = 0;
+	for (size_t i = 0; i < LOCK_PROFILER_BUCKETS; i++)
+	{
+		cHolds += outer.GetHold().GetBucket(i);
+	}
+	CHECK_EQUAL(cHolds, 1u);
+}
+
+TEST(AutoUnlockTakesTheLockBackForTheSameSite)
+{
+	CritSec lock("UnlockedLock");
+	{
+		AutoLock autoLock(lock, "Render");
+		AutoUnlock unlock(lock);
+	}
+
+	const LockSiteStats &site = FindSite("UnlockedLock", "Render");
+	CHECK_EQUAL(site.GetAcquisitions(), 2u);
+	CHECK_EQUAL(site.GetContended(), 0u);
+}
+
+TEST(SnapshotJsonListsEverySite)
+{
+	CritSec lock("Json\"Lock");
+	for (int i = 0; i < 2; i++)
+	{
+		AutoLock autoLock(lock, "First");
+	}
+	{
+		AutoLock autoLock(lock, "Second");
+	}
+	{
+		// Sites may be unnamed.
+		AutoLock autoLock(lock);
+	}
+
+	const std::string json = LockProfiler::Get().SnapshotJson();
+	CHECK_EQUAL(json.compare(0, 13, "{ \"locks\": [\n"), 0);
+	CHECK_EQUAL(json.compare(json.size() - 4, 4, "\n] }"), 0);
+
+	// Uncontended, the waits are all zero and the holds are too short to
+	// tell from here.
+	CHECK(json.find("{ \"lock\": \"Json\\\"Lock\", \"site\": \"First\", \"acquisitions\": 2, \"contended\": 0, "
+		"\"wait_ns\": { \"total\": 0, \"max\": 0, \"histogram\": [ 2 ] }, \"hold_ns\": { \"total\": ") != std::string::npos);
+	CHECK(json.find("{ \"lock\": \"Json\\\"Lock\", \"site\": \"Second\", \"acquisitions\": 1, ") != std::string::npos);
+	CHECK(json.find("{ \"lock\": \"Json\\\"Lock\", \"site\": \"(unnamed)\", \"acquisitions\": 1, ") != std::string::npos);
+
+	// The sites of the other tests are listed too.
+	CHECK(json.find("\"lock\": \"ContendedLock\", \"site\": \"Waiter\", \"acquisitions\": 11, \"contended\": 1, ") != std::string::npos);
+
+	// Reset clears the counters and keeps the sites.
+	LockProfiler::Get().Reset();
+	const std::string reset = LockProfiler::Get().SnapshotJson();
+	CHECK(reset.find("\"site\": \"First\", \"acquisitions\": 0, \"contended\": 0, "
+		"\"wait_ns\": { \"total\": 0, \"max\": 0, \"histogram\": [ ] }, \"hold_ns\": { \"total\": 0, \"max\": 0, \"histogram\": [ ] } }") != std::string::npos);
+}
+
+int main() { return RunTests(); }
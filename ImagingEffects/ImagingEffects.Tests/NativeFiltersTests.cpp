@@ -0,0 +1,340 @@
+// Tests of the native filter kernels. Every instruction set the processor
+// supports renders single filters at every width up to a few vector lengths
+// (so every length of scalar tail after the vector loop) and is compared
+// with a pixel-by-pixel reference written here for the linear and table
+// filters, and with the scalar kernels for the vignette's gains. Gains stay
+// within what the 16-bit vector multiply can hold. A chain, with its point
+// operations folded together, renders what its filters do one at a time.
+
+#include "FormatConversion.h"
+#include "NativeFilters.h"
+
+#include "TestFrames.h"
+#include "TestHarness.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+using namespace ImagingEffects;
+using namespace ImagingEffectsTests;
+
+namespace
+{
+	const ConversionIsa s_isas[] = { ConversionIsa_Scalar, ConversionIsa_SSE2, ConversionIsa_AVX2, ConversionIsa_NEON };
+	const uint32_t MAX_WIDTH = 67;
+	const uint32_t MAX_HEIGHT = 3;
+
+	// Runs fn once with each instruction set the processor supports, then
+	// restores the one that was in use.
+	template <class Fn>
+	void ForEachIsa(Fn fn)
+	{
+		const ConversionIsa original = GetConversionIsa();
+		for (size_t i = 0; i < sizeof(s_isas) / sizeof(s_isas[0]); i++)
+		{
+			if (SetConversionIsa(s_isas[i]))
+			{
+				fn(s_isas[i]);
+			}
+		}
+		SetConversionIsa(original);
+	}
+
+	uint8_t Clamp(int v)
+	{
+		return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+	}
+
+	int FloorDiv(int a, int b)
+	{
+		return a >= 0 ? a / b : -((-a + b - 1) / b);
+	}
+
+	int ToFixed(float value, float one, int minValue, int maxValue)
+	{
+		const float scaled = floorf(value * one + 0.5f);
+		return scaled < minValue ? minValue : (scaled > maxValue ? maxValue : (int)scaled);
+	}
+
+	// What a filter does to one byte of a plane, from its definition in
+	// NativeFilters.h: d = clamp((s - 128) * scale / 512 + bias), rounded
+	// down, for the linear filters, and the tables for curves. iByte tells
+	// U (even) from V (odd) in the chroma plane.
+	uint8_t ReferenceByte(const NativeFilter &filter, bool fChroma, uint32_t iByte, uint8_t s)
+	{
+		int scale = 512;
+		int bias = 128;
+		switch (filter.type)
+		{
+		case NativeFilter_Grayscale:
+			if (fChroma)
+			{
+				scale = 0;
+			}
+			break;
+		case NativeFilter_Sepia:
+			if (fChroma)
+			{
+				scale = ToFixed(1.0f - filter.intensity, 512.0f, 0, 512);
+				bias = 128 + ((iByte & 1) ? ToFixed(filter.intensity, 143.0f - 128.0f, -128, 127) : ToFixed(filter.intensity, 106.0f - 128.0f, -128, 127));
+			}
+			break;
+		case NativeFilter_BrightnessContrastSaturation:
+			scale = ToFixed(fChroma ? filter.saturation : filter.contrast, 512.0f, 0, 32767);
+			bias = fChroma ? 128 : 128 + ToFixed(filter.brightness, 255.0f, -255, 255);
+			break;
+		case NativeFilter_Curves:
+			return fChroma ? filter.curves[1 + (iByte & 1)][s] : filter.curves[0][s];
+		default:
+			break;
+		}
+		return Clamp(FloorDiv((s - 128) * scale, 512) + bias);
+	}
+
+	// Renders src through a chain of the filters.
+	void Render(const std::vector<NativeFilter> &filters, const VideoFrame &dest, const VideoFrame &src)
+	{
+		NativeFilterChain chain(filters, src.format, src.width, src.height, YuvMatrix_BT601, YuvRange_Video);
+		chain.Process(dest, src, 0, src.height);
+	}
+
+	// True if dest is the NV12 frame src through the filter, by ReferenceByte.
+	bool IsReferenceOutput(const NativeFilter &filter, const VideoFrame &dest, const VideoFrame &src)
+	{
+		PlaneShape shapes[3];
+		const uint32_t cPlanes = GetPlaneShapes(src.format, src.width, src.height, 0, shapes);
+		for (uint32_t i = 0; i < cPlanes; i++)
+		{
+			for (uint32_t row = 0; row < shapes[i].cRows; row++)
+			{
+				const uint8_t *s = src.planes[i].pData + src.planes[i].stride * (ptrdiff_t)row;
+				const uint8_t *d = dest.planes[i].pData + dest.planes[i].stride * (ptrdiff_t)row;
+				for (uint32_t x = 0; x < shapes[i].cbRow; x++)
+				{
+					if (d[x] != ReferenceByte(filter, i > 0, x, s[x]))
+					{
+						return false;
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	// Filters that the kernels compute as linear maps or tables, with
+	// scales that round, saturate and clamp.
+	std::vector<NativeFilter> MakePointFilters()
+	{
+		uint8_t curves[3][256];
+		uint32_t state = 7;
+		for (int c = 0; c < 3; c++)
+		{
+			for (int v = 0; v < 256; v++)
+			{
+				state = state * 1664525u + 1013904223u;
+				curves[c][v] = (uint8_t)(state >> 24);
+			}
+		}
+
+		std::vector<NativeFilter> filters;
+		filters.push_back(MakeGrayscaleFilter());
+		filters.push_back(MakeSepiaFilter(0.6f));
+		filters.push_back(MakeBrightnessContrastSaturationFilter(0.2f, 1.7f, 0.4f));
+		filters.push_back(MakeBrightnessContrastSaturationFilter(-0.3f, 0.33f, 2.9f));
+		filters.push_back(MakeBrightnessContrastSaturationFilter(-1.0f, 63.0f, 63.0f));
+		filters.push_back(MakeBrightnessContrastSaturationFilter(1.0f, 0.0f, 0.0f));
+		filters.push_back(MakeCurvesFilter(curves[0], curves[1], curves[2]));
+		return filters;
+	}
+
+	// A 17-point cube that warms the image.
+	std::shared_ptr<ColorCube> MakeWarmCube()
+	{
+		std::vector<float> rgb;
+		for (uint32_t b = 0; b < 17; b++)
+		{
+			for (uint32_t g = 0; g < 17; g++)
+			{
+				for (uint32_t r = 0; r < 17; r++)
+				{
+					rgb.push_back((std::min)(1.0f, r / 16.0f * 1.1f));
+					rgb.push_back(g / 16.0f);
+					rgb.push_back(b / 16.0f * 0.85f);
+				}
+			}
+		}
+		return ColorCube::Create(17, &rgb[0], rgb.size());
+	}
+
+	// Renders src through each filter in turn, a chain of one filter each.
+	void RenderOneAtATime(const std::vector<NativeFilter> &filters, const VideoFrame &dest, const VideoFrame &src)
+	{
+		TestFrame temp(src.format, src.width, src.height);
+		const VideoFrame *pIn = &src;
+		for (size_t i = 0; i < filters.size(); i++)
+		{
+			// The last filter writes dest; the others alternate through temp.
+			const VideoFrame &out = ((filters.size() - i) % 2 == 1) ? dest : temp.Get();
+			Render(std::vector<NativeFilter>(1, filters[i]), out, *pIn);
+			pIn = &out;
+		}
+	}
+}
+
+TEST(LinearAndTableFiltersMatchTheReference)
+{
+	const std::vector<NativeFilter> filters = MakePointFilters();
+	ForEachIsa([&](ConversionIsa isa)
+	{
+		int cFailures = 0;
+		for (size_t iFilter = 0; iFilter < filters.size(); iFilter++)
+		{
+			for (uint32_t width = 1; width <= MAX_WIDTH; width++)
+			{
+				for (uint32_t height = 1; height <= MAX_HEIGHT; height++)
+				{
+					TestFrame src(PixelFormat_NV12, width, height, 0, false, width * 8 + height);
+					TestFrame dest(PixelFormat_NV12, width, height, 0, false, 0);
+					Render(std::vector<NativeFilter>(1, filters[iFilter]), dest.Get(), src.Get());
+					if (!IsReferenceOutput(filters[iFilter], dest.Get(), src.Get()) && cFailures++ < 10)
+					{
+						fprintf(stderr, "isa %d: filter %u at %ux%u\n", (int)isa, (unsigned)iFilter, width, height);
+					}
+				}
+			}
+		}
+		CHECK_EQUAL(cFailures, 0);
+	});
+}
+
+// The vignette's gains come from a map built with the chain, so its vector
+// kernels are compared with the scalar ones, for NV12 and for the NV12
+// strips YUY2 frames are filtered in.
+TEST(GainFiltersMatchTheScalarKernels)
+{
+	const PixelFormat formats[] = { PixelFormat_NV12, PixelFormat_YUY2 };
+	const float strengths[] = { 0.3f, 0.8f, 1.0f };
+
+	for (size_t iFormat = 0; iFormat < 2; iFormat++)
+	{
+		for (size_t iStrength = 0; iStrength < 3; iStrength++)
+		{
+			const std::vector<NativeFilter> filters(1, MakeVignetteFilter(0.2f, strengths[iStrength]));
+			for (uint32_t width = 1; width <= MAX_WIDTH; width++)
+			{
+				const uint32_t height = 2 + width % 3;
+				TestFrame src(formats[iFormat], width, height, 0, false, width);
+				TestFrame expected(formats[iFormat], width, height, 0, false, 0);
+
+				const ConversionIsa original = GetConversionIsa();
+				SetConversionIsa(ConversionIsa_Scalar);
+				Render(filters, expected.Get(), src.Get());
+				SetConversionIsa(original);
+
+				ForEachIsa([&](ConversionIsa)
+				{
+					TestFrame dest(formats[iFormat], width, height, 0, false, 1);
+					Render(filters, dest.Get(), src.Get());
+					CHECK(FramesEqual(dest.Get(), expected.Get()));
+				});
+			}
+		}
+	}
+}
+
+// A gain of 128 is the largest: it leaves every value as it was, 255
+// included, and a filter that asks for more gets 128.
+TEST(GainsStayWithinTheVectorMultiply)
+{
+	TestFrame src(PixelFormat_NV12, MAX_WIDTH, 8, 0, false, 3);
+	const VideoFrame &frame = src.Get();
+	for (uint32_t x = 0; x < MAX_WIDTH; x++)
+	{
+		frame.planes[0].pData[x] = 255;
+		frame.planes[1].pData[x & ~1u] = 255;
+	}
+
+	NativeFilter brighten = MakeVignetteFilter(0.0f, 0.0f);
+	brighten.strength = -1.0f;
+	const NativeFilter none = MakeVignetteFilter(0.0f, 0.0f);
+
+	ForEachIsa([&](ConversionIsa)
+	{
+		TestFrame dest(PixelFormat_NV12, MAX_WIDTH, 8, 0, false, 4);
+		Render(std::vector<NativeFilter>(1, none), dest.Get(), frame);
+		CHECK(FramesEqual(dest.Get(), frame));
+
+		Render(std::vector<NativeFilter>(1, brighten), dest.Get(), frame);
+		CHECK(FramesEqual(dest.Get(), frame));
+	});
+}
+
+// The row tails follow the vector loop: a frame filtered in place, from
+// the same pixels, gives what a separate output does.
+TEST(InPlaceMatchesSeparateOutput)
+{
+	std::vector<NativeFilter> filters = MakePointFilters();
+	filters.push_back(MakeVignetteFilter(0.4f, 0.7f));
+
+	ForEachIsa([&](ConversionIsa)
+	{
+		for (uint32_t width = 1; width <= MAX_WIDTH; width += 3)
+		{
+			TestFrame src(PixelFormat_NV12, width, 5, 0, false, width);
+			TestFrame dest(PixelFormat_NV12, width, 5, 0, false, 0);
+			Render(filters, dest.Get(), src.Get());
+			Render(filters, src.Get(), src.Get());
+			CHECK(FramesEqual(src.Get(), dest.Get()));
+		}
+	});
+}
+
+// Random chains of the point filters, with vignettes and 3D tables between
+// them that split the runs to fold.
+TEST(FusedChainsMatchFiltersOneAtATime)
+{
+	const std::vector<NativeFilter> points = MakePointFilters();
+	const std::shared_ptr<ColorCube> cube = MakeWarmCube();
+	const PixelFormat formats[] = { PixelFormat_NV12, PixelFormat_YUY2 };
+
+	uint32_t state = 11;
+	for (int iChain = 0; iChain < 60; iChain++)
+	{
+		std::vector<NativeFilter> filters;
+		const uint32_t cFilters = 2 + iChain % 6;
+		for (uint32_t i = 0; i < cFilters; i++)
+		{
+			state = state * 1664525u + 1013904223u;
+			const uint32_t pick = (state >> 16) % (points.size() + 2);
+			if (pick < points.size())
+			{
+				filters.push_back(points[pick]);
+			}
+			else if (pick == points.size())
+			{
+				filters.push_back(MakeVignetteFilter(0.3f, 0.6f));
+			}
+			else
+			{
+				filters.push_back(MakeLut3DFilter(cube));
+			}
+		}
+
+		const PixelFormat format = formats[iChain % 2];
+		const uint32_t width = 17 + 13 * (iChain % 5);
+		const uint32_t height = 3 + iChain % 4;
+		TestFrame src(format, width, height, 0, false, iChain);
+		TestFrame fused(format, width, height, 0, false, 0);
+		TestFrame separate(format, width, height, 0, false, 0);
+
+		Render(filters, fused.Get(), src.Get());
+		RenderOneAtATime(filters, separate.Get(), src.Get());
+		CHECK(FramesEqual(fused.Get(), separate.Get()));
+	}
+}
+
+int main()
+{
+	return RunTests();
+}
@@ -0,0 +1,357 @@
+// Tests of the transform's queue of asynchronous operations, with its
+// operations in a ComPtrList and in a RingOpList: either way operations are
+// validated and dispatched in the order they were queued, one at a time
+// under the critical section, an operation that cannot start yet holds back
+// the ones behind it until the object calls ProcessQueue again, and the
+// list holds one reference to each queued operation. A full ring turns
+// operations away rather than blocking. Producers on several threads, with
+// work items run on several more, see every operation dispatched once and
+// in their order.
+//
+// The Media Foundation work queue is replaced by WorkQueue.h.
+
+#include "WindowsShim.h"
+
+#include <assert.h>
+
+#include "OpQueue.h"
+
+#include "TestHarness.h"
+#include "WorkQueue.h"
+
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <vector>
+
+using namespace ImagingEffectsTests;
+
+namespace
+{
+	// An operation: who queued it and its number among theirs. A long
+	// operation goes on after DispatchOperation returns, until Complete.
+	class Operation : public IUnknown
+	{
+	public:
+		Operation(uint32_t producer = 0, uint32_t sequence = 0, bool fLong = false)
+			: m_cRef(1)
+			, producer(producer)
+			, sequence(sequence)
+			, fLong(fLong)
+		{
+		}
+
+		ULONG AddRef()
+		{
+			return ++m_cRef;
+		}
+
+		ULONG Release()
+		{
+			return --m_cRef;
+		}
+
+		ULONG GetRefCount() const { return m_cRef; }
+
+		uint32_t producer;
+		uint32_t sequence;
+		bool fLong;
+
+	private:
+		std::atomic<ULONG> m_cRef;
+	};
+
+	typedef RingOpList<Operation> RingList;
+
+	// An object that queues operations as the transform does: one operation
+	// at a time, the next one dispatched when the last one ends.
+	template <class TOpList>
+	class Queue : public OpQueue<Queue<TOpList>, Operation, TOpList>
+	{
+		typedef OpQueue<Queue<TOpList>, Operation, TOpList> Base;
+
+	public:
+		Queue()
+			: Base(m_critsec)
+			, m_cRef(1)
+			, m_fBusy(false)
+			, m_cInside(0)
+			, m_cMaxInside(0)
+		{
+			InitializeCriticalSectionEx(&m_critsec, 100, 0);
+		}
+
+		~Queue()
+		{
+			DeleteCriticalSection(&m_critsec);
+		}
+
+		ULONG AddRef() { return ++m_cRef; }
+		ULONG Release() { return --m_cRef; }
+
+		// Ends the long operation in progress.
+		void Complete()
+		{
+			EnterCriticalSection(&m_critsec);
+			m_fBusy = false;
+			this->ProcessQueue();
+			LeaveCriticalSection(&m_critsec);
+		}
+
+		DWORD GetQueuedCount() const { return this->m_OpQueue.GetCount(); }
+
+		// The operations dispatched, in order. Read once the work items have run.
+		const std::vector<Operation*>& GetDispatched() const { return m_dispatched; }
+
+		// The most validations and dispatches seen running at once.
+		uint32_t GetMaxInside() const { return m_cMaxInside; }
+
+		ULONG GetRefCount() const { return m_cRef; }
+
+	protected:
+		HRESULT ValidateOperation(Operation *)
+		{
+			Enter();
+			const HRESULT hr = m_fBusy ? MF_E_NOTACCEPTING : S_OK;
+			Leave();
+			return hr;
+		}
+
+		HRESULT DispatchOperation(Operation *pOp)
+		{
+			Enter();
+			m_dispatched.push_back(pOp);
+			m_fBusy = pOp->fLong;
+			Leave();
+
+			if (!pOp->fLong)
+			{
+				this->ProcessQueue();
+			}
+			return S_OK;
+		}
+
+	private:
+		void Enter()
+		{
+			const uint32_t cInside = ++m_cInside;
+			if (cInside > m_cMaxInside)
+			{
+				m_cMaxInside = cInside;
+			}
+		}
+
+		void Leave()
+		{
+			--m_cInside;
+		}
+
+		CRITICAL_SECTION m_critsec;
+		std::atomic<ULONG> m_cRef;
+		bool m_fBusy;
+		std::atomic<uint32_t> m_cInside;
+		uint32_t m_cMaxInside;
+		std::vector<Operation*> m_dispatched;
+	};
+
+	template <class TOpList>
+	void CheckDispatchesInOrder()
+	{
+		WorkQueue &workQueue = WorkQueue::Get();
+		Queue<TOpList> queue;
+		Operation ops[5];
+
+		for (uint32_t i = 0; i < 5; i++)
+		{
+			CHECK_EQUAL(queue.QueueOperation(&ops[i]), S_OK);
+			CHECK_EQUAL(ops[i].GetRefCount(), 2u);
+		}
+		CHECK_EQUAL(queue.GetQueuedCount(), 5u);
+		CHECK(queue.GetDispatched().empty());
+		CHECK_EQUAL(workQueue.GetPendingCount(), (size_t)5);
+
+		workQueue.RunPending();
+
+		CHECK_EQUAL(queue.GetQueuedCount(), 0u);
+		CHECK_EQUAL(queue.GetDispatched().size(), (size_t)5);
+		for (uint32_t i = 0; i < 5 && i < queue.GetDispatched().size(); i++)
+		{
+			CHECK(queue.GetDispatched()[i] == &ops[i]);
+			CHECK_EQUAL(ops[i].GetRefCount(), 1u);
+		}
+		CHECK_EQUAL(queue.GetMaxInside(), 1u);
+		CHECK_EQUAL(queue.GetRefCount(), 1u);
+	}
+
+	template <class TOpList>
+	void CheckValidationHoldsBackTheQueue()
+	{
+		WorkQueue &workQueue = WorkQueue::Get();
+		Queue<TOpList> queue;
+		Operation first(0, 0, true);
+		Operation second;
+		Operation third;
+
+		queue.QueueOperation(&first);
+		queue.QueueOperation(&second);
+		queue.QueueOperation(&third);
+
+		HRESULT hr = S_OK;
+		CHECK(workQueue.RunOne(&hr));
+		CHECK_EQUAL(hr, S_OK);
+		CHECK_EQUAL(queue.GetDispatched().size(), (size_t)1);
+
+		// The first operation goes on: the others are turned away, stay at
+		// the front in their order and keep their references.
+		CHECK(workQueue.RunOne(&hr));
+		CHECK_EQUAL(hr, MF_E_NOTACCEPTING);
+		workQueue.RunPending();
+		CHECK_EQUAL(queue.GetDispatched().size(), (size_t)1);
+		CHECK_EQUAL(queue.GetQueuedCount(), 2u);
+		CHECK_EQUAL(second.GetRefCount(), 2u);
+		CHECK_EQUAL(third.GetRefCount(), 2u);
+
+		// Ending it lets the next one start, and that one the last.
+		queue.Complete();
+		workQueue.RunPending();
+		CHECK_EQUAL(queue.GetQueuedCount(), 0u);
+		CHECK_EQUAL(queue.GetDispatched().size(), (size_t)3);
+		if (queue.GetDispatched().size() == 3)
+		{
+			CHECK(queue.GetDispatched()[0] == &first);
+			CHECK(queue.GetDispatched()[1] == &second);
+			CHECK(queue.GetDispatched()[2] == &third);
+		}
+		CHECK_EQUAL(first.GetRefCount(), 1u);
+		CHECK_EQUAL(second.GetRefCount(), 1u);
+		CHECK_EQUAL(third.GetRefCount(), 1u);
+		CHECK_EQUAL(queue.GetRefCount(), 1u);
+	}
+
+	template <class TOpList>
+	void CheckConcurrentProducers()
+	{
+		const uint32_t PRODUCERS = 4;
+		const uint32_t OPS_PER_PRODUCER = 5000;
+
+		WorkQueue &workQueue = WorkQueue::Get();
+		Queue<TOpList> queue;
+		std::deque<Operation> ops;
+		for (uint32_t p = 0; p < PRODUCERS; p++)
+		{
+			for (uint32_t i = 0; i < OPS_PER_PRODUCER; i++)
+			{
+				ops.emplace_back(p, i);
+			}
+		}
+
+		workQueue.StartWorkers(3);
+		std::atomic<uint32_t> cTurnedAway(0);
+		std::vector<std::thread> producers;
+		for (uint32_t p = 0; p < PRODUCERS; p++)
+		{
+			producers.push_back(std::thread([&, p]()
+			{
+				for (uint32_t i = 0; i < OPS_PER_PRODUCER; i++)
+				{
+					// A full ring turns the operation away; try again.
+					while (queue.QueueOperation(&ops[p * OPS_PER_PRODUCER + i]) == MF_E_NOTACCEPTING)
+					{
+						cTurnedAway++;
+						std::this_thread::yield();
+					}
+				}
+			}));
+		}
+		for (uint32_t p = 0; p < PRODUCERS; p++)
+		{
+			producers[p].join();
+		}
+		workQueue.StopWorkers();
+
+		const std::vector<Operation*> &dispatched = queue.GetDispatched();
+		CHECK_EQUAL(dispatched.size(), ops.size());
+		CHECK_EQUAL(queue.GetQueuedCount(), 0u);
+		CHECK_EQUAL(queue.GetMaxInside(), 1u);
+
+		uint32_t next[PRODUCERS] = {};
+		uint32_t cOutOfOrder = 0;
+		for (size_t i = 0; i < dispatched.size(); i++)
+		{
+			const Operation *pOp = dispatched[i];
+			cOutOfOrder += (pOp->sequence != next[pOp->producer]);
+			next[pOp->producer] = pOp->sequence + 1;
+		}
+		CHECK_EQUAL(cOutOfOrder, 0u);
+
+		uint32_t cLeaked = 0;
+		for (size_t i = 0; i < ops.size(); i++)
+		{
+			cLeaked += (ops[i].GetRefCount() != 1);
+		}
+		CHECK_EQUAL(cLeaked, 0u);
+		printf("  %u operations turned away by a full list and queued again\n", cTurnedAway.load());
+	}
+}
+
+TEST(ComPtrListDispatchesInOrder)
+{
+	CheckDispatchesInOrder<ComPtrList<Operation> >();
+}
+
+TEST(RingOpListDispatchesInOrder)
+{
+	CheckDispatchesInOrder<RingList>();
+}
+
+TEST(ComPtrListValidationHoldsBackTheQueue)
+{
+	CheckValidationHoldsBackTheQueue<ComPtrList<Operation> >();
+}
+
+TEST(RingOpListValidationHoldsBackTheQueue)
+{
+	CheckValidationHoldsBackTheQueue<RingList>();
+}
+
+TEST(FullRingTurnsOperationsAway)
+{
+	WorkQueue &workQueue = WorkQueue::Get();
+	Queue<RingList> queue;
+	std::vector<Operation> ops(DEFAULT_OP_RING_CAPACITY + 1);
+
+	for (size_t i = 0; i < DEFAULT_OP_RING_CAPACITY; i++)
+	{
+		CHECK_EQUAL(queue.QueueOperation(&ops[i]), S_OK);
+	}
+	CHECK_EQUAL(queue.QueueOperation(&ops[DEFAULT_OP_RING_CAPACITY]), MF_E_NOTACCEPTING);
+	CHECK_EQUAL(ops[DEFAULT_OP_RING_CAPACITY].GetRefCount(), 1u);
+	CHECK_EQUAL(workQueue.GetPendingCount(), (size_t)DEFAULT_OP_RING_CAPACITY);
+
+	// Once the ring has room again, it takes the operation.
+	workQueue.RunPending();
+	CHECK_EQUAL(queue.QueueOperation(&ops[DEFAULT_OP_RING_CAPACITY]), S_OK);
+	workQueue.RunPending();
+	CHECK_EQUAL(queue.GetDispatched().size(), ops.size());
+
+	// A ComPtrList grows instead.
+	Queue<ComPtrList<Operation> > listQueue;
+	for (size_t i = 0; i < ops.size(); i++)
+	{
+		CHECK_EQUAL(listQueue.QueueOperation(&ops[i]), S_OK);
+	}
+	workQueue.RunPending();
+	CHECK_EQUAL(listQueue.GetDispatched().size(), ops.size());
+}
+
+TEST(ComPtrListTakesConcurrentProducers)
+{
+	CheckConcurrentProducers<ComPtrList<Operation> >();
+}
+
+TEST(RingOpListTakesConcurrentProducers)
+{
+	CheckConcurrentProducers<RingList>();
+}
+
+int main() { return RunTests(); }
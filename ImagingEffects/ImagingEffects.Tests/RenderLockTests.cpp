@@ -0,0 +1,290 @@
+// A lock-wait trace of the transform's synchronous ProcessOutput, with a
+// slow render. Effect below models the locking of CImagingEffect, which does
+// not build here: ProcessOutput, GetOutputStatus, SetOutputType and Flush
+// take m_critSec as the transform does, the current media type is a
+// snapshot read without it, and the render sleeps. The lock profiler
+// records how long each of them waited for the lock.
+//
+// Rendering under the lock, as the transform used to, status queries wait
+// for the frame; rendering under AutoUnlock, as it does now, they do not,
+// while m_fRendering still keeps the media type from changing and a flush
+// during the render discards the frame.
+
+#define CRITSEC_PROFILING
+
+#include "WindowsShim.h"
+
+#include "CritSec.h"
+#include "RcuPtr.h"
+
+#include "TestHarness.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+// Media Foundation (mferror.h).
+#ifndef MF_E_INVALIDREQUEST
+#define MF_E_INVALIDREQUEST                                         ((HRESULT)0xC00D36B2)
+#define MF_E_TRANSFORM_NEED_MORE_INPUT                              ((HRESULT)0xC00D6D72)
+#define MF_E_TRANSFORM_CANNOT_CHANGE_MEDIATYPE_WHILE_PROCESSING     ((HRESULT)0xC00D6D74)
+#endif
+
+namespace
+{
+	const uint64_t RENDER_NS = 40 * 1000 * 1000;
+	const uint32_t FRAMES = 8;
+
+	uint64_t Now()
+	{
+		return LockProfiler::Now();
+	}
+
+	struct StreamTypes
+	{
+		uint32_t width;
+		uint32_t height;
+	};
+
+	// Effect class:
+	// The synchronous path of CImagingEffect, with a render that takes
+	// RENDER_NS. pszLock names m_critSec in the profile.
+
+	class Effect
+	{
+	public:
+		Effect(const char *pszLock, bool fRenderUnderLock)
+			: m_critSec(pszLock)
+			, m_fRenderUnderLock(fRenderUnderLock)
+			, m_fSample(false)
+			, m_fRendering(false)
+			, m_cFlushes(0)
+			, m_fInRender(false)
+		{
+			PublishStreamTypes(1920, 1080);
+		}
+
+		HRESULT ProcessInput()
+		{
+			AutoLock lock(m_critSec, "ProcessInput");
+			if (m_fSample)
+			{
+				return MF_E_NOTACCEPTING;
+			}
+			m_fSample = true;
+			return S_OK;
+		}
+
+		HRESULT ProcessOutput()
+		{
+			AutoLock lock(m_critSec, "ProcessOutput");
+			if (!m_fSample)
+			{
+				return MF_E_TRANSFORM_NEED_MORE_INPUT;
+			}
+
+			// Another call is rendering the sample.
+			if (m_fRendering)
+			{
+				return MF_E_INVALIDREQUEST;
+			}
+
+			if (m_fRenderUnderLock)
+			{
+				Render();
+			}
+			else
+			{
+				const uint64_t cFlushes = m_cFlushes;
+				m_fRendering = true;
+				{
+					AutoUnlock unlock(m_critSec);
+					Render();
+				}
+				m_fRendering = false;
+
+				// Flushed while rendering: the frame is discarded.
+				if (m_cFlushes != cFlushes)
+				{
+					return MF_E_TRANSFORM_NEED_MORE_INPUT;
+				}
+			}
+
+			m_fSample = false;
+			return S_OK;
+		}
+
+		bool GetOutputStatus()
+		{
+			AutoLock lock(m_critSec, "GetOutputStatus");
+			return m_fSample;
+		}
+
+		// Read from the snapshot, without the lock.
+		uint32_t GetOutputWidth() const
+		{
+			return m_streamTypes.Acquire()->width;
+		}
+
+		HRESULT SetOutputType(uint32_t width, uint32_t height)
+		{
+			AutoLock lock(m_critSec, "SetOutputType");
+			if (HasPendingOutput())
+			{
+				return MF_E_TRANSFORM_CANNOT_CHANGE_MEDIATYPE_WHILE_PROCESSING;
+			}
+			PublishStreamTypes(width, height);
+			return S_OK;
+		}
+
+		void Flush()
+		{
+			AutoLock lock(m_critSec, "Flush");
+			m_fSample = false;
+			m_cFlushes++;
+		}
+
+		bool IsInRender() const { return m_fInRender; }
+
+	private:
+		bool HasPendingOutput() const { return m_fSample || m_fRendering; }
+
+		void Render()
+		{
+			m_fInRender = true;
+			std::this_thread::sleep_for(std::chrono::nanoseconds(RENDER_NS));
+			m_fInRender = false;
+		}
+
+		void PublishStreamTypes(uint32_t width, uint32_t height)
+		{
+			std::shared_ptr<StreamTypes> spTypes = std::make_shared<StreamTypes>();
+			spTypes->width = width;
+			spTypes->height = height;
+			m_streamTypes.Publish(spTypes);
+		}
+
+		CritSec m_critSec;
+		const bool m_fRenderUnderLock;
+		bool m_fSample;
+		bool m_fRendering;
+		uint64_t m_cFlushes;
+		std::atomic<bool> m_fInRender;
+		RcuPtr<const StreamTypes> m_streamTypes;
+	};
+
+	struct QueryTrace
+	{
+		uint64_t cQueries;
+		uint64_t nsMaxQuery;                    // Longest GetOutputStatus, lock wait included.
+	};
+
+	// Streams FRAMES frames through the effect while another thread asks
+	// for its status and media type, as a pipeline's control thread does.
+	void StreamWithQueries(Effect *pEffect, QueryTrace *pTrace)
+	{
+		std::atomic<bool> fDone(false);
+		QueryTrace trace = {};
+		std::thread queries([&]()
+		{
+			while (!fDone)
+			{
+				const uint64_t nsBefore = Now();
+				pEffect->GetOutputStatus();
+				CHECK_EQUAL(pEffect->GetOutputWidth(), 1920u);
+				const uint64_t nsQuery = Now() - nsBefore;
+				trace.cQueries++;
+				trace.nsMaxQuery = (std::max)(trace.nsMaxQuery, nsQuery);
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		});
+
+		for (uint32_t i = 0; i < FRAMES; i++)
+		{
+			CHECK_EQUAL(pEffect->ProcessInput(), S_OK);
+			CHECK_EQUAL(pEffect->ProcessOutput(), S_OK);
+		}
+		fDone = true;
+		queries.join();
+
+		*pTrace = trace;
+		printf("  %llu status queries, the longest %.1f ms, over %u frames of %.0f ms\n",
+			(unsigned long long)trace.cQueries, trace.nsMaxQuery / 1e6, FRAMES, RENDER_NS / 1e6);
+	}
+}
+
+TEST(StatusQueriesWaitForRendersUnderTheLock)
+{
+	Effect effect("RenderUnderLock", true);
+	QueryTrace trace;
+	StreamWithQueries(&effect, &trace);
+
+	// The trace shows the stall: queries wait most of a frame.
+	const LockSiteStats &status = *LockProfiler::Get().GetSite("RenderUnderLock", "GetOutputStatus");
+	CHECK(status.GetContended() > 0);
+	CHECK(status.GetWait().GetMax() >= RENDER_NS / 2);
+	CHECK(trace.nsMaxQuery >= RENDER_NS / 2);
+
+	const LockSiteStats &output = *LockProfiler::Get().GetSite("RenderUnderLock", "ProcessOutput");
+	CHECK(output.GetHold().GetMax() >= RENDER_NS);
+}
+
+TEST(StatusQueriesDoNotWaitForRenders)
+{
+	Effect effect("RenderUnlocked", false);
+	QueryTrace trace;
+	StreamWithQueries(&effect, &trace);
+
+	// Queries only wait for the bookkeeping around a render, if at all.
+	const LockSiteStats &status = *LockProfiler::Get().GetSite("RenderUnlocked", "GetOutputStatus");
+	CHECK(status.GetWait().GetMax() < RENDER_NS / 4);
+	CHECK(trace.nsMaxQuery < RENDER_NS / 4);
+	CHECK(trace.cQueries >= FRAMES * 4);
+
+	// ProcessOutput holds the lock around the render, not through it.
+	const LockSiteStats &output = *LockProfiler::Get().GetSite("RenderUnlocked", "ProcessOutput");
+	CHECK_EQUAL(output.GetAcquisitions(), 2u * FRAMES);
+	CHECK(output.GetHold().GetMax() < RENDER_NS / 4);
+
+	printf("%s\n", LockProfiler::Get().SnapshotJson().c_str());
+}
+
+TEST(RenderKeepsTheStateWhileUnlocked)
+{
+	Effect effect("RenderFlushed", false);
+	CHECK_EQUAL(effect.ProcessInput(), S_OK);
+
+	HRESULT hrOutput = S_OK;
+	std::thread render([&]()
+	{
+		hrOutput = effect.ProcessOutput();
+	});
+	while (!effect.IsInRender())
+	{
+		std::this_thread::yield();
+	}
+
+	// The media type cannot change and the sample cannot be rendered twice,
+	// but neither waits for the frame.
+	const uint64_t nsBefore = Now();
+	CHECK_EQUAL(effect.SetOutputType(1280, 720), MF_E_TRANSFORM_CANNOT_CHANGE_MEDIATYPE_WHILE_PROCESSING);
+	CHECK_EQUAL(effect.ProcessOutput(), MF_E_INVALIDREQUEST);
+	CHECK_EQUAL(effect.ProcessInput(), MF_E_NOTACCEPTING);
+	CHECK(effect.GetOutputStatus());
+
+	// A flush does not wait either, and the frame is then discarded.
+	effect.Flush();
+	CHECK(Now() - nsBefore < RENDER_NS / 4);
+	CHECK(!effect.GetOutputStatus());
+	render.join();
+	CHECK_EQUAL(hrOutput, MF_E_TRANSFORM_NEED_MORE_INPUT);
+
+	// Once the render is over, the type can change.
+	CHECK_EQUAL(effect.SetOutputType(1280, 720), S_OK);
+	CHECK_EQUAL(effect.GetOutputWidth(), 1280u);
+}
+
+int main() { return RunTests(); }
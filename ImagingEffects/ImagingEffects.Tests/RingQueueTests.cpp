@@ -0,0 +1,162 @@
+// Tests of the lock-free ring queues: capacity and wrap-around on one
+// thread, then producers and a consumer hammering small queues, checking
+// that every item arrives exactly once and each producer's items arrive in
+// the order it pushed them.
+
+#include "RingQueue.h"
+
+#include "TestHarness.h"
+
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	// An item of the stress tests: which producer pushed it, and its number
+	// among that producer's items.
+	uint64_t MakeItem(uint32_t iProducer, uint32_t index)
+	{
+		return ((uint64_t)iProducer << 32) | index;
+	}
+}
+
+TEST(CapacityIsRoundedUpToAPowerOfTwo)
+{
+	MpscRingQueue<int> mpsc(5);
+	SpscRingQueue<int> spsc(0);
+	CHECK_EQUAL(mpsc.GetCapacity(), 8u);
+	CHECK_EQUAL(spsc.GetCapacity(), 1u);
+}
+
+TEST(FillsEmptiesAndWraps)
+{
+	MpscRingQueue<int> mpsc(4);
+	SpscRingQueue<int> spsc(4);
+	int next = 0;
+	int expected = 0;
+
+	// Many laps around the ring, never more than the capacity at once.
+	for (int lap = 0; lap < 10; lap++)
+	{
+		while (mpsc.TryPush(next))
+		{
+			CHECK(spsc.TryPush(next));
+			next++;
+		}
+		CHECK(!spsc.TryPush(-1));
+		CHECK_EQUAL(mpsc.GetCount(), 4u);
+
+		int item = -1;
+		CHECK(mpsc.Peek(&item));
+		CHECK_EQUAL(item, expected);
+		for (int i = 0; i < 3; i++, expected++)
+		{
+			CHECK(mpsc.TryPop(&item));
+			CHECK_EQUAL(item, expected);
+			CHECK(spsc.TryPop(&item));
+			CHECK_EQUAL(item, expected);
+		}
+	}
+
+	int item;
+	CHECK(mpsc.TryPop(nullptr));
+	CHECK(spsc.TryPop(nullptr));
+	CHECK(!mpsc.TryPop(&item));
+	CHECK(!spsc.Peek(&item));
+	CHECK(mpsc.IsEmpty() && spsc.IsEmpty());
+}
+
+TEST(SpscStress)
+{
+	const uint32_t ITEM_COUNT = 1000000;
+	SpscRingQueue<uint64_t> queue(16);
+
+	std::thread producer([&queue]()
+	{
+		for (uint32_t i = 0; i < ITEM_COUNT; i++)
+		{
+			while (!queue.TryPush(MakeItem(0, i)))
+			{
+				std::this_thread::yield();
+			}
+		}
+	});
+
+	uint32_t cOutOfOrder = 0;
+	for (uint32_t i = 0; i < ITEM_COUNT; i++)
+	{
+		uint64_t item;
+		while (!queue.TryPop(&item))
+		{
+			std::this_thread::yield();
+		}
+		if (item != MakeItem(0, i))
+		{
+			cOutOfOrder++;
+		}
+	}
+	producer.join();
+
+	CHECK_EQUAL(cOutOfOrder, 0u);
+	CHECK(queue.IsEmpty());
+}
+
+TEST(MpscStress)
+{
+	const uint32_t PRODUCER_COUNT = 4;
+	const uint32_t ITEMS_PER_PRODUCER = 250000;
+	MpscRingQueue<uint64_t> queue(8);
+
+	std::vector<std::thread> producers;
+	for (uint32_t iProducer = 0; iProducer < PRODUCER_COUNT; iProducer++)
+	{
+		producers.push_back(std::thread([&queue, iProducer]()
+		{
+			for (uint32_t i = 0; i < ITEMS_PER_PRODUCER; i++)
+			{
+				while (!queue.TryPush(MakeItem(iProducer, i)))
+				{
+					std::this_thread::yield();
+				}
+			}
+		}));
+	}
+
+	// Each producer's items come out in order, none missing or repeated.
+	std::vector<uint32_t> next(PRODUCER_COUNT, 0);
+	uint32_t cWrong = 0;
+	for (uint32_t cPopped = 0; cPopped < PRODUCER_COUNT * ITEMS_PER_PRODUCER; cPopped++)
+	{
+		uint64_t item;
+		while (!queue.TryPop(&item))
+		{
+			std::this_thread::yield();
+		}
+
+		const uint32_t iProducer = (uint32_t)(item >> 32);
+		if (iProducer >= PRODUCER_COUNT || (uint32_t)item != next[iProducer])
+		{
+			cWrong++;
+			continue;
+		}
+		next[iProducer]++;
+	}
+
+	for (size_t i = 0; i < producers.size(); i++)
+	{
+		producers[i].join();
+	}
+
+	CHECK_EQUAL(cWrong, 0u);
+	for (uint32_t iProducer = 0; iProducer < PRODUCER_COUNT; iProducer++)
+	{
+		CHECK_EQUAL(next[iProducer], ITEMS_PER_PRODUCER);
+	}
+	CHECK(queue.IsEmpty());
+}
+
+int main()
+{
+	return RunTests();
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+// Frames for the tests: stored in a buffer of their own, as Media Foundation
+// lays them out, with any stride and either row order, and filled with a
+// repeatable pattern.
+//
+// This file does not depend on Windows headers.
+
+#include "VideoFrame.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace ImagingEffectsTests
+{
+	// TestFrame class:
+	// A frame and the memory behind it.
+
+	class TestFrame
+	{
+	public:
+		// stride is the pitch of the first plane, 0 for the minimum; it is
+		// negated for a bottom-up frame. The pixels are filled from seed.
+		TestFrame(ImagingEffects::PixelFormat format, uint32_t width, uint32_t height, uint32_t stride = 0, bool fBottomUp = false, uint32_t seed = 1)
+		{
+			const uint32_t cbRow = (stride > 0) ? stride : ImagingEffects::GetMinimumStride(format, width);
+			const uint32_t cRows = ImagingEffects::GetBufferRowCount(format, height);
+			m_buffer.resize((size_t)cbRow * cRows);
+
+			uint8_t *pTopRow = fBottomUp ? &m_buffer[(size_t)cbRow * (cRows - 1)] : &m_buffer[0];
+			const ptrdiff_t signedStride = fBottomUp ? -(ptrdiff_t)cbRow : (ptrdiff_t)cbRow;
+			if (!ImagingEffects::WrapVideoFrame(format, width, height, pTopRow, signedStride, &m_buffer[0], m_buffer.size(), &m_frame))
+			{
+				abort();
+			}
+
+			Fill(seed);
+		}
+
+		const ImagingEffects::VideoFrame& Get() const { return m_frame; }
+		const std::vector<uint8_t>& GetBuffer() const { return m_buffer; }
+
+		// Fills the whole buffer, padding included, from seed.
+		void Fill(uint32_t seed)
+		{
+			uint32_t state = seed * 2654435761u + 1;
+			for (size_t i = 0; i < m_buffer.size(); i++)
+			{
+				state = state * 1664525u + 1013904223u;
+				m_buffer[i] = (uint8_t)(state >> 24);
+			}
+		}
+
+	private:
+		TestFrame(const TestFrame&);
+		TestFrame& operator=(const TestFrame&);
+
+		std::vector<uint8_t> m_buffer;
+		ImagingEffects::VideoFrame m_frame;
+	};
+
+	// True if the frames have the same format, size and pixels. Row padding
+	// is not compared.
+	inline bool FramesEqual(const ImagingEffects::VideoFrame &a, const ImagingEffects::VideoFrame &b)
+	{
+		if (a.format != b.format || a.width != b.width || a.height != b.height || a.cPlanes != b.cPlanes)
+		{
+			return false;
+		}
+
+		ImagingEffects::PlaneShape shapes[3];
+		const uint32_t cPlanes = ImagingEffects::GetPlaneShapes(a.format, a.width, a.height, 0, shapes);
+		for (uint32_t i = 0; i < cPlanes; i++)
+		{
+			for (uint32_t row = 0; row < shapes[i].cRows; row++)
+			{
+				const uint8_t *pRowA = a.planes[i].pData + a.planes[i].stride * (ptrdiff_t)row;
+				const uint8_t *pRowB = b.planes[i].pData + b.planes[i].stride * (ptrdiff_t)row;
+				if (memcmp(pRowA, pRowB, shapes[i].cbRow) != 0)
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+// A minimal test harness for the portable code.
+//
+// Each test file is an executable of its own, run by ctest. Tests are
+// functions declared with TEST; CHECK and CHECK_EQUAL report a failure and
+// let the test go on, so one run shows every broken check:
+//
+//     TEST(SplitsEvenly)
+//     {
+//         CHECK_EQUAL(SplitIntoBands(0, 8, 4, 2, &bands), 4u);
+//     }
+//
+//     int main() { return RunTests(); }
+//
+// This file does not depend on Windows headers.
+
+#include <stdio.h>
+#include <vector>
+
+namespace ImagingEffectsTests
+{
+	typedef void (*TestFn)();
+
+	struct TestCase
+	{
+		const char *pszName;
+		TestFn fn;
+	};
+
+	inline std::vector<TestCase>& GetTests()
+	{
+		static std::vector<TestCase> s_tests;
+		return s_tests;
+	}
+
+	inline int& GetFailureCount()
+	{
+		static int s_cFailures = 0;
+		return s_cFailures;
+	}
+
+	inline void ReportFailure(const char *pszFile, int line, const char *pszExpr)
+	{
+		fprintf(stderr, "%s(%d): check failed: %s\n", pszFile, line, pszExpr);
+		GetFailureCount()++;
+	}
+
+	struct TestRegistrar
+	{
+		TestRegistrar(const char *pszName, TestFn fn)
+		{
+			TestCase test = { pszName, fn };
+			GetTests().push_back(test);
+		}
+	};
+
+	// Runs every test in the order they were declared. Returns the exit
+	// code for ctest: 0 if every check passed.
+	inline int RunTests()
+	{
+		int cFailedTests = 0;
+		for (size_t i = 0; i < GetTests().size(); i++)
+		{
+			const int cFailuresBefore = GetFailureCount();
+			GetTests()[i].fn();
+			const bool fPassed = (GetFailureCount() == cFailuresBefore);
+			printf("%s %s\n", fPassed ? "PASS" : "FAIL", GetTests()[i].pszName);
+			if (!fPassed)
+			{
+				cFailedTests++;
+			}
+		}
+
+		printf("%d of %d tests failed\n", cFailedTests, (int)GetTests().size());
+		return (cFailedTests == 0) ? 0 : 1;
+	}
+}
+
+#define TEST(name) \
+	static void name(); \
+	static ImagingEffectsTests::TestRegistrar s_registrar_##name(#name, name); \
+	static void name()
+
+#define CHECK(expr) \
+	((expr) ? (void)0 : ImagingEffectsTests::ReportFailure(__FILE__, __LINE__, #expr))
+
+#define CHECK_EQUAL(actual, expected) \
+	(((actual) == (expected)) ? (void)0 : ImagingEffectsTests::ReportFailure(__FILE__, __LINE__, #actual " == " #expected))
+
+using ImagingEffectsTests::RunTests;
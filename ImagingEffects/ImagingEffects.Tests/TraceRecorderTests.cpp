@@ -0,0 +1,455 @@
+// Tests of the trace recorder: the dump is valid JSON in the Trace Event
+// Format, with the phases, names, values and threads that were recorded,
+// oldest first; scopes begin and end on their thread; rings keep the newest
+// events; and threads beyond the limit are counted as lost.
+//
+// The dump is read back with a small JSON parser, so that a malformed one
+// fails here rather than in chrome://tracing.
+
+#include "TraceRecorder.h"
+
+#include "TestHarness.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace ImagingEffects;
+
+namespace
+{
+	// JsonValue struct:
+	// A parsed JSON value. Only what the tests look at is kept.
+
+	struct JsonValue
+	{
+		enum Type { Null, Bool, Number, String, Array, Object };
+
+		Type type;
+		double number;
+		std::string text;
+		std::vector<JsonValue> elements;
+		std::map<std::string, JsonValue> members;
+
+		JsonValue() : type(Null), number(0)
+		{
+		}
+
+		const JsonValue& operator[](const char *pszName) const
+		{
+			static const JsonValue s_null;
+			std::map<std::string, JsonValue>::const_iterator it = members.find(pszName);
+			return (it != members.end()) ? it->second : s_null;
+		}
+	};
+
+	// JsonParser class:
+	// Parses a whole document, strictly: no trailing commas, nothing after
+	// the value.
+
+	class JsonParser
+	{
+	public:
+		explicit JsonParser(const std::string &json)
+			: m_json(json)
+			, m_p(m_json.c_str())
+		{
+		}
+
+		bool Parse(JsonValue *pValue)
+		{
+			return ParseValue(pValue) && (SkipSpace(), *m_p == '\0');
+		}
+
+	private:
+		void SkipSpace()
+		{
+			while (*m_p == ' ' || *m_p == '\n' || *m_p == '\r' || *m_p == '\t')
+			{
+				m_p++;
+			}
+		}
+
+		bool Expect(char c)
+		{
+			SkipSpace();
+			if (*m_p != c)
+			{
+				return false;
+			}
+			m_p++;
+			return true;
+		}
+
+		bool ParseValue(JsonValue *pValue)
+		{
+			SkipSpace();
+			switch (*m_p)
+			{
+			case '{':
+				return ParseObject(pValue);
+			case '[':
+				return ParseArray(pValue);
+			case '"':
+				pValue->type = JsonValue::String;
+				return ParseString(&pValue->text);
+			case 't':
+			case 'f':
+			case 'n':
+				return ParseWord(pValue);
+			default:
+				return ParseNumber(pValue);
+			}
+		}
+
+		bool ParseObject(JsonValue *pValue)
+		{
+			pValue->type = JsonValue::Object;
+			m_p++;
+			if (Expect('}'))
+			{
+				return true;
+			}
+			do
+			{
+				std::string name;
+				SkipSpace();
+				if (!ParseString(&name) || !Expect(':') || !ParseValue(&pValue->members[name]))
+				{
+					return false;
+				}
+			} while (Expect(','));
+			return Expect('}');
+		}
+
+		bool ParseArray(JsonValue *pValue)
+		{
+			pValue->type = JsonValue::Array;
+			m_p++;
+			if (Expect(']'))
+			{
+				return true;
+			}
+			do
+			{
+				pValue->elements.push_back(JsonValue());
+				if (!ParseValue(&pValue->elements.back()))
+				{
+					return false;
+				}
+			} while (Expect(','));
+			return Expect(']');
+		}
+
+		// Only the escapes the recorder writes are accepted.
+		bool ParseString(std::string *pText)
+		{
+			if (*m_p != '"')
+			{
+				return false;
+			}
+			for (m_p++; *m_p != '"'; m_p++)
+			{
+				if (*m_p == '\0' || (unsigned char)*m_p < 0x20)
+				{
+					return false;
+				}
+				if (*m_p == '\\')
+				{
+					m_p++;
+					if (*m_p != '"' && *m_p != '\\')
+					{
+						return false;
+					}
+				}
+				pText->push_back(*m_p);
+			}
+			m_p++;
+			return true;
+		}
+
+		bool ParseWord(JsonValue *pValue)
+		{
+			const char *words[] = { "true", "false", "null" };
+			for (int i = 0; i < 3; i++)
+			{
+				const size_t cch = strlen(words[i]);
+				if (strncmp(m_p, words[i], cch) == 0)
+				{
+					m_p += cch;
+					pValue->type = (i < 2) ? JsonValue::Bool : JsonValue::Null;
+					pValue->number = (i == 0) ? 1 : 0;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		bool ParseNumber(JsonValue *pValue)
+		{
+			char *pEnd = nullptr;
+			pValue->number = strtod(m_p, &pEnd);
+			if (pEnd == m_p)
+			{
+				return false;
+			}
+			pValue->type = JsonValue::Number;
+			m_p = pEnd;
+			return true;
+		}
+
+		const std::string m_json;
+		const char *m_p;
+	};
+
+	// Dumps the recorder and parses the dump. Returns the events, or an
+	// empty array (and a failed check) if the dump is not valid.
+	JsonValue DumpEvents()
+	{
+		JsonValue document;
+		JsonParser parser(TraceRecorder::Get().DumpJson());
+		CHECK(parser.Parse(&document));
+		CHECK_EQUAL(document["displayTimeUnit"].text, std::string("ns"));
+		CHECK_EQUAL(document["otherData"]["lostEvents"].type, JsonValue::Number);
+		CHECK_EQUAL(document["traceEvents"].type, JsonValue::Array);
+		return document["traceEvents"];
+	}
+
+	// True if the event has the phase and name, and the fields of its phase.
+	bool IsEvent(const JsonValue &ev, char phase, const char *pszName)
+	{
+		if (ev["ph"].text != std::string(1, phase) || ev["name"].text != pszName)
+		{
+			return false;
+		}
+		if (ev["ts"].type != JsonValue::Number || ev["pid"].type != JsonValue::Number || ev["tid"].type != JsonValue::Number)
+		{
+			return false;
+		}
+
+		const bool fHasValue = (phase == TracePhase_Counter || phase == TracePhase_Instant);
+		if ((ev["args"]["value"].type == JsonValue::Number) != fHasValue)
+		{
+			return false;
+		}
+		return phase != TracePhase_Instant || ev["s"].text == "t";
+	}
+
+	// Every begin of a thread is ended, by the same name, innermost first.
+	bool ScopesNest(const JsonValue &events)
+	{
+		std::map<double, std::vector<std::string> > open;
+		for (size_t i = 0; i < events.elements.size(); i++)
+		{
+			const JsonValue &ev = events.elements[i];
+			std::vector<std::string> &stack = open[ev["tid"].number];
+			if (ev["ph"].text == "B")
+			{
+				stack.push_back(ev["name"].text);
+			}
+			else if (ev["ph"].text == "E")
+			{
+				if (stack.empty() || stack.back() != ev["name"].text)
+				{
+					return false;
+				}
+				stack.pop_back();
+			}
+		}
+
+		for (std::map<double, std::vector<std::string> >::const_iterator it = open.begin(); it != open.end(); ++it)
+		{
+			if (!it->second.empty())
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool IsOldestFirst(const JsonValue &events)
+	{
+		for (size_t i = 1; i < events.elements.size(); i++)
+		{
+			if (events.elements[i]["ts"].number < events.elements[i - 1]["ts"].number)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+TEST(DisabledRecordsNothing)
+{
+	TraceRecorder::Get().SetEnabled(false);
+	TraceRecorder::Get().Clear();
+	{
+		TraceScope scope("Render");
+		TraceRecorder::Get().Counter("FramesInFlight", 3);
+	}
+	CHECK(DumpEvents().elements.empty());
+}
+
+TEST(EventsOfEachPhase)
+{
+	TraceRecorder &recorder = TraceRecorder::Get();
+	recorder.Clear();
+	recorder.SetEnabled(true);
+	{
+		TraceScope frame("Frame");
+		recorder.Counter("FramesInFlight", 2);
+		{
+			TraceScope render("Render");
+		}
+		recorder.Instant("Drop", -1);
+	}
+	recorder.SetEnabled(false);
+
+	const JsonValue events = DumpEvents();
+	CHECK_EQUAL(events.elements.size(), 6u);
+	if (events.elements.size() == 6)
+	{
+		CHECK(IsEvent(events.elements[0], 'B', "Frame"));
+		CHECK(IsEvent(events.elements[1], 'C', "FramesInFlight"));
+		CHECK_EQUAL(events.elements[1]["args"]["value"].number, 2.0);
+		CHECK(IsEvent(events.elements[2], 'B', "Render"));
+		CHECK(IsEvent(events.elements[3], 'E', "Render"));
+		CHECK(IsEvent(events.elements[4], 'i', "Drop"));
+		CHECK_EQUAL(events.elements[4]["args"]["value"].number, -1.0);
+		CHECK(IsEvent(events.elements[5], 'E', "Frame"));
+	}
+	CHECK(IsOldestFirst(events));
+	CHECK(ScopesNest(events));
+}
+
+TEST(TimesAreMicroseconds)
+{
+	TraceRecorder &recorder = TraceRecorder::Get();
+	recorder.Clear();
+	recorder.SetEnabled(true);
+	const uint64_t tBefore = TraceRecorder::Now();
+	recorder.Instant("Mark", 0);
+	const uint64_t tAfter = TraceRecorder::Now();
+	recorder.SetEnabled(false);
+
+	const JsonValue events = DumpEvents();
+	CHECK_EQUAL(events.elements.size(), 1u);
+	if (events.elements.size() == 1)
+	{
+		// The stamp, in microseconds, lies between the two clock reads.
+		const double us = events.elements[0]["ts"].number;
+		CHECK(us >= (double)(tBefore / 1000) && us <= (double)(tAfter / 1000 + 1));
+	}
+}
+
+TEST(NamesAreEscaped)
+{
+	TraceRecorder &recorder = TraceRecorder::Get();
+	recorder.Clear();
+	recorder.SetEnabled(true);
+	recorder.Instant("Say \"cheese\" \\o/", 1);
+	recorder.SetEnabled(false);
+
+	const JsonValue events = DumpEvents();
+	CHECK_EQUAL(events.elements.size(), 1u);
+	if (events.elements.size() == 1)
+	{
+		CHECK(IsEvent(events.elements[0], 'i', "Say \"cheese\" \\o/"));
+	}
+}
+
+TEST(ThreadsRecordIntoRingsOfTheirOwn)
+{
+	const int THREAD_COUNT = 4;
+	const int SCOPES_PER_THREAD = 500;
+	TraceRecorder &recorder = TraceRecorder::Get();
+	recorder.Clear();
+	recorder.SetEnabled(true);
+
+	std::vector<std::thread> threads;
+	for (int iThread = 0; iThread < THREAD_COUNT; iThread++)
+	{
+		threads.push_back(std::thread([]()
+		{
+			for (int i = 0; i < SCOPES_PER_THREAD; i++)
+			{
+				TraceScope outer("Frame");
+				TraceScope inner("Render");
+			}
+		}));
+	}
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+	recorder.SetEnabled(false);
+
+	const JsonValue events = DumpEvents();
+	CHECK_EQUAL(events.elements.size(), (size_t)(THREAD_COUNT * SCOPES_PER_THREAD * 4));
+	CHECK(IsOldestFirst(events));
+	CHECK(ScopesNest(events));
+
+	std::map<double, int> cEventsPerThread;
+	for (size_t i = 0; i < events.elements.size(); i++)
+	{
+		cEventsPerThread[events.elements[i]["tid"].number]++;
+	}
+	CHECK_EQUAL(cEventsPerThread.size(), (size_t)THREAD_COUNT);
+}
+
+TEST(RingsKeepTheNewestEvents)
+{
+	TraceRecorder &recorder = TraceRecorder::Get();
+	recorder.Clear();
+	recorder.SetEnabled(true);
+	for (uint32_t i = 0; i < 3 * TRACE_RING_EVENTS + 5; i++)
+	{
+		recorder.Counter("Frame", i);
+	}
+	recorder.SetEnabled(false);
+
+	const JsonValue events = DumpEvents();
+	CHECK_EQUAL(events.elements.size(), (size_t)TRACE_RING_EVENTS);
+	if (!events.elements.empty())
+	{
+		CHECK_EQUAL(events.elements.front()["args"]["value"].number, (double)(2 * TRACE_RING_EVENTS + 5));
+		CHECK_EQUAL(events.elements.back()["args"]["value"].number, (double)(3 * TRACE_RING_EVENTS + 4));
+	}
+
+	// Cleared events are left out.
+	recorder.Clear();
+	CHECK(DumpEvents().elements.empty());
+}
+
+// Runs last: the threads it starts use up the rings.
+TEST(ThreadsBeyondTheLimitAreLost)
+{
+	TraceRecorder &recorder = TraceRecorder::Get();
+	recorder.Clear();
+	recorder.SetEnabled(true);
+	for (uint32_t i = 0; i < TRACE_MAX_THREADS; i++)
+	{
+		std::thread thread([&recorder]()
+		{
+			recorder.Instant("Start", 0);
+		});
+		thread.join();
+	}
+	recorder.SetEnabled(false);
+
+	CHECK(recorder.GetLostEvents() > 0);
+	JsonValue document;
+	JsonParser parser(recorder.DumpJson());
+	CHECK(parser.Parse(&document));
+	CHECK_EQUAL(document["otherData"]["lostEvents"].number, (double)recorder.GetLostEvents());
+	CHECK(document["traceEvents"].elements.size() < TRACE_MAX_THREADS);
+}
+
+int main()
+{
+	return RunTests();
+}
@@ -0,0 +1,160 @@
+// Tests of the frame model: the strides and sizes assumed for a format
+// agree with each other, frames are wrapped in place whatever their padding
+// and row order, buffers that are too small are refused, and frames are
+// copied and converted band by band as they are as a whole.
+
+#include "VideoFrame.h"
+
+#include "TestFrames.h"
+#include "TestHarness.h"
+
+using namespace ImagingEffects;
+using namespace ImagingEffectsTests;
+
+namespace
+{
+	const PixelFormat s_formats[] = { PixelFormat_NV12, PixelFormat_YUY2, PixelFormat_I420 };
+}
+
+TEST(DefaultStrideAndImageSizeAgree)
+{
+	for (size_t iFormat = 0; iFormat < 3; iFormat++)
+	{
+		const PixelFormat format = s_formats[iFormat];
+		for (uint32_t width = 1; width <= 100; width++)
+		{
+			for (uint32_t height = 1; height <= 20; height++)
+			{
+				const uint32_t stride = GetDefaultStride(format, width);
+				uint32_t cbImage = 0;
+				CHECK(stride >= GetMinimumStride(format, width));
+				CHECK(GetImageSize(format, width, height, &cbImage));
+				CHECK_EQUAL(cbImage, stride * GetBufferRowCount(format, height));
+
+				// A buffer of the image size holds a frame at the default
+				// stride, and one byte less does not.
+				std::vector<uint8_t> buffer(cbImage);
+				VideoFrame frame;
+				CHECK(WrapVideoFrame(format, width, height, &buffer[0], stride, &buffer[0], cbImage, &frame));
+				CHECK(!WrapVideoFrame(format, width, height, &buffer[0], stride, &buffer[0], cbImage - 1, &frame));
+			}
+		}
+	}
+
+	uint32_t cbImage;
+	CHECK(!GetImageSize(PixelFormat_YUY2, 65536, 65536, &cbImage));
+}
+
+TEST(WrapsPaddedFramesInPlace)
+{
+	std::vector<uint8_t> buffer(128 * 15);
+	VideoFrame frame;
+
+	CHECK(WrapVideoFrame(PixelFormat_NV12, 99, 10, &buffer[0], 128, &buffer[0], buffer.size(), &frame));
+	CHECK_EQUAL(frame.cPlanes, 2u);
+	CHECK(frame.planes[0].pData == &buffer[0]);
+	CHECK(frame.planes[1].pData == &buffer[128 * 10]);
+	CHECK_EQUAL(frame.planes[1].stride, (ptrdiff_t)128);
+	CHECK(IsTopDown(frame));
+
+	CHECK(WrapVideoFrame(PixelFormat_I420, 99, 10, &buffer[0], 128, &buffer[0], buffer.size(), &frame));
+	CHECK_EQUAL(frame.cPlanes, 3u);
+	CHECK(frame.planes[1].pData == &buffer[128 * 10]);
+	CHECK(frame.planes[2].pData == &buffer[128 * 10 + 64 * 5]);
+	CHECK_EQUAL(frame.planes[2].stride, (ptrdiff_t)64);
+}
+
+TEST(WrapsBottomUpFramesInPlace)
+{
+	std::vector<uint8_t> buffer(128 * 15);
+	uint8_t *pTopRow = &buffer[128 * 14];
+	VideoFrame frame;
+
+	// The planes follow each other in the direction of the stride.
+	CHECK(WrapVideoFrame(PixelFormat_NV12, 100, 10, pTopRow, -128, &buffer[0], buffer.size(), &frame));
+	CHECK(frame.planes[0].pData == pTopRow);
+	CHECK(frame.planes[1].pData == pTopRow - 128 * 10);
+	CHECK_EQUAL(frame.planes[1].stride, (ptrdiff_t)-128);
+	CHECK(!IsTopDown(frame));
+
+	// One row further and the chroma plane leaves the buffer.
+	CHECK(!WrapVideoFrame(PixelFormat_NV12, 100, 10, pTopRow - 128, -128, &buffer[0], buffer.size(), &frame));
+
+	// I420 halves the stride, which means nothing for bottom-up frames.
+	CHECK(!WrapVideoFrame(PixelFormat_I420, 100, 10, pTopRow, -128, &buffer[0], buffer.size(), &frame));
+}
+
+TEST(RefusesWhatDoesNotFit)
+{
+	std::vector<uint8_t> buffer(64 * 64);
+	VideoFrame frame;
+
+	CHECK(!WrapVideoFrame(PixelFormat_YUY2, 33, 4, &buffer[0], 66, &buffer[0], buffer.size(), &frame));
+	CHECK(!WrapVideoFrame(PixelFormat_NV12, 33, 4, &buffer[0], 33, &buffer[0], buffer.size(), &frame));
+	CHECK(!WrapVideoFrame(PixelFormat_I420, 32, 4, &buffer[0], 33, &buffer[0], buffer.size(), &frame));
+	CHECK(!WrapVideoFrame(PixelFormat_NV12, 0, 4, &buffer[0], 64, &buffer[0], buffer.size(), &frame));
+	CHECK(!WrapVideoFrame(PixelFormat_NV12, 64, 4, nullptr, 64, nullptr, 0, &frame));
+	CHECK(!WrapVideoFrame(PixelFormat_NV12, 64, 4, &buffer[0] + buffer.size(), 64, &buffer[0], buffer.size(), &frame));
+	CHECK(!WrapVideoFrame(PixelFormat_NV12, 64, 64, &buffer[0], 64, &buffer[0], buffer.size(), &frame));
+
+	// Without the buffer bounds only the stride is checked.
+	CHECK(WrapVideoFrame(PixelFormat_NV12, 64, 64, &buffer[0], 64, nullptr, 0, &frame));
+}
+
+TEST(PlaneShapesOfOddSizes)
+{
+	PlaneShape shapes[3];
+	CHECK_EQUAL(GetPlaneShapes(PixelFormat_NV12, 5, 3, 8, shapes), 2u);
+	CHECK_EQUAL(shapes[0].cbRow, 5u);
+	CHECK_EQUAL(shapes[1].cbRow, 6u);
+	CHECK_EQUAL(shapes[1].cRows, 2u);
+	CHECK_EQUAL(GetPlaneShapes(PixelFormat_YUY2, 5, 3, 12, shapes), 1u);
+	CHECK_EQUAL(shapes[0].cbRow, 12u);
+	CHECK_EQUAL(GetPlaneShapes(PixelFormat_I420, 5, 3, 8, shapes), 3u);
+	CHECK_EQUAL(shapes[2].cbRow, 3u);
+	CHECK_EQUAL(shapes[2].stride, (ptrdiff_t)4);
+	CHECK_EQUAL(GetPlaneShapes((PixelFormat)7, 5, 3, 8, shapes), 0u);
+}
+
+// Every pair of formats, padded and bottom-up where the format allows it,
+// converted in bands starting on even rows.
+TEST(BandsConvertAsTheWholeFrame)
+{
+	const uint32_t width = 37;
+	const uint32_t height = 23;
+	for (size_t iSrc = 0; iSrc < 3; iSrc++)
+	{
+		for (size_t iDst = 0; iDst < 3; iDst++)
+		{
+			for (int layout = 0; layout < 2; layout++)
+			{
+				const PixelFormat srcFormat = s_formats[iSrc];
+				const PixelFormat dstFormat = s_formats[iDst];
+				const bool fBottomUp = (layout == 1);
+				const uint32_t srcStride = GetMinimumStride(srcFormat, width) + (fBottomUp ? 10 : 0);
+				const uint32_t dstStride = GetMinimumStride(dstFormat, width) + (fBottomUp ? 0 : 26);
+
+				TestFrame src(srcFormat, width, height, srcStride, fBottomUp && srcFormat != PixelFormat_I420, 1);
+				TestFrame whole(dstFormat, width, height, 0, false, 2);
+				TestFrame banded(dstFormat, width, height, dstStride, fBottomUp && dstFormat != PixelFormat_I420, 3);
+
+				ConvertVideoFrame(src.Get(), whole.Get(), 0, height);
+				for (uint32_t top = 0; top < height; top += 6)
+				{
+					ConvertVideoFrame(src.Get(), banded.Get(), top, top + 6);
+				}
+				CHECK(FramesEqual(banded.Get(), whole.Get()));
+
+				if (srcFormat == dstFormat)
+				{
+					CHECK(FramesEqual(whole.Get(), src.Get()));
+				}
+			}
+		}
+	}
+}
+
+int main()
+{
+	return RunTests();
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+// The few Windows definitions the headers in Common use, so that their
+// tests build on other systems too. On Windows this is windows.h.
+//
+// Include it before the Common header under test:
+//
+//     #include "WindowsShim.h"
+//     #include "LinkList.h"
+//
+// CRITICAL_SECTION is a recursive mutex, enough for CritSec.h and OpQueue.h.
+// The Media Foundation work queue is only declared: MFPutWorkItem2 is
+// defined by WorkQueue.h, which runs the work items on threads of its own.
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+
+typedef uint32_t DWORD;
+typedef uint32_t ULONG;
+typedef int32_t LONG;
+typedef int32_t HRESULT;
+typedef int BOOL;
+
+#define S_OK            ((HRESULT)0)
+#define E_NOTIMPL       ((HRESULT)0x80004001)
+#define E_NOINTERFACE   ((HRESULT)0x80004002)
+#define E_FAIL          ((HRESULT)0x80004005)
+#define E_POINTER       ((HRESULT)0x80004003)
+#define E_OUTOFMEMORY   ((HRESULT)0x8007000E)
+#define E_INVALIDARG    ((HRESULT)0x80070057)
+#define SUCCEEDED(hr)   ((HRESULT)(hr) >= 0)
+#define FAILED(hr)      ((HRESULT)(hr) < 0)
+#define FALSE           0
+#define TRUE            1
+
+#define STDMETHODIMP            HRESULT
+#define STDMETHODIMP_(type)     type
+
+// Code analysis annotations.
+#define _Acquires_lock_(lock)
+#define _Releases_lock_(lock)
+
+// An interface identifier: one per type, told apart by address.
+struct IID
+{
+	const void *pId;
+
+	bool operator==(const IID &other) const { return pId == other.pId; }
+};
+typedef const IID& REFIID;
+
+template <class T>
+REFIID GetShimIid()
+{
+	static const char s_id = 0;
+	static const IID s_iid = { &s_id };
+	return s_iid;
+}
+#define __uuidof(type) GetShimIid<type>()
+
+struct IUnknown
+{
+	virtual ULONG AddRef() = 0;
+	virtual ULONG Release() = 0;
+};
+
+struct CRITICAL_SECTION
+{
+	std::recursive_mutex mutex;
+};
+
+inline BOOL InitializeCriticalSectionEx(CRITICAL_SECTION *, DWORD, DWORD) { return TRUE; }
+inline void InitializeCriticalSection(CRITICAL_SECTION *) {}
+inline void DeleteCriticalSection(CRITICAL_SECTION *) {}
+inline void EnterCriticalSection(CRITICAL_SECTION *pCritSec) { pCritSec->mutex.lock(); }
+inline BOOL TryEnterCriticalSection(CRITICAL_SECTION *pCritSec) { return pCritSec->mutex.try_lock() ? TRUE : FALSE; }
+inline void LeaveCriticalSection(CRITICAL_SECTION *pCritSec) { pCritSec->mutex.unlock(); }
+
+// Media Foundation (mfapi.h, mferror.h).
+#define MF_E_NOTACCEPTING                   ((HRESULT)0xC00D36B5)
+#define MFASYNC_CALLBACK_QUEUE_STANDARD     0x00000001
+
+struct IMFAsyncResult : public IUnknown
+{
+};
+
+struct IMFAsyncCallback : public IUnknown
+{
+	virtual HRESULT QueryInterface(REFIID iid, void **ppv) = 0;
+	virtual HRESULT GetParameters(DWORD *pdwFlags, DWORD *pdwQueue) = 0;
+	virtual HRESULT Invoke(IMFAsyncResult *pAsyncResult) = 0;
+};
+
+HRESULT MFPutWorkItem2(DWORD dwQueue, LONG priority, IMFAsyncCallback *pCallback, IUnknown *pState);
+#endif
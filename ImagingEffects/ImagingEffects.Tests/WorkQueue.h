@@ -0,0 +1,160 @@
+#pragma once
+
+// A stand-in for the Media Foundation work queue, for tests and tools that
+// drive OpQueue.h without Media Foundation. MFPutWorkItem2 puts the callback
+// on one queue; the caller runs the items itself, one at a time, or starts
+// worker threads that run them as they come, as the platform does:
+//
+//     WorkQueue &queue = WorkQueue::Get();
+//     object.QueueOperation(pOp);       // Puts a work item.
+//     queue.RunPending();               // Invokes it, and any it puts.
+//
+// The header defines MFPutWorkItem2. Include it, after WindowsShim.h, in one
+// source file of an executable only, and not on Windows.
+//
+// This file does not depend on Windows headers.
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ImagingEffectsTests
+{
+	// WorkQueue class:
+	// The callbacks put with MFPutWorkItem2, in the order they were put.
+
+	class WorkQueue
+	{
+	public:
+		static WorkQueue& Get()
+		{
+			static WorkQueue s_queue;
+			return s_queue;
+		}
+
+		void Put(IMFAsyncCallback *pCallback)
+		{
+			pCallback->AddRef();
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_items.push_back(pCallback);
+			m_itemAdded.notify_one();
+		}
+
+		size_t GetPendingCount()
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			return m_items.size();
+		}
+
+		// Invokes the oldest item, if there is one. Returns false if there is
+		// not; *phr receives what Invoke returned.
+		bool RunOne(HRESULT *phr = nullptr)
+		{
+			IMFAsyncCallback *pCallback = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				if (m_items.empty())
+				{
+					return false;
+				}
+				pCallback = m_items.front();
+				m_items.pop_front();
+			}
+			Invoke(pCallback, phr);
+			return true;
+		}
+
+		// Invokes items until there are none left, those they put included.
+		// Returns the number invoked.
+		size_t RunPending()
+		{
+			size_t cRun = 0;
+			while (RunOne())
+			{
+				cRun++;
+			}
+			return cRun;
+		}
+
+		// Starts threads that invoke the items as they are put, several at
+		// once, in parallel, as the platform's queues do.
+		void StartWorkers(uint32_t cThreads)
+		{
+			m_fStopping = false;
+			for (uint32_t i = 0; i < cThreads; i++)
+			{
+				m_workers.push_back(std::thread([this]() { RunWorker(); }));
+			}
+		}
+
+		// Waits for the workers to invoke every item, then stops them.
+		void StopWorkers()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				m_fStopping = true;
+				m_itemAdded.notify_all();
+			}
+			for (size_t i = 0; i < m_workers.size(); i++)
+			{
+				m_workers[i].join();
+			}
+			m_workers.clear();
+		}
+
+	private:
+		WorkQueue()
+			: m_fStopping(false)
+		{
+		}
+
+		void Invoke(IMFAsyncCallback *pCallback, HRESULT *phr)
+		{
+			const HRESULT hr = pCallback->Invoke(nullptr);
+			pCallback->Release();
+			if (phr)
+			{
+				*phr = hr;
+			}
+		}
+
+		void RunWorker()
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			for (;;)
+			{
+				if (!m_items.empty())
+				{
+					IMFAsyncCallback *pCallback = m_items.front();
+					m_items.pop_front();
+					lock.unlock();
+					Invoke(pCallback, nullptr);
+					lock.lock();
+				}
+				else if (m_fStopping)
+				{
+					return;
+				}
+				else
+				{
+					m_itemAdded.wait(lock);
+				}
+			}
+		}
+
+		std::mutex m_lock;
+		std::condition_variable m_itemAdded;
+		std::deque<IMFAsyncCallback*> m_items;
+		std::vector<std::thread> m_workers;
+		bool m_fStopping;
+	};
+}
+
+HRESULT MFPutWorkItem2(DWORD, LONG, IMFAsyncCallback *pCallback, IUnknown *)
+{
+	ImagingEffectsTests::WorkQueue::Get().Put(pCallback);
+	return S_OK;
+}
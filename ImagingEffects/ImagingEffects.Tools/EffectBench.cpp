@@ -0,0 +1,811 @@
+// Benchmarks of the effect engine over formats, sizes, chains and threads.
+//
+// Each case renders frames of one format and size through an EffectEngine
+// with a chain of 0 to 8 native filters, the bands of a frame on a pool of
+// threads, as the transform does in OnProcessOutput once the buffers are
+// locked. Named chains measure one effect of the chain building: "points"
+// is five point filters, which fold into one pass over the frame, and
+// "points-unfused" the same five rendered one pass each, as they would be
+// without folding. "lut3d" is a 3D colour table alone. "bypass" renders
+// nothing: a frame only goes through the in-flight queue under a lock, as
+// ProcessInput and ProcessOutput do with the transform bypassed, next to
+// filters:0, the copy the transform made before it had a bypass. Frames are
+// rendered back to back, the late-frame scheduler off, for at least
+// --min-time seconds and --min-frames frames, after a few frames of
+// warm-up. A case reports the time per frame, frames and
+// megabytes (of input) per second, the allocations per frame and the 50th
+// and 99th percentiles of the frame time.
+//
+// --modes inplace renders each frame onto its input, as the transform does
+// with "InPlace" set, instead of into an output frame of its own. A frame
+// then touches one frame's worth of memory instead of two, which the
+// "MB touched" column and bytes_touched_per_frame report, so the two modes
+// can be compared for memory bandwidth.
+//
+// Cases are named like Google Benchmark's, e.g.
+// ProcessFrame/NV12/1080p/filters:4/threads:2, and --json writes the
+// results in its JSON layout, so they can be tracked and compared from run
+// to run with the same scripts:
+//
+//     effectbench --formats nv12 --sizes 1080p,4k --chains 0-8 --json results.json
+//     effectbench --sizes 1080p --threads 1 --chains 1,points,points-unfused
+//     effectbench --sizes 4k --threads 1 --chains 0,2,5 --modes copy,inplace
+//     effectbench --filter YUY2/720p
+//
+// Run with --help for every option.
+
+#include "EffectEngine.h"
+#include "FrameSource.h"
+#include "InFlightQueue.h"
+#include "ThreadPool.h"
+#include "TraceRecorder.h"
+
+// Every allocation through operator new is counted, on every thread, so
+// that a case can report what a frame allocates.
+#include "AllocationCounter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace ImagingEffects;
+
+namespace
+{
+	// Frames rendered before a case is timed, so that first-touch costs
+	// and one-time allocations do not count.
+	const uint32_t WARMUP_FRAMES = 3;
+
+	// Distinct input frames a case cycles through, so that the source is not
+	// always in the cache.
+	const size_t INPUT_FRAMES = 4;
+
+	// Bands per pool thread, as the engine uses per processor by default.
+	const size_t BANDS_PER_THREAD = 2;
+
+	const uint32_t MAX_CHAIN_LENGTH = 8;
+
+	// Bypassed frames timed at once: one is quicker than reading the clock.
+	const uint32_t BYPASS_BATCH = 1024;
+
+	// Frames in flight in the bypass case, as the transform allows by default.
+	const size_t BYPASS_IN_FLIGHT = 4;
+
+	enum ChainKind
+	{
+		Chain_Prefix,           // The first cFilters filters of MakeChain.
+		Chain_Points,           // Five point filters, folded into one pass.
+		Chain_PointsUnfused,    // The same five, one pass each.
+		Chain_Lut3D,            // A 3D table alone.
+		Chain_Bypass            // No rendering at all.
+	};
+
+	struct NamedChain
+	{
+		const char *pszName;
+		ChainKind kind;
+	};
+
+	const NamedChain NAMED_CHAINS[] =
+	{
+		{ "points", Chain_Points },
+		{ "points-unfused", Chain_PointsUnfused },
+		{ "lut3d", Chain_Lut3D },
+		{ "bypass", Chain_Bypass }
+	};
+
+	struct ChainSpec
+	{
+		ChainKind kind;
+		uint32_t cFilters;      // Chain_Prefix only.
+	};
+
+	struct Resolution
+	{
+		const char *pszName;
+		uint32_t width;
+		uint32_t height;
+	};
+
+	const Resolution RESOLUTIONS[] =
+	{
+		{ "480p", 640, 480 },
+		{ "720p", 1280, 720 },
+		{ "1080p", 1920, 1080 },
+		{ "4k", 3840, 2160 }
+	};
+
+	struct Options
+	{
+		std::vector<SourceFormat> formats;
+		std::vector<size_t> resolutions;        // Indices into RESOLUTIONS.
+		std::vector<ChainSpec> chains;
+		std::vector<uint32_t> threadCounts;
+		std::vector<size_t> modes;              // 0 copies, 1 renders in place.
+		double minTime;                         // Seconds.
+		uint32_t cMinFrames;
+		std::string filter;
+		std::string jsonPath;
+	};
+
+	struct Case
+	{
+		std::string name;
+		SourceFormat format;
+		const Resolution *pResolution;
+		ChainSpec chain;
+		uint32_t cThreads;
+		bool fInPlace;
+	};
+
+	struct Result
+	{
+		uint64_t cFrames;
+		uint64_t nsElapsed;
+		uint64_t cAllocations;
+		uint32_t cbFrame;
+		uint64_t p50;
+		uint64_t p99;
+	};
+
+	void PrintUsage()
+	{
+		printf(
+			"Usage: effectbench [options]\n"
+			"  --formats F,...    nv12 and/or yuy2 (default both)\n"
+			"  --sizes S,...      480p, 720p, 1080p and/or 4k (default all)\n"
+			"  --chains C,...     Chain lengths, 0 to 8, ranges such as 0-8, or the named chains\n"
+			"                     points, points-unfused, lut3d and bypass (default all)\n"
+			"  --threads N,...    Pool sizes, or ranges (default 1 and powers of two up to the processors)\n"
+			"  --modes M,...      copy (into an output frame) and/or inplace (onto the input) (default copy)\n"
+			"  --min-time S       Seconds each case runs at least (default 0.5)\n"
+			"  --min-frames N     Frames each case renders at least (default 10)\n"
+			"  --filter TEXT      Run only the cases whose name contains TEXT\n"
+			"  --json FILE        Write the results to FILE in Google Benchmark's JSON layout\n");
+	}
+
+	// Parses a comma-separated list of numbers and ranges, such as 0,2-4.
+	bool ParseNumbers(const char *psz, uint32_t maxValue, std::vector<uint32_t> *pValues)
+	{
+		pValues->clear();
+		while (*psz != '\0')
+		{
+			char *pEnd = nullptr;
+			unsigned long first = strtoul(psz, &pEnd, 10);
+			if (pEnd == psz)
+			{
+				return false;
+			}
+			unsigned long last = first;
+			if (*pEnd == '-')
+			{
+				psz = pEnd + 1;
+				last = strtoul(psz, &pEnd, 10);
+				if (pEnd == psz)
+				{
+					return false;
+				}
+			}
+			if (first > last || last > maxValue)
+			{
+				return false;
+			}
+			for (unsigned long value = first; value <= last; value++)
+			{
+				pValues->push_back((uint32_t)value);
+			}
+			if (*pEnd != ',' && *pEnd != '\0')
+			{
+				return false;
+			}
+			psz = (*pEnd == ',') ? pEnd + 1 : pEnd;
+		}
+		return !pValues->empty();
+	}
+
+	// Parses a comma-separated list of names; *pIndices receives the index
+	// of each in names.
+	bool ParseNames(const char *psz, const char *const *pNames, size_t cNames, std::vector<size_t> *pIndices)
+	{
+		pIndices->clear();
+		std::string list(psz);
+		size_t start = 0;
+		while (start <= list.size())
+		{
+			size_t end = list.find(',', start);
+			if (end == std::string::npos)
+			{
+				end = list.size();
+			}
+			const std::string name = list.substr(start, end - start);
+			size_t i = 0;
+			while (i < cNames && name != pNames[i])
+			{
+				i++;
+			}
+			if (i == cNames)
+			{
+				return false;
+			}
+			pIndices->push_back(i);
+			start = end + 1;
+		}
+		return !pIndices->empty();
+	}
+
+	// Parses a comma-separated list of chain lengths, ranges of them and
+	// names of NAMED_CHAINS.
+	bool ParseChains(const char *psz, std::vector<ChainSpec> *pChains)
+	{
+		pChains->clear();
+		std::string list(psz);
+		size_t start = 0;
+		while (start <= list.size())
+		{
+			size_t end = list.find(',', start);
+			if (end == std::string::npos)
+			{
+				end = list.size();
+			}
+			const std::string item = list.substr(start, end - start);
+			start = end + 1;
+
+			size_t i = 0;
+			while (i < sizeof(NAMED_CHAINS) / sizeof(NAMED_CHAINS[0]) && item != NAMED_CHAINS[i].pszName)
+			{
+				i++;
+			}
+			if (i < sizeof(NAMED_CHAINS) / sizeof(NAMED_CHAINS[0]))
+			{
+				const ChainSpec chain = { NAMED_CHAINS[i].kind, 0 };
+				pChains->push_back(chain);
+				continue;
+			}
+
+			std::vector<uint32_t> lengths;
+			if (!ParseNumbers(item.c_str(), MAX_CHAIN_LENGTH, &lengths))
+			{
+				return false;
+			}
+			for (size_t j = 0; j < lengths.size(); j++)
+			{
+				const ChainSpec chain = { Chain_Prefix, lengths[j] };
+				pChains->push_back(chain);
+			}
+		}
+		return !pChains->empty();
+	}
+
+	bool ParseOptions(int argc, char **argv, Options *pOptions)
+	{
+		static const char *const s_formatNames[] = { "nv12", "yuy2" };
+		static const char *const s_resolutionNames[] = { "480p", "720p", "1080p", "4k" };
+		static const char *const s_modeNames[] = { "copy", "inplace" };
+
+		pOptions->formats.push_back(SourceFormat_NV12);
+		pOptions->formats.push_back(SourceFormat_YUY2);
+		for (size_t i = 0; i < sizeof(RESOLUTIONS) / sizeof(RESOLUTIONS[0]); i++)
+		{
+			pOptions->resolutions.push_back(i);
+		}
+		for (uint32_t i = 0; i <= MAX_CHAIN_LENGTH; i++)
+		{
+			const ChainSpec chain = { Chain_Prefix, i };
+			pOptions->chains.push_back(chain);
+		}
+		for (size_t i = 0; i < sizeof(NAMED_CHAINS) / sizeof(NAMED_CHAINS[0]); i++)
+		{
+			const ChainSpec chain = { NAMED_CHAINS[i].kind, 0 };
+			pOptions->chains.push_back(chain);
+		}
+		const uint32_t cProcessors = (std::max)(1u, std::thread::hardware_concurrency());
+		for (uint32_t cThreads = 1; cThreads < cProcessors; cThreads *= 2)
+		{
+			pOptions->threadCounts.push_back(cThreads);
+		}
+		pOptions->threadCounts.push_back(cProcessors);
+		pOptions->modes.push_back(0);
+		pOptions->minTime = 0.5;
+		pOptions->cMinFrames = 10;
+
+		for (int i = 1; i < argc; i++)
+		{
+			const char *pszName = argv[i];
+			if (strcmp(pszName, "--help") == 0 || i + 1 >= argc)
+			{
+				return false;
+			}
+
+			const char *pszValue = argv[++i];
+			std::vector<size_t> indices;
+			if (strcmp(pszName, "--formats") == 0)
+			{
+				if (!ParseNames(pszValue, s_formatNames, 2, &indices)) return false;
+				pOptions->formats.clear();
+				for (size_t j = 0; j < indices.size(); j++)
+				{
+					pOptions->formats.push_back(indices[j] == 0 ? SourceFormat_NV12 : SourceFormat_YUY2);
+				}
+			}
+			else if (strcmp(pszName, "--sizes") == 0)
+			{
+				if (!ParseNames(pszValue, s_resolutionNames, 4, &pOptions->resolutions)) return false;
+			}
+			else if (strcmp(pszName, "--chains") == 0)
+			{
+				if (!ParseChains(pszValue, &pOptions->chains)) return false;
+			}
+			else if (strcmp(pszName, "--threads") == 0)
+			{
+				if (!ParseNumbers(pszValue, 1024, &pOptions->threadCounts)) return false;
+				if (std::find(pOptions->threadCounts.begin(), pOptions->threadCounts.end(), 0u) != pOptions->threadCounts.end()) return false;
+			}
+			else if (strcmp(pszName, "--modes") == 0)
+			{
+				if (!ParseNames(pszValue, s_modeNames, 2, &pOptions->modes)) return false;
+			}
+			else if (strcmp(pszName, "--min-time") == 0) pOptions->minTime = strtod(pszValue, nullptr);
+			else if (strcmp(pszName, "--min-frames") == 0) pOptions->cMinFrames = (uint32_t)strtoul(pszValue, nullptr, 10);
+			else if (strcmp(pszName, "--filter") == 0) pOptions->filter = pszValue;
+			else if (strcmp(pszName, "--json") == 0) pOptions->jsonPath = pszValue;
+			else return false;
+		}
+
+		return pOptions->cMinFrames > 0;
+	}
+
+	// A 17-point cube that lifts the shadows and cools the highlights.
+	std::shared_ptr<ColorCube> MakeBenchCube()
+	{
+		const uint32_t size = 17;
+		std::vector<float> rgb;
+		for (uint32_t b = 0; b < size; b++)
+		{
+			for (uint32_t g = 0; g < size; g++)
+			{
+				for (uint32_t r = 0; r < size; r++)
+				{
+					const float luma = (r + g + b) / 48.0f;
+					rgb.push_back(0.05f + r / 16.0f * 0.95f);
+					rgb.push_back(0.05f + g / 16.0f * 0.95f);
+					rgb.push_back((std::min)(1.0f, 0.05f + b / 16.0f * 0.95f + luma * 0.05f));
+				}
+			}
+		}
+		return ColorCube::Create(size, &rgb[0], rgb.size());
+	}
+
+	// The first cFilters filters of a fixed chain that brings in each kind
+	// of filter in turn, the kinds that fold into one table first, then the
+	// ones that do not (a vignette, a 3D table), then more of each.
+	std::vector<NativeFilter> MakeChain(uint32_t cFilters)
+	{
+		uint8_t curve[256];
+		for (int i = 0; i < 256; i++)
+		{
+			curve[i] = (uint8_t)(i < 128 ? i * 3 / 4 : 96 + (i - 128) * 5 / 4);
+		}
+
+		std::vector<NativeFilter> chain;
+		chain.push_back(MakeSepiaFilter(0.8f));
+		chain.push_back(MakeBrightnessContrastSaturationFilter(0.05f, 1.2f, 1.1f));
+		chain.push_back(MakeCurvesFilter(curve, nullptr, nullptr));
+		chain.push_back(MakeVignetteFilter(0.5f, 0.6f));
+		chain.push_back(MakeLut3DFilter(MakeBenchCube()));
+		chain.push_back(MakeBrightnessContrastSaturationFilter(-0.02f, 1.05f, 0.9f));
+		chain.push_back(MakeCurvesFilter(nullptr, curve, curve));
+		chain.push_back(MakeVignetteFilter(0.7f, 0.3f));
+		chain.resize(cFilters);
+		return chain;
+	}
+
+	// Five filters that each map a plane byte by byte, so that the chain
+	// folds them into one table per plane.
+	std::vector<NativeFilter> MakePointChain()
+	{
+		uint8_t curve[256];
+		for (int i = 0; i < 256; i++)
+		{
+			curve[i] = (uint8_t)(i < 128 ? i * 3 / 4 : 96 + (i - 128) * 5 / 4);
+		}
+
+		std::vector<NativeFilter> chain;
+		chain.push_back(MakeSepiaFilter(0.4f));
+		chain.push_back(MakeBrightnessContrastSaturationFilter(0.05f, 1.2f, 1.1f));
+		chain.push_back(MakeCurvesFilter(curve, nullptr, nullptr));
+		chain.push_back(MakeBrightnessContrastSaturationFilter(-0.02f, 1.05f, 0.9f));
+		chain.push_back(MakeCurvesFilter(nullptr, curve, curve));
+		return chain;
+	}
+
+	// The chains a case renders each frame with, one after the other: the
+	// first from the input to the output, the others in place on the output.
+	std::vector<std::vector<NativeFilter> > GetPasses(const ChainSpec &chain)
+	{
+		std::vector<std::vector<NativeFilter> > passes;
+		switch (chain.kind)
+		{
+		case Chain_Prefix:
+			passes.push_back(MakeChain(chain.cFilters));
+			break;
+		case Chain_Points:
+			passes.push_back(MakePointChain());
+			break;
+		case Chain_PointsUnfused:
+			{
+				const std::vector<NativeFilter> filters = MakePointChain();
+				for (size_t i = 0; i < filters.size(); i++)
+				{
+					passes.push_back(std::vector<NativeFilter>(1, filters[i]));
+				}
+			}
+			break;
+		case Chain_Lut3D:
+			passes.push_back(std::vector<NativeFilter>(1, MakeLut3DFilter(MakeBenchCube())));
+			break;
+		case Chain_Bypass:
+			break;
+		}
+		return passes;
+	}
+
+	uint32_t GetFilterCount(const ChainSpec &chain)
+	{
+		const std::vector<std::vector<NativeFilter> > passes = GetPasses(chain);
+		size_t cFilters = 0;
+		for (size_t i = 0; i < passes.size(); i++)
+		{
+			cFilters += passes[i].size();
+		}
+		return (uint32_t)cFilters;
+	}
+
+	std::string GetChainName(const ChainSpec &chain)
+	{
+		for (size_t i = 0; i < sizeof(NAMED_CHAINS) / sizeof(NAMED_CHAINS[0]); i++)
+		{
+			if (chain.kind != Chain_Prefix && chain.kind == NAMED_CHAINS[i].kind)
+			{
+				return std::string("chain:") + NAMED_CHAINS[i].pszName;
+			}
+		}
+		return "filters:" + std::to_string(chain.cFilters);
+	}
+
+	bool RunCase(const Options &options, const Case &benchCase, Result *pResult)
+	{
+		FrameSource source;
+		SourceConfig config = MakeSourceConfig(benchCase.format, benchCase.pResolution->width, benchCase.pResolution->height, 30);
+		config.content = SourceContent_Noise;
+		if (!source.SetConfig(config))
+		{
+			return false;
+		}
+
+		// Noise, so that every entry of the filters' tables is used. In place,
+		// each input is overwritten and put back as it was, untimed, after
+		// it is rendered, so that every frame filters the same noise.
+		std::vector<uint8_t> inputs[INPUT_FRAMES];
+		std::vector<uint8_t> originals[INPUT_FRAMES];
+		VideoFrame inputFrames[INPUT_FRAMES];
+		for (size_t i = 0; i < INPUT_FRAMES; i++)
+		{
+			inputs[i].resize(source.GetBufferSize());
+			source.RenderFrame(i, &inputs[i][0]);
+			source.WrapFrame(&inputs[i][0], &inputFrames[i]);
+			if (benchCase.fInPlace)
+			{
+				originals[i] = inputs[i];
+			}
+		}
+		std::vector<uint8_t> output(benchCase.fInPlace ? 0 : source.GetBufferSize());
+		VideoFrame outputFrame;
+		if (!benchCase.fInPlace)
+		{
+			source.WrapFrame(&output[0], &outputFrame);
+		}
+
+		std::unique_ptr<LatencyHistogram> spHistogram(new LatencyHistogram());
+		FrameTiming timing;
+		timing.fHasTime = true;
+		timing.hnsDuration = source.GetFrameDuration();
+
+		// One engine per pass; every case but points-unfused has one.
+		ThreadPool pool(benchCase.cThreads);
+		const std::vector<std::vector<NativeFilter> > passes = GetPasses(benchCase.chain);
+		std::vector<std::unique_ptr<EffectEngine> > engines;
+		SchedulerPolicy policy = MakeDefaultSchedulerPolicy();
+		policy.fEnabled = false;
+		for (size_t i = 0; i < passes.size(); i++)
+		{
+			std::unique_ptr<EffectEngine> spEngine(new EffectEngine(pool.GetParallelFor(), BANDS_PER_THREAD * benchCase.cThreads));
+			spEngine->SetSchedulerPolicy(policy);
+			spEngine->SetFilters(passes[i], std::vector<NativeFilter>());
+			if (!spEngine->SetFormat(MakeStreamFormat(inputFrames[0].format, inputFrames[0].width, inputFrames[0].height)))
+			{
+				return false;
+			}
+			if (benchCase.fInPlace && !spEngine->GetRenderer()->CanProcessInPlace(FrameAction_Process))
+			{
+				return false;
+			}
+			engines.push_back(std::move(spEngine));
+		}
+
+		// Renders a frame through every pass: the first reads the input, the
+		// others work on the output. In place, the output is the input.
+		auto renderFrame = [&](uint64_t iFrame)
+		{
+			const VideoFrame &input = inputFrames[iFrame % INPUT_FRAMES];
+			const VideoFrame &dest = benchCase.fInPlace ? input : outputFrame;
+			for (size_t i = 0; i < engines.size(); i++)
+			{
+				FrameAction action;
+				engines[i]->ProcessFrame(timing, dest, i == 0 ? input : dest, &action);
+			}
+		};
+		// Bypassed, the input is the output: a frame is reserved a slot in
+		// flight and completed at once when it comes in, then popped when it
+		// goes out, under the lock each time, with the counter the transform
+		// traces.
+		InFlightQueue<const VideoFrame*> inFlight(BYPASS_IN_FLIGHT);
+		std::mutex streamLock;
+		auto bypassFrames = [&](uint64_t iFrame)
+		{
+			for (uint32_t i = 0; i < BYPASS_BATCH; i++)
+			{
+				const VideoFrame *pInput = &inputFrames[(iFrame + i) % INPUT_FRAMES];
+				{
+					std::lock_guard<std::mutex> lock(streamLock);
+					uint64_t ticket = 0;
+					inFlight.Reserve(source.GetFrameTime(iFrame + i), &ticket);
+					TraceRecorder::Get().Counter("FramesInFlight", (int64_t)inFlight.GetCount());
+					inFlight.Complete(ticket, pInput);
+					inFlight.TakeNewlyReady();
+				}
+				{
+					std::lock_guard<std::mutex> lock(streamLock);
+					const VideoFrame *pOutput = nullptr;
+					inFlight.PopReady(&pOutput);
+				}
+			}
+		};
+		const bool fBypass = benchCase.chain.kind == Chain_Bypass;
+		const uint32_t cBatch = fBypass ? BYPASS_BATCH : 1;
+
+		auto restoreInput = [&](uint64_t iFrame)
+		{
+			if (benchCase.fInPlace)
+			{
+				memcpy(&inputs[iFrame % INPUT_FRAMES][0], &originals[iFrame % INPUT_FRAMES][0], inputs[0].size());
+			}
+		};
+
+		uint64_t iFrame = 0;
+		for (; iFrame < WARMUP_FRAMES; iFrame++)
+		{
+			timing.hnsTime = source.GetFrameTime(iFrame);
+			if (fBypass)
+			{
+				bypassFrames(iFrame);
+				continue;
+			}
+			renderFrame(iFrame);
+			restoreInput(iFrame);
+		}
+
+		// Only the rendering is timed.
+		const uint64_t nsMinTime = (uint64_t)(options.minTime * 1e9);
+		const uint64_t cAllocationsStart = GetAllocationCount();
+		const uint64_t nsStart = TraceRecorder::Now();
+		uint64_t nsRendering = 0;
+		uint64_t cFrames = 0;
+		while (cFrames < options.cMinFrames || TraceRecorder::Now() - nsStart < nsMinTime)
+		{
+			timing.hnsTime = source.GetFrameTime(iFrame);
+			const uint64_t nsBefore = TraceRecorder::Now();
+			if (fBypass)
+			{
+				bypassFrames(iFrame);
+			}
+			else
+			{
+				renderFrame(iFrame);
+			}
+			const uint64_t nsFrames = TraceRecorder::Now() - nsBefore;
+			spHistogram->Record(nsFrames / cBatch);
+			nsRendering += nsFrames;
+			restoreInput(iFrame);
+			iFrame += cBatch;
+			cFrames += cBatch;
+		}
+		pResult->cAllocations = GetAllocationCount() - cAllocationsStart;
+		pResult->nsElapsed = nsRendering;
+		pResult->cFrames = cFrames;
+		GetImageSize(inputFrames[0].format, inputFrames[0].width, inputFrames[0].height, &pResult->cbFrame);
+
+		std::vector<uint64_t> counts(LATENCY_BUCKET_COUNT);
+		spHistogram->CopyCounts(&counts[0]);
+		pResult->p50 = LatencyHistogram::GetPercentile(&counts[0], cFrames / cBatch, 0.5);
+		pResult->p99 = LatencyHistogram::GetPercentile(&counts[0], cFrames / cBatch, 0.99);
+		return true;
+	}
+
+	double GetFramesPerSecond(const Result &result)
+	{
+		return result.nsElapsed > 0 ? result.cFrames * 1e9 / result.nsElapsed : 0;
+	}
+
+	double GetBytesPerSecond(const Result &result)
+	{
+		return GetFramesPerSecond(result) * result.cbFrame;
+	}
+
+	// The memory a frame reads or writes: the input and the output, the
+	// input alone in place, and none bypassed.
+	uint64_t GetBytesTouched(const Case &benchCase, const Result &result)
+	{
+		if (benchCase.chain.kind == Chain_Bypass)
+		{
+			return 0;
+		}
+		return (uint64_t)result.cbFrame * (benchCase.fInPlace ? 1 : 2);
+	}
+
+	bool WriteJson(const char *pszPath, const Options &options, const std::vector<Case> &cases, const std::vector<Result> &results)
+	{
+		FILE *pFile = fopen(pszPath, "w");
+		if (pFile == nullptr)
+		{
+			return false;
+		}
+
+		char date[32];
+		const time_t now = time(nullptr);
+		strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+
+#ifdef NDEBUG
+		const char *pszBuildType = "release";
+#else
+		const char *pszBuildType = "debug";
+#endif
+
+		static const char *const s_formatNames[] = { "NV12", "YUY2" };
+		fprintf(pFile,
+			"{\n"
+			"  \"context\": {\n"
+			"    \"date\": \"%s\",\n"
+			"    \"executable\": \"effectbench\",\n"
+			"    \"num_cpus\": %u,\n"
+			"    \"library_build_type\": \"%s\",\n"
+			"    \"min_time\": %.3f\n"
+			"  },\n"
+			"  \"benchmarks\": [",
+			date, (std::max)(1u, std::thread::hardware_concurrency()), pszBuildType, options.minTime);
+
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const Case &benchCase = cases[i];
+			const Result &result = results[i];
+			fprintf(pFile,
+				"%s\n"
+				"    {\n"
+				"      \"name\": \"%s\",\n"
+				"      \"run_name\": \"%s\",\n"
+				"      \"run_type\": \"iteration\",\n"
+				"      \"iterations\": %llu,\n"
+				"      \"real_time\": %.1f,\n"
+				"      \"time_unit\": \"ns\",\n"
+				"      \"format\": \"%s\",\n"
+				"      \"width\": %u,\n"
+				"      \"height\": %u,\n"
+				"      \"filters\": %u,\n"
+				"      \"passes\": %u,\n"
+				"      \"threads\": %u,\n"
+				"      \"in_place\": %s,\n"
+				"      \"bytes_touched_per_frame\": %llu,\n"
+				"      \"frames_per_second\": %.3f,\n"
+				"      \"bytes_per_second\": %.0f,\n"
+				"      \"allocs_per_frame\": %.3f,\n"
+				"      \"p50_ns\": %llu,\n"
+				"      \"p99_ns\": %llu\n"
+				"    }",
+				i > 0 ? "," : "",
+				benchCase.name.c_str(), benchCase.name.c_str(), (unsigned long long)result.cFrames,
+				(double)result.nsElapsed / result.cFrames,
+				s_formatNames[benchCase.format], benchCase.pResolution->width, benchCase.pResolution->height,
+				GetFilterCount(benchCase.chain), (unsigned)GetPasses(benchCase.chain).size(), benchCase.cThreads,
+				benchCase.fInPlace ? "true" : "false", (unsigned long long)GetBytesTouched(benchCase, result),
+				GetFramesPerSecond(result), GetBytesPerSecond(result), (double)result.cAllocations / result.cFrames,
+				(unsigned long long)result.p50, (unsigned long long)result.p99);
+		}
+
+		fprintf(pFile, "\n  ]\n}\n");
+		return fclose(pFile) == 0;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, &options))
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	static const char *const s_formatNames[] = { "NV12", "YUY2" };
+	std::vector<Case> cases;
+	for (size_t iFormat = 0; iFormat < options.formats.size(); iFormat++)
+	{
+		for (size_t iResolution = 0; iResolution < options.resolutions.size(); iResolution++)
+		{
+			for (size_t iChain = 0; iChain < options.chains.size(); iChain++)
+			{
+				for (size_t iThreads = 0; iThreads < options.threadCounts.size(); iThreads++)
+				{
+					for (size_t iMode = 0; iMode < options.modes.size(); iMode++)
+					{
+						Case benchCase;
+						benchCase.format = options.formats[iFormat];
+						benchCase.pResolution = &RESOLUTIONS[options.resolutions[iResolution]];
+						benchCase.chain = options.chains[iChain];
+						benchCase.cThreads = options.threadCounts[iThreads];
+						benchCase.fInPlace = options.modes[iMode] == 1;
+						if (benchCase.fInPlace && benchCase.chain.kind == Chain_Bypass)
+						{
+							// Bypassed, the frame is not rendered either way.
+							continue;
+						}
+						benchCase.name = std::string("ProcessFrame/") + s_formatNames[benchCase.format] + "/" +
+							benchCase.pResolution->pszName + "/" + GetChainName(benchCase.chain) +
+							"/threads:" + std::to_string(benchCase.cThreads) + (benchCase.fInPlace ? "/inplace" : "");
+						if (benchCase.name.find(options.filter) != std::string::npos)
+						{
+							cases.push_back(benchCase);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	if (cases.empty())
+	{
+		fprintf(stderr, "No case matches the filter \"%s\".\n", options.filter.c_str());
+		return 1;
+	}
+
+	printf("%-60s %12s %10s %10s %10s %13s %10s\n", "Case", "ns/frame", "fps", "MB/s", "MB touched", "allocs/frame", "p99 ms");
+	std::vector<Result> results;
+	for (size_t i = 0; i < cases.size(); i++)
+	{
+		Result result;
+		if (!RunCase(options, cases[i], &result))
+		{
+			fprintf(stderr, "%s: the engine does not take this format%s.\n", cases[i].name.c_str(), cases[i].fInPlace ? ", or cannot render it in place" : "");
+			return 1;
+		}
+		results.push_back(result);
+
+		printf("%-60s %12.0f %10.1f %10.1f %10.1f %13.2f %10.3f\n",
+			cases[i].name.c_str(), (double)result.nsElapsed / result.cFrames, GetFramesPerSecond(result),
+			GetBytesPerSecond(result) / 1e6, GetBytesTouched(cases[i], result) / 1e6,
+			(double)result.cAllocations / result.cFrames, result.p99 / 1e6);
+		fflush(stdout);
+	}
+
+	if (!options.jsonPath.empty() && !WriteJson(options.jsonPath.c_str(), options, cases, results))
+	{
+		fprintf(stderr, "Cannot write %s\n", options.jsonPath.c_str());
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,347 @@
+// Replays a recording of effect input through the effect engine.
+//
+// The frames of a recording (FrameRecording.h) are rendered back to back,
+// as fast as possible, with the effect configuration the recording gives
+// for each of them. The late-frame scheduler is off, so every frame gets
+// its full chain and the output depends only on the recording: it is the
+// same on any machine, with any number of threads. Each output frame is
+// hashed; --hashes saves the hashes as a golden file and --golden compares
+// them with one, so a replay is also a test of the rendering.
+//
+//     effectreplay --hashes golden.txt slow-stream.rec
+//     effectreplay --golden golden.txt --repeat 5 --threads 4 slow-stream.rec
+//
+// Run with --help for every option.
+
+#include "EffectEngine.h"
+#include "FrameRecording.h"
+#include "ThreadPool.h"
+#include "TraceRecorder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace ImagingEffects;
+
+namespace
+{
+	struct Options
+	{
+		std::string recordingPath;
+		uint32_t cThreads;
+		uint32_t cRepeats;
+		std::string hashesPath;
+		std::string goldenPath;
+		std::string outputPath;
+	};
+
+	// What a replay of the recording did.
+	struct ReplayResult
+	{
+		uint64_t cFrames;
+		uint64_t cConfigs;
+		uint64_t cbFrames;          // Bytes of input.
+		uint64_t nsRender;
+		bool fSdkEffects;           // A configuration had SDK effects, which were not replayed.
+		StreamFormat lastFormat;
+	};
+
+	void PrintUsage()
+	{
+		printf(
+			"Usage: effectreplay [options] RECORDING\n"
+			"  --threads N        Threads for the bands of a frame, 0 for one per processor (default 0)\n"
+			"  --repeat N         Replay the recording N times (default 1)\n"
+			"  --hashes FILE      Write the hash of each output frame to FILE\n"
+			"  --golden FILE      Compare the hashes with FILE, written by --hashes\n"
+			"  --output FILE      Write the output frames to FILE, raw, one after another\n");
+	}
+
+	bool ParseOptions(int argc, char **argv, Options *pOptions)
+	{
+		pOptions->cThreads = 0;
+		pOptions->cRepeats = 1;
+
+		for (int i = 1; i < argc; i++)
+		{
+			const char *pszName = argv[i];
+			if (strncmp(pszName, "--", 2) != 0)
+			{
+				if (!pOptions->recordingPath.empty())
+				{
+					return false;
+				}
+				pOptions->recordingPath = pszName;
+				continue;
+			}
+			if (strcmp(pszName, "--help") == 0 || i + 1 >= argc)
+			{
+				return false;
+			}
+
+			const char *pszValue = argv[++i];
+			if (strcmp(pszName, "--threads") == 0) pOptions->cThreads = (uint32_t)strtoul(pszValue, nullptr, 10);
+			else if (strcmp(pszName, "--repeat") == 0) pOptions->cRepeats = (uint32_t)strtoul(pszValue, nullptr, 10);
+			else if (strcmp(pszName, "--hashes") == 0) pOptions->hashesPath = pszValue;
+			else if (strcmp(pszName, "--golden") == 0) pOptions->goldenPath = pszValue;
+			else if (strcmp(pszName, "--output") == 0) pOptions->outputPath = pszValue;
+			else return false;
+		}
+
+		return !pOptions->recordingPath.empty() && pOptions->cRepeats > 0;
+	}
+
+	// Reads a file written by --hashes: a frame number and a hash per line.
+	bool ReadHashes(const char *pszPath, std::vector<uint64_t> *pHashes)
+	{
+		FILE *pFile = fopen(pszPath, "r");
+		if (pFile == nullptr)
+		{
+			return false;
+		}
+
+		unsigned long long iFrame = 0;
+		unsigned long long hash = 0;
+		while (fscanf(pFile, "%llu %llx", &iFrame, &hash) == 2 && iFrame == pHashes->size())
+		{
+			pHashes->push_back(hash);
+		}
+		const bool fOk = (feof(pFile) != 0);
+		fclose(pFile);
+		return fOk;
+	}
+
+	bool WriteHashes(const char *pszPath, const std::vector<uint64_t> &hashes)
+	{
+		FILE *pFile = fopen(pszPath, "w");
+		if (pFile == nullptr)
+		{
+			return false;
+		}
+		for (size_t i = 0; i < hashes.size(); i++)
+		{
+			fprintf(pFile, "%llu %016llx\n", (unsigned long long)i, (unsigned long long)hashes[i]);
+		}
+		return fclose(pFile) == 0;
+	}
+
+	// Replays the recording once. The hash of each output frame goes into
+	// *pHashes; pOutput, if not null, receives the output frames.
+	bool Replay(const Options &options, ThreadPool *pPool, LatencyHistogram *pHistogram, FILE *pOutput, std::vector<uint64_t> *pHashes, ReplayResult *pResult)
+	{
+		FrameRecordReader reader;
+		if (!reader.Open(fopen(options.recordingPath.c_str(), "rb")))
+		{
+			fprintf(stderr, "%s is not a recording this tool can read.\n", options.recordingPath.c_str());
+			return false;
+		}
+
+		EffectEngine engine(pPool->GetParallelFor());
+		SchedulerPolicy policy = MakeDefaultSchedulerPolicy();
+		policy.fEnabled = false;
+		engine.SetSchedulerPolicy(policy);
+
+		memset(pResult, 0, sizeof(*pResult));
+		pHashes->clear();
+		std::vector<uint8_t> output;
+		VideoFrame outputFrame;
+		bool fHaveFormat = false;
+
+		RecordKind kind;
+		while (reader.ReadNext(&kind))
+		{
+			if (kind == RecordKind_Format)
+			{
+				const StreamFormat &format = reader.GetFormat();
+				if (!engine.SetFormat(format))
+				{
+					fprintf(stderr, "The engine does not take the frames of the recording (%ux%u, format %d).\n",
+						format.width, format.height, (int)format.pixelFormat);
+					return false;
+				}
+
+				const uint32_t stride = GetMinimumStride(format.pixelFormat, format.width);
+				output.assign((size_t)stride * GetBufferRowCount(format.pixelFormat, format.height), 0);
+				WrapVideoFrame(format.pixelFormat, format.width, format.height, &output[0], stride, &output[0], output.size(), &outputFrame);
+				pResult->lastFormat = format;
+				fHaveFormat = true;
+			}
+			else if (kind == RecordKind_Config)
+			{
+				const EffectConfig &config = reader.GetConfig();
+				engine.SetFilters(config.filters, config.fallbackFilters);
+				pResult->fSdkEffects |= config.fHasSdkEffects;
+				pResult->cConfigs++;
+			}
+			else if (kind == RecordKind_Frame && fHaveFormat)
+			{
+				const uint64_t nsStart = TraceRecorder::Now();
+				FrameAction action;
+				engine.ProcessFrame(reader.GetTiming(), outputFrame, reader.GetFrame(), &action);
+				const uint64_t nsElapsed = TraceRecorder::Now() - nsStart;
+
+				pHistogram->Record(nsElapsed);
+				pResult->nsRender += nsElapsed;
+				pResult->cbFrames += output.size();
+				pResult->cFrames++;
+				pHashes->push_back(HashVideoFrame(outputFrame));
+
+				if (pOutput != nullptr && fwrite(&output[0], 1, output.size(), pOutput) != output.size())
+				{
+					fprintf(stderr, "Cannot write %s\n", options.outputPath.c_str());
+					return false;
+				}
+			}
+		}
+
+		if (!reader.IsAtEnd())
+		{
+			fprintf(stderr, "The recording is damaged after %llu frames.\n", (unsigned long long)pResult->cFrames);
+			return false;
+		}
+		return true;
+	}
+
+	double ToMs(uint64_t ns)
+	{
+		return ns / 1e6;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, &options))
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	std::vector<uint64_t> golden;
+	if (!options.goldenPath.empty() && !ReadHashes(options.goldenPath.c_str(), &golden))
+	{
+		fprintf(stderr, "Cannot read the hashes in %s\n", options.goldenPath.c_str());
+		return 1;
+	}
+
+	FILE *pOutput = nullptr;
+	if (!options.outputPath.empty())
+	{
+		pOutput = fopen(options.outputPath.c_str(), "wb");
+		if (pOutput == nullptr)
+		{
+			fprintf(stderr, "Cannot write %s\n", options.outputPath.c_str());
+			return 1;
+		}
+	}
+
+	ThreadPool pool(options.cThreads);
+	std::unique_ptr<LatencyHistogram> spHistogram(new LatencyHistogram());
+	std::vector<uint64_t> hashes;
+	std::vector<uint64_t> passHashes;
+	ReplayResult result;
+	uint64_t nsRender = 0;
+
+	// Every pass must render the same frames; the first is kept.
+	for (uint32_t iPass = 0; iPass < options.cRepeats; iPass++)
+	{
+		if (!Replay(options, &pool, spHistogram.get(), iPass == 0 ? pOutput : nullptr, &passHashes, &result))
+		{
+			return 1;
+		}
+		nsRender += result.nsRender;
+
+		if (iPass == 0)
+		{
+			hashes.swap(passHashes);
+		}
+		else if (passHashes != hashes)
+		{
+			fprintf(stderr, "Pass %u rendered different frames from the first.\n", iPass + 1);
+			return 3;
+		}
+	}
+
+	if (pOutput != nullptr)
+	{
+		fclose(pOutput);
+	}
+
+	if (result.cFrames == 0)
+	{
+		fprintf(stderr, "The recording has no frames.\n");
+		return 1;
+	}
+
+	// One hash for the whole output, to compare runs at a glance.
+	uint64_t digest = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < hashes.size(); i++)
+	{
+		for (int j = 0; j < 8; j++)
+		{
+			digest = (digest ^ (uint8_t)(hashes[i] >> (8 * j))) * 0x100000001b3ull;
+		}
+	}
+
+	std::vector<uint64_t> counts(LATENCY_BUCKET_COUNT);
+	spHistogram->CopyCounts(&counts[0]);
+	const uint64_t cFrames = result.cFrames * options.cRepeats;
+	const double seconds = nsRender / 1e9;
+
+	static const char *const s_formatNames[] = { "NV12", "YUY2", "I420" };
+	printf("%llu frames, last %ux%u %s, %llu configurations, replayed %u times on %u threads\n",
+		(unsigned long long)result.cFrames, result.lastFormat.width, result.lastFormat.height,
+		s_formatNames[result.lastFormat.pixelFormat], (unsigned long long)result.cConfigs,
+		options.cRepeats, (uint32_t)pool.GetThreadCount());
+	if (result.fSdkEffects)
+	{
+		printf("the recording used SDK effects, which are not recorded: only the native filters were replayed\n");
+	}
+	printf("%.1f fps, %.1f MB/s; frame time p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+		cFrames / seconds, result.cbFrames * (double)options.cRepeats / 1e6 / seconds,
+		ToMs(LatencyHistogram::GetPercentile(&counts[0], cFrames, 0.5)),
+		ToMs(LatencyHistogram::GetPercentile(&counts[0], cFrames, 0.99)),
+		ToMs(LatencyHistogram::GetPercentile(&counts[0], cFrames, 1.0)));
+	printf("output hash %016llx\n", (unsigned long long)digest);
+
+	if (!options.hashesPath.empty() && !WriteHashes(options.hashesPath.c_str(), hashes))
+	{
+		fprintf(stderr, "Cannot write %s\n", options.hashesPath.c_str());
+		return 1;
+	}
+
+	if (!options.goldenPath.empty())
+	{
+		size_t cDiffering = 0;
+		size_t iFirst = 0;
+		for (size_t i = 0; i < hashes.size(); i++)
+		{
+			if (i >= golden.size() || hashes[i] != golden[i])
+			{
+				iFirst = cDiffering == 0 ? i : iFirst;
+				cDiffering++;
+			}
+		}
+
+		if (golden.size() != hashes.size())
+		{
+			printf("%llu frames rendered, %llu in %s\n", (unsigned long long)hashes.size(), (unsigned long long)golden.size(), options.goldenPath.c_str());
+		}
+		if (cDiffering > 0)
+		{
+			printf("%llu frames differ from %s, the first is frame %llu\n",
+				(unsigned long long)cDiffering, options.goldenPath.c_str(), (unsigned long long)iFirst);
+		}
+		if (cDiffering > 0 || golden.size() != hashes.size())
+		{
+			return 3;
+		}
+		printf("every frame matches %s\n", options.goldenPath.c_str());
+	}
+
+	return 0;
+}
@@ -0,0 +1,392 @@
+// Feeds the effect engine with a synthetic camera.
+//
+// Frames from a FrameSource are rendered through an EffectEngine either in
+// real time, each frame handed over when a camera of the frame rate would
+// deliver it, or as fast as possible. In real time the engine's scheduler
+// is on, and frames that fall behind are degraded, passed through or
+// dropped. At the end the frame rate, what became of the frames and the
+// latency percentiles are printed. --record saves the engine's input as a
+// recording, for effectreplay.
+//
+//     framesim --format yuy2 --width 1920 --height 1080 --fps 30 --content moving --seconds 60
+//     framesim --mode fast --frames 1000 --filters heavy
+//
+// Run with --help for every option.
+
+#include "EffectEngine.h"
+#include "FrameRecording.h"
+#include "FrameSource.h"
+#include "ThreadPool.h"
+#include "TraceRecorder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+using namespace ImagingEffects;
+
+namespace
+{
+	enum RunMode
+	{
+		RunMode_RealTime,
+		RunMode_Fast
+	};
+
+	struct Options
+	{
+		SourceConfig source;
+		RunMode mode;
+		uint64_t cFrames;           // 0 if cSeconds decides.
+		uint32_t cSeconds;
+		uint32_t cThreads;
+		std::string filters;
+		std::string outputPath;
+		std::string recordPath;
+		std::string tracePath;
+	};
+
+	struct NamedValue
+	{
+		const char *pszName;
+		int value;
+	};
+
+	const NamedValue FORMATS[] =
+	{
+		{ "nv12", SourceFormat_NV12 },
+		{ "yuy2", SourceFormat_YUY2 },
+		{ "uyvy", SourceFormat_UYVY }
+	};
+
+	const NamedValue CONTENTS[] =
+	{
+		{ "gradient", SourceContent_Gradient },
+		{ "noise", SourceContent_Noise },
+		{ "moving", SourceContent_MovingObjects },
+		{ "static", SourceContent_Static }
+	};
+
+	const NamedValue MODES[] =
+	{
+		{ "realtime", RunMode_RealTime },
+		{ "fast", RunMode_Fast }
+	};
+
+	template <size_t N>
+	bool FindValue(const NamedValue (&values)[N], const char *pszName, int *pValue)
+	{
+		for (size_t i = 0; i < N; i++)
+		{
+			if (strcmp(values[i].pszName, pszName) == 0)
+			{
+				*pValue = values[i].value;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void PrintUsage()
+	{
+		printf(
+			"Usage: framesim [options]\n"
+			"  --format F         nv12, yuy2 or uyvy (default nv12)\n"
+			"  --width N          Frame width, even (default 1280)\n"
+			"  --height N         Frame height, even (default 720)\n"
+			"  --fps N            Frame rate (default 30)\n"
+			"  --padding N        Bytes of padding at the end of each row (default 0)\n"
+			"  --content C        gradient, noise, moving or static (default moving)\n"
+			"  --seed N           Varies the noise and the moving objects (default 1)\n"
+			"  --mode M           realtime or fast (default realtime)\n"
+			"  --frames N         Frames to render (default: --seconds of frames)\n"
+			"  --seconds N        Length of the run at the frame rate (default 10)\n"
+			"  --filters F        none, light or heavy (default light)\n"
+			"  --threads N        Threads for the bands of a frame, 0 for one per processor (default 0)\n"
+			"  --output FILE      Write the rendered frames to FILE, raw, one after another\n"
+			"  --record FILE      Record the frames and the filters to FILE, for effectreplay\n"
+			"  --trace FILE       Write a Chrome trace of the last events to FILE\n");
+	}
+
+	bool ParseOptions(int argc, char **argv, Options *pOptions)
+	{
+		pOptions->source = MakeSourceConfig(SourceFormat_NV12, 1280, 720, 30);
+		pOptions->source.content = SourceContent_MovingObjects;
+		pOptions->mode = RunMode_RealTime;
+		pOptions->cFrames = 0;
+		pOptions->cSeconds = 10;
+		pOptions->cThreads = 0;
+		pOptions->filters = "light";
+
+		for (int i = 1; i < argc; i++)
+		{
+			const char *pszName = argv[i];
+			if (strcmp(pszName, "--help") == 0 || i + 1 >= argc)
+			{
+				return false;
+			}
+
+			const char *pszValue = argv[++i];
+			uint32_t value = (uint32_t)strtoul(pszValue, nullptr, 10);
+			int named = 0;
+			if (strcmp(pszName, "--width") == 0) pOptions->source.width = value;
+			else if (strcmp(pszName, "--height") == 0) pOptions->source.height = value;
+			else if (strcmp(pszName, "--fps") == 0) pOptions->source.frameRate = value;
+			else if (strcmp(pszName, "--padding") == 0) pOptions->source.cbPadding = value;
+			else if (strcmp(pszName, "--seed") == 0) pOptions->source.seed = value;
+			else if (strcmp(pszName, "--frames") == 0) pOptions->cFrames = strtoull(pszValue, nullptr, 10);
+			else if (strcmp(pszName, "--seconds") == 0) pOptions->cSeconds = value;
+			else if (strcmp(pszName, "--threads") == 0) pOptions->cThreads = value;
+			else if (strcmp(pszName, "--filters") == 0) pOptions->filters = pszValue;
+			else if (strcmp(pszName, "--output") == 0) pOptions->outputPath = pszValue;
+			else if (strcmp(pszName, "--record") == 0) pOptions->recordPath = pszValue;
+			else if (strcmp(pszName, "--trace") == 0) pOptions->tracePath = pszValue;
+			else if (strcmp(pszName, "--format") == 0 && FindValue(FORMATS, pszValue, &named)) pOptions->source.format = (SourceFormat)named;
+			else if (strcmp(pszName, "--content") == 0 && FindValue(CONTENTS, pszValue, &named)) pOptions->source.content = (SourceContent)named;
+			else if (strcmp(pszName, "--mode") == 0 && FindValue(MODES, pszValue, &named)) pOptions->mode = (RunMode)named;
+			else return false;
+		}
+
+		if (pOptions->cFrames == 0)
+		{
+			pOptions->cFrames = (uint64_t)pOptions->cSeconds * pOptions->source.frameRate;
+		}
+
+		return pOptions->filters == "none" || pOptions->filters == "light" || pOptions->filters == "heavy";
+	}
+
+	// A 17-point cube that warms the image: red up, blue down.
+	std::shared_ptr<ColorCube> MakeWarmCube()
+	{
+		const uint32_t size = 17;
+		std::vector<float> rgb;
+		for (uint32_t b = 0; b < size; b++)
+		{
+			for (uint32_t g = 0; g < size; g++)
+			{
+				for (uint32_t r = 0; r < size; r++)
+				{
+					rgb.push_back((std::min)(1.0f, r / 16.0f * 1.08f));
+					rgb.push_back(g / 16.0f);
+					rgb.push_back(b / 16.0f * 0.9f);
+				}
+			}
+		}
+		return ColorCube::Create(size, &rgb[0], rgb.size());
+	}
+
+	// The light set is one cheap filter; the heavy set is a chain of every
+	// per-pixel kind, with a 3D table.
+	void MakeFilters(const std::string &name, std::vector<NativeFilter> *pFilters, std::vector<NativeFilter> *pFallbackFilters)
+	{
+		if (name == "none")
+		{
+			return;
+		}
+
+		pFilters->push_back(MakeSepiaFilter(0.8f));
+		if (name == "heavy")
+		{
+			uint8_t curve[256];
+			for (int i = 0; i < 256; i++)
+			{
+				curve[i] = (uint8_t)(i < 128 ? i * 3 / 4 : 96 + (i - 128) * 5 / 4);
+			}
+			pFilters->push_back(MakeBrightnessContrastSaturationFilter(0.05f, 1.2f, 1.1f));
+			pFilters->push_back(MakeCurvesFilter(curve, nullptr, nullptr));
+			pFilters->push_back(MakeLut3DFilter(MakeWarmCube()));
+			pFilters->push_back(MakeVignetteFilter(0.5f, 0.6f));
+		}
+		pFallbackFilters->push_back(MakeGrayscaleFilter());
+	}
+
+	double ToMs(uint64_t ns)
+	{
+		return ns / 1e6;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, &options))
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	FrameSource source;
+	if (!source.SetConfig(options.source))
+	{
+		fprintf(stderr, "The source format is not valid: the size must be even and not zero.\n");
+		return 1;
+	}
+
+	if (!options.tracePath.empty())
+	{
+		TraceRecorder::Get().SetEnabled(true);
+	}
+
+	// UYVY is reordered to YUY2 for the engine, which does not take it.
+	const bool fUyvy = (options.source.format == SourceFormat_UYVY);
+	FrameSource engineLayout;
+	SourceConfig engineConfig = options.source;
+	if (fUyvy)
+	{
+		engineConfig.format = SourceFormat_YUY2;
+	}
+	engineLayout.SetConfig(engineConfig);
+
+	std::vector<uint8_t> captured(source.GetBufferSize());
+	std::vector<uint8_t> input(fUyvy ? engineLayout.GetBufferSize() : 0);
+	std::vector<uint8_t> output(engineLayout.GetBufferSize());
+	VideoFrame inputFrame;
+	VideoFrame outputFrame;
+	engineLayout.WrapFrame(fUyvy ? &input[0] : &captured[0], &inputFrame);
+	engineLayout.WrapFrame(&output[0], &outputFrame);
+
+	ThreadPool pool(options.cThreads);
+	EffectEngine engine(pool.GetParallelFor());
+	std::vector<NativeFilter> filters;
+	std::vector<NativeFilter> fallbackFilters;
+	MakeFilters(options.filters, &filters, &fallbackFilters);
+	engine.SetFilters(filters, fallbackFilters);
+	engine.SetFormat(MakeStreamFormat(inputFrame.format, inputFrame.width, inputFrame.height));
+
+	SchedulerPolicy policy = MakeDefaultSchedulerPolicy();
+	policy.fEnabled = (options.mode == RunMode_RealTime);
+	engine.SetSchedulerPolicy(policy);
+
+	FILE *pOutput = nullptr;
+	if (!options.outputPath.empty())
+	{
+		pOutput = fopen(options.outputPath.c_str(), "wb");
+		if (pOutput == nullptr)
+		{
+			fprintf(stderr, "Cannot write %s\n", options.outputPath.c_str());
+			return 1;
+		}
+	}
+
+	// The recording holds what the engine is given: UYVY frames as YUY2.
+	FrameRecordWriter recorder;
+	if (!options.recordPath.empty())
+	{
+		EffectConfig config;
+		config.filters = filters;
+		config.fallbackFilters = fallbackFilters;
+		config.policy = policy;
+		config.fHasSdkEffects = false;
+		if (!recorder.Open(fopen(options.recordPath.c_str(), "wb")) || !recorder.WriteConfig(config))
+		{
+			fprintf(stderr, "Cannot write %s\n", options.recordPath.c_str());
+			return 1;
+		}
+	}
+
+	static const char *const s_formatNames[] = { "NV12", "YUY2", "UYVY" };
+	static const char *const s_contentNames[] = { "gradient", "noise", "moving objects", "static" };
+	printf("%llu frames of %ux%u %s (stride %d), %s, at %u fps %s, %s filters on %u threads\n",
+		(unsigned long long)options.cFrames, options.source.width, options.source.height,
+		s_formatNames[options.source.format], (int)source.GetStride(), s_contentNames[options.source.content],
+		options.source.frameRate, options.mode == RunMode_RealTime ? "in real time" : "as fast as possible",
+		options.filters.c_str(), (uint32_t)pool.GetThreadCount());
+
+	uint64_t cActions[FrameAction_Count] = {};
+	uint64_t nsSource = 0;
+	uint64_t cLate = 0;             // Frames handed over after the next one was due.
+	const uint64_t nsStart = TraceRecorder::Now();
+
+	for (uint64_t iFrame = 0; iFrame < options.cFrames; iFrame++)
+	{
+		// A camera delivers the frame at its time stamp, and does not wait
+		// for the frames before it.
+		const uint64_t nsDue = nsStart + (uint64_t)source.GetFrameTime(iFrame) * 100;
+		if (options.mode == RunMode_RealTime)
+		{
+			const uint64_t nsNow = TraceRecorder::Now();
+			if (nsNow < nsDue)
+			{
+				std::this_thread::sleep_for(std::chrono::nanoseconds(nsDue - nsNow));
+			}
+			else if (nsNow >= nsDue + (uint64_t)source.GetFrameDuration() * 100)
+			{
+				cLate++;
+			}
+		}
+
+		const uint64_t nsRender = TraceRecorder::Now();
+		source.RenderFrame(iFrame, &captured[0]);
+		if (fUyvy)
+		{
+			ConvertUyvyToYuy2(&captured[0], source.GetStride(), &input[0], engineLayout.GetStride(), options.source.width, options.source.height);
+		}
+		nsSource += TraceRecorder::Now() - nsRender;
+
+		FrameTiming timing;
+		timing.fHasTime = true;
+		timing.hnsTime = source.GetFrameTime(iFrame);
+		timing.hnsDuration = source.GetFrameDuration();
+
+		if (!options.recordPath.empty())
+		{
+			(void)recorder.WriteFrame(engine.GetRenderer()->GetFormat(), timing, inputFrame);
+		}
+
+		FrameAction action = FrameAction_Drop;
+		engine.ProcessFrame(timing, outputFrame, inputFrame, &action);
+		cActions[action]++;
+
+		if (pOutput != nullptr && action != FrameAction_Drop)
+		{
+			fwrite(&output[0], 1, output.size(), pOutput);
+		}
+	}
+
+	const double elapsed = (TraceRecorder::Now() - nsStart) / 1e9;
+	if (pOutput != nullptr)
+	{
+		fclose(pOutput);
+	}
+	if (!options.recordPath.empty() && !recorder.Close())
+	{
+		fprintf(stderr, "Cannot write %s\n", options.recordPath.c_str());
+		return 1;
+	}
+
+	LatencySummary latency[FrameStage_Count];
+	engine.GetLatency(latency);
+
+	printf("\n%.1f fps over %.2f s; generating a frame took %.3f ms on average\n",
+		options.cFrames / elapsed, elapsed, ToMs(nsSource / (options.cFrames > 0 ? options.cFrames : 1)));
+	printf("processed %llu, degraded %llu, passed through %llu, dropped %llu",
+		(unsigned long long)cActions[FrameAction_Process], (unsigned long long)cActions[FrameAction_Degrade],
+		(unsigned long long)cActions[FrameAction_PassThrough], (unsigned long long)cActions[FrameAction_Drop]);
+	if (options.mode == RunMode_RealTime)
+	{
+		printf(", %llu handed over late", (unsigned long long)cLate);
+	}
+	printf("\nrender latency over the last %llu frames: p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms\n",
+		(unsigned long long)latency[FrameStage_Total].cFrames,
+		ToMs(latency[FrameStage_Total].p50), ToMs(latency[FrameStage_Total].p99), ToMs(latency[FrameStage_Total].p999));
+
+	if (!options.tracePath.empty())
+	{
+		FILE *pFile = fopen(options.tracePath.c_str(), "w");
+		if (pFile == nullptr)
+		{
+			fprintf(stderr, "Cannot write %s\n", options.tracePath.c_str());
+			return 1;
+		}
+		std::string json = TraceRecorder::Get().DumpJson();
+		fwrite(json.data(), 1, json.size(), pFile);
+		fclose(pFile);
+	}
+
+	return 0;
+}
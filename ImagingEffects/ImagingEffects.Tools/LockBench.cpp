@@ -0,0 +1,510 @@
+// Benchmarks of the transform's operation queue and of CritSec under
+// contention.
+//
+// OpQueue cases queue operations from --threads producer threads at once,
+// as fast as they can, while --workers threads run the work items, as the
+// platform's work queue does, and dispatch them one at a time under the
+// critical section. With a ComPtrList each QueueOperation takes the
+// critical section, which the dispatches hold too, and allocates a node;
+// with a RingOpList it takes neither. Producers keep at most
+// DEFAULT_OP_RING_CAPACITY operations queued, the ring's capacity, so both
+// lists hold as many. A case reports the time per QueueOperation on a
+// producer, the operations dispatched per second, the allocations per
+// operation and how often a full ring turned one away.
+//
+// The work queue is WorkQueue.h, the tests' stand-in for the platform's, so
+// the numbers compare the lists with each other rather than predict the
+// transform's.
+//
+// CritSec cases take and leave one CritSec with AutoLock from --threads
+// threads at once, as fast as they can, holding it for an increment. A case
+// reports the time per AutoLock on a thread. lockbench-profiled is the same
+// program built with CRITSEC_PROFILING, so that running the CritSec cases of
+// both gives the cost of the lock profiler (see LockProfiler.h):
+//
+//     lockbench --filter CritSec
+//     lockbench-profiled --filter CritSec
+//
+// Cases are named like Google Benchmark's, e.g. OpQueue/RingOpList/threads:4,
+// and --json writes the results in its JSON layout:
+//
+//     lockbench --threads 1-4 --min-time 1 --json results.json
+//
+// Run with --help for every option.
+
+#include "WindowsShim.h"
+
+#include <assert.h>
+
+#include "CritSec.h"
+#include "OpQueue.h"
+
+// Every allocation through operator new is counted, on every thread.
+#include "AllocationCounter.h"
+#include "WorkQueue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace ImagingEffectsTests;
+
+namespace
+{
+	// Operations each producer cycles through. More than the list holds,
+	// so an operation has been dispatched before it is queued again.
+	const size_t OPS_PER_PRODUCER = 4 * DEFAULT_OP_RING_CAPACITY;
+
+	enum CaseKind
+	{
+		Case_ComPtrList,
+		Case_RingOpList,
+		Case_CritSec
+	};
+
+	const char *const CASE_NAMES[] = { "OpQueue/ComPtrList", "OpQueue/RingOpList", "CritSec/AutoLock" };
+
+#ifdef CRITSEC_PROFILING
+	const char *const EXECUTABLE_NAME = "lockbench-profiled";
+#else
+	const char *const EXECUTABLE_NAME = "lockbench";
+#endif
+
+	struct Options
+	{
+		std::vector<uint32_t> threadCounts;
+		uint32_t cWorkers;
+		double minTime;                         // Seconds.
+		std::string filter;
+		std::string jsonPath;
+	};
+
+	struct Case
+	{
+		std::string name;
+		CaseKind kind;
+		uint32_t cThreads;
+	};
+
+	struct Result
+	{
+		uint64_t cOps;
+		uint64_t nsElapsed;
+		uint64_t nsOps;                         // Summed over the threads.
+		uint64_t cAllocations;
+		uint64_t cTurnedAway;
+	};
+
+	uint64_t Now()
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void PrintUsage()
+	{
+		printf(
+			"Usage: %s [options]\n"
+			"  --threads N,...    Producer threads, or ranges (default 1 and powers of two up to the processors)\n"
+			"  --workers N        Threads running the work items (default 2)\n"
+			"  --min-time S       Seconds each case runs (default 0.5)\n"
+			"  --filter TEXT      Run only the cases whose name contains TEXT\n"
+			"  --json FILE        Write the results to FILE in Google Benchmark's JSON layout\n",
+			EXECUTABLE_NAME);
+	}
+
+	// Parses a comma-separated list of numbers and ranges, such as 1,2-4.
+	bool ParseNumbers(const char *psz, uint32_t maxValue, std::vector<uint32_t> *pValues)
+	{
+		pValues->clear();
+		while (*psz != '\0')
+		{
+			char *pEnd = nullptr;
+			unsigned long first = strtoul(psz, &pEnd, 10);
+			if (pEnd == psz)
+			{
+				return false;
+			}
+			unsigned long last = first;
+			if (*pEnd == '-')
+			{
+				psz = pEnd + 1;
+				last = strtoul(psz, &pEnd, 10);
+				if (pEnd == psz)
+				{
+					return false;
+				}
+			}
+			if (first == 0 || first > last || last > maxValue)
+			{
+				return false;
+			}
+			for (unsigned long value = first; value <= last; value++)
+			{
+				pValues->push_back((uint32_t)value);
+			}
+			if (*pEnd != ',' && *pEnd != '\0')
+			{
+				return false;
+			}
+			psz = (*pEnd == ',') ? pEnd + 1 : pEnd;
+		}
+		return !pValues->empty();
+	}
+
+	bool ParseOptions(int argc, char **argv, Options *pOptions)
+	{
+		const uint32_t cProcessors = (std::max)(1u, std::thread::hardware_concurrency());
+		for (uint32_t cThreads = 1; cThreads < cProcessors; cThreads *= 2)
+		{
+			pOptions->threadCounts.push_back(cThreads);
+		}
+		pOptions->threadCounts.push_back(cProcessors);
+		pOptions->cWorkers = 2;
+		pOptions->minTime = 0.5;
+
+		for (int i = 1; i < argc; i++)
+		{
+			const char *pszName = argv[i];
+			if (strcmp(pszName, "--help") == 0 || i + 1 >= argc)
+			{
+				return false;
+			}
+
+			const char *pszValue = argv[++i];
+			if (strcmp(pszName, "--threads") == 0)
+			{
+				if (!ParseNumbers(pszValue, 1024, &pOptions->threadCounts)) return false;
+			}
+			else if (strcmp(pszName, "--workers") == 0) pOptions->cWorkers = (uint32_t)strtoul(pszValue, nullptr, 10);
+			else if (strcmp(pszName, "--min-time") == 0) pOptions->minTime = strtod(pszValue, nullptr);
+			else if (strcmp(pszName, "--filter") == 0) pOptions->filter = pszValue;
+			else if (strcmp(pszName, "--json") == 0) pOptions->jsonPath = pszValue;
+			else return false;
+		}
+
+		return pOptions->cWorkers > 0;
+	}
+
+	class Operation : public IUnknown
+	{
+	public:
+		Operation() : m_cRef(1)
+		{
+		}
+
+		ULONG AddRef() { return ++m_cRef; }
+		ULONG Release() { return --m_cRef; }
+
+	private:
+		std::atomic<ULONG> m_cRef;
+	};
+
+	// Dispatches each operation at once and ends it, as the transform does
+	// with its short operations.
+	template <class TOpList>
+	class Queue : public OpQueue<Queue<TOpList>, Operation, TOpList>
+	{
+		typedef OpQueue<Queue<TOpList>, Operation, TOpList> Base;
+
+	public:
+		Queue()
+			: Base(m_critsec)
+			, m_cRef(1)
+			, m_cDispatched(0)
+		{
+			InitializeCriticalSectionEx(&m_critsec, 100, 0);
+		}
+
+		~Queue()
+		{
+			DeleteCriticalSection(&m_critsec);
+		}
+
+		ULONG AddRef() { return ++m_cRef; }
+		ULONG Release() { return --m_cRef; }
+
+		uint64_t GetDispatchedCount() const { return m_cDispatched; }
+
+	protected:
+		HRESULT ValidateOperation(Operation *)
+		{
+			return S_OK;
+		}
+
+		HRESULT DispatchOperation(Operation *)
+		{
+			m_cDispatched++;
+			return this->ProcessQueue();
+		}
+
+	private:
+		CRITICAL_SECTION m_critsec;
+		std::atomic<ULONG> m_cRef;
+		std::atomic<uint64_t> m_cDispatched;
+	};
+
+	template <class TOpList>
+	void RunOpQueue(const Options &options, const Case &benchCase, Result *pResult)
+	{
+		WorkQueue &workQueue = WorkQueue::Get();
+		Queue<TOpList> queue;
+		std::vector<std::vector<Operation> > ops(benchCase.cThreads);
+		for (uint32_t p = 0; p < benchCase.cThreads; p++)
+		{
+			std::vector<Operation>(OPS_PER_PRODUCER).swap(ops[p]);
+		}
+
+		workQueue.StartWorkers(options.cWorkers);
+
+		std::atomic<bool> fStop(false);
+		std::atomic<uint64_t> nsQueueing(0);
+		std::atomic<uint64_t> cTurnedAway(0);
+		std::atomic<uint64_t> cQueued(0);
+		std::vector<std::thread> producers;
+		const uint64_t cAllocationsStart = GetAllocationCount();
+		const uint64_t nsStart = Now();
+		for (uint32_t p = 0; p < benchCase.cThreads; p++)
+		{
+			producers.push_back(std::thread([&, p]()
+			{
+				uint64_t nsSpent = 0;
+				uint64_t cRejected = 0;
+				for (size_t i = 0; !fStop.load(std::memory_order_relaxed); i++)
+				{
+					// Counted before it is queued, so that the producers
+					// together never go over the bound.
+					while (cQueued++ - queue.GetDispatchedCount() >= DEFAULT_OP_RING_CAPACITY)
+					{
+						cQueued--;
+						std::this_thread::yield();
+						if (fStop.load(std::memory_order_relaxed))
+						{
+							break;
+						}
+					}
+					if (fStop.load(std::memory_order_relaxed))
+					{
+						break;
+					}
+
+					Operation *pOp = &ops[p][i % OPS_PER_PRODUCER];
+					const uint64_t nsBefore = Now();
+					const HRESULT hr = queue.QueueOperation(pOp);
+					nsSpent += Now() - nsBefore;
+					if (FAILED(hr))
+					{
+						cQueued--;
+					}
+					cRejected += (hr == MF_E_NOTACCEPTING);
+				}
+				nsQueueing += nsSpent;
+				cTurnedAway += cRejected;
+			}));
+		}
+
+		std::this_thread::sleep_for(std::chrono::microseconds((uint64_t)(options.minTime * 1e6)));
+		fStop = true;
+		for (size_t p = 0; p < producers.size(); p++)
+		{
+			producers[p].join();
+		}
+		workQueue.StopWorkers();
+
+		pResult->nsElapsed = Now() - nsStart;
+		pResult->cAllocations = GetAllocationCount() - cAllocationsStart;
+		pResult->cOps = queue.GetDispatchedCount();
+		pResult->nsOps = nsQueueing;
+		pResult->cTurnedAway = cTurnedAway;
+	}
+
+	// Each thread counts its own AutoLocks; the clock is read only at the
+	// start and the end, so that it does not hide the profiler's reads.
+	void RunCritSec(const Options &options, const Case &benchCase, Result *pResult)
+	{
+		CritSec lock("LockBench");
+		std::atomic<bool> fStop(false);
+		std::atomic<uint64_t> cLocks(0);
+		uint64_t cIncrements = 0;
+		std::vector<std::thread> threads;
+		const uint64_t cAllocationsStart = GetAllocationCount();
+		const uint64_t nsStart = Now();
+		for (uint32_t t = 0; t < benchCase.cThreads; t++)
+		{
+			threads.push_back(std::thread([&]()
+			{
+				uint64_t cDone = 0;
+				while (!fStop.load(std::memory_order_relaxed))
+				{
+					AutoLock autoLock(lock, "RunCritSec");
+					cIncrements++;
+					cDone++;
+				}
+				cLocks += cDone;
+			}));
+		}
+
+		std::this_thread::sleep_for(std::chrono::microseconds((uint64_t)(options.minTime * 1e6)));
+		fStop = true;
+		for (size_t t = 0; t < threads.size(); t++)
+		{
+			threads[t].join();
+		}
+
+		pResult->nsElapsed = Now() - nsStart;
+		pResult->cAllocations = GetAllocationCount() - cAllocationsStart;
+		pResult->cOps = cLocks;
+		pResult->nsOps = pResult->nsElapsed * benchCase.cThreads;
+		pResult->cTurnedAway = 0;
+		assert(cIncrements == pResult->cOps);
+	}
+
+	void RunCase(const Options &options, const Case &benchCase, Result *pResult)
+	{
+		if (benchCase.kind == Case_ComPtrList)
+		{
+			RunOpQueue<ComPtrList<Operation> >(options, benchCase, pResult);
+		}
+		else if (benchCase.kind == Case_RingOpList)
+		{
+			RunOpQueue<RingOpList<Operation> >(options, benchCase, pResult);
+		}
+		else
+		{
+			RunCritSec(options, benchCase, pResult);
+		}
+	}
+
+	// The time per QueueOperation, or per AutoLock.
+	double GetNsPerOp(const Result &result)
+	{
+		return result.cOps > 0 ? (double)result.nsOps / (result.cOps + result.cTurnedAway) : 0.0;
+	}
+
+	double GetOpsPerSecond(const Result &result)
+	{
+		return result.nsElapsed > 0 ? result.cOps * 1e9 / result.nsElapsed : 0.0;
+	}
+
+	bool WriteJson(const char *pszPath, const Options &options, const std::vector<Case> &cases, const std::vector<Result> &results)
+	{
+		FILE *pFile = fopen(pszPath, "w");
+		if (pFile == nullptr)
+		{
+			return false;
+		}
+
+		char date[32];
+		const time_t now = time(nullptr);
+		strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+
+#ifdef NDEBUG
+		const char *pszBuildType = "release";
+#else
+		const char *pszBuildType = "debug";
+#endif
+
+		fprintf(pFile,
+			"{\n"
+			"  \"context\": {\n"
+			"    \"date\": \"%s\",\n"
+			"    \"executable\": \"%s\",\n"
+			"    \"num_cpus\": %u,\n"
+			"    \"library_build_type\": \"%s\",\n"
+			"    \"workers\": %u,\n"
+			"    \"min_time\": %.3f\n"
+			"  },\n"
+			"  \"benchmarks\": [",
+			date, EXECUTABLE_NAME, (std::max)(1u, std::thread::hardware_concurrency()), pszBuildType, options.cWorkers, options.minTime);
+
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const Case &benchCase = cases[i];
+			const Result &result = results[i];
+			fprintf(pFile,
+				"%s\n"
+				"    {\n"
+				"      \"name\": \"%s\",\n"
+				"      \"run_name\": \"%s\",\n"
+				"      \"run_type\": \"iteration\",\n"
+				"      \"iterations\": %llu,\n"
+				"      \"real_time\": %.1f,\n"
+				"      \"time_unit\": \"ns\",\n"
+				"      \"kind\": \"%s\",\n"
+				"      \"threads\": %u,\n"
+				"      \"ops_per_second\": %.0f,\n"
+				"      \"allocs_per_op\": %.3f,\n"
+				"      \"turned_away\": %llu\n"
+				"    }",
+				i > 0 ? "," : "",
+				benchCase.name.c_str(), benchCase.name.c_str(), (unsigned long long)result.cOps,
+				GetNsPerOp(result), CASE_NAMES[benchCase.kind], benchCase.cThreads,
+				GetOpsPerSecond(result), result.cOps > 0 ? (double)result.cAllocations / result.cOps : 0.0,
+				(unsigned long long)result.cTurnedAway);
+		}
+
+		fprintf(pFile, "\n  ]\n}\n");
+		return fclose(pFile) == 0;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, &options))
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	std::vector<Case> cases;
+	for (size_t iThreads = 0; iThreads < options.threadCounts.size(); iThreads++)
+	{
+		for (int kind = Case_ComPtrList; kind <= Case_CritSec; kind++)
+		{
+			Case benchCase;
+			benchCase.kind = (CaseKind)kind;
+			benchCase.cThreads = options.threadCounts[iThreads];
+			benchCase.name = std::string(CASE_NAMES[kind]) + "/threads:" + std::to_string(benchCase.cThreads);
+			if (benchCase.name.find(options.filter) != std::string::npos)
+			{
+				cases.push_back(benchCase);
+			}
+		}
+	}
+
+	if (cases.empty())
+	{
+		fprintf(stderr, "No case matches the filter \"%s\".\n", options.filter.c_str());
+		return 1;
+	}
+
+	printf("%-36s %12s %14s %11s %12s\n", "Case", "ns/op", "ops/s", "allocs/op", "turned away");
+	std::vector<Result> results;
+	for (size_t i = 0; i < cases.size(); i++)
+	{
+		Result result;
+		RunCase(options, cases[i], &result);
+		results.push_back(result);
+
+		printf("%-36s %12.1f %14.0f %11.3f %12llu\n",
+			cases[i].name.c_str(), GetNsPerOp(result), GetOpsPerSecond(result),
+			result.cOps > 0 ? (double)result.cAllocations / result.cOps : 0.0, (unsigned long long)result.cTurnedAway);
+		fflush(stdout);
+	}
+
+	if (!options.jsonPath.empty() && !WriteJson(options.jsonPath.c_str(), options, cases, results))
+	{
+		fprintf(stderr, "Cannot write %s\n", options.jsonPath.c_str());
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,389 @@
+// Load test of the stream manager with synthetic camera feeds.
+//
+// Feeds of frames from the synthetic camera (FrameSource.h) are added one by one, so that the streams
+// admitted later are judged on the measured cost of the earlier ones, and
+// submit frames at their frame rate for the length of the test. At the end
+// the aggregate frame rate, and the latency and the fate of the frames of
+// each stream, are printed.
+//
+//     streamloadtest --streams 32 --width 1280 --height 720 --fps 30 --seconds 10
+//
+// Run with --help for every option.
+
+#include "FrameSource.h"
+#include "StreamManager.h"
+#include "TraceRecorder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+using namespace ImagingEffects;
+
+namespace
+{
+	// Output frames each feed can have in flight; a feed whose frames are all
+	// still being rendered skips its next frame, as a camera would.
+	const size_t FRAMES_PER_FEED = 4;
+
+	// Source frames each feed renders ahead and cycles through, so that the
+	// cost of generating frames does not slow the pacing.
+	const size_t SOURCES_PER_FEED = 2;
+
+	struct Options
+	{
+		uint32_t cStreams;
+		uint32_t cThreads;
+		uint32_t width;
+		uint32_t height;
+		PixelFormat pixelFormat;
+		SourceContent content;
+		uint32_t frameRate;
+		uint32_t cSeconds;
+		uint32_t maxLoadPercent;
+		uint32_t rampMs;
+		std::vector<uint32_t> weights;
+		std::string tracePath;
+	};
+
+	struct Frame
+	{
+		std::vector<uint8_t> data;
+		VideoFrame frame;
+	};
+
+	struct Feed
+	{
+		Feed() : id(0), fAdmitted(false), iNextSource(0), cSkipped(0), nsNextFrame(0)
+		{
+			for (size_t i = 0; i < FRAMES_PER_FEED; i++)
+			{
+				fBusy[i] = false;
+			}
+		}
+
+		StreamId id;
+		uint32_t weight;
+		bool fAdmitted;
+		Frame sources[SOURCES_PER_FEED];
+		Frame outputs[FRAMES_PER_FEED];
+		std::atomic<bool> fBusy[FRAMES_PER_FEED];
+		size_t iNextSource;
+		uint64_t cSkipped;          // Frames not submitted because every output was in flight.
+		uint64_t nsNextFrame;
+	};
+
+	void PrintUsage()
+	{
+		printf(
+			"Usage: streamloadtest [options]\n"
+			"  --streams N        Feeds to add (default 16)\n"
+			"  --threads N        Worker threads, 0 for one per processor (default 0)\n"
+			"  --width N          Frame width (default 1280)\n"
+			"  --height N         Frame height (default 720)\n"
+			"  --format F         nv12 or yuy2 (default nv12)\n"
+			"  --content C        gradient, noise, moving or static (default moving)\n"
+			"  --fps N            Frame rate of each feed (default 30)\n"
+			"  --seconds N        Length of the test after the last feed is added (default 10)\n"
+			"  --max-load N       Admission limit, in percent of the threads' time (default 85)\n"
+			"  --ramp-ms N        Delay between adding two feeds (default 100)\n"
+			"  --weights A,B,...  Weights given to the feeds in turn (default 1)\n"
+			"  --trace FILE       Write a Chrome trace of the last events to FILE\n");
+	}
+
+	bool ParseWeights(const char *psz, std::vector<uint32_t> *pWeights)
+	{
+		pWeights->clear();
+		while (*psz != '\0')
+		{
+			char *pEnd = nullptr;
+			unsigned long weight = strtoul(psz, &pEnd, 10);
+			if (pEnd == psz || weight == 0)
+			{
+				return false;
+			}
+			pWeights->push_back((uint32_t)weight);
+			psz = (*pEnd == ',') ? pEnd + 1 : pEnd;
+		}
+		return !pWeights->empty();
+	}
+
+	bool ParseOptions(int argc, char **argv, Options *pOptions)
+	{
+		pOptions->cStreams = 16;
+		pOptions->cThreads = 0;
+		pOptions->width = 1280;
+		pOptions->height = 720;
+		pOptions->pixelFormat = PixelFormat_NV12;
+		pOptions->content = SourceContent_MovingObjects;
+		pOptions->frameRate = 30;
+		pOptions->cSeconds = 10;
+		pOptions->maxLoadPercent = 85;
+		pOptions->rampMs = 100;
+		pOptions->weights.assign(1, 1);
+
+		for (int i = 1; i < argc; i++)
+		{
+			const char *pszName = argv[i];
+			if (strcmp(pszName, "--help") == 0 || i + 1 >= argc)
+			{
+				return false;
+			}
+
+			const char *pszValue = argv[++i];
+			uint32_t value = (uint32_t)strtoul(pszValue, nullptr, 10);
+			if (strcmp(pszName, "--streams") == 0) pOptions->cStreams = value;
+			else if (strcmp(pszName, "--threads") == 0) pOptions->cThreads = value;
+			else if (strcmp(pszName, "--width") == 0) pOptions->width = value;
+			else if (strcmp(pszName, "--height") == 0) pOptions->height = value;
+			else if (strcmp(pszName, "--fps") == 0) pOptions->frameRate = value;
+			else if (strcmp(pszName, "--seconds") == 0) pOptions->cSeconds = value;
+			else if (strcmp(pszName, "--max-load") == 0) pOptions->maxLoadPercent = value;
+			else if (strcmp(pszName, "--ramp-ms") == 0) pOptions->rampMs = value;
+			else if (strcmp(pszName, "--trace") == 0) pOptions->tracePath = pszValue;
+			else if (strcmp(pszName, "--format") == 0)
+			{
+				if (strcmp(pszValue, "nv12") == 0) pOptions->pixelFormat = PixelFormat_NV12;
+				else if (strcmp(pszValue, "yuy2") == 0) pOptions->pixelFormat = PixelFormat_YUY2;
+				else return false;
+			}
+			else if (strcmp(pszName, "--content") == 0)
+			{
+				if (strcmp(pszValue, "gradient") == 0) pOptions->content = SourceContent_Gradient;
+				else if (strcmp(pszValue, "noise") == 0) pOptions->content = SourceContent_Noise;
+				else if (strcmp(pszValue, "moving") == 0) pOptions->content = SourceContent_MovingObjects;
+				else if (strcmp(pszValue, "static") == 0) pOptions->content = SourceContent_Static;
+				else return false;
+			}
+			else if (strcmp(pszName, "--weights") == 0)
+			{
+				if (!ParseWeights(pszValue, &pOptions->weights)) return false;
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		return pOptions->cStreams > 0 && pOptions->frameRate > 0 && pOptions->width > 0 && pOptions->height > 0;
+	}
+
+	bool AllocateFrame(const FrameSource &source, Frame *pFrame)
+	{
+		pFrame->data.assign(source.GetBufferSize(), 0);
+		return source.WrapFrame(&pFrame->data[0], &pFrame->frame);
+	}
+
+	double ToMs(uint64_t ns)
+	{
+		return ns / 1e6;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, &options))
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	if (!options.tracePath.empty())
+	{
+		TraceRecorder::Get().SetEnabled(true);
+	}
+
+	StreamManager manager(options.cThreads, options.maxLoadPercent);
+
+	StreamConfig config = MakeStreamConfig(MakeStreamFormat(options.pixelFormat, options.width, options.height), options.frameRate);
+	config.filters.push_back(MakeSepiaFilter(0.8f));
+	config.filters.push_back(MakeBrightnessContrastSaturationFilter(0.05f, 1.1f, 1.2f));
+	config.filters.push_back(MakeVignetteFilter(0.6f, 0.5f));
+	config.fallbackFilters.push_back(MakeGrayscaleFilter());
+
+	std::vector<std::unique_ptr<Feed>> feeds;
+	for (uint32_t i = 0; i < options.cStreams; i++)
+	{
+		std::unique_ptr<Feed> spFeed(new Feed());
+		spFeed->weight = options.weights[i % options.weights.size()];
+		SourceConfig sourceConfig = MakeSourceConfig(options.pixelFormat == PixelFormat_YUY2 ? SourceFormat_YUY2 : SourceFormat_NV12, options.width, options.height, options.frameRate);
+		sourceConfig.content = options.content;
+		sourceConfig.seed = i + 1;
+		FrameSource source;
+		if (!source.SetConfig(sourceConfig))
+		{
+			fprintf(stderr, "The frame size is not valid: it must be even and not zero.\n");
+			return 1;
+		}
+
+		for (size_t j = 0; j < SOURCES_PER_FEED; j++)
+		{
+			AllocateFrame(source, &spFeed->sources[j]);
+			source.RenderFrame(j, &spFeed->sources[j].data[0]);
+		}
+		for (size_t j = 0; j < FRAMES_PER_FEED; j++)
+		{
+			AllocateFrame(source, &spFeed->outputs[j]);
+		}
+		feeds.push_back(std::move(spFeed));
+	}
+
+	printf("%u feeds of %ux%u %s at %u fps on %u threads, admission at %u%% load\n",
+		options.cStreams, options.width, options.height, options.pixelFormat == PixelFormat_NV12 ? "NV12" : "YUY2",
+		options.frameRate, (uint32_t)manager.GetThreadCount(), options.maxLoadPercent);
+
+	// One thread paces every feed: it adds the next feed when its turn comes,
+	// and submits each admitted feed's frames at the feed's frame rate.
+	const uint64_t nsInterval = 1000000000ull / options.frameRate;
+	const uint64_t nsRamp = (uint64_t)options.rampMs * 1000000;
+	const uint64_t nsStart = TraceRecorder::Now();
+	const uint64_t nsLastAdd = nsStart + nsRamp * (options.cStreams - 1);
+	const uint64_t nsEnd = nsLastAdd + (uint64_t)options.cSeconds * 1000000000ull;
+	uint32_t cAdded = 0;
+	uint32_t cAdmitted = 0;
+
+	for (;;)
+	{
+		uint64_t nsNow = TraceRecorder::Now();
+		if (nsNow >= nsEnd)
+		{
+			break;
+		}
+
+		if (cAdded < options.cStreams && nsNow >= nsStart + nsRamp * cAdded)
+		{
+			Feed &feed = *feeds[cAdded];
+			StreamConfig feedConfig = config;
+			feedConfig.weight = feed.weight;
+			feed.fAdmitted = manager.AddStream(feedConfig, &feed.id);
+			// Spread the frames of the feeds over the frame interval.
+			feed.nsNextFrame = nsNow + nsInterval * cAdded / options.cStreams;
+			if (feed.fAdmitted)
+			{
+				cAdmitted++;
+			}
+			else
+			{
+				printf("Feed %u refused at %u%% load\n", cAdded, manager.GetLoadPercent());
+			}
+			cAdded++;
+		}
+
+		uint64_t nsWake = (cAdded < options.cStreams) ? nsStart + nsRamp * cAdded : nsEnd;
+		for (uint32_t i = 0; i < cAdded; i++)
+		{
+			Feed &feed = *feeds[i];
+			if (!feed.fAdmitted)
+			{
+				continue;
+			}
+
+			if (nsNow >= feed.nsNextFrame)
+			{
+				feed.nsNextFrame += nsInterval;
+
+				size_t iOutput = 0;
+				while (iOutput < FRAMES_PER_FEED && feed.fBusy[iOutput].load())
+				{
+					iOutput++;
+				}
+
+				if (iOutput == FRAMES_PER_FEED)
+				{
+					feed.cSkipped++;
+				}
+				else
+				{
+					std::atomic<bool> *pBusy = &feed.fBusy[iOutput];
+					pBusy->store(true);
+					const Frame &source = feed.sources[feed.iNextSource++ % SOURCES_PER_FEED];
+					if (!manager.SubmitFrame(feed.id, feed.outputs[iOutput].frame, source.frame, [pBusy](FrameAction) { pBusy->store(false); }))
+					{
+						pBusy->store(false);
+					}
+				}
+			}
+			nsWake = (std::min)(nsWake, feed.nsNextFrame);
+		}
+
+		nsNow = TraceRecorder::Now();
+		if (nsWake > nsNow)
+		{
+			std::this_thread::sleep_for(std::chrono::nanoseconds(nsWake - nsNow));
+		}
+	}
+
+	// Let the frames in flight finish before reading the statistics.
+	for (uint32_t i = 0; i < cAdded; i++)
+	{
+		for (size_t j = 0; j < FRAMES_PER_FEED; j++)
+		{
+			while (feeds[i]->fBusy[j].load())
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+	}
+
+	const double seconds = options.cSeconds;
+	uint64_t cTotal[FrameAction_Count] = {};
+	uint64_t worstP99 = 0;
+
+	printf("\n%6s %6s %9s %9s %9s %9s %9s %9s %10s %10s %10s\n",
+		"feed", "weight", "processed", "degraded", "passed", "dropped", "refused", "skipped", "p50 ms", "p99 ms", "queue p99");
+	for (uint32_t i = 0; i < cAdded; i++)
+	{
+		const Feed &feed = *feeds[i];
+		StreamStats stats;
+		if (!feed.fAdmitted || !manager.GetStreamStats(feed.id, &stats))
+		{
+			continue;
+		}
+
+		for (int j = 0; j < FrameAction_Count; j++)
+		{
+			cTotal[j] += stats.cFrames[j];
+		}
+		worstP99 = (std::max)(worstP99, stats.latency.p99);
+
+		printf("%6u %6u %9llu %9llu %9llu %9llu %9llu %9llu %10.2f %10.2f %10.2f\n",
+			i, feed.weight,
+			(unsigned long long)stats.cFrames[FrameAction_Process],
+			(unsigned long long)stats.cFrames[FrameAction_Degrade],
+			(unsigned long long)stats.cFrames[FrameAction_PassThrough],
+			(unsigned long long)stats.cFrames[FrameAction_Drop],
+			(unsigned long long)stats.cRefused,
+			(unsigned long long)feed.cSkipped,
+			ToMs(stats.latency.p50), ToMs(stats.latency.p99), ToMs(stats.queueWait.p99));
+	}
+
+	// The rates count the frames of the whole run, including the ramp.
+	const double elapsed = (TraceRecorder::Now() - nsStart) / 1e9;
+	const uint64_t cShown = cTotal[FrameAction_Process] + cTotal[FrameAction_Degrade] + cTotal[FrameAction_PassThrough];
+	printf("\n%u of %u feeds admitted, load %u%%\n", cAdmitted, options.cStreams, manager.GetLoadPercent());
+	printf("Aggregate: %.1f fps shown, %.1f fps with the full chain, over %.1f s (%.0f s at full load)\n",
+		cShown / elapsed, cTotal[FrameAction_Process] / elapsed, elapsed, seconds);
+	printf("Worst per-feed p99 latency: %.2f ms\n", ToMs(worstP99));
+
+	if (!options.tracePath.empty())
+	{
+		FILE *pFile = fopen(options.tracePath.c_str(), "w");
+		if (pFile == nullptr)
+		{
+			fprintf(stderr, "Cannot write %s\n", options.tracePath.c_str());
+			return 1;
+		}
+		std::string json = TraceRecorder::Get().DumpJson();
+		fwrite(json.data(), 1, json.size(), pFile);
+		fclose(pFile);
+	}
+
+	return 0;
+}